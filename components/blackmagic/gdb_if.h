@@ -21,9 +21,16 @@
 #ifndef __GDB_IF_H
 #define __GDB_IF_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 int gdb_if_init(void);
 unsigned char gdb_if_getchar(void);
 unsigned char gdb_if_getchar_to(int timeout);
 void gdb_if_putchar(unsigned char c, int flush);
 
+/* Block until something has been received, then copy up to `len` bytes of it into `buf` */
+size_t gdb_if_read(void *buf, size_t len);
+void gdb_if_write(const void *buf, size_t len, bool flush);
+
 #endif
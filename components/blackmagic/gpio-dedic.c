@@ -14,6 +14,7 @@
 #include "esp_log.h"
 #include "hal/dedic_gpio_cpu_ll.h"
 #include "gpio-dedic.h"
+#include "wire-engine.h"
 
 static dedic_gpio_bundle_handle_t dedic_gpio_bundle;
 
@@ -43,8 +44,10 @@ static void configure_gpio(int gpio)
 #error "Having tristatable TCK without tristatable TMS is not supported"
 #endif
 
-void gpio_dedic_init(void)
+/* The bundle belongs to the core that creates it, so this runs on the wire engine */
+static void gpio_dedic_setup(void *arg)
 {
+	(void)arg;
 	static bool initialized = false;
 	if (initialized)
 		return;
@@ -52,7 +55,7 @@ void gpio_dedic_init(void)
 
 	// The order of pins in this array is important, as it must match up with
 	// the definitions at the top of gpio-dedic.h.
-	int dedic_pin_array[] = {
+	int dedic_pin_array[SOC_DEDIC_GPIO_OUT_CHANNELS_NUM] = {
 		CONFIG_TMS_SWDIO_GPIO,
 		CONFIG_TCK_SWCLK_GPIO,
 		CONFIG_TDO_GPIO,
@@ -84,8 +87,25 @@ void gpio_dedic_init(void)
 		}
 	}
 
+#if GANG_SWDIO_LANES > 0
+	// Gang lanes follow directly after the last pin that is present
+	static const int gang_pins[] = GANG_SWDIO_GPIOS;
+	for (size_t i = 0; i < GANG_SWDIO_LANES; i++) {
+		configure_gpio(gang_pins[i]);
+		dedic_pin_array[dedic_config.array_size++] = gang_pins[i];
+	}
+#endif
+
 	ESP_ERROR_CHECK(dedic_gpio_new_bundle(&dedic_config, &dedic_gpio_bundle));
 
+#if GANG_SWDIO_LANES > 0 && SOC_DEDIC_GPIO_OUT_AUTO_ENABLE
+	// The bundle drives every pad it owns. Leave the gang lanes floating until gang mode is turned on.
+	for (size_t i = 0; i < GANG_SWDIO_LANES; i++) {
+		gpio_ll_output_disable(GPIO_HAL_GET_HW(GPIO_PORT_0), gang_pins[i]);
+		REG_WRITE(GPIO_FUNC0_OUT_SEL_CFG_REG + (gang_pins[i] * 4), SIG_GPIO_OUT_IDX);
+	}
+#endif
+
 	if (CONFIG_TMS_SWDIO_DIR_GPIO != -1) {
 		// Enable driving TMS/SWDIO
 		dedic_gpio_cpu_ll_write_mask(SWDIO_TMS_DIR_DEDIC_MASK, 0);
@@ -98,4 +118,9 @@ void gpio_dedic_init(void)
 	}
 }
 
+void gpio_dedic_init(void)
+{
+	wire_engine_call(gpio_dedic_setup, NULL);
+}
+
 #endif /* SWDPTAP_MODE_DEDIC == 1 */
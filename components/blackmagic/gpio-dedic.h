@@ -2,6 +2,7 @@
 #define GPIO_DEDIC_H_
 
 #include "general.h"
+#include "soc/soc_caps.h"
 
 // SWDIO must be pin 0 to simplify the masking and shifting when reading values in
 // and writing values out.
@@ -30,6 +31,40 @@
 #define ALL_OUTPUT_MASK (SWCLK_DEDIC_MASK | JTAG_TDI_DEDIC_MASK | SWDIO_TMS_DIR_DEDIC_MASK | SWCLK_DIR_DEDIC_MASK)
 #endif
 
+/*
+ * Extra SWDIO lanes for gang programming. The bundle packs its pins in the
+ * order above, leaving out the ones a board doesn't have, so the lanes sit
+ * directly after the last pin that is present.
+ */
+#if (CONFIG_TDI_GPIO == -1) || (CONFIG_TDO_GPIO == -1)
+#define GANG_SWDIO_DEDIC_PIN_BASE 2
+#elif CONFIG_TMS_SWDIO_DIR_GPIO == -1
+#define GANG_SWDIO_DEDIC_PIN_BASE 4
+#elif CONFIG_TCK_TDI_DIR_GPIO == -1
+#define GANG_SWDIO_DEDIC_PIN_BASE 5
+#else
+#define GANG_SWDIO_DEDIC_PIN_BASE 6
+#endif
+
+#if defined(CONFIG_GANG_SWDIO3_GPIO) && CONFIG_GANG_SWDIO3_GPIO != -1
+#define GANG_SWDIO_LANES 3
+#define GANG_SWDIO_GPIOS {CONFIG_GANG_SWDIO1_GPIO, CONFIG_GANG_SWDIO2_GPIO, CONFIG_GANG_SWDIO3_GPIO}
+#elif defined(CONFIG_GANG_SWDIO2_GPIO) && CONFIG_GANG_SWDIO2_GPIO != -1
+#define GANG_SWDIO_LANES 2
+#define GANG_SWDIO_GPIOS {CONFIG_GANG_SWDIO1_GPIO, CONFIG_GANG_SWDIO2_GPIO}
+#elif defined(CONFIG_GANG_SWDIO1_GPIO) && CONFIG_GANG_SWDIO1_GPIO != -1
+#define GANG_SWDIO_LANES 1
+#define GANG_SWDIO_GPIOS {CONFIG_GANG_SWDIO1_GPIO}
+#else
+#define GANG_SWDIO_LANES 0
+#endif
+
+#if GANG_SWDIO_DEDIC_PIN_BASE + GANG_SWDIO_LANES > SOC_DEDIC_GPIO_OUT_CHANNELS_NUM
+#error "Not enough dedicated GPIO channels for this many gang programming lanes"
+#endif
+
+#define GANG_SWDIO_DEDIC_MASK (((1 << GANG_SWDIO_LANES) - 1) << GANG_SWDIO_DEDIC_PIN_BASE)
+
 void gpio_dedic_init(void);
 
 #endif /* GPIO_DEDIC_H_ */
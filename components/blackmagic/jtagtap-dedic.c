@@ -21,9 +21,11 @@
 /* This file implements the low-level JTAG TAP interface.  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "gdb_packet.h"
 #include "general.h"
+#include "exception.h"
 #include "jtagtap.h"
 #include "platform.h"
 
@@ -34,6 +36,10 @@
 #include "esp_log.h"
 #include "hal/dedic_gpio_cpu_ll.h"
 #include "gpio-dedic.h"
+#include "jtagtap-spi.h"
+#include "tap-bitstream.h"
+#include "wire-engine.h"
+#include "wire-trace.h"
 
 jtag_proc_s jtag_proc;
 
@@ -100,6 +106,32 @@ static void dummy_cycle(const bool tms, const bool tdi, const size_t clock_cycle
 	(void)clock_cycles;
 }
 
+/* Touches the dedicated GPIO bundle, so this runs on the wire engine */
+static void jtagtap_setup(void *arg)
+{
+	(void)arg;
+
+// Ensure the TMS pin is driven as an output, and that TDO is an input
+#if SOC_DEDIC_GPIO_OUT_AUTO_ENABLE
+	REG_WRITE(GPIO_FUNC0_OUT_SEL_CFG_REG + (CONFIG_TMS_SWDIO_GPIO * 4), CORE1_GPIO_OUT0_IDX);
+	gpio_ll_output_enable(GPIO_HAL_GET_HW(GPIO_PORT_0), CONFIG_TMS_SWDIO_GPIO);
+
+	gpio_ll_output_disable(GPIO_HAL_GET_HW(GPIO_PORT_0), CONFIG_TDO_GPIO);
+#else
+	dedic_gpio_cpu_ll_enable_output(ALL_OUTPUT_MASK | SWDIO_TMS_DEDIC_MASK);
+#endif
+
+	if (CONFIG_TMS_SWDIO_DIR_GPIO >= 0)
+		dedic_gpio_cpu_ll_write_mask(SWDIO_TMS_DIR_DEDIC_MASK, 0);
+	if (CONFIG_TCK_TDI_DIR_GPIO >= 0)
+		dedic_gpio_cpu_ll_write_mask(SWCLK_DIR_DEDIC_MASK, 0);
+
+	/* Ensure we're in JTAG mode */
+	for (size_t i = 0; i <= 50U; ++i)
+		jtagtap_next(true, false); /* 50 + 1 idle cycles for SWD reset */
+	jtagtap_tms_seq(0xe73cU, 16U); /* SWD to JTAG sequence */
+}
+
 void jtagtap_init(void)
 {
 	gpio_dedic_init();
@@ -119,21 +151,6 @@ void jtagtap_init(void)
 
 	ESP_LOGI("jtag", "initializing jtag GPIO");
 
-// Ensure the TMS pin is driven as an output, and that TDO is an input
-#if SOC_DEDIC_GPIO_OUT_AUTO_ENABLE
-	REG_WRITE(GPIO_FUNC0_OUT_SEL_CFG_REG + (CONFIG_TMS_SWDIO_GPIO * 4), CORE1_GPIO_OUT0_IDX);
-	gpio_ll_output_enable(GPIO_HAL_GET_HW(GPIO_PORT_0), CONFIG_TMS_SWDIO_GPIO);
-
-	gpio_ll_output_disable(GPIO_HAL_GET_HW(GPIO_PORT_0), CONFIG_TDO_GPIO);
-#else
-	dedic_gpio_cpu_ll_enable_output(ALL_OUTPUT_MASK | SWDIO_TMS_DEDIC_MASK);
-#endif
-
-	if (CONFIG_TMS_SWDIO_DIR_GPIO >= 0)
-		dedic_gpio_cpu_ll_write_mask(SWDIO_TMS_DIR_DEDIC_MASK, 0);
-	if (CONFIG_TCK_TDI_DIR_GPIO >= 0)
-		dedic_gpio_cpu_ll_write_mask(SWCLK_DIR_DEDIC_MASK, 0);
-
 	jtag_proc.jtagtap_reset = jtagtap_reset;
 	jtag_proc.jtagtap_next = jtagtap_next;
 	jtag_proc.jtagtap_tms_seq = jtagtap_tms_seq;
@@ -142,10 +159,8 @@ void jtagtap_init(void)
 	jtag_proc.jtagtap_cycle = jtagtap_cycle;
 	jtag_proc.tap_idle_cycles = 1;
 
-	/* Ensure we're in JTAG mode */
-	for (size_t i = 0; i <= 50U; ++i)
-		jtagtap_next(true, false); /* 50 + 1 idle cycles for SWD reset */
-	jtagtap_tms_seq(0xe73cU, 16U); /* SWD to JTAG sequence */
+	wire_engine_call(jtagtap_setup, NULL);
+	wire_engine_wrap_jtag(&jtag_proc);
 }
 
 static void jtagtap_reset(void)
@@ -156,10 +171,10 @@ static void jtagtap_reset(void)
 static bool jtagtap_next_clk_delay()
 {
 	CLK_HIGH();
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 	const uint16_t result = GET_TDO();
 	CLK_LOW();
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 	return result != 0;
 }
 
@@ -175,7 +190,7 @@ static bool jtagtap_next(const bool tms, const bool tdi)
 {
 	platform_maybe_delay();
 	SET_TMS_TDI(tms, tdi);
-	if (target_delay_us)
+	if (target_delay_cycles)
 		return jtagtap_next_clk_delay();
 	else // NOLINT(readability-else-after-return)
 		return jtagtap_next_no_delay();
@@ -187,10 +202,10 @@ static void jtagtap_tms_seq_clk_delay(uint32_t tms_states, const size_t clock_cy
 		const bool state = tms_states & 1U;
 		SET_TMS(state);
 		CLK_HIGH();
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		tms_states >>= 1U;
 		CLK_LOW();
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 	}
 }
 
@@ -212,7 +227,7 @@ static void jtagtap_tms_seq(const uint32_t tms_states, const size_t ticks)
 {
 	platform_maybe_delay();
 	SET_TDI(1);
-	if (target_delay_us)
+	if (target_delay_cycles)
 		jtagtap_tms_seq_clk_delay(tms_states, ticks);
 	else
 		jtagtap_tms_seq_no_delay(tms_states, ticks);
@@ -231,7 +246,7 @@ static void jtagtap_tdi_tdo_seq_clk_delay(
 		SET_TMS_TDI(cycle + 1U >= clock_cycles && final_tms, !!(data_in[byte] & (1U << bit)));
 		/* Start the clock cycle */
 		CLK_HIGH();
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		/* If TDO is high, store a 1 in the appropriate position in the value being accumulated */
 		if (GET_TDO())
 			value |= 1U << bit;
@@ -241,7 +256,7 @@ static void jtagtap_tdi_tdo_seq_clk_delay(
 		}
 		/* Finish the clock cycle */
 		CLK_LOW();
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 	}
 	/* If clock_cycles is not divisible by 8, we have some extra data to write back here. */
 	if (clock_cycles & 7U) {
@@ -250,60 +265,120 @@ static void jtagtap_tdi_tdo_seq_clk_delay(
 	}
 }
 
-static void jtagtap_tdi_tdo_seq_no_delay(
-	const uint8_t *const data_in, uint8_t *const data_out, const bool final_tms, const size_t clock_cycles)
+/*
+ * The no-delay shift engines work a 32-bit word at a time: TDI is shifted out
+ * of a register, and TDO is shifted into the top of an accumulator without a
+ * branch. The last 1-32 bits, which include the one that carries final_tms,
+ * are run through the same loop as a separate partial word.
+ */
+static inline __attribute__((always_inline)) uint32_t jtagtap_tdi_tdo_word(
+	uint32_t tdi, const size_t clock_cycles, const bool final_tms)
 {
-	uint8_t value = 0;
-	for (size_t cycle = 0; cycle < clock_cycles;) {
-		/* Calculate the next bit and byte to consume data from */
-		const uint8_t bit = cycle & 7U;
-		const size_t byte = cycle >> 3U;
-		const bool tms = cycle + 1U >= clock_cycles && final_tms;
-		const bool tdi = data_in[byte] & (1U << bit);
+	uint32_t tdo = 0;
+	for (size_t cycle = clock_cycles; cycle--;) {
+		const bool tms = !cycle && final_tms;
 		/* Block the compiler from re-ordering the calculations to preserve timings */
 		__asm__ volatile("" ::: "memory");
 		CLK_LOW();
 		/* Block the compiler from re-ordering the calculations to preserve timings */
 		__asm__ volatile("" ::: "memory");
-		/* Configure the bus for the next cycle */
+		/* The write is masked, so there's no need to isolate the TDI bit first */
 		SET_TMS_TDI(tms, tdi);
-		/* Block the compiler from re-ordering the calculations to preserve timings */
-		__asm__ volatile("" ::: "memory");
-		/* Increment the cycle counter */
-		++cycle;
+		tdi >>= 1U;
 		/* Block the compiler from re-ordering the calculations to preserve timings */
 		__asm__ volatile("nop" ::: "memory");
 		/* Start the clock cycle */
 		CLK_HIGH();
-		/* If TDO is high, store a 1 in the appropriate position in the value being accumulated */
-		if (GET_TDO()) /* XXX: Try to remove the need for the if here */
-			value |= 1U << bit;
-		/* If we've got the next whole byte, store the accumulated value and reset state */
-		if (bit == 7U) {
-			data_out[byte] = value;
-			value = 0;
-		}
-		/* Finish the clock cycle */
+		/* Shift TDO in from the top */
+		tdo = (tdo >> 1U) | (((dedic_gpio_cpu_ll_read_in() >> JTAG_TDO_DEDIC_PIN) & 1U) << 31U);
 	}
-	/* If clock_cycles is not divisible by 8, we have some extra data to write back here. */
-	if (clock_cycles & 7U) {
-		const size_t byte = (clock_cycles - 1U) >> 3U;
-		data_out[byte] = value;
+	return tdo >> (32U - clock_cycles);
+}
+
+static void jtagtap_tdi_tdo_seq_no_delay(
+	const uint8_t *const data_in, uint8_t *const data_out, const bool final_tms, const size_t clock_cycles)
+{
+	if (!clock_cycles)
+		return;
+	/* Keep at least one bit back for the tail so final_tms lands on the last cycle */
+	const size_t words = (clock_cycles - 1U) >> 5U;
+	for (size_t word = 0; word < words; ++word) {
+		uint32_t tdi;
+		memcpy(&tdi, data_in + (word << 2U), sizeof(tdi));
+		const uint32_t tdo = jtagtap_tdi_tdo_word(tdi, 32U, false);
+		memcpy(data_out + (word << 2U), &tdo, sizeof(tdo));
 	}
+
+	const size_t tail_cycles = clock_cycles - (words << 5U);
+	const size_t tail_bytes = (tail_cycles + 7U) >> 3U;
+	uint32_t tdi = 0;
+	memcpy(&tdi, data_in + (words << 2U), tail_bytes);
+	const uint32_t tdo = jtagtap_tdi_tdo_word(tdi, tail_cycles, final_tms);
+	memcpy(data_out + (words << 2U), &tdo, tail_bytes);
 	CLK_LOW();
 }
 
-static void jtagtap_tdi_tdo_seq(
+#ifdef JTAGTAP_SPI_MIN_CYCLES
+/*
+ * Hand all but the last bit of a long scan to the SPI peripheral. The last
+ * bit carries final_tms, which the peripheral has no way to drive, so it is
+ * clocked here. Returns false if the scan must be bit-banged instead.
+ */
+static bool jtagtap_spi_offload(
+	const uint8_t *const data_in, uint8_t *const data_out, const bool final_tms, const size_t clock_cycles)
+{
+	if (clock_cycles < JTAGTAP_SPI_MIN_CYCLES)
+		return false;
+	const size_t last = clock_cycles - 1U;
+	SET_TMS_TDI(0, 0);
+	if (!jtagtap_spi_shift(data_in, data_out, last))
+		return false;
+	const bool tdo = jtagtap_next(final_tms, tap_bitstream_get_bit(data_in, last));
+	if (data_out)
+		tap_bitstream_set_bit(data_out, last, tdo);
+	return true;
+}
+#endif
+
+/*
+ * Raise for a SPI scan that failed partway through. Only when BMP called
+ * the tap directly: through the wire engine this runs on the engine task,
+ * which has nowhere to raise to, and the engine's forwarder raises instead.
+ */
+static void jtagtap_spi_check(const bool direct)
+{
+#ifdef JTAGTAP_SPI_MIN_CYCLES
+	if (direct && jtagtap_spi_take_error())
+		raise_exception(EXCEPTION_ERROR, "JTAG SPI scan failed");
+#else
+	(void)direct;
+#endif
+}
+
+static void jtagtap_tdi_tdo_shift(
 	uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, size_t clock_cycles)
 {
-	platform_maybe_delay();
+#ifdef JTAGTAP_SPI_MIN_CYCLES
+	if (jtagtap_spi_offload(data_in, data_out, final_tms, clock_cycles))
+		return;
+#endif
 	SET_TMS_TDI(0, 0);
-	if (target_delay_us != 0)
+	if (target_delay_cycles != 0)
 		jtagtap_tdi_tdo_seq_clk_delay(data_in, data_out, final_tms, clock_cycles);
 	else
 		jtagtap_tdi_tdo_seq_no_delay(data_in, data_out, final_tms, clock_cycles);
 }
 
+static void jtagtap_tdi_tdo_seq(
+	uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, size_t clock_cycles)
+{
+	platform_maybe_delay();
+	const uint32_t trace_start = wire_trace_start();
+	jtagtap_tdi_tdo_shift(data_out, final_tms, data_in, clock_cycles);
+	wire_trace_jtag(WIRE_TRACE_JTAG_TDI_TDO, clock_cycles, final_tms, data_in, data_out, trace_start);
+	jtagtap_spi_check(jtag_proc.jtagtap_tdi_tdo_seq == jtagtap_tdi_tdo_seq);
+}
+
 static void jtagtap_tdi_seq_clk_delay(const uint8_t *const data_in, const bool final_tms, size_t clock_cycles)
 {
 	for (size_t cycle = 0; cycle < clock_cycles; ++cycle) {
@@ -313,56 +388,78 @@ static void jtagtap_tdi_seq_clk_delay(const uint8_t *const data_in, const bool f
 		/* Set up the TDI pin and start the clock cycle */
 		SET_TMS_TDI(cycle + 1U >= clock_cycles && final_tms, !!(data_in[byte] & (1U << bit)));
 		CLK_HIGH();
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		/* Finish the clock cycle */
 		CLK_LOW();
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 	}
 }
 
-static void jtagtap_tdi_seq_no_delay(const uint8_t *const data_in, const bool final_tms, size_t clock_cycles)
+static inline __attribute__((always_inline)) void jtagtap_tdi_word(
+	uint32_t tdi, const size_t clock_cycles, const bool final_tms)
 {
-	for (size_t cycle = 0; cycle < clock_cycles;) {
-		const uint8_t bit = cycle & 7U;
-		const size_t byte = cycle >> 3U;
-		const bool tms = cycle + 1U >= clock_cycles && final_tms;
-		const bool tdi = data_in[byte] & (1U << bit);
+	for (size_t cycle = clock_cycles; cycle--;) {
+		const bool tms = !cycle && final_tms;
 		/* Block the compiler from re-ordering the calculations to preserve timings */
 		__asm__ volatile("" ::: "memory");
 		CLK_LOW();
-		/* On the last tick, assert final_tms to TMS_PIN */
-		/* Set up the TDI pin and start the clock cycle */
-		SET_TMS_TDI(tms, !!tdi);
-		/* Block the compiler from re-ordering the calculations to preserve timings */
-		__asm__ volatile("" ::: "memory");
-		/* Increment the cycle counter */
-		++cycle;
+		/* Set up the TDI pin and, on the last tick, assert final_tms to TMS_PIN */
+		SET_TMS_TDI(tms, tdi);
+		tdi >>= 1U;
 		/* Block the compiler from re-ordering the calculations to preserve timings */
 		__asm__ volatile("nop" ::: "memory");
 		/* Start the clock cycle */
 		CLK_HIGH();
-		/* Finish the clock cycle */
 	}
+}
+
+static void jtagtap_tdi_seq_no_delay(const uint8_t *const data_in, const bool final_tms, size_t clock_cycles)
+{
+	if (!clock_cycles)
+		return;
+	const size_t words = (clock_cycles - 1U) >> 5U;
+	for (size_t word = 0; word < words; ++word) {
+		uint32_t tdi;
+		memcpy(&tdi, data_in + (word << 2U), sizeof(tdi));
+		jtagtap_tdi_word(tdi, 32U, false);
+	}
+
+	const size_t tail_cycles = clock_cycles - (words << 5U);
+	uint32_t tdi = 0;
+	memcpy(&tdi, data_in + (words << 2U), (tail_cycles + 7U) >> 3U);
+	jtagtap_tdi_word(tdi, tail_cycles, final_tms);
 	CLK_LOW();
 }
 
-static void jtagtap_tdi_seq(const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+static void jtagtap_tdi_shift(const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
 {
-	platform_maybe_delay();
+#ifdef JTAGTAP_SPI_MIN_CYCLES
+	if (jtagtap_spi_offload(data_in, NULL, final_tms, clock_cycles))
+		return;
+#endif
 	SET_TMS(0);
-	if (target_delay_us)
+	if (target_delay_cycles)
 		jtagtap_tdi_seq_clk_delay(data_in, final_tms, clock_cycles);
 	else
 		jtagtap_tdi_seq_no_delay(data_in, final_tms, clock_cycles);
 }
 
+static void jtagtap_tdi_seq(const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+{
+	platform_maybe_delay();
+	const uint32_t trace_start = wire_trace_start();
+	jtagtap_tdi_shift(final_tms, data_in, clock_cycles);
+	wire_trace_jtag(WIRE_TRACE_JTAG_TDI, clock_cycles, final_tms, data_in, NULL, trace_start);
+	jtagtap_spi_check(jtag_proc.jtagtap_tdi_seq == jtagtap_tdi_seq);
+}
+
 static void jtagtap_cycle_clk_delay(const size_t clock_cycles)
 {
 	for (size_t cycle = 0; cycle < clock_cycles; ++cycle) {
 		CLK_HIGH();
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		CLK_LOW();
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 	}
 }
 
@@ -378,7 +475,7 @@ static void jtagtap_cycle_no_delay(const size_t clock_cycles)
 static void jtagtap_cycle(const bool tms, const bool tdi, const size_t clock_cycles)
 {
 	jtagtap_next(tms, tdi);
-	if (target_delay_us)
+	if (target_delay_cycles)
 		jtagtap_cycle_clk_delay(clock_cycles - 1U);
 	else
 		jtagtap_cycle_no_delay(clock_cycles - 1U);
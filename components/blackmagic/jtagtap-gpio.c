@@ -26,6 +26,8 @@
 #include "general.h"
 #include "jtagtap.h"
 #include "platform.h"
+#include "wire-engine.h"
+#include "wire-trace.h"
 
 #if JTAGTAP_MODE_GPIO == 1
 
@@ -123,6 +125,7 @@ void jtagtap_init(void)
 	for (size_t i = 0; i <= 50U; ++i)
 		jtagtap_next(true, false); /* 50 + 1 idle cycles for SWD reset */
 	jtagtap_tms_seq(0xe73cU, 16U); /* SWD to JTAG sequence */
+	wire_engine_wrap_jtag(&jtag_proc);
 }
 
 static void jtagtap_reset(void)
@@ -141,10 +144,10 @@ static void jtagtap_reset(void)
 static bool jtagtap_next_clk_delay()
 {
 	gpio_set(TCK_PORT, TCK_PIN);
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 	const uint16_t result = gpio_get(TDO_PORT, TDO_PIN);
 	gpio_clear(TCK_PORT, TCK_PIN);
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 	return result != 0;
 }
 
@@ -161,7 +164,7 @@ static bool jtagtap_next(const bool tms, const bool tdi)
 	platform_maybe_delay();
 	gpio_set_val(TMS_PORT, TMS_PIN, tms);
 	gpio_set_val(TDI_PORT, TDI_PIN, tdi);
-	if (target_delay_us != 0)
+	if (target_delay_cycles != 0)
 		return jtagtap_next_clk_delay();
 	else // NOLINT(readability-else-after-return)
 		return jtagtap_next_no_delay();
@@ -173,10 +176,10 @@ static void jtagtap_tms_seq_clk_delay(uint32_t tms_states, const size_t clock_cy
 		const bool state = tms_states & 1U;
 		gpio_set_val(TMS_PORT, TMS_PIN, state);
 		gpio_set(TCK_PORT, TCK_PIN);
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		tms_states >>= 1U;
 		gpio_clear(TCK_PORT, TCK_PIN);
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 	}
 }
 
@@ -199,7 +202,7 @@ static void jtagtap_tms_seq_no_delay(uint32_t tms_states, const size_t clock_cyc
 static void jtagtap_tms_seq(const uint32_t tms_states, const size_t ticks)
 {
 	gpio_set(TDI_PORT, TDI_PIN);
-	if (target_delay_us != 0)
+	if (target_delay_cycles != 0)
 		jtagtap_tms_seq_clk_delay(tms_states, ticks);
 	else
 		jtagtap_tms_seq_no_delay(tms_states, ticks);
@@ -219,7 +222,7 @@ static void jtagtap_tdi_tdo_seq_clk_delay(
 		gpio_set_val(TDI_PORT, TDI_PIN, data_in[byte] & (1U << bit));
 		/* Start the clock cycle */
 		gpio_set(TCK_PORT, TCK_PIN);
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		/* If TDO is high, store a 1 in the appropriate position in the value being accumulated */
 		if (gpio_get(TDO_PORT, TDO_PIN))
 			value |= 1U << bit;
@@ -229,7 +232,7 @@ static void jtagtap_tdi_tdo_seq_clk_delay(
 		}
 		/* Finish the clock cycle */
 		gpio_clear(TCK_PORT, TCK_PIN);
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 	}
 	/* If clock_cycles is not divisible by 8, we have some extra data to write back here. */
 	if (clock_cycles & 7U) {
@@ -287,12 +290,14 @@ static void jtagtap_tdi_tdo_seq_no_delay(
 static void jtagtap_tdi_tdo_seq(
 	uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, size_t clock_cycles)
 {
+	const uint32_t trace_start = wire_trace_start();
 	gpio_clear(TMS_PORT, TMS_PIN);
 	gpio_clear(TDI_PORT, TDI_PIN);
-	if (target_delay_us != 0)
+	if (target_delay_cycles != 0)
 		jtagtap_tdi_tdo_seq_clk_delay(data_in, data_out, final_tms, clock_cycles);
 	else
 		jtagtap_tdi_tdo_seq_no_delay(data_in, data_out, final_tms, clock_cycles);
+	wire_trace_jtag(WIRE_TRACE_JTAG_TDI_TDO, clock_cycles, final_tms, data_in, data_out, trace_start);
 }
 
 static void jtagtap_tdi_seq_clk_delay(const uint8_t *const data_in, const bool final_tms, size_t clock_cycles)
@@ -305,10 +310,10 @@ static void jtagtap_tdi_seq_clk_delay(const uint8_t *const data_in, const bool f
 		/* Set up the TDI pin and start the clock cycle */
 		gpio_set_val(TDI_PORT, TDI_PIN, data_in[byte] & (1U << bit));
 		gpio_set(TCK_PORT, TCK_PIN);
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		/* Finish the clock cycle */
 		gpio_clear(TCK_PORT, TCK_PIN);
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 	}
 }
 
@@ -345,20 +350,22 @@ static void jtagtap_tdi_seq_no_delay(const uint8_t *const data_in, const bool fi
 
 static void jtagtap_tdi_seq(const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
 {
+	const uint32_t trace_start = wire_trace_start();
 	gpio_clear(TMS_PORT, TMS_PIN);
-	if (target_delay_us != 0)
+	if (target_delay_cycles != 0)
 		jtagtap_tdi_seq_clk_delay(data_in, final_tms, clock_cycles);
 	else
 		jtagtap_tdi_seq_no_delay(data_in, final_tms, clock_cycles);
+	wire_trace_jtag(WIRE_TRACE_JTAG_TDI, clock_cycles, final_tms, data_in, NULL, trace_start);
 }
 
 static void jtagtap_cycle_clk_delay(const size_t clock_cycles)
 {
 	for (size_t cycle = 0; cycle < clock_cycles; ++cycle) {
 		gpio_set(TCK_PORT, TCK_PIN);
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		gpio_clear(TCK_PORT, TCK_PIN);
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 	}
 }
 
@@ -374,7 +381,7 @@ static void jtagtap_cycle_no_delay(const size_t clock_cycles)
 static void jtagtap_cycle(const bool tms, const bool tdi, const size_t clock_cycles)
 {
 	jtagtap_next(tms, tdi);
-	if (target_delay_us != 0)
+	if (target_delay_cycles != 0)
 		jtagtap_cycle_clk_delay(clock_cycles - 1U);
 	else
 		jtagtap_cycle_no_delay(clock_cycles - 1U);
@@ -0,0 +1,214 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements long JTAG shifts using the SPI peripheral.
+ *
+ * TCK, TDI and TDO map directly onto SCLK, MOSI and MISO in SPI mode 0:
+ * TDI is set up on the falling edge and both sides sample on the rising
+ * edge. For the duration of a shift, TCK and TDI are switched over from
+ * the dedicated GPIO bundle to the SPI peripheral in the GPIO matrix. TMS
+ * stays on the bundle and holds its level, and TDO feeds both so that
+ * the input never needs to be switched. The DMA transfer is
+ * interrupt-driven, so the core is free to run other tasks while a long
+ * scan is clocked out.
+ */
+
+#include "general.h"
+#include "jtagtap-spi.h"
+
+#if JTAGTAP_MODE_DEDIC == 1 && defined(CONFIG_JTAG_SPI_OFFLOAD)
+
+#include "driver/spi_master.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_rom_gpio.h"
+#include "soc/dedic_gpio_periph.h"
+#include "soc/spi_periph.h"
+
+#include "gpio-dedic.h"
+#include "tap-bitstream.h"
+
+#define TAG "jtag-spi"
+
+#define JTAGTAP_SPI_HOST SPI2_HOST
+/* Largest single DMA transaction, kept a multiple of 4 bytes so chunks stay word aligned */
+#define JTAGTAP_SPI_CHUNK_BYTES 4092U
+#define JTAGTAP_SPI_CHUNK_BITS  (JTAGTAP_SPI_CHUNK_BYTES * 8U)
+/* The bit-banged tap tops out around here, so don't let the peripheral run faster */
+#define JTAGTAP_SPI_MAX_FREQUENCY 20000000U
+
+static spi_device_handle_t jtagtap_spi_device;
+static uint32_t jtagtap_spi_frequency;
+static uint8_t *jtagtap_spi_tx;
+static uint8_t *jtagtap_spi_rx;
+static bool jtagtap_spi_failed;
+/* Only touched by the task that runs the tap */
+static bool jtagtap_spi_scan_error;
+
+static bool jtagtap_spi_bus_init(void)
+{
+	if (jtagtap_spi_tx)
+		return true;
+	if (jtagtap_spi_failed)
+		return false;
+
+	/* Pins are routed by hand, so the driver must not touch the IO MUX */
+	const spi_bus_config_t bus_config = {
+		.mosi_io_num = -1,
+		.miso_io_num = -1,
+		.sclk_io_num = -1,
+		.quadwp_io_num = -1,
+		.quadhd_io_num = -1,
+		.max_transfer_sz = JTAGTAP_SPI_CHUNK_BYTES,
+	};
+	esp_err_t ret = spi_bus_initialize(JTAGTAP_SPI_HOST, &bus_config, SPI_DMA_CH_AUTO);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "unable to initialize spi bus: %s", esp_err_to_name(ret));
+		jtagtap_spi_failed = true;
+		return false;
+	}
+
+	jtagtap_spi_tx = heap_caps_malloc(JTAGTAP_SPI_CHUNK_BYTES, MALLOC_CAP_DMA);
+	jtagtap_spi_rx = heap_caps_malloc(JTAGTAP_SPI_CHUNK_BYTES, MALLOC_CAP_DMA);
+	if (!jtagtap_spi_tx || !jtagtap_spi_rx) {
+		ESP_LOGE(TAG, "unable to allocate dma buffers");
+		heap_caps_free(jtagtap_spi_tx);
+		heap_caps_free(jtagtap_spi_rx);
+		jtagtap_spi_tx = NULL;
+		jtagtap_spi_rx = NULL;
+		spi_bus_free(JTAGTAP_SPI_HOST);
+		jtagtap_spi_failed = true;
+		return false;
+	}
+
+	/* TDO goes to both the bundle and the SPI peripheral for good */
+	esp_rom_gpio_connect_in_signal(CONFIG_TDO_GPIO, spi_periph_signal[JTAGTAP_SPI_HOST].spiq_in, false);
+	return true;
+}
+
+/* (Re)create the device whenever the requested clock changes */
+static bool jtagtap_spi_device_update(void)
+{
+	uint32_t frequency = platform_max_frequency_get();
+	if (frequency > JTAGTAP_SPI_MAX_FREQUENCY)
+		frequency = JTAGTAP_SPI_MAX_FREQUENCY;
+	if (jtagtap_spi_device && frequency == jtagtap_spi_frequency)
+		return true;
+
+	if (jtagtap_spi_device) {
+		spi_bus_remove_device(jtagtap_spi_device);
+		jtagtap_spi_device = NULL;
+	}
+
+	const spi_device_interface_config_t device_config = {
+		.mode = 0,
+		.clock_speed_hz = (int)frequency,
+		.spics_io_num = -1,
+		.flags = SPI_DEVICE_BIT_LSBFIRST,
+		.queue_size = 1,
+	};
+	const esp_err_t ret = spi_bus_add_device(JTAGTAP_SPI_HOST, &device_config, &jtagtap_spi_device);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "unable to add spi device: %s", esp_err_to_name(ret));
+		jtagtap_spi_device = NULL;
+		return false;
+	}
+	jtagtap_spi_frequency = frequency;
+	return true;
+}
+
+static void jtagtap_spi_route(const bool to_spi)
+{
+	if (to_spi) {
+		esp_rom_gpio_connect_out_signal(
+			CONFIG_TCK_SWCLK_GPIO, spi_periph_signal[JTAGTAP_SPI_HOST].spiclk_out, false, false);
+		esp_rom_gpio_connect_out_signal(CONFIG_TDI_GPIO, spi_periph_signal[JTAGTAP_SPI_HOST].spid_out, false, false);
+	} else {
+		/* The bundle lives on the core that created it, which is the one running the tap */
+		const int core = esp_cpu_get_core_id();
+		esp_rom_gpio_connect_out_signal(CONFIG_TCK_SWCLK_GPIO,
+			dedic_gpio_periph_signals.cores[core].out_sig_per_channel[SWCLK_DEDIC_PIN], false, false);
+		esp_rom_gpio_connect_out_signal(CONFIG_TDI_GPIO,
+			dedic_gpio_periph_signals.cores[core].out_sig_per_channel[JTAG_TDI_DEDIC_PIN], false, false);
+	}
+}
+
+bool jtagtap_spi_shift(const uint8_t *const data_in, uint8_t *const data_out, const size_t clock_cycles)
+{
+	if (!clock_cycles || !jtagtap_spi_bus_init() || !jtagtap_spi_device_update())
+		return false;
+
+	spi_device_acquire_bus(jtagtap_spi_device, portMAX_DELAY);
+	jtagtap_spi_route(true);
+	size_t offset = 0;
+	bool ok = true;
+	for (; offset < clock_cycles; offset += JTAGTAP_SPI_CHUNK_BITS) {
+		const size_t remaining = clock_cycles - offset;
+		const size_t bits = remaining < JTAGTAP_SPI_CHUNK_BITS ? remaining : JTAGTAP_SPI_CHUNK_BITS;
+		tap_bitstream_encode(jtagtap_spi_tx, data_in, offset, bits);
+
+		spi_transaction_t transaction = {
+			.length = bits,
+			.rxlength = data_out ? bits : 0,
+			.tx_buffer = jtagtap_spi_tx,
+			.rx_buffer = data_out ? jtagtap_spi_rx : NULL,
+		};
+		if (spi_device_transmit(jtagtap_spi_device, &transaction) != ESP_OK) {
+			ESP_LOGE(TAG, "spi transaction failed at bit %zu", offset);
+			ok = false;
+			break;
+		}
+
+		if (data_out)
+			tap_bitstream_decode(data_out, offset, jtagtap_spi_rx, bits);
+	}
+	jtagtap_spi_route(false);
+	spi_device_release_bus(jtagtap_spi_device);
+
+	/* Nothing clocked yet, bit-banging can still do the whole scan */
+	if (!ok && !offset)
+		return false;
+	/* A partial scan can't be rewound, and what TDO returned so far is not a scan result */
+	if (!ok)
+		jtagtap_spi_scan_error = true;
+	return true;
+}
+
+bool jtagtap_spi_take_error(void)
+{
+	const bool error = jtagtap_spi_scan_error;
+	jtagtap_spi_scan_error = false;
+	return error;
+}
+
+#else
+
+bool jtagtap_spi_shift(const uint8_t *const data_in, uint8_t *const data_out, const size_t clock_cycles)
+{
+	(void)data_in;
+	(void)data_out;
+	(void)clock_cycles;
+	return false;
+}
+
+bool jtagtap_spi_take_error(void)
+{
+	return false;
+}
+
+#endif /* JTAGTAP_MODE_DEDIC == 1 && CONFIG_JTAG_SPI_OFFLOAD */
@@ -0,0 +1,24 @@
+#ifndef JTAGTAP_SPI_H_
+#define JTAGTAP_SPI_H_
+
+#include "general.h"
+
+#if defined(CONFIG_JTAG_SPI_OFFLOAD)
+#define JTAGTAP_SPI_MIN_CYCLES CONFIG_JTAG_SPI_MIN_BITS
+#endif
+
+/*
+ * Shift `clock_cycles` bits through TDI/TDO using the SPI peripheral and
+ * DMA, leaving TMS at whatever level the caller set up. `data_out` may be
+ * NULL if TDO is not needed. Returns false if the peripheral is not
+ * available or fails before the first bit, in which case nothing has been
+ * clocked and the caller must fall back to bit-banging. A failure partway
+ * through can't be rewound, so it returns true and is left for
+ * jtagtap_spi_take_error(). This never raises, as it runs on the wire engine.
+ */
+bool jtagtap_spi_shift(const uint8_t *data_in, uint8_t *data_out, size_t clock_cycles);
+
+/* Whether a shift failed partway through since the last call, in which case TDO holds no scan result */
+bool jtagtap_spi_take_error(void);
+
+#endif /* JTAGTAP_SPI_H_ */
@@ -0,0 +1,8 @@
+/* Host stand-in for the ESP-IDF header of the same name */
+
+#ifndef TAP_SIM_DRIVER_DEDIC_GPIO_H_
+#define TAP_SIM_DRIVER_DEDIC_GPIO_H_
+
+typedef struct dedic_gpio_bundle *dedic_gpio_bundle_handle_t;
+
+#endif /* TAP_SIM_DRIVER_DEDIC_GPIO_H_ */
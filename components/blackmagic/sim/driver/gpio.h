@@ -0,0 +1,67 @@
+/* Host stand-in for the ESP-IDF header of the same name, routing pins to the target model */
+
+#ifndef TAP_SIM_DRIVER_GPIO_H_
+#define TAP_SIM_DRIVER_GPIO_H_
+
+#include <stdint.h>
+
+#include "tap-sim.h"
+
+typedef int gpio_num_t;
+typedef int esp_err_t;
+
+#define ESP_OK             0
+#define ESP_ERROR_CHECK(x) (void)(x)
+
+typedef enum {
+	GPIO_MODE_DISABLE = 0,
+	GPIO_MODE_INPUT = 1,
+	GPIO_MODE_OUTPUT = 2,
+	GPIO_MODE_INPUT_OUTPUT = 3,
+} gpio_mode_t;
+
+typedef enum {
+	GPIO_INTR_DISABLE = 0,
+} gpio_int_type_t;
+
+typedef struct {
+	uint64_t pin_bit_mask;
+	gpio_mode_t mode;
+	int pull_up_en;
+	int pull_down_en;
+	gpio_int_type_t intr_type;
+} gpio_config_t;
+
+static inline esp_err_t gpio_config(const gpio_config_t *const config)
+{
+	(void)config;
+	return ESP_OK;
+}
+
+static inline esp_err_t gpio_reset_pin(const gpio_num_t pin)
+{
+	if (pin >= 0)
+		tap_sim_output_enable(1U << pin, false);
+	return ESP_OK;
+}
+
+static inline esp_err_t gpio_set_direction(const gpio_num_t pin, const gpio_mode_t mode)
+{
+	if (pin >= 0)
+		tap_sim_output_enable(1U << pin, mode & GPIO_MODE_OUTPUT);
+	return ESP_OK;
+}
+
+static inline esp_err_t gpio_set_level(const gpio_num_t pin, const uint32_t level)
+{
+	if (pin >= 0)
+		tap_sim_write(1U << pin, level ? 1U << pin : 0U);
+	return ESP_OK;
+}
+
+static inline int gpio_get_level(const gpio_num_t pin)
+{
+	return pin >= 0 ? (tap_sim_read_in() >> pin) & 1U : 0;
+}
+
+#endif /* TAP_SIM_DRIVER_GPIO_H_ */
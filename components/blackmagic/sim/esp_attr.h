@@ -0,0 +1,9 @@
+/* Host stand-in for the ESP-IDF header of the same name */
+
+#ifndef TAP_SIM_ESP_ATTR_H_
+#define TAP_SIM_ESP_ATTR_H_
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#endif /* TAP_SIM_ESP_ATTR_H_ */
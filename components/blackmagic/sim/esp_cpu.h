@@ -0,0 +1,15 @@
+/* Host stand-in for the ESP-IDF header of the same name, counting model time */
+
+#ifndef TAP_SIM_ESP_CPU_H_
+#define TAP_SIM_ESP_CPU_H_
+
+#include <stdint.h>
+
+#include "tap-sim.h"
+
+static inline uint32_t esp_cpu_get_cycle_count(void)
+{
+	return tap_sim_cycle_count();
+}
+
+#endif /* TAP_SIM_ESP_CPU_H_ */
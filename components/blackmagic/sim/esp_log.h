@@ -0,0 +1,47 @@
+/* Host stand-in for the ESP-IDF header of the same name, logging to stderr */
+
+#ifndef TAP_SIM_ESP_LOG_H_
+#define TAP_SIM_ESP_LOG_H_
+
+#include <inttypes.h>
+#include <stdint.h>
+
+#define CONFIG_LOG_TIMESTAMP_SOURCE_RTOS 1
+
+typedef enum {
+	ESP_LOG_NONE,
+	ESP_LOG_ERROR,
+	ESP_LOG_WARN,
+	ESP_LOG_INFO,
+	ESP_LOG_DEBUG,
+	ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_INFO
+#endif
+
+#define LOG_COLOR_E     ""
+#define LOG_COLOR_W     ""
+#define LOG_COLOR_I     ""
+#define LOG_COLOR_D     ""
+#define LOG_COLOR_V     ""
+#define LOG_RESET_COLOR ""
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+	__attribute__((format(printf, 3, 4)));
+uint32_t esp_log_timestamp(void);
+
+#define ESP_LOG_LEVEL_LOCAL(level, tag, format, ...)                           \
+	do {                                                                       \
+		if (LOG_LOCAL_LEVEL >= (level))                                        \
+			esp_log_write(level, tag, "%s: " format "\n", tag, ##__VA_ARGS__); \
+	} while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+#endif /* TAP_SIM_ESP_LOG_H_ */
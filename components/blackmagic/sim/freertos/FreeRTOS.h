@@ -0,0 +1,8 @@
+/* Host stand-in for the ESP-IDF header of the same name, the host runs everything on one core */
+
+#ifndef TAP_SIM_FREERTOS_H_
+#define TAP_SIM_FREERTOS_H_
+
+#define configNUMBER_OF_CORES 1
+
+#endif /* TAP_SIM_FREERTOS_H_ */
@@ -0,0 +1,8 @@
+/* Host stand-in for the FreeRTOS header of the same name, the host has no tasks to manage */
+
+#ifndef TAP_SIM_FREERTOS_TASK_H_
+#define TAP_SIM_FREERTOS_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+#endif /* TAP_SIM_FREERTOS_TASK_H_ */
@@ -0,0 +1,37 @@
+/* Host stand-in for the ESP-IDF header of the same name, routing the bundle to the target model */
+
+#ifndef TAP_SIM_HAL_DEDIC_GPIO_CPU_LL_H_
+#define TAP_SIM_HAL_DEDIC_GPIO_CPU_LL_H_
+
+#include <stdint.h>
+
+#include "tap-sim.h"
+
+static inline uint32_t dedic_gpio_cpu_ll_read_in(void)
+{
+	return tap_sim_read_in();
+}
+
+static inline uint32_t dedic_gpio_cpu_ll_read_out(void)
+{
+	return tap_sim_read_out();
+}
+
+static inline void dedic_gpio_cpu_ll_write_mask(const uint32_t mask, const uint32_t value)
+{
+	tap_sim_write(mask, value);
+}
+
+static inline void dedic_gpio_cpu_ll_write_all(const uint32_t value)
+{
+	tap_sim_write(UINT32_MAX, value);
+}
+
+/* Like the CSR it stands in for, this sets the whole output-enable mask */
+static inline void dedic_gpio_cpu_ll_enable_output(const uint32_t mask)
+{
+	tap_sim_output_enable(UINT32_MAX, false);
+	tap_sim_output_enable(mask, true);
+}
+
+#endif /* TAP_SIM_HAL_DEDIC_GPIO_CPU_LL_H_ */
@@ -0,0 +1,125 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Host stand-in for main/include/platform.h, wiring the tap pins to the target model */
+
+#ifndef FARPATCH_PLATFORM_H
+#define FARPATCH_PLATFORM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "driver/gpio.h"
+#include "tap-sim.h"
+
+/* The taps pick their clock macros by chip, so present the model as an ESP32-S3 */
+#define CONFIG_IDF_TARGET_ESP32S3 1
+#define CONFIG_IDF_TARGET         "esp32s3"
+
+#define CONFIG_CUSTOM_HARDWARE
+#define CONFIG_TMS_SWDIO_GPIO     TAP_SIM_PIN_SWDIO_TMS
+#define CONFIG_TCK_SWCLK_GPIO     TAP_SIM_PIN_SWCLK_TCK
+#define CONFIG_TDO_GPIO           TAP_SIM_PIN_TDO
+#define CONFIG_TDI_GPIO           TAP_SIM_PIN_TDI
+#define CONFIG_TMS_SWDIO_DIR_GPIO -1
+#define CONFIG_TCK_TDI_DIR_GPIO   -1
+#define CONFIG_NRST_GPIO          -1
+#define CONFIG_TMS_ADC_UNIT       -1
+#define CONFIG_TDO_ADC_UNIT       -1
+
+#define PLATFORM_HAS_DEBUG
+extern bool debug_bmp;
+
+#define SET_RUN_STATE(state) \
+	do {                     \
+	} while (0)
+#define SET_IDLE_STATE(state) \
+	do {                      \
+	} while (0)
+#define SET_ERROR_STATE(state) \
+	do {                       \
+	} while (0)
+
+#ifndef NO_LIBOPENCM3
+#define NO_LIBOPENCM3
+#endif
+
+#ifndef PC_HOSTED
+#define PC_HOSTED 0
+#endif
+
+#define ENABLE_DEBUG 1
+
+#define SWDIO_MODE_FLOAT()                                         \
+	do {                                                           \
+		tap_sim_output_enable(1U << CONFIG_TMS_SWDIO_GPIO, false); \
+	} while (0)
+
+#define SWDIO_MODE_DRIVE()                                        \
+	do {                                                          \
+		tap_sim_output_enable(1U << CONFIG_TMS_SWDIO_GPIO, true); \
+	} while (0)
+
+#define TMS_PIN CONFIG_TMS_SWDIO_GPIO
+#define TCK_PIN CONFIG_TCK_SWCLK_GPIO
+#define TDI_PIN CONFIG_TDI_GPIO
+#define TDO_PIN CONFIG_TDO_GPIO
+
+#define SWDIO_PIN    CONFIG_TMS_SWDIO_GPIO
+#define SWDIO_IN_PIN CONFIG_TMS_SWDIO_GPIO
+#define SWCLK_PIN    CONFIG_TCK_SWCLK_GPIO
+#define SRST_PIN     CONFIG_SRST_GPIO
+
+#define SWCLK_PORT 0
+#define SWDIO_PORT 0
+
+#define gpio_set(port, pin)                      \
+	do {                                         \
+		tap_sim_write(1U << (pin), 1U << (pin)); \
+	} while (0)
+#define gpio_clear(port, pin)           \
+	do {                                \
+		tap_sim_write(1U << (pin), 0U); \
+	} while (0)
+#define gpio_get(port, pin) ((tap_sim_read_in() >> (pin)) & 0x1)
+
+#define gpio_set_val(port, pin, value) \
+	if (value) {                       \
+		gpio_set(port, pin);           \
+	} else {                           \
+		gpio_clear(port, pin);         \
+	}
+
+#define GPIO_INPUT  GPIO_MODE_INPUT
+#define GPIO_OUTPUT GPIO_MODE_OUTPUT
+
+#define PLATFORM_IDENT "host"
+
+/* Half of a tap clock period in CPU cycles, or 0 to clock as fast as the tap code runs */
+extern uint32_t target_delay_cycles;
+extern uint32_t target_clk_deadline;
+
+/* Model time does not pass on its own, so a delay simply spends its cycles */
+static inline __attribute__((always_inline)) void platform_clk_delay(void)
+{
+	tap_sim_advance(target_delay_cycles);
+}
+
+#endif /* FARPATCH_PLATFORM_H */
@@ -0,0 +1,9 @@
+/* Host stand-in for the ESP-IDF header of the same name, describing the modelled bundle */
+
+#ifndef TAP_SIM_SOC_SOC_CAPS_H_
+#define TAP_SIM_SOC_SOC_CAPS_H_
+
+#define SOC_DEDIC_GPIO_OUT_CHANNELS_NUM 8
+#define SOC_DEDIC_GPIO_IN_CHANNELS_NUM  8
+
+#endif /* TAP_SIM_SOC_SOC_CAPS_H_ */
@@ -0,0 +1,128 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file provides the platform symbols the taps link against when built for the host. */
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "platform.h"
+#include "cortexm.h"
+#include "exception.h"
+#include "jtagtap.h"
+#include "swd-queue.h"
+#include "timing.h"
+
+/* Model cycles per millisecond, as if the taps ran on a 240 MHz core */
+#define TAP_SIM_HOST_CYCLES_PER_MS 240000U
+
+uint32_t target_delay_cycles;
+uint32_t target_clk_deadline;
+bool debug_bmp;
+
+/* The firmware yields to FreeRTOS here, there is nothing to yield to on the host */
+void platform_maybe_delay(void)
+{
+}
+
+/* Stands in for gpio-dedic.c, the model needs no pin matrix set up */
+void gpio_dedic_init(void)
+{
+	static bool initialized = false;
+	if (initialized)
+		return;
+	initialized = true;
+
+	tap_sim_output_enable(UINT32_MAX, false);
+	tap_sim_output_enable((1U << CONFIG_TCK_SWCLK_GPIO) | (1U << CONFIG_TDI_GPIO), true);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+	(void)level;
+	(void)tag;
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+uint32_t esp_log_timestamp(void)
+{
+	return tap_sim_cycle_count();
+}
+
+/* The firmware keeps one of these per task, the host only has the one */
+struct exception **get_innermost_exception(void)
+{
+	static struct exception *innermost;
+	return &innermost;
+}
+
+/* Time follows the model, so a timeout only runs out while the taps are clocking */
+uint32_t platform_time_ms(void)
+{
+	return tap_sim_cycle_count() / TAP_SIM_HOST_CYCLES_PER_MS;
+}
+
+void platform_timeout_set(platform_timeout_s *const target, const uint32_t ms)
+{
+	target->time = platform_time_ms() + ms;
+}
+
+bool platform_timeout_is_expired(const platform_timeout_s *const target)
+{
+	return (int32_t)(platform_time_ms() - target->time) >= 0;
+}
+
+/* Five clocks with TMS high reach Test-Logic-Reset from any state, the sixth moves on to Run-Test/Idle */
+void jtagtap_soft_reset(void)
+{
+	jtag_proc.jtagtap_tms_seq(0x1fU, 6U);
+}
+
+/*
+ * swdptap_transfer_install() looks at the target layer, which the model
+ * doesn't have. Nothing here is a Cortex-M, so it never gets further.
+ */
+bool target_is_cortexm(const target_s *const target)
+{
+	(void)target;
+	return false;
+}
+
+adiv5_access_port_s *cortexm_ap(target_s *const target)
+{
+	(void)target;
+	return NULL;
+}
+
+/* Only its address is looked at */
+uint32_t adiv5_swd_raw_access(
+	adiv5_debug_port_s *const dp, const uint8_t rnw, const uint16_t addr, const uint32_t value)
+{
+	(void)dp;
+	(void)rnw;
+	(void)addr;
+	(void)value;
+	return 0;
+}
+
+void swd_queue_install(adiv5_debug_port_s *const dp)
+{
+	(void)dp;
+}
@@ -0,0 +1,449 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This file runs the SWD and JTAG taps against the target model: reads,
+ * writes, WAIT, FAULT and parity errors over SWD, IDCODE and chain scans
+ * over JTAG, and how many cycles each clock costs. The same tests run
+ * against the dedicated GPIO and the plain GPIO taps. The bitstream
+ * packing used by the SPI JTAG path is checked on its own and by shifting
+ * packed chunks through the model.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "general.h"
+#include "adiv5.h"
+#include "jtagtap.h"
+#include "platform.h"
+#include "swd-transfer.h"
+#include "tap-bitstream.h"
+
+#define TAP_SIM_TEST_POWER_UP (ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ | ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ)
+
+/*
+ * Model cycles a tap may spend on pin accesses for each clock, on top of the
+ * two half periods of target_delay_cycles. These are regression limits: a
+ * change that makes a kernel slower fails here.
+ */
+#if SWDPTAP_MODE_DEDIC == 1
+#define TAP_SIM_TEST_SWD_PIN_CYCLES  4U
+#define TAP_SIM_TEST_JTAG_PIN_CYCLES 5U
+#else
+#define TAP_SIM_TEST_SWD_PIN_CYCLES  4U
+#define TAP_SIM_TEST_JTAG_PIN_CYCLES 6U
+#endif
+
+/* Bits clocked through the chain for the JTAG throughput check */
+#define TAP_SIM_TEST_JTAG_BITS 1024U
+
+/* Bits and chunk size for the bitstream round trip, the chunk deliberately not a whole number of bytes */
+#define TAP_SIM_TEST_BITSTREAM_BITS  100U
+#define TAP_SIM_TEST_BITSTREAM_CHUNK 13U
+
+static unsigned tap_sim_test_failures;
+
+#define CHECK(cond)                                                     \
+	do {                                                                \
+		if (!(cond)) {                                                  \
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			++tap_sim_test_failures;                                    \
+		}                                                               \
+	} while (0)
+
+static uint8_t tap_sim_test_read(const uint16_t addr, uint32_t *const value)
+{
+	*value = 0;
+	return swdptap_transfer(swdptap_make_request(ADIV5_LOW_READ, addr), value, 8U);
+}
+
+static uint8_t tap_sim_test_write(const uint16_t addr, uint32_t value)
+{
+	return swdptap_transfer(swdptap_make_request(ADIV5_LOW_WRITE, addr), &value, 8U);
+}
+
+/* Reset the model and bring the SW-DP out of reset with a line reset and some idle cycles */
+static void tap_sim_test_connect(const tap_sim_config_s *const config)
+{
+	tap_sim_reset(config);
+	swdptap_init();
+	swd_proc.seq_out(UINT32_MAX, 32U);
+	swd_proc.seq_out(UINT32_MAX, 28U);
+	swd_proc.seq_out(0U, 8U);
+}
+
+/* Power up the debug domain and set up AP 0 for auto-incrementing word accesses */
+static void tap_sim_test_power_up(void)
+{
+	CHECK(tap_sim_test_write(ADIV5_DP_CTRLSTAT, TAP_SIM_TEST_POWER_UP) == SWD_ACK_OK);
+	CHECK(tap_sim_test_write(ADIV5_DP_SELECT, 0U) == SWD_ACK_OK);
+	CHECK(tap_sim_test_write(ADIV5_AP_CSW, ADIV5_AP_CSW_SIZE_WORD | ADIV5_AP_CSW_ADDRINC_SINGLE) == SWD_ACK_OK);
+}
+
+static void tap_sim_test_dpidr(void)
+{
+	tap_sim_test_connect(NULL);
+	uint32_t value;
+	CHECK(tap_sim_test_read(ADIV5_DP_DPIDR, &value) == SWD_ACK_OK);
+	CHECK(value == TAP_SIM_DPIDR);
+	CHECK(tap_sim_stats()->swd_line_resets == 1U);
+	CHECK(tap_sim_stats()->swd_protocol_errors == 0U);
+	CHECK(tap_sim_stats()->bus_contention == 0U);
+}
+
+static void tap_sim_test_memory(void)
+{
+	static const uint32_t words[] = {0x01234567U, 0x89abcdefU, 0xdeadbeefU, 0x00c0ffeeU};
+	tap_sim_test_connect(NULL);
+	tap_sim_test_power_up();
+
+	CHECK(tap_sim_test_write(ADIV5_AP_TAR, TAP_SIM_RAM_BASE + 0x100U) == SWD_ACK_OK);
+	for (size_t i = 0; i < ARRAY_LENGTH(words); ++i)
+		CHECK(tap_sim_test_write(ADIV5_AP_DRW, words[i]) == SWD_ACK_OK);
+	CHECK(memcmp(tap_sim_ram() + 0x100U, words, sizeof(words)) == 0);
+
+	/* AP reads are posted, each returns the previous one's data and RDBUFF the last */
+	uint32_t read[ARRAY_LENGTH(words) + 1U];
+	CHECK(tap_sim_test_write(ADIV5_AP_TAR, TAP_SIM_RAM_BASE + 0x100U) == SWD_ACK_OK);
+	for (size_t i = 0; i < ARRAY_LENGTH(words); ++i)
+		CHECK(tap_sim_test_read(ADIV5_AP_DRW, &read[i]) == SWD_ACK_OK);
+	CHECK(tap_sim_test_read(ADIV5_DP_RDBUFF, &read[ARRAY_LENGTH(words)]) == SWD_ACK_OK);
+	CHECK(memcmp(&read[1], words, sizeof(words)) == 0);
+	CHECK(tap_sim_stats()->bus_contention == 0U);
+}
+
+static void tap_sim_test_wait(void)
+{
+	const tap_sim_config_s config = {.wait_every = 1U};
+	tap_sim_test_connect(&config);
+	CHECK(tap_sim_test_write(ADIV5_DP_CTRLSTAT, TAP_SIM_TEST_POWER_UP) == SWD_ACK_OK);
+
+	/* The model answers each AP access with WAIT once, then the retry goes through */
+	uint32_t value;
+	CHECK(tap_sim_test_write(ADIV5_AP_TAR, TAP_SIM_RAM_BASE) == SWD_ACK_WAIT);
+	CHECK(tap_sim_test_write(ADIV5_AP_TAR, TAP_SIM_RAM_BASE) == SWD_ACK_OK);
+	CHECK(tap_sim_test_read(ADIV5_AP_TAR, &value) == SWD_ACK_WAIT);
+	CHECK(tap_sim_test_read(ADIV5_AP_TAR, &value) == SWD_ACK_OK);
+	CHECK(tap_sim_test_read(ADIV5_DP_RDBUFF, &value) == SWD_ACK_OK);
+	CHECK(value == TAP_SIM_RAM_BASE);
+	CHECK(tap_sim_stats()->swd_waits >= 2U);
+	/* The bus must be turned around properly after a WAIT with no data phase */
+	CHECK(tap_sim_stats()->bus_contention == 0U);
+	CHECK(tap_sim_stats()->swd_protocol_errors == 0U);
+}
+
+static void tap_sim_test_fault(void)
+{
+	tap_sim_test_connect(NULL);
+	tap_sim_test_power_up();
+
+	/* Nothing is mapped at 0, so the bus access sets STICKYERR and later AP accesses FAULT */
+	uint32_t value;
+	CHECK(tap_sim_test_write(ADIV5_AP_TAR, 0U) == SWD_ACK_OK);
+	CHECK(tap_sim_test_write(ADIV5_AP_DRW, 0U) == SWD_ACK_OK);
+	CHECK(tap_sim_test_read(ADIV5_AP_DRW, &value) == SWD_ACK_FAULT);
+	/* DP accesses still work, and clearing the flag through ABORT recovers the AP */
+	CHECK(tap_sim_test_write(ADIV5_DP_ABORT, ADIV5_DP_ABORT_STKERRCLR) == SWD_ACK_OK);
+	CHECK(tap_sim_test_write(ADIV5_AP_TAR, TAP_SIM_RAM_BASE) == SWD_ACK_OK);
+	CHECK(tap_sim_stats()->swd_faults == 1U);
+	CHECK(tap_sim_stats()->bus_contention == 0U);
+}
+
+/* The access path BMP uses, which retries WAITs itself */
+static void tap_sim_test_raw_access(void)
+{
+	const tap_sim_config_s config = {.wait_every = 1U};
+	tap_sim_test_connect(&config);
+	adiv5_debug_port_s dp;
+	memset(&dp, 0, sizeof(dp));
+
+	swdptap_raw_access(&dp, ADIV5_LOW_WRITE, ADIV5_DP_CTRLSTAT, TAP_SIM_TEST_POWER_UP);
+	swdptap_raw_access(&dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, TAP_SIM_RAM_BASE + 0x40U);
+	swdptap_raw_access(&dp, ADIV5_LOW_READ, ADIV5_AP_TAR, 0U);
+	CHECK(swdptap_raw_access(&dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0U) == TAP_SIM_RAM_BASE + 0x40U);
+	CHECK(dp.fault == 0U);
+	CHECK(tap_sim_stats()->swd_waits >= 2U);
+	CHECK(tap_sim_stats()->bus_contention == 0U);
+}
+
+static void tap_sim_test_parity(void)
+{
+	const tap_sim_config_s config = {.parity_error_every = 2U};
+	tap_sim_test_connect(&config);
+
+	uint32_t value;
+	CHECK(tap_sim_test_read(ADIV5_DP_DPIDR, &value) == SWD_ACK_OK);
+	CHECK(tap_sim_test_read(ADIV5_DP_DPIDR, &value) == (SWD_ACK_OK | SWD_TRANSFER_PARITY_ERROR));
+	CHECK(value == TAP_SIM_DPIDR);
+	CHECK(tap_sim_test_read(ADIV5_DP_DPIDR, &value) == SWD_ACK_OK);
+}
+
+/* Every clock takes two half periods, and no more than the limit in pin accesses on top */
+static void tap_sim_test_cycles_per_clock(const uint32_t cycles, const uint64_t clocks, const uint32_t pin_cycles)
+{
+	CHECK(cycles >= clocks * 2U * target_delay_cycles);
+	CHECK(cycles <= clocks * (2U * target_delay_cycles + pin_cycles));
+}
+
+static void tap_sim_test_swd_throughput(void)
+{
+	tap_sim_test_connect(NULL);
+	tap_sim_test_power_up();
+	CHECK(tap_sim_test_write(ADIV5_AP_TAR, TAP_SIM_RAM_BASE) == SWD_ACK_OK);
+
+	const uint32_t start = tap_sim_cycle_count();
+	const uint64_t clocks = tap_sim_stats()->clock_edges;
+	for (uint32_t word = 0; word < 64U; ++word)
+		CHECK(tap_sim_test_write(ADIV5_AP_DRW, word) == SWD_ACK_OK);
+	tap_sim_test_cycles_per_clock(
+		tap_sim_cycle_count() - start, tap_sim_stats()->clock_edges - clocks, TAP_SIM_TEST_SWD_PIN_CYCLES);
+}
+
+/* Switch the model over to JTAG the way a scan does, ending in Run-Test/Idle */
+static void tap_sim_test_jtag_connect(const tap_sim_config_s *const config)
+{
+	tap_sim_reset(config);
+	jtagtap_init();
+	jtag_proc.jtagtap_reset();
+}
+
+/* From Run-Test/Idle to Shift-DR or Shift-IR */
+static void tap_sim_test_jtag_shift_dr(void)
+{
+	jtag_proc.jtagtap_tms_seq(0x1U, 3U);
+}
+
+static void tap_sim_test_jtag_shift_ir(void)
+{
+	jtag_proc.jtagtap_tms_seq(0x3U, 4U);
+}
+
+/* From Exit1 through Update back to Run-Test/Idle */
+static void tap_sim_test_jtag_update(void)
+{
+	jtag_proc.jtagtap_tms_seq(0x1U, 2U);
+}
+
+static void tap_sim_test_jtag_idcode(void)
+{
+	tap_sim_test_jtag_connect(NULL);
+
+	/* Test-Logic-Reset selects IDCODE */
+	static const uint8_t tdi[4] = {0};
+	uint8_t tdo[4];
+	tap_sim_test_jtag_shift_dr();
+	jtag_proc.jtagtap_tdi_tdo_seq(tdo, true, tdi, 32U);
+	tap_sim_test_jtag_update();
+
+	uint32_t idcode;
+	memcpy(&idcode, tdo, sizeof(idcode));
+	CHECK(idcode == TAP_SIM_JTAG_ID);
+	CHECK(tap_sim_stats()->jtag_dr_scans == 1U);
+}
+
+static void tap_sim_test_jtag_chain(void)
+{
+	const tap_sim_config_s config = {
+		.taps = 3U,
+		.ir_len = {4U, 5U, 3U},
+		.idcode = {TAP_SIM_JTAG_ID, 0x0b12c477U, 0U},
+	};
+	tap_sim_test_jtag_connect(&config);
+
+	/* Each TAP's IDCODE, nearest TDO first, then the 1-bit BYPASS of the TAP without one, then TDI */
+	uint8_t ones[12];
+	uint8_t tdo[12];
+	memset(ones, 0xff, sizeof(ones));
+	tap_sim_test_jtag_shift_dr();
+	jtag_proc.jtagtap_tdi_tdo_seq(tdo, true, ones, 96U);
+	tap_sim_test_jtag_update();
+	uint32_t idcodes[2];
+	memcpy(idcodes, tdo, sizeof(idcodes));
+	CHECK(idcodes[0] == TAP_SIM_JTAG_ID);
+	CHECK(idcodes[1] == config.idcode[1]);
+	CHECK(tdo[8] == 0xfeU);
+
+	/* Every IR captures ...01, and all ones selects BYPASS on each of them */
+	uint8_t ir[2];
+	tap_sim_test_jtag_shift_ir();
+	jtag_proc.jtagtap_tdi_tdo_seq(ir, true, ones, 12U);
+	tap_sim_test_jtag_update();
+	CHECK((ir[0] | ((ir[1] & 0x0fU) << 8U)) == 0x211U);
+
+	/* Three TAPs in BYPASS delay TDI by three clocks */
+	static const uint8_t pattern = 0xa5U;
+	uint8_t delayed;
+	tap_sim_test_jtag_shift_dr();
+	jtag_proc.jtagtap_tdi_tdo_seq(&delayed, true, &pattern, 8U);
+	tap_sim_test_jtag_update();
+	CHECK(delayed == (uint8_t)(pattern << 3U));
+	CHECK(tap_sim_stats()->jtag_ir_scans == 1U);
+}
+
+static void tap_sim_test_jtag_throughput(void)
+{
+	tap_sim_test_jtag_connect(NULL);
+
+	static uint8_t tdi[TAP_SIM_TEST_JTAG_BITS / 8U];
+	static uint8_t tdo[TAP_SIM_TEST_JTAG_BITS / 8U];
+	for (size_t i = 0; i < sizeof(tdi); ++i)
+		tdi[i] = (uint8_t)(i * 37U);
+	tap_sim_test_jtag_shift_dr();
+
+	const uint32_t start = tap_sim_cycle_count();
+	const uint64_t clocks = tap_sim_stats()->clock_edges;
+	jtag_proc.jtagtap_tdi_tdo_seq(tdo, false, tdi, TAP_SIM_TEST_JTAG_BITS);
+	CHECK(tap_sim_stats()->clock_edges - clocks == TAP_SIM_TEST_JTAG_BITS);
+	tap_sim_test_cycles_per_clock(tap_sim_cycle_count() - start, TAP_SIM_TEST_JTAG_BITS, TAP_SIM_TEST_JTAG_PIN_CYCLES);
+
+	/* IDCODE comes out first, then what went in */
+	uint32_t idcode;
+	memcpy(&idcode, tdo, sizeof(idcode));
+	CHECK(idcode == TAP_SIM_JTAG_ID);
+	CHECK(memcmp(tdo + 4U, tdi, sizeof(tdi) - 4U) == 0);
+}
+
+static void tap_sim_test_bitstream_bits(void)
+{
+	uint8_t data[4] = {0};
+	tap_bitstream_set_bit(data, 11U, true);
+	tap_bitstream_set_bit(data, 30U, true);
+	CHECK(data[0] == 0x00U && data[1] == 0x08U && data[2] == 0x00U && data[3] == 0x40U);
+	CHECK(tap_bitstream_get_bit(data, 11U) && !tap_bitstream_get_bit(data, 10U) && tap_bitstream_get_bit(data, 30U));
+	tap_bitstream_set_bit(data, 11U, false);
+	CHECK(data[1] == 0x00U && data[3] == 0x40U);
+}
+
+/* Every pairing of aligned and unaligned offsets with whole and partial bytes */
+static const size_t tap_sim_test_bitstream_offsets[] = {0U, 3U, 8U, 13U};
+static const size_t tap_sim_test_bitstream_lengths[] = {1U, 7U, 8U, 9U, 17U, 31U};
+
+static void tap_sim_test_bitstream_encode(void)
+{
+	uint8_t src[8];
+	for (size_t i = 0; i < sizeof(src); ++i)
+		src[i] = (uint8_t)(i * 37U + 11U);
+
+	for (size_t i = 0; i < ARRAY_LENGTH(tap_sim_test_bitstream_offsets); ++i) {
+		for (size_t j = 0; j < ARRAY_LENGTH(tap_sim_test_bitstream_lengths); ++j) {
+			const size_t offset = tap_sim_test_bitstream_offsets[i];
+			const size_t bits = tap_sim_test_bitstream_lengths[j];
+			uint8_t dest[8];
+			memset(dest, 0xff, sizeof(dest));
+			const size_t bytes = tap_bitstream_encode(dest, src, offset, bits);
+			CHECK(bytes == TAP_BITSTREAM_BYTES(bits));
+
+			/* The sequence, then cleared tail bits, then bytes the encoder didn't write */
+			for (size_t bit = 0; bit < bytes * 8U; ++bit)
+				CHECK(tap_bitstream_get_bit(dest, bit) == (bit < bits && tap_bitstream_get_bit(src, offset + bit)));
+			for (size_t byte = bytes; byte < sizeof(dest); ++byte)
+				CHECK(dest[byte] == 0xffU);
+		}
+	}
+}
+
+static void tap_sim_test_bitstream_decode(void)
+{
+	uint8_t src[4];
+	for (size_t i = 0; i < sizeof(src); ++i)
+		src[i] = (uint8_t)(i * 91U + 5U);
+
+	for (size_t i = 0; i < ARRAY_LENGTH(tap_sim_test_bitstream_offsets); ++i) {
+		for (size_t j = 0; j < ARRAY_LENGTH(tap_sim_test_bitstream_lengths); ++j) {
+			const size_t offset = tap_sim_test_bitstream_offsets[i];
+			const size_t bits = tap_sim_test_bitstream_lengths[j];
+			uint8_t before[8];
+			uint8_t dest[8];
+			memset(before, 0x5a, sizeof(before));
+			memcpy(dest, before, sizeof(dest));
+			tap_bitstream_decode(dest, offset, src, bits);
+
+			/* Only the bits of the sequence change */
+			for (size_t bit = 0; bit < sizeof(dest) * 8U; ++bit) {
+				const bool inside = bit >= offset && bit < offset + bits;
+				const bool expected =
+					inside ? tap_bitstream_get_bit(src, bit - offset) : tap_bitstream_get_bit(before, bit);
+				CHECK(tap_bitstream_get_bit(dest, bit) == expected);
+			}
+		}
+	}
+}
+
+/* Shift a scan through the model in packed chunks the way the SPI path does, and unpack what comes back */
+static void tap_sim_test_bitstream_round_trip(void)
+{
+	tap_sim_test_jtag_connect(NULL);
+
+	uint8_t data_in[TAP_BITSTREAM_BYTES(TAP_SIM_TEST_BITSTREAM_BITS)];
+	uint8_t data_out[TAP_BITSTREAM_BYTES(TAP_SIM_TEST_BITSTREAM_BITS)];
+	for (size_t i = 0; i < sizeof(data_in); ++i)
+		data_in[i] = (uint8_t)(i * 53U + 29U);
+	memset(data_out, 0, sizeof(data_out));
+
+	tap_sim_test_jtag_shift_dr();
+	for (size_t offset = 0; offset < TAP_SIM_TEST_BITSTREAM_BITS; offset += TAP_SIM_TEST_BITSTREAM_CHUNK) {
+		const size_t remaining = TAP_SIM_TEST_BITSTREAM_BITS - offset;
+		const size_t bits = MIN(remaining, TAP_SIM_TEST_BITSTREAM_CHUNK);
+		uint8_t tx[TAP_BITSTREAM_BYTES(TAP_SIM_TEST_BITSTREAM_CHUNK)];
+		uint8_t rx[TAP_BITSTREAM_BYTES(TAP_SIM_TEST_BITSTREAM_CHUNK)];
+		tap_bitstream_encode(tx, data_in, offset, bits);
+		jtag_proc.jtagtap_tdi_tdo_seq(rx, bits == remaining, tx, bits);
+		tap_bitstream_decode(data_out, offset, rx, bits);
+	}
+	tap_sim_test_jtag_update();
+
+	/* IDCODE comes out first, then what went in */
+	uint32_t idcode;
+	memcpy(&idcode, data_out, sizeof(idcode));
+	CHECK(idcode == TAP_SIM_JTAG_ID);
+	for (size_t bit = 32U; bit < TAP_SIM_TEST_BITSTREAM_BITS; ++bit)
+		CHECK(tap_bitstream_get_bit(data_out, bit) == tap_bitstream_get_bit(data_in, bit - 32U));
+	CHECK(tap_sim_stats()->jtag_dr_scans == 1U);
+}
+
+int main(void)
+{
+	tap_sim_test_bitstream_bits();
+	tap_sim_test_bitstream_encode();
+	tap_sim_test_bitstream_decode();
+
+	/* Run everything both as fast as the tap goes and with a clock delay */
+	static const uint32_t delays[] = {0U, 4U};
+	for (size_t i = 0; i < ARRAY_LENGTH(delays); ++i) {
+		target_delay_cycles = delays[i];
+		tap_sim_test_dpidr();
+		tap_sim_test_memory();
+		tap_sim_test_wait();
+		tap_sim_test_fault();
+		tap_sim_test_raw_access();
+		tap_sim_test_parity();
+		tap_sim_test_swd_throughput();
+		tap_sim_test_jtag_idcode();
+		tap_sim_test_jtag_chain();
+		tap_sim_test_jtag_throughput();
+		tap_sim_test_bitstream_round_trip();
+	}
+
+	if (tap_sim_test_failures) {
+		fprintf(stderr, "%u checks failed\n", tap_sim_test_failures);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,749 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements the cycle-level target model used by host builds of the taps. */
+
+#include <string.h>
+
+#include "tap-sim.h"
+
+#define PIN_MASK(pin) (1U << (pin))
+
+/* SWD ACK encodings on the wire */
+#define SWD_ACK_OK    0x1U
+#define SWD_ACK_WAIT  0x2U
+#define SWD_ACK_FAULT 0x4U
+
+/* JTAG-DP ACK encodings captured by DPACC/APACC */
+#define JTAG_ACK_OK_FAULT 0x2U
+#define JTAG_ACK_WAIT     0x1U
+
+/* JTAG-DP instructions */
+#define JTAG_IR_ABORT  0x8U
+#define JTAG_IR_DPACC  0xaU
+#define JTAG_IR_APACC  0xbU
+#define JTAG_IR_IDCODE 0xeU
+
+#define DP_CTRLSTAT_STICKYORUN   (1U << 1U)
+#define DP_CTRLSTAT_STICKYERR    (1U << 5U)
+#define DP_CTRLSTAT_WDATAERR     (1U << 7U)
+#define DP_CTRLSTAT_CDBGPWRUPREQ (1U << 28U)
+#define DP_CTRLSTAT_CSYSPWRUPREQ (1U << 30U)
+#define DP_CTRLSTAT_STICKY_MASK  (DP_CTRLSTAT_STICKYORUN | DP_CTRLSTAT_STICKYERR | DP_CTRLSTAT_WDATAERR)
+
+#define DP_ABORT_STKCMPCLR  (1U << 1U)
+#define DP_ABORT_STKERRCLR  (1U << 2U)
+#define DP_ABORT_WDERRCLR   (1U << 3U)
+#define DP_ABORT_ORUNERRCLR (1U << 4U)
+
+#define AP_CSW_SIZE_MASK    0x7U
+#define AP_CSW_ADDRINC_MASK 0x30U
+#define AP_CSW_DEVICEEN     (1U << 6U)
+#define AP_CSW_ADDRINC_OFF  0x00U
+#define AP_BASE             0xe00ff003U
+
+/* SCS window holding CPUID, DHCSR and friends, backed by plain storage */
+#define SCS_BASE 0xe000e000U
+#define SCS_SIZE 0x1000U
+
+#define SWD_LINE_RESET_BITS 50U
+#define SWD_JTAG_TO_SWD     0xe79eU
+#define SWD_SWD_TO_JTAG     0xe73cU
+
+typedef enum swd_state {
+	SWD_LOCKOUT,
+	SWD_RESET,
+	SWD_IDLE,
+	SWD_HEADER,
+	SWD_TRN_ACK,
+	SWD_ACK,
+	SWD_RDATA,
+	SWD_TRN_WDATA,
+	SWD_WDATA,
+	SWD_TRN_END,
+} swd_state_e;
+
+typedef enum jtag_state {
+	JTAG_TEST_LOGIC_RESET,
+	JTAG_RUN_TEST_IDLE,
+	JTAG_SELECT_DR,
+	JTAG_CAPTURE_DR,
+	JTAG_SHIFT_DR,
+	JTAG_EXIT1_DR,
+	JTAG_PAUSE_DR,
+	JTAG_EXIT2_DR,
+	JTAG_UPDATE_DR,
+	JTAG_SELECT_IR,
+	JTAG_CAPTURE_IR,
+	JTAG_SHIFT_IR,
+	JTAG_EXIT1_IR,
+	JTAG_PAUSE_IR,
+	JTAG_EXIT2_IR,
+	JTAG_UPDATE_IR,
+} jtag_state_e;
+
+/* Next state for TMS low and TMS high */
+static const uint8_t jtag_next_state[16][2] = {
+	[JTAG_TEST_LOGIC_RESET] = {JTAG_RUN_TEST_IDLE, JTAG_TEST_LOGIC_RESET},
+	[JTAG_RUN_TEST_IDLE] = {JTAG_RUN_TEST_IDLE, JTAG_SELECT_DR},
+	[JTAG_SELECT_DR] = {JTAG_CAPTURE_DR, JTAG_SELECT_IR},
+	[JTAG_CAPTURE_DR] = {JTAG_SHIFT_DR, JTAG_EXIT1_DR},
+	[JTAG_SHIFT_DR] = {JTAG_SHIFT_DR, JTAG_EXIT1_DR},
+	[JTAG_EXIT1_DR] = {JTAG_PAUSE_DR, JTAG_UPDATE_DR},
+	[JTAG_PAUSE_DR] = {JTAG_PAUSE_DR, JTAG_EXIT2_DR},
+	[JTAG_EXIT2_DR] = {JTAG_SHIFT_DR, JTAG_UPDATE_DR},
+	[JTAG_UPDATE_DR] = {JTAG_RUN_TEST_IDLE, JTAG_SELECT_DR},
+	[JTAG_SELECT_IR] = {JTAG_CAPTURE_IR, JTAG_TEST_LOGIC_RESET},
+	[JTAG_CAPTURE_IR] = {JTAG_SHIFT_IR, JTAG_EXIT1_IR},
+	[JTAG_SHIFT_IR] = {JTAG_SHIFT_IR, JTAG_EXIT1_IR},
+	[JTAG_EXIT1_IR] = {JTAG_PAUSE_IR, JTAG_UPDATE_IR},
+	[JTAG_PAUSE_IR] = {JTAG_PAUSE_IR, JTAG_EXIT2_IR},
+	[JTAG_EXIT2_IR] = {JTAG_SHIFT_IR, JTAG_UPDATE_IR},
+	[JTAG_UPDATE_IR] = {JTAG_RUN_TEST_IDLE, JTAG_SELECT_DR},
+};
+
+typedef struct jtag_tap {
+	jtag_state_e state;
+	uint8_t ir_len;
+	uint32_t ir;
+	uint32_t ir_shift;
+	uint64_t dr_shift;
+	uint8_t dr_len;
+	uint32_t idcode;
+	bool tdo;
+} jtag_tap_s;
+
+typedef struct tap_sim {
+	tap_sim_config_s config;
+	tap_sim_stats_s stats;
+
+	/* Probe side of the wires */
+	uint32_t out;
+	uint32_t oe;
+
+	/* SW-DP wire state */
+	bool jtag_mode;
+	swd_state_e swd_state;
+	bool swd_drive;
+	bool swd_out;
+	uint32_t swd_ones;
+	uint32_t swd_since_reset;
+	uint16_t swd_history;
+	uint8_t swd_header;
+	uint8_t swd_bits;
+	uint8_t swd_ack;
+	uint32_t swd_data;
+	bool swd_parity;
+	uint32_t swd_reads;
+
+	/* JTAG chain, tap 0 is nearest TDO */
+	jtag_tap_s taps[TAP_SIM_MAX_TAPS];
+	uint32_t jtag_result;
+	uint8_t jtag_ack;
+
+	/* DP and MEM-AP */
+	uint32_t ctrlstat;
+	uint32_t select;
+	uint32_t rdbuff;
+	uint32_t csw;
+	uint32_t tar;
+	uint32_t ap_accesses;
+	bool wait_served;
+
+	uint8_t ram[TAP_SIM_RAM_SIZE];
+	uint8_t scs[SCS_SIZE];
+} tap_sim_s;
+
+static tap_sim_s sim;
+
+static bool tap_sim_parity(uint32_t value)
+{
+	return __builtin_parity(value);
+}
+
+/*
+ * Memory bus
+ */
+
+static uint8_t *tap_sim_bus_map(const uint32_t addr)
+{
+	if (addr - TAP_SIM_RAM_BASE < TAP_SIM_RAM_SIZE)
+		return &sim.ram[addr - TAP_SIM_RAM_BASE];
+	if (addr - SCS_BASE < SCS_SIZE)
+		return &sim.scs[addr - SCS_BASE];
+	return NULL;
+}
+
+/* Byte lanes follow the address, as on a real AHB-AP */
+static bool tap_sim_bus_read(const uint32_t addr, const size_t size, uint32_t *const value)
+{
+	const uint32_t aligned = addr & ~(uint32_t)(size - 1U);
+	const uint8_t *const mem = tap_sim_bus_map(aligned);
+	if (!mem)
+		return false;
+	uint32_t data = 0;
+	for (size_t i = 0; i < size; ++i)
+		data |= (uint32_t)mem[i] << ((((aligned & 3U) + i) & 3U) * 8U);
+	*value = data;
+	return true;
+}
+
+static bool tap_sim_bus_write(const uint32_t addr, const size_t size, const uint32_t value)
+{
+	const uint32_t aligned = addr & ~(uint32_t)(size - 1U);
+	uint8_t *const mem = tap_sim_bus_map(aligned);
+	if (!mem)
+		return false;
+	for (size_t i = 0; i < size; ++i)
+		mem[i] = value >> ((((aligned & 3U) + i) & 3U) * 8U);
+	return true;
+}
+
+/*
+ * MEM-AP and DP registers
+ */
+
+static size_t tap_sim_csw_size(void)
+{
+	switch (sim.csw & AP_CSW_SIZE_MASK) {
+	case 0:
+		return 1U;
+	case 1:
+		return 2U;
+	default:
+		return 4U;
+	}
+}
+
+static void tap_sim_drw_access(const bool rnw, uint32_t *const value)
+{
+	const size_t size = tap_sim_csw_size();
+	const bool ok = rnw ? tap_sim_bus_read(sim.tar, size, value) : tap_sim_bus_write(sim.tar, size, *value);
+	if (!ok) {
+		sim.ctrlstat |= DP_CTRLSTAT_STICKYERR;
+		if (rnw)
+			*value = 0;
+	}
+	/* Packed transfers are not modelled, they increment like single ones */
+	if ((sim.csw & AP_CSW_ADDRINC_MASK) != AP_CSW_ADDRINC_OFF)
+		sim.tar = (sim.tar & ~0x3ffU) | ((sim.tar + size) & 0x3ffU);
+}
+
+static void tap_sim_ap_access(const uint8_t addr, const bool rnw, uint32_t *const value)
+{
+	/* Only AP 0 exists */
+	if (sim.select >> 24U) {
+		if (rnw)
+			*value = 0;
+		return;
+	}
+
+	const uint8_t reg = (sim.select & 0xf0U) | (addr & 0x0cU);
+	switch (reg) {
+	case 0x00U:
+		if (rnw)
+			*value = sim.csw | AP_CSW_DEVICEEN;
+		else
+			sim.csw = *value;
+		break;
+	case 0x04U:
+		if (rnw)
+			*value = sim.tar;
+		else
+			sim.tar = *value;
+		break;
+	case 0x0cU:
+		tap_sim_drw_access(rnw, value);
+		break;
+	case 0x10U:
+	case 0x14U:
+	case 0x18U:
+	case 0x1cU: {
+		const uint32_t bd_addr = (sim.tar & ~0xfU) | (reg & 0xcU);
+		const bool ok = rnw ? tap_sim_bus_read(bd_addr, 4U, value) : tap_sim_bus_write(bd_addr, 4U, *value);
+		if (!ok) {
+			sim.ctrlstat |= DP_CTRLSTAT_STICKYERR;
+			if (rnw)
+				*value = 0;
+		}
+		break;
+	}
+	case 0xf8U:
+		if (rnw)
+			*value = AP_BASE;
+		break;
+	case 0xfcU:
+		if (rnw)
+			*value = TAP_SIM_AP_IDR;
+		break;
+	default:
+		if (rnw)
+			*value = 0;
+		break;
+	}
+}
+
+static void tap_sim_dp_abort(const uint32_t value)
+{
+	if (value & DP_ABORT_STKERRCLR)
+		sim.ctrlstat &= ~DP_CTRLSTAT_STICKYERR;
+	if (value & DP_ABORT_WDERRCLR)
+		sim.ctrlstat &= ~DP_CTRLSTAT_WDATAERR;
+	if (value & DP_ABORT_ORUNERRCLR)
+		sim.ctrlstat &= ~DP_CTRLSTAT_STICKYORUN;
+}
+
+static void tap_sim_dp_access(const uint8_t addr, const bool rnw, uint32_t *const value)
+{
+	switch (addr & 0x0cU) {
+	case 0x0U:
+		if (rnw)
+			*value = TAP_SIM_DPIDR;
+		else
+			tap_sim_dp_abort(*value);
+		break;
+	case 0x4U:
+		if (rnw) {
+			/* Power-up requests are acknowledged immediately */
+			const uint32_t reqs = sim.ctrlstat & (DP_CTRLSTAT_CDBGPWRUPREQ | DP_CTRLSTAT_CSYSPWRUPREQ);
+			*value = sim.ctrlstat | (reqs << 1U);
+		} else {
+			/* Over JTAG the sticky flags are write-one-to-clear */
+			if (sim.jtag_mode)
+				sim.ctrlstat &= ~(*value & DP_CTRLSTAT_STICKY_MASK);
+			sim.ctrlstat = (sim.ctrlstat & DP_CTRLSTAT_STICKY_MASK) | (*value & ~DP_CTRLSTAT_STICKY_MASK);
+		}
+		break;
+	case 0x8U:
+		if (rnw)
+			*value = sim.rdbuff; /* RESEND */
+		else
+			sim.select = *value;
+		break;
+	default:
+		if (rnw)
+			*value = sim.jtag_mode ? 0U : sim.rdbuff;
+		break;
+	}
+}
+
+/* Decide the response to an access before its data phase */
+static uint8_t tap_sim_dap_check(const bool ap)
+{
+	if (!ap)
+		return SWD_ACK_OK;
+	if (sim.config.wait_every && !sim.wait_served && ++sim.ap_accesses % sim.config.wait_every == 0) {
+		sim.wait_served = true;
+		return SWD_ACK_WAIT;
+	}
+	sim.wait_served = false;
+	if (sim.ctrlstat & DP_CTRLSTAT_STICKY_MASK)
+		return SWD_ACK_FAULT;
+	return SWD_ACK_OK;
+}
+
+static void tap_sim_dap_execute(const bool ap, const uint8_t addr, const bool rnw, uint32_t *const value)
+{
+	if (ap)
+		tap_sim_ap_access(addr, rnw, value);
+	else
+		tap_sim_dp_access(addr, rnw, value);
+}
+
+/*
+ * SW-DP wire protocol
+ */
+
+static void tap_sim_swd_header(void)
+{
+	const uint8_t header = sim.swd_header;
+	const bool parity = tap_sim_parity((header >> 1U) & 0xfU);
+	if (((header >> 5U) & 1U) != parity || (header & 0x40U) || !(header & 0x80U)) {
+		/* Protocol error: stop responding until the next line reset */
+		++sim.stats.swd_protocol_errors;
+		sim.swd_state = SWD_LOCKOUT;
+		return;
+	}
+
+	const bool ap = header & 0x02U;
+	const bool rnw = header & 0x04U;
+	const uint8_t addr = (header >> 1U) & 0x0cU;
+	++sim.stats.swd_transactions;
+
+	sim.swd_ack = tap_sim_dap_check(ap);
+	if (sim.swd_ack == SWD_ACK_WAIT)
+		++sim.stats.swd_waits;
+	else if (sim.swd_ack == SWD_ACK_FAULT)
+		++sim.stats.swd_faults;
+
+	if (sim.swd_ack == SWD_ACK_OK && rnw) {
+		uint32_t value = 0;
+		tap_sim_dap_execute(ap, addr, true, &value);
+		/* AP reads are posted: this read returns the previous one's data */
+		if (ap) {
+			sim.swd_data = sim.rdbuff;
+			sim.rdbuff = value;
+		} else
+			sim.swd_data = value;
+		sim.swd_parity = tap_sim_parity(sim.swd_data);
+		if (sim.config.parity_error_every && ++sim.swd_reads % sim.config.parity_error_every == 0)
+			sim.swd_parity = !sim.swd_parity;
+	}
+	sim.swd_state = SWD_TRN_ACK;
+}
+
+static void tap_sim_swd_rise(void)
+{
+	const bool host_drives = sim.oe & PIN_MASK(TAP_SIM_PIN_SWDIO_TMS);
+	const bool bit = sim.out & PIN_MASK(TAP_SIM_PIN_SWDIO_TMS);
+
+	if (host_drives) {
+		if (sim.swd_drive)
+			++sim.stats.bus_contention;
+		sim.swd_history = (sim.swd_history >> 1U) | (bit ? 0x8000U : 0U);
+		++sim.swd_since_reset;
+		sim.swd_ones = bit ? sim.swd_ones + 1U : 0U;
+		if (sim.swd_ones >= SWD_LINE_RESET_BITS) {
+			if (sim.swd_ones == SWD_LINE_RESET_BITS)
+				++sim.stats.swd_line_resets;
+			sim.swd_since_reset = 0;
+			sim.swd_drive = false;
+			sim.swd_state = SWD_RESET;
+			return;
+		}
+		if (sim.swd_since_reset == 16U && sim.swd_history == SWD_SWD_TO_JTAG) {
+			sim.jtag_mode = true;
+			for (size_t i = 0; i < TAP_SIM_MAX_TAPS; ++i)
+				sim.taps[i].state = JTAG_TEST_LOGIC_RESET;
+			return;
+		}
+	}
+
+	switch (sim.swd_state) {
+	case SWD_LOCKOUT:
+		break;
+	case SWD_RESET:
+		if (!bit)
+			sim.swd_state = SWD_IDLE;
+		break;
+	case SWD_IDLE:
+		if (bit) {
+			sim.swd_header = 1U;
+			sim.swd_bits = 1U;
+			sim.swd_state = SWD_HEADER;
+		}
+		break;
+	case SWD_HEADER:
+		sim.swd_header |= (uint8_t)(bit << sim.swd_bits);
+		if (++sim.swd_bits == 8U)
+			tap_sim_swd_header();
+		break;
+	case SWD_TRN_ACK:
+		/* Take the line and present the first ACK bit */
+		sim.swd_drive = true;
+		sim.swd_out = sim.swd_ack & 1U;
+		sim.swd_bits = 1U;
+		sim.swd_state = SWD_ACK;
+		break;
+	case SWD_ACK:
+		if (sim.swd_bits < 3U) {
+			sim.swd_out = (sim.swd_ack >> sim.swd_bits) & 1U;
+			++sim.swd_bits;
+		} else if (sim.swd_ack != SWD_ACK_OK) {
+			sim.swd_drive = false;
+			sim.swd_state = SWD_TRN_END;
+		} else if (sim.swd_header & 0x04U) {
+			sim.swd_out = sim.swd_data & 1U;
+			sim.swd_bits = 1U;
+			sim.swd_state = SWD_RDATA;
+		} else {
+			sim.swd_drive = false;
+			sim.swd_state = SWD_TRN_WDATA;
+		}
+		break;
+	case SWD_RDATA:
+		if (sim.swd_bits < 32U) {
+			sim.swd_out = (sim.swd_data >> sim.swd_bits) & 1U;
+			++sim.swd_bits;
+		} else if (sim.swd_bits == 32U) {
+			sim.swd_out = sim.swd_parity;
+			++sim.swd_bits;
+		} else {
+			sim.swd_drive = false;
+			sim.swd_state = SWD_TRN_END;
+		}
+		break;
+	case SWD_TRN_WDATA:
+		sim.swd_data = 0;
+		sim.swd_bits = 0;
+		sim.swd_state = SWD_WDATA;
+		break;
+	case SWD_WDATA:
+		if (sim.swd_bits < 32U) {
+			sim.swd_data |= (uint32_t)bit << sim.swd_bits;
+			++sim.swd_bits;
+			break;
+		}
+		if (bit != tap_sim_parity(sim.swd_data)) {
+			++sim.stats.swd_write_parity_errors;
+			sim.ctrlstat |= DP_CTRLSTAT_WDATAERR;
+		} else {
+			uint32_t value = sim.swd_data;
+			tap_sim_dap_execute(sim.swd_header & 0x02U, (sim.swd_header >> 1U) & 0x0cU, false, &value);
+		}
+		sim.swd_state = SWD_IDLE;
+		break;
+	case SWD_TRN_END:
+		sim.swd_state = SWD_IDLE;
+		break;
+	}
+}
+
+/*
+ * JTAG chain
+ */
+
+static bool tap_sim_is_dp(const jtag_tap_s *const tap)
+{
+	return tap == &sim.taps[0];
+}
+
+static void tap_sim_jtag_capture_dr(jtag_tap_s *const tap)
+{
+	const uint32_t bypass = (1U << tap->ir_len) - 1U;
+	if (tap->ir == bypass || (!tap_sim_is_dp(tap) && !tap->idcode)) {
+		tap->dr_shift = 0;
+		tap->dr_len = 1U;
+	} else if (!tap_sim_is_dp(tap) || tap->ir == JTAG_IR_IDCODE) {
+		tap->dr_shift = tap->idcode;
+		tap->dr_len = 32U;
+	} else if (tap->ir == JTAG_IR_DPACC || tap->ir == JTAG_IR_APACC || tap->ir == JTAG_IR_ABORT) {
+		tap->dr_shift = ((uint64_t)sim.jtag_result << 3U) | sim.jtag_ack;
+		tap->dr_len = 35U;
+	} else {
+		tap->dr_shift = 0;
+		tap->dr_len = 1U;
+	}
+}
+
+static void tap_sim_jtag_update_dr(jtag_tap_s *const tap)
+{
+	++sim.stats.jtag_dr_scans;
+	if (!tap_sim_is_dp(tap) || tap->dr_len != 35U)
+		return;
+
+	const bool rnw = tap->dr_shift & 1U;
+	const uint8_t addr = (tap->dr_shift << 1U) & 0x0cU;
+	uint32_t value = tap->dr_shift >> 3U;
+
+	if (tap->ir == JTAG_IR_ABORT) {
+		tap_sim_dp_abort(value);
+		return;
+	}
+
+	const bool ap = tap->ir == JTAG_IR_APACC;
+	const uint8_t ack = tap_sim_dap_check(ap);
+	if (ack == SWD_ACK_WAIT) {
+		sim.jtag_ack = JTAG_ACK_WAIT;
+		return;
+	}
+	sim.jtag_ack = JTAG_ACK_OK_FAULT;
+	/* There is no FAULT response over JTAG, the access is dropped and the sticky flag tells the story */
+	if (ack == SWD_ACK_FAULT)
+		return;
+	tap_sim_dap_execute(ap, addr, rnw, &value);
+	sim.jtag_result = rnw ? value : 0U;
+}
+
+static void tap_sim_jtag_tap_rise(jtag_tap_s *const tap, const bool tms, const bool tdi)
+{
+	switch (tap->state) {
+	case JTAG_TEST_LOGIC_RESET:
+		tap->ir = tap_sim_is_dp(tap) ? JTAG_IR_IDCODE : 0U;
+		break;
+	case JTAG_CAPTURE_DR:
+		tap_sim_jtag_capture_dr(tap);
+		break;
+	case JTAG_SHIFT_DR:
+		tap->dr_shift = (tap->dr_shift >> 1U) | ((uint64_t)tdi << (tap->dr_len - 1U));
+		break;
+	case JTAG_UPDATE_DR:
+		tap_sim_jtag_update_dr(tap);
+		break;
+	case JTAG_CAPTURE_IR:
+		tap->ir_shift = 1U;
+		break;
+	case JTAG_SHIFT_IR:
+		tap->ir_shift = (tap->ir_shift >> 1U) | ((uint32_t)tdi << (tap->ir_len - 1U));
+		break;
+	case JTAG_UPDATE_IR:
+		tap->ir = tap->ir_shift & ((1U << tap->ir_len) - 1U);
+		if (tap_sim_is_dp(tap))
+			++sim.stats.jtag_ir_scans;
+		break;
+	default:
+		break;
+	}
+	tap->state = jtag_next_state[tap->state][tms];
+}
+
+static void tap_sim_jtag_rise(void)
+{
+	const bool tms = sim.out & PIN_MASK(TAP_SIM_PIN_SWDIO_TMS);
+	const size_t count = sim.config.taps;
+	bool tdi[TAP_SIM_MAX_TAPS];
+
+	/* Latch every TAP's input before any of them shifts */
+	for (size_t i = 0; i < count; ++i)
+		tdi[i] = i + 1U == count ? (sim.out & PIN_MASK(TAP_SIM_PIN_TDI)) != 0 : sim.taps[i + 1U].tdo;
+	for (size_t i = 0; i < count; ++i)
+		tap_sim_jtag_tap_rise(&sim.taps[i], tms, tdi[i]);
+
+	/* Watch for the SWD select sequence too, TMS and SWDIO share a pin */
+	sim.swd_history = (sim.swd_history >> 1U) | (tms ? 0x8000U : 0U);
+	++sim.swd_since_reset;
+	sim.swd_ones = tms ? sim.swd_ones + 1U : 0U;
+	if (sim.swd_ones >= SWD_LINE_RESET_BITS)
+		sim.swd_since_reset = 0;
+	else if (sim.swd_since_reset == 16U && sim.swd_history == SWD_JTAG_TO_SWD) {
+		sim.jtag_mode = false;
+		sim.swd_state = SWD_LOCKOUT;
+	}
+}
+
+static void tap_sim_jtag_fall(void)
+{
+	for (size_t i = 0; i < sim.config.taps; ++i) {
+		jtag_tap_s *const tap = &sim.taps[i];
+		if (tap->state == JTAG_SHIFT_DR)
+			tap->tdo = tap->dr_shift & 1U;
+		else if (tap->state == JTAG_SHIFT_IR)
+			tap->tdo = tap->ir_shift & 1U;
+	}
+}
+
+/*
+ * Public interface
+ */
+
+void tap_sim_reset(const tap_sim_config_s *const config)
+{
+	/* Only the target is reset, the probe keeps driving whatever it was */
+	const uint32_t out = sim.out;
+	const uint32_t oe = sim.oe;
+	memset(&sim, 0, sizeof(sim));
+	sim.out = out;
+	sim.oe = oe;
+	if (config)
+		sim.config = *config;
+	if (!sim.config.taps || sim.config.taps > TAP_SIM_MAX_TAPS)
+		sim.config.taps = 1U;
+	if (!sim.config.ir_len[0])
+		sim.config.ir_len[0] = 4U;
+	if (!sim.config.idcode[0])
+		sim.config.idcode[0] = TAP_SIM_JTAG_ID;
+
+	for (size_t i = 0; i < sim.config.taps; ++i) {
+		jtag_tap_s *const tap = &sim.taps[i];
+		tap->ir_len = sim.config.ir_len[i] ? sim.config.ir_len[i] : 4U;
+		tap->idcode = sim.config.idcode[i];
+		tap->state = JTAG_TEST_LOGIC_RESET;
+		tap->ir = i ? 0U : JTAG_IR_IDCODE;
+		tap->tdo = true;
+	}
+
+	/* The SW-DP needs a line reset before it will talk */
+	sim.swd_state = SWD_LOCKOUT;
+	/* The SWD and TDO lines idle high through their pull-ups */
+	sim.taps[0].tdo = true;
+
+	const uint32_t cpuid = TAP_SIM_CPUID;
+	memcpy(&sim.scs[0xd00U], &cpuid, sizeof(cpuid));
+}
+
+void tap_sim_write(const uint32_t mask, const uint32_t value)
+{
+	const uint32_t previous = sim.out;
+	sim.out = (sim.out & ~mask) | (value & mask);
+	++sim.stats.cycles;
+
+	const uint32_t clk = PIN_MASK(TAP_SIM_PIN_SWCLK_TCK);
+	if (!(previous & clk) && (sim.out & clk)) {
+		++sim.stats.clock_edges;
+		if (sim.jtag_mode)
+			tap_sim_jtag_rise();
+		else
+			tap_sim_swd_rise();
+	} else if ((previous & clk) && !(sim.out & clk)) {
+		if (sim.jtag_mode)
+			tap_sim_jtag_fall();
+	}
+}
+
+uint32_t tap_sim_read_in(void)
+{
+	++sim.stats.cycles;
+	uint32_t in = sim.out & ~(PIN_MASK(TAP_SIM_PIN_SWDIO_TMS) | PIN_MASK(TAP_SIM_PIN_TDO));
+
+	bool swdio;
+	if (!sim.jtag_mode && sim.swd_drive)
+		swdio = sim.swd_out;
+	else if (sim.oe & PIN_MASK(TAP_SIM_PIN_SWDIO_TMS))
+		swdio = sim.out & PIN_MASK(TAP_SIM_PIN_SWDIO_TMS);
+	else
+		swdio = true;
+	if (swdio)
+		in |= PIN_MASK(TAP_SIM_PIN_SWDIO_TMS);
+
+	if (!sim.jtag_mode || sim.taps[0].tdo)
+		in |= PIN_MASK(TAP_SIM_PIN_TDO);
+	return in;
+}
+
+uint32_t tap_sim_read_out(void)
+{
+	++sim.stats.cycles;
+	return sim.out;
+}
+
+void tap_sim_output_enable(const uint32_t mask, const bool enable)
+{
+	if (enable)
+		sim.oe |= mask;
+	else
+		sim.oe &= ~mask;
+}
+
+void tap_sim_advance(const uint32_t cycles)
+{
+	sim.stats.cycles += cycles;
+}
+
+uint32_t tap_sim_cycle_count(void)
+{
+	return (uint32_t)sim.stats.cycles;
+}
+
+uint8_t *tap_sim_ram(void)
+{
+	return sim.ram;
+}
+
+const tap_sim_stats_s *tap_sim_stats(void)
+{
+	return &sim.stats;
+}
@@ -0,0 +1,94 @@
+#ifndef TAP_SIM_H_
+#define TAP_SIM_H_
+
+/*
+ * Cycle-level software model of the target side of the debug wires.
+ *
+ * This lets the bit-banged tap backends run on a Linux host. The headers in
+ * this directory stand in for the ESP-IDF ones. The dedicated GPIO
+ * accessors and the gpio_set()/gpio_get() macros drive the model's pins,
+ * and every SWCLK/TCK edge advances the model:
+ *
+ *  - an ADIv5 SW-DP with line reset, lockout after protocol errors, WAIT
+ *    and FAULT responses, sticky errors and posted AP reads,
+ *  - a JTAG chain whose first TAP is an ARM JTAG-DP (DPACC/APACC) sharing
+ *    the same DP, followed by optional TAPs offering only IDCODE and BYPASS,
+ *  - a MEM-AP with byte/halfword/word accesses, TAR auto-increment that
+ *    wraps at 1 KiB like real hardware, and a RAM region.
+ *
+ * Host time is virtual. Each pin access costs one cycle and each
+ * platform_clk_delay() costs target_delay_cycles, so esp_cpu_get_cycle_count()
+ * measures the kernels themselves rather than the host they run on.
+ *
+ * CMakeLists.txt in this directory builds tap-sim-test.c twice under ctest:
+ * tap_sim_dedic links swdptap-dedic.c, jtagtap-dedic.c and tap-bitstream.c,
+ * and tap_sim_gpio links swdptap-gpio.c and jtagtap-gpio.c. Both link the
+ * real swd-transfer.c and exception.c. tap-sim-host.c stands in for
+ * gpio-dedic.c, platform timing and the few BMP functions those files call.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Pin numbers double as bit positions, matching the dedicated GPIO bundle layout */
+#define TAP_SIM_PIN_SWDIO_TMS 0U
+#define TAP_SIM_PIN_SWCLK_TCK 1U
+#define TAP_SIM_PIN_TDO       2U
+#define TAP_SIM_PIN_TDI       3U
+
+#define TAP_SIM_MAX_TAPS 4U
+
+#define TAP_SIM_DPIDR    0x2ba01477U
+#define TAP_SIM_JTAG_ID  0x4ba00477U
+#define TAP_SIM_AP_IDR   0x24770011U
+#define TAP_SIM_CPUID    0x410fc241U
+#define TAP_SIM_RAM_BASE 0x20000000U
+#define TAP_SIM_RAM_SIZE 0x10000U
+
+typedef struct tap_sim_config {
+	/* Number of TAPs in the JTAG chain, the first is always the JTAG-DP */
+	size_t taps;
+	uint8_t ir_len[TAP_SIM_MAX_TAPS];
+	uint32_t idcode[TAP_SIM_MAX_TAPS];
+	/* Answer every Nth AP access with WAIT once, 0 to disable */
+	uint32_t wait_every;
+	/* Corrupt the parity bit of every Nth SWD read, 0 to disable */
+	uint32_t parity_error_every;
+} tap_sim_config_s;
+
+typedef struct tap_sim_stats {
+	uint64_t cycles;
+	uint64_t clock_edges;
+	uint32_t swd_transactions;
+	uint32_t swd_waits;
+	uint32_t swd_faults;
+	uint32_t swd_protocol_errors;
+	uint32_t swd_write_parity_errors;
+	uint32_t swd_line_resets;
+	uint32_t jtag_dr_scans;
+	uint32_t jtag_ir_scans;
+	uint32_t bus_contention;
+} tap_sim_stats_s;
+
+/*
+ * Reset the target side of the model, all counters and RAM. The probe side
+ * of the pins is left as it is. `config` may be NULL for a single JTAG-DP.
+ */
+void tap_sim_reset(const tap_sim_config_s *config);
+
+/* Pin interface, in dedicated GPIO bundle bit layout */
+void tap_sim_write(uint32_t mask, uint32_t value);
+uint32_t tap_sim_read_in(void);
+uint32_t tap_sim_read_out(void);
+void tap_sim_output_enable(uint32_t mask, bool enable);
+
+/* Virtual time */
+void tap_sim_advance(uint32_t cycles);
+uint32_t tap_sim_cycle_count(void);
+
+/* Backdoor access to target memory and counters for checking results */
+uint8_t *tap_sim_ram(void);
+const tap_sim_stats_s *tap_sim_stats(void);
+
+#endif /* TAP_SIM_H_ */
@@ -0,0 +1,65 @@
+#ifndef SWD_GANG_H_
+#define SWD_GANG_H_
+
+#include "general.h"
+
+/*
+ * Gang programming: extra SWDIO lines that share SWCLK with the primary one.
+ *
+ * While gang mode is on, every bit driven on SWDIO goes out on all lanes in
+ * the same clock cycle, so identical targets see identical sequences. BMP
+ * only ever talks to the target on the primary lane; every bit read back is
+ * also sampled on the other lanes, and each lane's ACK and data are compared
+ * with the primary lane's at the end of the transfer. A lane whose ACK
+ * differs, for a read or a write, has fallen out of lockstep: a WAIT on one
+ * board only is enough, as that board then reads the next bits differently
+ * from the others. It is dropped at the next turnaround and left floating.
+ * Read data that differs after an OK on both, such as a status poll that
+ * finishes sooner on one board, is only counted.
+ *
+ * Lanes are numbered from 0, the primary SWDIO.
+ */
+
+#if SWDPTAP_MODE_DEDIC == 1
+#include "gpio-dedic.h"
+#else
+#define GANG_SWDIO_LANES 0
+#endif
+
+#define SWD_GANG_LANES (GANG_SWDIO_LANES + 1)
+
+typedef struct swd_gang_status {
+	bool enabled;
+	/* Bitmask of lanes still in lockstep, bit 0 is the primary lane */
+	uint8_t active;
+	/* Bitmask of lanes that have fallen out of lockstep since gang mode was turned on */
+	uint8_t dropped;
+	/* SWD transactions since gang mode was turned on */
+	uint32_t transfers;
+	/* Value of `transfers` when each lane was dropped */
+	uint32_t dropped_at[SWD_GANG_LANES];
+	/* Reads where each lane ACKed OK with the primary lane but returned different data */
+	uint32_t read_mismatches[SWD_GANG_LANES];
+} swd_gang_status_s;
+
+#if GANG_SWDIO_LANES > 0
+
+/* Start driving every lane in lockstep, or float the extra lanes again */
+void swd_gang_enable(bool enable);
+void swd_gang_status(swd_gang_status_s *status);
+
+#else
+
+static inline void swd_gang_enable(const bool enable)
+{
+	(void)enable;
+}
+
+static inline void swd_gang_status(swd_gang_status_s *const status)
+{
+	*status = (swd_gang_status_s){.active = 1U};
+}
+
+#endif /* GANG_SWDIO_LANES > 0 */
+
+#endif /* SWD_GANG_H_ */
@@ -0,0 +1,356 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements batched SW-DP accesses on top of swdptap_transfer().
+ *
+ * Callers build a list of DP/AP reads and writes and run them in a single
+ * flush. The posted-read pipeline of the AP is tracked while the list is
+ * built so that every result pointer receives the data that belongs to it.
+ */
+
+#include "general.h"
+#include "adiv5.h"
+#include "exception.h"
+#include "swd-queue.h"
+#include "swd-transfer.h"
+#include "timing.h"
+#include "wire-engine.h"
+
+/* Address auto-increment is only guaranteed within a 1kiB block */
+#define SWD_QUEUE_TAR_WRAP 0x400U
+
+static bool swd_queue_append(swd_queue_s *const queue, const uint8_t rnw, const uint16_t addr, const uint32_t value,
+	uint32_t *const result)
+{
+	if (queue->count >= SWD_QUEUE_DEPTH)
+		return false;
+	swd_queue_entry_s *const entry = &queue->entries[queue->count++];
+	entry->request = swdptap_make_request(rnw, addr);
+	entry->value = value;
+	entry->result = result;
+	return true;
+}
+
+/* Collect the data of a posted AP read before anything else touches the DP */
+static bool swd_queue_drain(swd_queue_s *const queue)
+{
+	if (!queue->posted)
+		return true;
+	if (!swd_queue_append(queue, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0U, queue->posted))
+		return false;
+	queue->posted = NULL;
+	return true;
+}
+
+void swd_queue_init(swd_queue_s *const queue, adiv5_debug_port_s *const dp)
+{
+	queue->dp = dp;
+	queue->count = 0U;
+	queue->posted = NULL;
+}
+
+size_t swd_queue_space(const swd_queue_s *const queue)
+{
+	return SWD_QUEUE_DEPTH - queue->count - 1U;
+}
+
+bool swd_queue_read(swd_queue_s *const queue, const uint16_t addr, uint32_t *const result)
+{
+	if (!(addr & ADIV5_APnDP)) {
+		if (!swd_queue_drain(queue))
+			return false;
+		return swd_queue_append(queue, ADIV5_LOW_READ, addr, 0U, result);
+	}
+
+	/* This read returns the data of the previous AP read, if any */
+	if (!swd_queue_append(queue, ADIV5_LOW_READ, addr, 0U, queue->posted))
+		return false;
+	queue->posted = result;
+	return true;
+}
+
+bool swd_queue_write(swd_queue_s *const queue, const uint16_t addr, const uint32_t value)
+{
+	if (!swd_queue_drain(queue))
+		return false;
+	return swd_queue_append(queue, ADIV5_LOW_WRITE, addr, value, NULL);
+}
+
+/* Runs on the wire engine, so it only records the outcome and leaves the error handling to the caller */
+static void swd_queue_run(void *const arg)
+{
+	swd_queue_s *const queue = (swd_queue_s *)arg;
+	uint8_t ack = SWD_ACK_OK;
+	size_t idx = 0;
+
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, 250U);
+	while (idx < queue->count) {
+		const swd_queue_entry_s *const entry = &queue->entries[idx];
+		uint32_t data = entry->value;
+		/* Only the last transfer needs the idle cycles that flush the DP pipeline */
+		const size_t idle_cycles = idx + 1U == queue->count ? 8U : 0U;
+		ack = swdptap_transfer(entry->request, &data, idle_cycles);
+
+		if (ack == SWD_ACK_OK) {
+			if (entry->result)
+				*entry->result = data;
+			++idx;
+			continue;
+		}
+
+		/* A WAIT leaves the DP untouched, so replay the same entry */
+		if (ack == SWD_ACK_WAIT && !platform_timeout_is_expired(&timeout))
+			continue;
+		break;
+	}
+
+	queue->ack = ack;
+	queue->completed = idx;
+}
+
+void swd_queue_submit(swd_queue_s *const queue)
+{
+	if (!swd_queue_drain(queue)) {
+		/* swd_queue_space() keeps a slot free for this, so only misuse ends up here */
+		queue->count = 0U;
+		raise_exception(EXCEPTION_ERROR, "SWD queue overflow");
+	}
+	queue->ticket = wire_engine_submit(swd_queue_run, queue);
+}
+
+uint8_t swd_queue_complete(swd_queue_s *const queue)
+{
+	adiv5_debug_port_s *const dp = queue->dp;
+	wire_engine_wait(queue->ticket);
+
+	const uint8_t ack = queue->ack;
+	const size_t idx = queue->completed;
+	queue->count = 0U;
+	if (ack == SWD_ACK_OK)
+		return ack;
+
+	if (ack == SWD_ACK_WAIT) {
+		DEBUG_ERROR("SWD queue entry %zu resulted in wait, aborting\n", idx);
+		dp->abort(dp, ADIV5_DP_ABORT_DAPABORT);
+		dp->fault = ack;
+		return ack;
+	}
+	if (ack == SWD_ACK_FAULT || ack == SWD_ACK_NO_RESPONSE) {
+		DEBUG_ERROR("SWD queue entry %zu resulted in %s\n", idx, ack == SWD_ACK_FAULT ? "fault" : "no response");
+		dp->fault = ack;
+		return ack;
+	}
+	if (ack & SWD_TRANSFER_PARITY_ERROR) {
+		dp->fault = 1U;
+		DEBUG_ERROR("SWD queue entry %zu resulted in parity error\n", idx);
+		raise_exception(EXCEPTION_ERROR, "SWD parity error");
+	}
+	DEBUG_ERROR("SWD queue entry %zu has invalid ack %x\n", idx, ack);
+	raise_exception(EXCEPTION_ERROR, "SWD invalid ACK");
+}
+
+uint8_t swd_queue_flush(swd_queue_s *const queue)
+{
+	swd_queue_submit(queue);
+	return swd_queue_complete(queue);
+}
+
+#if SWDPTAP_HAS_TRANSFER == 1
+
+/* SW-DPs that can be on the bus at once, as with multi-drop */
+#define SWD_QUEUE_PORTS 4U
+
+typedef void (*swd_queue_mem_read_t)(adiv5_access_port_s *ap, void *dest, target_addr_t src, size_t len);
+
+/* A DP routed through the queue, and the accessor it had before */
+typedef struct swd_queue_port {
+	adiv5_debug_port_s *dp;
+	swd_queue_mem_read_t fallback_mem_read;
+} swd_queue_port_s;
+
+static swd_queue_port_s swd_queue_ports[SWD_QUEUE_PORTS];
+/* Entries are reused oldest first, as the oldest DP is the one most likely freed by a rescan */
+static size_t swd_queue_next_port;
+static const swd_queue_port_s *swd_queue_newest_port;
+
+/*
+ * Guarded by the BMP core lock, and too large to live on the GDB task stack.
+ * Two of each so one chunk can be built while the other is on the wire.
+ */
+static swd_queue_s swd_queue_mem[2];
+static uint32_t swd_queue_words[2][SWD_QUEUE_DEPTH];
+
+/* Queue a read of as many words as fit from `addr`, returning the number queued */
+static size_t swd_queue_mem_chunk(
+	swd_queue_s *const queue, uint32_t *const words, const target_addr_t addr, const size_t remaining)
+{
+	/* Each chunk rewrites TAR, so it must not cross an auto-increment boundary */
+	const size_t to_wrap = (SWD_QUEUE_TAR_WRAP - (addr & (SWD_QUEUE_TAR_WRAP - 1U))) >> 2U;
+	size_t count = swd_queue_space(queue) - 1U;
+	if (count > to_wrap)
+		count = to_wrap;
+	if (count > remaining)
+		count = remaining;
+
+	swd_queue_write(queue, ADIV5_AP_TAR, addr);
+	for (size_t idx = 0; idx < count; ++idx)
+		swd_queue_read(queue, ADIV5_AP_DRW, &words[idx]);
+	return count;
+}
+
+/* Read `remaining` words from `addr` through the queues swd_queue_mem_read() set up */
+static void swd_queue_mem_pipeline(uint8_t *data, target_addr_t addr, size_t remaining)
+{
+	size_t slot = 0U;
+	size_t words = swd_queue_mem_chunk(&swd_queue_mem[0], swd_queue_words[0], addr, remaining);
+	swd_queue_submit(&swd_queue_mem[0]);
+	addr += words << 2U;
+	remaining -= words;
+
+	/* Build the next chunk while this one is on the wire, then copy this one out while the next runs */
+	for (;;) {
+		const size_t next_slot = slot ^ 1U;
+		size_t next_words = 0U;
+		if (remaining)
+			next_words = swd_queue_mem_chunk(&swd_queue_mem[next_slot], swd_queue_words[next_slot], addr, remaining);
+
+		if (swd_queue_complete(&swd_queue_mem[slot]) != SWD_ACK_OK)
+			return;
+		if (next_words)
+			swd_queue_submit(&swd_queue_mem[next_slot]);
+
+		memcpy(data, swd_queue_words[slot], words << 2U);
+		data += words << 2U;
+		if (!next_words)
+			return;
+
+		addr += next_words << 2U;
+		remaining -= next_words;
+		words = next_words;
+		slot = next_slot;
+	}
+}
+
+static swd_queue_port_s *swd_queue_port(const adiv5_debug_port_s *const dp)
+{
+	for (size_t idx = 0; idx < SWD_QUEUE_PORTS; ++idx) {
+		if (swd_queue_ports[idx].dp == dp)
+			return &swd_queue_ports[idx];
+	}
+	return NULL;
+}
+
+static void swd_queue_mem_read(
+	adiv5_access_port_s *const ap, void *const dest, const target_addr_t src, const size_t len)
+{
+	adiv5_debug_port_s *const dp = ap->dp;
+	const swd_queue_port_s *port = swd_queue_port(dp);
+	/* Only whole, aligned words on a DP the queue knows take the batched path */
+	if (!port || (src & 3U) || (len & 3U) || !len) {
+		/*
+		 * A DP that lost its entry to a newer one still points here. Every
+		 * SW-DP starts out with the same stock accessor, so use the newest.
+		 */
+		if (!port)
+			port = swd_queue_newest_port;
+		port->fallback_mem_read(ap, dest, src, len);
+		return;
+	}
+	if (dp->fault)
+		return;
+
+	swd_queue_init(&swd_queue_mem[0], dp);
+	swd_queue_init(&swd_queue_mem[1], dp);
+	swd_queue_write(&swd_queue_mem[0], ADIV5_DP_SELECT, ((uint32_t)ap->apsel << 24U) | (ADIV5_AP_DRW & 0xf0U));
+	swd_queue_write(
+		&swd_queue_mem[0], ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD | ADIV5_AP_CSW_ADDRINC_SINGLE);
+
+	/*
+	 * A chunk may still be on the wire when something raises, and the wire
+	 * engine stays ours until it completes, so wait for it before unwinding
+	 */
+	TRY(EXCEPTION_ALL)
+	{
+		swd_queue_mem_pipeline((uint8_t *)dest, src, len >> 2U);
+	}
+	CATCH()
+	{
+	default:
+		wire_engine_drain();
+		raise_exception(exception_frame.type, exception_frame.msg);
+	}
+}
+
+bool swd_queue_mem_write_words(adiv5_access_port_s *const ap, const target_addr_t *const addrs,
+	const uint32_t *const values, const size_t count)
+{
+	adiv5_debug_port_s *const dp = ap->dp;
+	/* SELECT, CSW and the closing RDBUFF read, then TAR and DRW for each word */
+	if (!swd_queue_port(dp) || count > (SWD_QUEUE_DEPTH - 3U) / 2U)
+		return false;
+	if (dp->fault || !count)
+		return true;
+
+	swd_queue_s *const queue = &swd_queue_mem[0];
+	swd_queue_init(queue, dp);
+	swd_queue_write(queue, ADIV5_DP_SELECT, ((uint32_t)ap->apsel << 24U) | (ADIV5_AP_DRW & 0xf0U));
+	swd_queue_write(queue, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD | ADIV5_AP_CSW_ADDRINC_SINGLE);
+	for (size_t idx = 0; idx < count; ++idx) {
+		swd_queue_write(queue, ADIV5_AP_TAR, addrs[idx]);
+		swd_queue_write(queue, ADIV5_AP_DRW, values[idx]);
+	}
+	/* The last write is posted, reading RDBUFF makes sure it landed */
+	swd_queue_read(queue, ADIV5_DP_RDBUFF, NULL);
+	swd_queue_flush(queue);
+	return true;
+}
+
+void swd_queue_install(adiv5_debug_port_s *const dp)
+{
+	if (!dp || dp->mem_read == swd_queue_mem_read)
+		return;
+	/* The same address again is a new DP allocated where a freed one was */
+	swd_queue_port_s *port = swd_queue_port(dp);
+	if (!port) {
+		port = &swd_queue_ports[swd_queue_next_port];
+		swd_queue_next_port = (swd_queue_next_port + 1U) % SWD_QUEUE_PORTS;
+	}
+	port->dp = dp;
+	port->fallback_mem_read = dp->mem_read;
+	swd_queue_newest_port = port;
+	dp->mem_read = swd_queue_mem_read;
+}
+
+#else
+
+bool swd_queue_mem_write_words(adiv5_access_port_s *const ap, const target_addr_t *const addrs,
+	const uint32_t *const values, const size_t count)
+{
+	(void)ap;
+	(void)addrs;
+	(void)values;
+	(void)count;
+	return false;
+}
+
+void swd_queue_install(adiv5_debug_port_s *const dp)
+{
+	(void)dp;
+}
+
+#endif /* SWDPTAP_HAS_TRANSFER == 1 */
@@ -0,0 +1,72 @@
+#ifndef SWD_QUEUE_H_
+#define SWD_QUEUE_H_
+
+#include "general.h"
+#include "adiv5.h"
+
+/* Maximum number of transfers that can be batched before a flush is required */
+#define SWD_QUEUE_DEPTH 64U
+
+typedef struct swd_queue_entry {
+	uint8_t request;
+	uint32_t value;
+	/* Where the data clocked in by this transfer goes, or NULL to discard it */
+	uint32_t *result;
+} swd_queue_entry_s;
+
+typedef struct swd_queue {
+	adiv5_debug_port_s *dp;
+	swd_queue_entry_s entries[SWD_QUEUE_DEPTH];
+	size_t count;
+	/* Destination of the AP read whose data is still posted in the DP */
+	uint32_t *posted;
+	/* Outcome of the last run on the wire engine: final ACK and entries completed */
+	uint8_t ack;
+	size_t completed;
+	uint32_t ticket;
+} swd_queue_s;
+
+void swd_queue_init(swd_queue_s *queue, adiv5_debug_port_s *dp);
+
+/*
+ * Append a DP or AP access to the queue. AP reads are posted: the data for
+ * an AP read arrives with the next AP read or with the RDBUFF read that the
+ * queue inserts automatically, so `result` is only valid after a successful
+ * swd_queue_flush(). Returns false if the queue is full.
+ */
+bool swd_queue_read(swd_queue_s *queue, uint16_t addr, uint32_t *result);
+bool swd_queue_write(swd_queue_s *queue, uint16_t addr, uint32_t value);
+
+/* Number of entries that can still be queued, keeping room for the final RDBUFF read */
+size_t swd_queue_space(const swd_queue_s *queue);
+
+/*
+ * Clock out every queued transfer back-to-back. WAIT responses are retried
+ * from the entry that stalled, FAULT and timeouts stop the batch and latch
+ * dp->fault. Returns the ACK of the last transfer run, SWD_ACK_OK on success.
+ * The queue is empty afterwards regardless of the outcome.
+ */
+uint8_t swd_queue_flush(swd_queue_s *queue);
+
+/*
+ * swd_queue_flush() in two halves, so the caller can get on with something
+ * else while the wire engine clocks the queue out. Nothing may touch the
+ * queue or its result pointers in between, and no other queue may be
+ * submitted until this one has completed.
+ */
+void swd_queue_submit(swd_queue_s *queue);
+uint8_t swd_queue_complete(swd_queue_s *queue);
+
+/*
+ * Write `count` words to scattered, aligned addresses through `ap` in one
+ * flush. Returns false without writing anything if `ap` is not on a DP that
+ * swd_queue_install() was given, or there are too many words for one flush.
+ * Errors latch dp->fault as with any other access.
+ */
+bool swd_queue_mem_write_words(
+	adiv5_access_port_s *ap, const target_addr_t *addrs, const uint32_t *values, size_t count);
+
+/* Route aligned word block reads on `dp` through the queue. Each DP keeps its own place in it. */
+void swd_queue_install(adiv5_debug_port_s *dp);
+
+#endif /* SWD_QUEUE_H_ */
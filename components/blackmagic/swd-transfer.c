@@ -0,0 +1,138 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2011  Black Sphere Technologies Ltd.
+ * Written by Gareth McMullin <gareth@blacksphere.co.nz>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements ADIv5 SW-DP low-level access on top of the fused
+ * single-call transfer kernel provided by the tap backend.
+ */
+
+#include "general.h"
+#include "adiv5.h"
+#include "cortexm.h"
+#include "exception.h"
+#include "maths_utils.h"
+#include "swd-queue.h"
+#include "swd-transfer.h"
+#include "timing.h"
+#include "wire-engine.h"
+
+uint8_t swdptap_make_request(const uint8_t rnw, const uint16_t addr)
+{
+	uint8_t request = SWD_REQUEST_START | SWD_REQUEST_PARK;
+	if (addr & ADIV5_APnDP)
+		request |= SWD_REQUEST_APNDP;
+	if (rnw)
+		request |= SWD_REQUEST_RNW;
+	request |= (addr << 1U) & SWD_REQUEST_ADDR;
+	if (calculate_odd_parity(request & (SWD_REQUEST_APNDP | SWD_REQUEST_RNW | SWD_REQUEST_ADDR)))
+		request |= SWD_REQUEST_PARITY;
+	return request;
+}
+
+#if SWDPTAP_HAS_TRANSFER == 1
+
+typedef struct swdptap_access {
+	uint8_t request;
+	uint8_t ack;
+	uint32_t value;
+	uint32_t data;
+} swdptap_access_s;
+
+/* Runs on the wire engine, retrying WAITs there rather than bouncing each one back to the caller */
+static void swdptap_access_run(void *const arg)
+{
+	swdptap_access_s *const access = (swdptap_access_s *)arg;
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, 250U);
+	do {
+		access->data = access->value;
+		access->ack = swdptap_transfer(access->request, &access->data, 8U);
+	} while (access->ack == SWD_ACK_WAIT && !platform_timeout_is_expired(&timeout));
+}
+
+uint32_t swdptap_raw_access(adiv5_debug_port_s *const dp, const uint8_t rnw, const uint16_t addr, const uint32_t value)
+{
+	if ((addr & ADIV5_APnDP) && dp->fault)
+		return 0;
+
+	swdptap_access_s access = {
+		.request = swdptap_make_request(rnw, addr),
+		.value = value,
+	};
+	wire_engine_call(swdptap_access_run, &access);
+	const uint8_t ack = access.ack;
+	const uint32_t data = access.data;
+
+	if (ack == SWD_ACK_WAIT) {
+		DEBUG_ERROR("SWD access resulted in wait, aborting\n");
+		dp->abort(dp, ADIV5_DP_ABORT_DAPABORT);
+		dp->fault = ack;
+		return 0;
+	}
+
+	if (ack == SWD_ACK_FAULT) {
+		DEBUG_ERROR("SWD access resulted in fault\n");
+		dp->fault = ack;
+		return 0;
+	}
+
+	if (ack == SWD_ACK_NO_RESPONSE) {
+		DEBUG_ERROR("SWD access resulted in no response\n");
+		dp->fault = ack;
+		return 0;
+	}
+
+	if (ack & SWD_TRANSFER_PARITY_ERROR) {
+		dp->fault = 1U;
+		DEBUG_ERROR("SWD access resulted in parity error\n");
+		raise_exception(EXCEPTION_ERROR, "SWD parity error");
+	}
+
+	if (ack != SWD_ACK_OK) {
+		DEBUG_ERROR("SWD access has invalid ack %x\n", ack);
+		raise_exception(EXCEPTION_ERROR, "SWD invalid ACK");
+	}
+
+	return rnw ? data : 0;
+}
+
+void swdptap_transfer_install(target_s *const target)
+{
+	if (!target || !target_is_cortexm(target))
+		return;
+
+	adiv5_access_port_s *const ap = cortexm_ap(target);
+	if (!ap || !ap->dp)
+		return;
+
+	/* Only replace the stock SW-DP accessor, leave JTAG-DP alone */
+	if (ap->dp->low_access == adiv5_swd_raw_access)
+		ap->dp->low_access = swdptap_raw_access;
+	if (ap->dp->low_access == swdptap_raw_access)
+		swd_queue_install(ap->dp);
+}
+
+#else
+
+void swdptap_transfer_install(target_s *const target)
+{
+	(void)target;
+}
+
+#endif /* SWDPTAP_HAS_TRANSFER == 1 */
@@ -0,0 +1,41 @@
+#ifndef SWD_TRANSFER_H_
+#define SWD_TRANSFER_H_
+
+#include "general.h"
+#include "adiv5.h"
+#include "target.h"
+
+/* Bits of the 8-bit SWD request header */
+#define SWD_REQUEST_START  0x01U
+#define SWD_REQUEST_APNDP  0x02U
+#define SWD_REQUEST_RNW    0x04U
+#define SWD_REQUEST_ADDR   0x18U
+#define SWD_REQUEST_PARITY 0x20U
+#define SWD_REQUEST_PARK   0x80U
+
+/* Or'd into the ACK returned by swdptap_transfer() when a read fails its parity check */
+#define SWD_TRANSFER_PARITY_ERROR 0x08U
+
+/* Whether the active tap backend provides a fused transfer kernel */
+#if SWDPTAP_MODE_DEDIC == 1 || SWDPTAP_MODE_GPIO == 1
+#define SWDPTAP_HAS_TRANSFER 1
+#else
+#define SWDPTAP_HAS_TRANSFER 0
+#endif
+
+/*
+ * Run one complete SWD transaction: request header, turnaround, ACK, data
+ * and parity, followed by `idle_cycles` idle clocks if the target responded
+ * with OK. For reads the result is stored in `data`, for writes `data` is
+ * the value to send. Returns the 3-bit ACK. Only call this on the wire
+ * engine, see wire-engine.h.
+ */
+uint8_t swdptap_transfer(uint8_t request, uint32_t *data, size_t idle_cycles);
+
+uint8_t swdptap_make_request(uint8_t rnw, uint16_t addr);
+uint32_t swdptap_raw_access(adiv5_debug_port_s *dp, uint8_t rnw, uint16_t addr, uint32_t value);
+
+/* Point the DP behind `target` at the fused kernel, if this is an SWD target */
+void swdptap_transfer_install(target_s *target);
+
+#endif /* SWD_TRANSFER_H_ */
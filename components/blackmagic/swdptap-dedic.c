@@ -23,11 +23,17 @@
 #define DEBUG_SWD_TRANSACTIONS
 /* This file implements the SW-DP interface. */
 
+#include <string.h>
+
 #include "adiv5.h"
 #include "general.h"
 #include "platform.h"
 #include "timing.h"
 #include "maths_utils.h"
+#include "swd-gang.h"
+#include "swd-transfer.h"
+#include "wire-engine.h"
+#include "wire-trace.h"
 
 #if SWDPTAP_MODE_DEDIC == 1
 
@@ -55,6 +61,7 @@
 	do {                                                                                       \
 		gpio_ll_output_disable(GPIO_HAL_GET_HW(GPIO_PORT_0), CONFIG_TMS_SWDIO_GPIO);           \
 		REG_WRITE(GPIO_FUNC0_OUT_SEL_CFG_REG + (CONFIG_TMS_SWDIO_GPIO * 4), SIG_GPIO_OUT_IDX); \
+		SWD_GANG_FLOAT();                                                                      \
 		if (CONFIG_TMS_SWDIO_DIR_GPIO >= 0)                                                    \
 			dedic_gpio_cpu_ll_write_mask(SWDIO_TMS_DIR_DEDIC_MASK, SWDIO_TMS_DIR_DEDIC_MASK);  \
 	} while (0)
@@ -64,6 +71,7 @@
 			dedic_gpio_cpu_ll_write_mask(SWDIO_TMS_DIR_DEDIC_MASK, 0);                            \
 		REG_WRITE(GPIO_FUNC0_OUT_SEL_CFG_REG + (CONFIG_TMS_SWDIO_GPIO * 4), CORE1_GPIO_OUT0_IDX); \
 		gpio_ll_output_enable(GPIO_HAL_GET_HW(GPIO_PORT_0), CONFIG_TMS_SWDIO_GPIO);               \
+		SWD_GANG_DRIVE();                                                                         \
 	} while (0)
 #else
 // Others have a dedicated function for this
@@ -73,13 +81,156 @@
 		if (CONFIG_TMS_SWDIO_DIR_GPIO >= 0)                                                   \
 			dedic_gpio_cpu_ll_write_mask(SWDIO_TMS_DIR_DEDIC_MASK, SWDIO_TMS_DIR_DEDIC_MASK); \
 	} while (0)
-#define SWDIO_MODE_DRIVE()                                                       \
-	do {                                                                         \
-		if (CONFIG_TMS_SWDIO_DIR_GPIO >= 0)                                      \
-			dedic_gpio_cpu_ll_write_mask(SWDIO_TMS_DIR_DEDIC_MASK, 0);           \
-		dedic_gpio_cpu_ll_enable_output(ALL_OUTPUT_MASK | SWDIO_TMS_DEDIC_MASK); \
+#define SWDIO_MODE_DRIVE()                                                                         \
+	do {                                                                                           \
+		if (CONFIG_TMS_SWDIO_DIR_GPIO >= 0)                                                        \
+			dedic_gpio_cpu_ll_write_mask(SWDIO_TMS_DIR_DEDIC_MASK, 0);                             \
+		SWD_GANG_DRIVE();                                                                          \
+		dedic_gpio_cpu_ll_enable_output(ALL_OUTPUT_MASK | SWDIO_TMS_DEDIC_MASK | SWD_GANG_ACTIVE); \
+	} while (0)
+#endif
+
+#if GANG_SWDIO_LANES > 0
+/* Gang lanes currently driven alongside SWDIO, as a bundle mask */
+static uint32_t swd_gang_active;
+/* Active lanes that answered a transfer differently, to be dropped at the next turnaround */
+static uint32_t swd_gang_diverged;
+static bool swd_gang_enabled;
+static uint32_t swd_gang_transfers;
+static uint8_t swd_gang_dropped;
+static uint32_t swd_gang_dropped_at[SWD_GANG_LANES];
+static uint32_t swd_gang_read_mismatches[SWD_GANG_LANES];
+/* Bits read on each lane, shifted in from the top like the primary lane's */
+static uint32_t swd_gang_shift[GANG_SWDIO_LANES];
+/* What each lane answered to the current transfer */
+static uint8_t swd_gang_ack[GANG_SWDIO_LANES];
+static uint32_t swd_gang_data[GANG_SWDIO_LANES];
+
+/* Every bit goes out on all active lanes at once */
+#undef BIT_OUT
+#define BIT_OUT(x)                                                   \
+	dedic_gpio_cpu_ll_write_mask(SWDIO_TMS_DEDIC_MASK | swd_gang_active, \
+		(x) ? SWDIO_TMS_DEDIC_MASK | swd_gang_active : 0)
+
+/* BMP only sees the primary lane. The others are sampled on the same edge and kept for swd_gang_compare(). */
+static inline __attribute__((always_inline)) uint32_t swd_gang_bit_in(void)
+{
+	const uint32_t in = dedic_gpio_cpu_ll_read_in();
+	for (size_t lane = 0; lane < GANG_SWDIO_LANES; ++lane) {
+		const uint32_t bit = (in >> (GANG_SWDIO_DEDIC_PIN_BASE + lane)) & 1U;
+		swd_gang_shift[lane] = (swd_gang_shift[lane] >> 1U) | (bit << 31U);
+	}
+	return in & SWDIO_TMS_DEDIC_MASK;
+}
+
+#undef BIT_IN
+#define BIT_IN() swd_gang_bit_in()
+
+/* Keep each lane's ACK and read data as the transfer goes, the next field shifts them out */
+#define SWD_GANG_LATCH_ACK()                                   \
+	do {                                                       \
+		for (size_t lane = 0; lane < GANG_SWDIO_LANES; ++lane) \
+			swd_gang_ack[lane] = swd_gang_shift[lane] >> 29U;  \
+	} while (0)
+#define SWD_GANG_LATCH_DATA()                                  \
+	do {                                                       \
+		for (size_t lane = 0; lane < GANG_SWDIO_LANES; ++lane) \
+			swd_gang_data[lane] = swd_gang_shift[lane];        \
+	} while (0)
+
+/*
+ * Compare each lane's answer with the primary lane's once a transfer is over.
+ *
+ * The ACK decides what the rest of the transfer looks like on the wire, so
+ * a lane whose ACK differs is out of step whatever the request was. After
+ * an OK the target on that lane takes the next request as write data, or
+ * drives its read data over the next request. After a WAIT or FAULT it
+ * sees the data phase as a malformed request and locks up. Such a lane is
+ * dropped at the next turnaround, once it is floating.
+ *
+ * Read data is allowed to differ when both ACKs are OK: a BSY poll can read
+ * busy on one board and idle on another. That is counted for `monitor gang`
+ * and nothing more.
+ */
+static void swd_gang_compare(const uint8_t request, const uint8_t ack, const uint32_t data)
+{
+	for (size_t lane = 0; lane < GANG_SWDIO_LANES; ++lane) {
+		const uint32_t mask = 1U << (GANG_SWDIO_DEDIC_PIN_BASE + lane);
+		if (!(swd_gang_active & mask))
+			continue;
+		if (swd_gang_ack[lane] != (ack & 7U))
+			swd_gang_diverged |= mask;
+		else if ((request & SWD_REQUEST_RNW) && ack == SWD_ACK_OK && swd_gang_data[lane] != data)
+			++swd_gang_read_mismatches[lane + 1U];
+	}
+}
+
+/* Drop lanes that fell out of step. The turnaround that led here has already floated them. */
+static void swd_gang_prune(void)
+{
+	if (!swd_gang_diverged)
+		return;
+	for (size_t lane = 0; lane < GANG_SWDIO_LANES; ++lane) {
+		if (swd_gang_diverged & (1U << (GANG_SWDIO_DEDIC_PIN_BASE + lane))) {
+			swd_gang_dropped |= 1U << (lane + 1U);
+			swd_gang_dropped_at[lane + 1U] = swd_gang_transfers;
+		}
+	}
+	swd_gang_active &= ~swd_gang_diverged;
+	swd_gang_diverged = 0U;
+}
+
+#if SOC_DEDIC_GPIO_OUT_AUTO_ENABLE
+static const int swd_gang_gpios[GANG_SWDIO_LANES] = GANG_SWDIO_GPIOS;
+
+static void swd_gang_float(void)
+{
+	for (size_t lane = 0; lane < GANG_SWDIO_LANES; ++lane) {
+		if (!(swd_gang_active & (1U << (GANG_SWDIO_DEDIC_PIN_BASE + lane))))
+			continue;
+		gpio_ll_output_disable(GPIO_HAL_GET_HW(GPIO_PORT_0), swd_gang_gpios[lane]);
+		REG_WRITE(GPIO_FUNC0_OUT_SEL_CFG_REG + (swd_gang_gpios[lane] * 4), SIG_GPIO_OUT_IDX);
+	}
+}
+
+static void swd_gang_drive(void)
+{
+	swd_gang_prune();
+	for (size_t lane = 0; lane < GANG_SWDIO_LANES; ++lane) {
+		if (!(swd_gang_active & (1U << (GANG_SWDIO_DEDIC_PIN_BASE + lane))))
+			continue;
+		REG_WRITE(GPIO_FUNC0_OUT_SEL_CFG_REG + (swd_gang_gpios[lane] * 4),
+			CORE1_GPIO_OUT0_IDX + GANG_SWDIO_DEDIC_PIN_BASE + lane);
+		gpio_ll_output_enable(GPIO_HAL_GET_HW(GPIO_PORT_0), swd_gang_gpios[lane]);
+	}
+}
+
+#define SWD_GANG_FLOAT() swd_gang_float()
+#define SWD_GANG_DRIVE() swd_gang_drive()
+#else
+/* The output enable mask written on every turnaround takes care of the lanes */
+#define SWD_GANG_FLOAT() \
+	do {                 \
 	} while (0)
+#define SWD_GANG_DRIVE() swd_gang_prune()
 #endif
+#define SWD_GANG_ACTIVE swd_gang_active
+
+#else
+#define SWD_GANG_FLOAT() \
+	do {                 \
+	} while (0)
+#define SWD_GANG_DRIVE() \
+	do {                 \
+	} while (0)
+#define SWD_GANG_LATCH_ACK() \
+	do {                     \
+	} while (0)
+#define SWD_GANG_LATCH_DATA() \
+	do {                      \
+	} while (0)
+#define SWD_GANG_ACTIVE 0U
+#endif /* GANG_SWDIO_LANES > 0 */
 
 void IRAM_ATTR platform_maybe_delay(void);
 
@@ -101,13 +252,20 @@ static uint32_t IRAM_ATTR swdptap_seq_in_no_delay(size_t clock_cycles) __attribu
 static void IRAM_ATTR swdptap_seq_out_clk_delay(uint32_t tms_states, size_t clock_cycles) __attribute__((optimize(3)));
 static void IRAM_ATTR swdptap_seq_out_no_delay(uint32_t tms_states, size_t clock_cycles) __attribute__((optimize(3)));
 
+static uint8_t IRAM_ATTR swdptap_transfer_clk_delay(uint8_t request, uint32_t *data, size_t idle_cycles)
+	__attribute__((optimize(3)));
+static uint8_t IRAM_ATTR swdptap_transfer_no_delay(uint8_t request, uint32_t *data, size_t idle_cycles)
+	__attribute__((optimize(3)));
+
+/* Shared between the sequence callbacks and the fused transfer kernel */
+static swdio_status_t swdio_direction = SWDIO_STATUS_FLOAT;
+
 static void swdptap_turnaround(const swdio_status_t dir)
 {
-	static swdio_status_t olddir = SWDIO_STATUS_FLOAT;
 	/* Don't turnaround if direction not changing */
-	if (dir == olddir)
+	if (dir == swdio_direction)
 		return;
-	olddir = dir;
+	swdio_direction = dir;
 
 #ifdef DEBUG_SWD_BITS
 	DEBUG_INFO("%s", dir ? "\n-> " : "\n<- ");
@@ -116,9 +274,9 @@ static void swdptap_turnaround(const swdio_status_t dir)
 	if (dir == SWDIO_STATUS_FLOAT) {
 		SWDIO_MODE_FLOAT();
 	}
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 	CLK_HIGH();
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 
 	CLK_LOW();
 	if (dir == SWDIO_STATUS_DRIVE) {
@@ -137,10 +295,10 @@ static uint32_t swdptap_seq_in_clk_delay(const size_t clock_cycles)
 	 * to a faster down-count that uses SUBS followed by BCS/BCC.
 	 */
 	for (size_t cycle = clock_cycles; cycle--;) {
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		const bool bit = BIT_IN();
 		CLK_HIGH();
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		value >>= 1U;
 		value |= (uint32_t)bit << 31U;
 		CLK_LOW();
@@ -174,7 +332,7 @@ static uint32_t swdptap_seq_in(size_t clock_cycles)
 {
 	platform_maybe_delay();
 	swdptap_turnaround(SWDIO_STATUS_FLOAT);
-	if (target_delay_us != 0)
+	if (target_delay_cycles != 0)
 		return swdptap_seq_in_clk_delay(clock_cycles);
 	else // NOLINT(readability-else-after-return)
 		return swdptap_seq_in_no_delay(clock_cycles);
@@ -185,10 +343,10 @@ static bool swdptap_seq_in_parity(uint32_t *ret, size_t clock_cycles)
 	platform_maybe_delay();
 	const uint32_t result = swdptap_seq_in(clock_cycles);
 
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 	const bool bit = BIT_IN();
 	CLK_HIGH();
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 
 	CLK_LOW();
 	/* Terminate the read cycle now */
@@ -212,9 +370,9 @@ static void swdptap_seq_out_clk_delay(const uint32_t tms_states, const size_t cl
 	 */
 	for (size_t cycle = clock_cycles; cycle--;) {
 		BIT_OUT(bit);
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		CLK_HIGH();
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		value >>= 1U;
 		bit = value & 1U;
 		CLK_LOW();
@@ -246,7 +404,7 @@ static void swdptap_seq_out(const uint32_t tms_states, const size_t clock_cycles
 {
 	platform_maybe_delay();
 	swdptap_turnaround(SWDIO_STATUS_DRIVE);
-	if (target_delay_us != 0)
+	if (target_delay_cycles != 0)
 		swdptap_seq_out_clk_delay(tms_states, clock_cycles);
 	else
 		swdptap_seq_out_no_delay(tms_states, clock_cycles);
@@ -258,12 +416,135 @@ static void swdptap_seq_out_parity(const uint32_t tms_states, const size_t clock
 	const bool parity = calculate_odd_parity(tms_states);
 	swdptap_seq_out(tms_states, clock_cycles);
 	BIT_OUT(parity);
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 	CLK_HIGH();
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 	CLK_LOW();
 }
 
+/*
+ * The fused transfer kernel. These helpers get inlined into the two
+ * transfer variants below with `delay` as a constant, so the no-delay
+ * variant ends up with no delay calls or branches on `target_delay_cycles`.
+ */
+#define TRANSFER_DELAY()          \
+	do {                          \
+		if (delay)                \
+			platform_clk_delay(); \
+	} while (0)
+
+static inline __attribute__((always_inline)) void swdptap_transfer_turnaround(
+	const swdio_status_t dir, const bool delay)
+{
+	if (dir == swdio_direction)
+		return;
+	swdio_direction = dir;
+
+	if (dir == SWDIO_STATUS_FLOAT)
+		SWDIO_MODE_FLOAT();
+	TRANSFER_DELAY();
+	CLK_HIGH();
+	TRANSFER_DELAY();
+	CLK_LOW();
+	if (dir == SWDIO_STATUS_DRIVE)
+		SWDIO_MODE_DRIVE();
+}
+
+static inline __attribute__((always_inline)) void swdptap_transfer_out(
+	uint32_t value, const size_t clock_cycles, const bool delay)
+{
+	for (size_t cycle = clock_cycles; cycle--;) {
+		BIT_OUT(value & 1U);
+		TRANSFER_DELAY();
+		CLK_HIGH();
+		TRANSFER_DELAY();
+		value >>= 1U;
+		CLK_LOW();
+	}
+}
+
+/* Clocks in between 1 and 32 bits, LSB first */
+static inline __attribute__((always_inline)) uint32_t swdptap_transfer_in(const size_t clock_cycles, const bool delay)
+{
+	uint32_t value = 0;
+	for (size_t cycle = clock_cycles; cycle--;) {
+		TRANSFER_DELAY();
+		const uint32_t bit = BIT_IN();
+		CLK_HIGH();
+		TRANSFER_DELAY();
+		value >>= 1U;
+		value |= bit << 31U;
+		CLK_LOW();
+	}
+	return value >> (32U - clock_cycles);
+}
+
+static inline __attribute__((always_inline)) uint8_t swdptap_transfer_body(
+	const uint8_t request, uint32_t *const data, const size_t idle_cycles, const bool delay)
+{
+	/* Request header, then hand the bus to the target for the ACK */
+	swdptap_transfer_turnaround(SWDIO_STATUS_DRIVE, delay);
+	swdptap_transfer_out(request, 8U, delay);
+	swdptap_transfer_turnaround(SWDIO_STATUS_FLOAT, delay);
+	uint8_t ack = swdptap_transfer_in(3U, delay);
+	SWD_GANG_LATCH_ACK();
+
+	/* No data phase follows a WAIT or FAULT. Leave the bus floating, the next
+	 * request turns it around. */
+	if (ack != SWD_ACK_OK)
+		return ack;
+
+	if (request & SWD_REQUEST_RNW) {
+		const uint32_t value = swdptap_transfer_in(32U, delay);
+		SWD_GANG_LATCH_DATA();
+		const bool parity = swdptap_transfer_in(1U, delay);
+		swdptap_transfer_turnaround(SWDIO_STATUS_DRIVE, delay);
+		*data = value;
+		if (calculate_odd_parity(value) != parity)
+			ack |= SWD_TRANSFER_PARITY_ERROR;
+	} else {
+		const uint32_t value = *data;
+		swdptap_transfer_turnaround(SWDIO_STATUS_DRIVE, delay);
+		swdptap_transfer_out(value, 32U, delay);
+		swdptap_transfer_out(calculate_odd_parity(value), 1U, delay);
+	}
+
+	if (idle_cycles)
+		swdptap_transfer_out(0U, idle_cycles, delay);
+	return ack;
+}
+
+static uint8_t swdptap_transfer_clk_delay(const uint8_t request, uint32_t *const data, const size_t idle_cycles)
+{
+	return swdptap_transfer_body(request, data, idle_cycles, true);
+}
+
+static uint8_t swdptap_transfer_no_delay(const uint8_t request, uint32_t *const data, const size_t idle_cycles)
+{
+	return swdptap_transfer_body(request, data, idle_cycles, false);
+}
+
+uint8_t IRAM_ATTR swdptap_transfer(const uint8_t request, uint32_t *const data, const size_t idle_cycles)
+{
+	platform_maybe_delay();
+	const uint32_t trace_start = wire_trace_start();
+#if GANG_SWDIO_LANES > 0
+	if (swd_gang_active)
+		++swd_gang_transfers;
+#endif
+	uint8_t ack;
+	if (target_delay_cycles != 0)
+		ack = swdptap_transfer_clk_delay(request, data, idle_cycles);
+	else
+		ack = swdptap_transfer_no_delay(request, data, idle_cycles);
+#if GANG_SWDIO_LANES > 0
+	if (swd_gang_active)
+		swd_gang_compare(request, ack, *data);
+#endif
+	wire_trace_swd(request, ack, *data, trace_start);
+	return ack;
+}
+
 void swdptap_init(void)
 {
 	swd_proc.seq_in = swdptap_seq_in;
@@ -271,6 +552,49 @@ void swdptap_init(void)
 	swd_proc.seq_out = swdptap_seq_out;
 	swd_proc.seq_out_parity = swdptap_seq_out_parity;
 	gpio_dedic_init();
+	wire_engine_wrap_swd(&swd_proc);
+}
+
+#if GANG_SWDIO_LANES > 0
+static void swd_gang_enable_remote(void *const arg)
+{
+	const bool enable = *(const bool *)arg;
+
+	/* Let go of the lanes that are being driven, then bring the new set up in whatever direction SWDIO is in */
+	if (swdio_direction == SWDIO_STATUS_DRIVE)
+		SWD_GANG_FLOAT();
+	swd_gang_active = enable ? GANG_SWDIO_DEDIC_MASK : 0U;
+	swd_gang_diverged = 0U;
+	swd_gang_enabled = enable;
+	swd_gang_transfers = 0U;
+	swd_gang_dropped = 0U;
+	memset(swd_gang_dropped_at, 0, sizeof(swd_gang_dropped_at));
+	memset(swd_gang_read_mismatches, 0, sizeof(swd_gang_read_mismatches));
+	if (swdio_direction == SWDIO_STATUS_DRIVE)
+		SWDIO_MODE_DRIVE();
+}
+
+void swd_gang_enable(bool enable)
+{
+	gpio_dedic_init();
+	wire_engine_call(swd_gang_enable_remote, &enable);
+}
+
+static void swd_gang_status_remote(void *const arg)
+{
+	swd_gang_status_s *const status = (swd_gang_status_s *)arg;
+	status->enabled = swd_gang_enabled;
+	status->active = 1U | (((swd_gang_active & ~swd_gang_diverged) >> GANG_SWDIO_DEDIC_PIN_BASE) << 1U);
+	status->dropped = swd_gang_dropped;
+	status->transfers = swd_gang_transfers;
+	memcpy(status->dropped_at, swd_gang_dropped_at, sizeof(status->dropped_at));
+	memcpy(status->read_mismatches, swd_gang_read_mismatches, sizeof(status->read_mismatches));
+}
+
+void swd_gang_status(swd_gang_status_s *const status)
+{
+	wire_engine_call(swd_gang_status_remote, status);
 }
+#endif /* GANG_SWDIO_LANES > 0 */
 
 #endif
@@ -28,6 +28,9 @@
 #include "platform.h"
 #include "timing.h"
 #include "maths_utils.h"
+#include "swd-transfer.h"
+#include "wire-engine.h"
+#include "wire-trace.h"
 
 #if SWDPTAP_MODE_GPIO == 1
 
@@ -66,10 +69,10 @@ static void swdptap_turnaround(const swdio_status_t dir)
 	if (dir == SWDIO_STATUS_FLOAT) {
 		SWDIO_MODE_FLOAT();
 	}
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 
 	gpio_set(SWCLK_PORT, SWCLK_PIN);
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 
 	gpio_clear(SWCLK_PORT, SWCLK_PIN);
 	if (dir == SWDIO_STATUS_DRIVE) {
@@ -88,10 +91,10 @@ static uint32_t swdptap_seq_in_clk_delay(const size_t clock_cycles)
 	 * to a faster down-count that uses SUBS followed by BCS/BCC.
 	 */
 	for (size_t cycle = clock_cycles; cycle--;) {
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		const bool bit = gpio_get(SWDIO_IN_PORT, SWDIO_IN_PIN);
 		gpio_set(SWCLK_PORT, SWCLK_PIN);
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		value >>= 1U;
 		value |= (uint32_t)bit << 31U;
 		gpio_clear(SWCLK_PORT, SWCLK_PIN);
@@ -137,7 +140,7 @@ static uint32_t swdptap_seq_in(size_t clock_cycles)
 {
 	platform_maybe_delay();
 	swdptap_turnaround(SWDIO_STATUS_FLOAT);
-	if (target_delay_us != 0)
+	if (target_delay_cycles != 0)
 		return swdptap_seq_in_clk_delay(clock_cycles);
 	else // NOLINT(readability-else-after-return)
 		return swdptap_seq_in_no_delay(clock_cycles);
@@ -147,12 +150,12 @@ static bool swdptap_seq_in_parity(uint32_t *ret, size_t clock_cycles)
 {
 	platform_maybe_delay();
 	const uint32_t result = swdptap_seq_in(clock_cycles);
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 
 	const bool bit = gpio_get(SWDIO_IN_PORT, SWDIO_IN_PIN);
 
 	gpio_set(SWCLK_PORT, SWCLK_PIN);
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 
 	gpio_clear(SWCLK_PORT, SWCLK_PIN);
 	/* Terminate the read cycle now */
@@ -176,9 +179,9 @@ static void swdptap_seq_out_clk_delay(const uint32_t tms_states, const size_t cl
 	 */
 	for (size_t cycle = clock_cycles; cycle--;) {
 		gpio_set_val(SWDIO_PORT, SWDIO_PIN, bit);
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		gpio_set(SWCLK_PORT, SWCLK_PIN);
-		esp_rom_delay_us(target_delay_us);
+		platform_clk_delay();
 		value >>= 1U;
 		bit = value & 1U;
 		gpio_clear(SWCLK_PORT, SWCLK_PIN);
@@ -218,7 +221,7 @@ static void swdptap_seq_out(const uint32_t tms_states, const size_t clock_cycles
 {
 	platform_maybe_delay();
 	swdptap_turnaround(SWDIO_STATUS_DRIVE);
-	if (target_delay_us != 0)
+	if (target_delay_cycles != 0)
 		swdptap_seq_out_clk_delay(tms_states, clock_cycles);
 	else
 		swdptap_seq_out_no_delay(tms_states, clock_cycles);
@@ -230,18 +233,50 @@ static void swdptap_seq_out_parity(const uint32_t tms_states, const size_t clock
 	const bool parity = calculate_odd_parity(tms_states);
 	swdptap_seq_out(tms_states, clock_cycles);
 	gpio_set_val(SWDIO_PORT, SWDIO_PIN, parity);
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 	gpio_set(SWCLK_PORT, SWCLK_PIN);
-	esp_rom_delay_us(target_delay_us);
+	platform_clk_delay();
 	gpio_clear(SWCLK_PORT, SWCLK_PIN);
 }
 
+/*
+ * The GPIO backend has no fused kernel of its own, but running the whole
+ * transaction from here still saves the ADIv5 layer four indirect calls
+ * and a round of ACK decoding per access.
+ */
+static uint8_t IRAM_ATTR swdptap_transfer_body(const uint8_t request, uint32_t *const data, const size_t idle_cycles)
+{
+	swdptap_seq_out(request, 8U);
+	uint8_t ack = swdptap_seq_in(3U);
+	if (ack != SWD_ACK_OK)
+		return ack;
+
+	if (request & SWD_REQUEST_RNW) {
+		if (!swdptap_seq_in_parity(data, 32U))
+			ack |= SWD_TRANSFER_PARITY_ERROR;
+	} else
+		swdptap_seq_out_parity(*data, 32U);
+
+	if (idle_cycles)
+		swdptap_seq_out(0U, idle_cycles);
+	return ack;
+}
+
+uint8_t IRAM_ATTR swdptap_transfer(const uint8_t request, uint32_t *const data, const size_t idle_cycles)
+{
+	const uint32_t trace_start = wire_trace_start();
+	const uint8_t ack = swdptap_transfer_body(request, data, idle_cycles);
+	wire_trace_swd(request, ack, *data, trace_start);
+	return ack;
+}
+
 void swdptap_init(void)
 {
 	swd_proc.seq_in = swdptap_seq_in;
 	swd_proc.seq_in_parity = swdptap_seq_in_parity;
 	swd_proc.seq_out = swdptap_seq_out;
 	swd_proc.seq_out_parity = swdptap_seq_out_parity;
+	wire_engine_wrap_swd(&swd_proc);
 }
 
 #endif
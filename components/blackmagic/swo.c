@@ -38,6 +38,7 @@
 #include <lwip/netdb.h>
 #include <lwip/sockets.h>
 #include <lwip/sys.h>
+#include "net_reactor.h"
 #include "platform.h"
 #include "sdkconfig.h"
 #include "swo.h"
@@ -59,18 +60,19 @@ static uint8_t itm_packet_length = 0; /* decoder state */
 static bool itm_decode_packet = false;
 
 // A list of clients to send SWO traffic to.
-static int swo_clients[16] = {};
+static volatile int swo_clients[16] = {};
 static int swo_client_count = 0;
 
 static void swo_post_to_all_clients(const uint8_t *data, size_t len)
 {
 	for (int i = 0; i < (sizeof(swo_clients) / sizeof(*swo_clients)); i += 1) {
-		if (swo_clients[i] <= 0) {
+		const int client = swo_clients[i];
+		if (client <= 0) {
 			continue;
 		}
-		if (send(swo_clients[i], data, len, 0) <= 0) {
-			close(swo_clients[i]);
+		if (send(client, data, len, 0) <= 0) {
 			swo_clients[i] = 0;
+			net_reactor_close(client);
 		}
 	}
 }
@@ -115,64 +117,73 @@ void swo_post(const uint8_t *data, size_t len)
 	}
 }
 
-void swo_listen_task(void *ignored)
+/* Clients only ever listen, so anything readable is either stray input or the connection closing */
+static bool swo_client_recv(int sock, void *arg)
 {
-	int swo_server;
-
-	(void)ignored;
-	if (CONFIG_SWO_TCP_PORT == -1) {
-		return;
+	const int slot = (int)(intptr_t)arg;
+	uint8_t discard[64];
+	if (recv(sock, discard, sizeof(discard), MSG_DONTWAIT) > 0) {
+		return true;
 	}
-	struct sockaddr_in addr;
-	addr.sin_family = AF_INET;
-	addr.sin_port = htons(CONFIG_SWO_TCP_PORT);
-	addr.sin_addr.s_addr = htonl(INADDR_ANY);
-
-	assert((swo_server = socket(PF_INET, SOCK_STREAM, 0)) != -1);
-	int opt = 1;
-	assert(setsockopt(swo_server, SOL_SOCKET, SO_REUSEADDR, (void *)&opt, sizeof(opt)) != -1);
-	assert(setsockopt(swo_server, IPPROTO_TCP, TCP_NODELAY, (void *)&opt, sizeof(opt)) != -1);
-
-	assert(bind(swo_server, (struct sockaddr *)&addr, sizeof(addr)) != -1);
-	assert(listen(swo_server, 5) != -1);
+	ESP_LOGI(TAG, "client %d disconnected", sock);
+	if (swo_clients[slot] == sock) {
+		swo_clients[slot] = 0;
+	}
+	return false;
+}
 
-	ESP_LOGI(TAG, "swo server listening on port %d", CONFIG_SWO_TCP_PORT);
+static bool swo_accept(int swo_server, void *arg)
+{
+	(void)arg;
+	struct sockaddr_storage source_addr;
+	socklen_t addr_len = sizeof(source_addr);
+	int s = accept(swo_server, (struct sockaddr *)&source_addr, &addr_len);
+	if (s < 0) {
+		ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
+		return true;
+	}
 
-	while (1) {
-		struct sockaddr_storage source_addr;
-		socklen_t addr_len = sizeof(source_addr);
-		int s = accept(swo_server, (struct sockaddr *)&source_addr, &addr_len);
-		if (s < 0) {
-			ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
-			continue;
+	// Look for a free slot in the connection array.
+	int slot = -1;
+	for (int i = 0; i < (sizeof(swo_clients) / sizeof(*swo_clients)); i += 1) {
+		if (swo_clients[i] == 0) {
+			slot = i;
+			break;
 		}
+	}
+	if (slot < 0 || !net_reactor_add(s, swo_client_recv, (void *)(intptr_t)slot)) {
+		ESP_LOGE(TAG, "unable to accept connection %d because connection table is full", s);
+		close(s);
+		return true;
+	}
+	swo_clients[slot] = s;
+	swo_client_count += 1;
 
-		// Look for a free slot in the connection array.
-		bool found = false;
-		for (int i = 0; i < (sizeof(swo_clients) / sizeof(*swo_clients)); i += 1) {
-			if (swo_clients[i] == 0) {
-				swo_clients[i] = s;
-				swo_client_count += 1;
-				found = true;
-				break;
-			}
-		}
-		if (!found) {
-			ESP_LOGE(TAG, "unable to accept connection %d because connection table is full", s);
-			close(s);
-			continue;
-		}
+	// Convert ip address to string
+	char addr_str[128] = {};
+	if (source_addr.ss_family == PF_INET) {
+		inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr, addr_str, sizeof(addr_str) - 1);
+	}
+	if (source_addr.ss_family == PF_INET6) {
+		inet6_ntoa_r(((struct sockaddr_in6 *)&source_addr)->sin6_addr, addr_str, sizeof(addr_str) - 1);
+	}
+	ESP_LOGI(TAG, "client connected from %s", addr_str);
+	return true;
+}
 
-		// Convert ip address to string
-		char addr_str[128] = {};
-		if (source_addr.ss_family == PF_INET) {
-			inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr, addr_str, sizeof(addr_str) - 1);
-		}
-		if (source_addr.ss_family == PF_INET6) {
-			inet6_ntoa_r(((struct sockaddr_in6 *)&source_addr)->sin6_addr, addr_str, sizeof(addr_str) - 1);
-		}
-		ESP_LOGI(TAG, "client connected from %s", addr_str);
+void swo_listen_init(void)
+{
+	if (CONFIG_SWO_TCP_PORT == -1) {
+		return;
 	}
+
+	const int swo_server = net_reactor_listen(CONFIG_SWO_TCP_PORT, 5);
+	if (swo_server < 0) {
+		return;
+	}
+	net_reactor_add(swo_server, swo_accept, NULL);
+
+	ESP_LOGI(TAG, "swo server listening on port %d", CONFIG_SWO_TCP_PORT);
 }
 
 void swo_baud(unsigned int baud)
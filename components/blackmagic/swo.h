@@ -41,4 +41,7 @@ void swo_deinit(bool deallocate);
 /* Send SWO data to anyone who's listening */
 void swo_post(const uint8_t *data, size_t len);
 
+/* Accept SWO clients on CONFIG_SWO_TCP_PORT through the network reactor */
+void swo_listen_init(void);
+
 #endif /* PLATFORMS_COMMON_SWO_H */
@@ -0,0 +1,71 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements the bitstream packing used by peripheral-driven taps. */
+
+#include <string.h>
+
+#include "tap-bitstream.h"
+
+/* Mask covering the valid bits of the final byte of a `bits`-long sequence */
+static inline uint8_t tap_bitstream_tail_mask(const size_t bits)
+{
+	const size_t tail = bits & 7U;
+	return tail ? (uint8_t)((1U << tail) - 1U) : 0xffU;
+}
+
+size_t tap_bitstream_encode(uint8_t *const dest, const uint8_t *const src, const size_t offset, const size_t bits)
+{
+	const size_t bytes = TAP_BITSTREAM_BYTES(bits);
+	if (!bytes)
+		return 0;
+	const uint8_t *const in = src + (offset >> 3U);
+	const size_t shift = offset & 7U;
+	if (!shift)
+		memcpy(dest, in, bytes);
+	else {
+		/* Don't read past the source byte holding the last bit */
+		const size_t last = (shift + bits - 1U) >> 3U;
+		for (size_t i = 0; i < bytes; ++i)
+			dest[i] = (uint8_t)((in[i] >> shift) | (i < last ? in[i + 1U] << (8U - shift) : 0));
+	}
+	dest[bytes - 1U] &= tap_bitstream_tail_mask(bits);
+	return bytes;
+}
+
+void tap_bitstream_decode(uint8_t *const dest, const size_t offset, const uint8_t *const src, const size_t bits)
+{
+	const size_t bytes = TAP_BITSTREAM_BYTES(bits);
+	if (!bytes)
+		return;
+	uint8_t *const out = dest + (offset >> 3U);
+	const size_t shift = offset & 7U;
+	if (!shift) {
+		memcpy(out, src, bytes - 1U);
+		const uint8_t mask = tap_bitstream_tail_mask(bits);
+		out[bytes - 1U] = (out[bytes - 1U] & ~mask) | (src[bytes - 1U] & mask);
+		return;
+	}
+	/* Each source byte straddles two destination bytes */
+	for (size_t i = 0; i < bytes; ++i) {
+		const uint16_t mask = (uint16_t)((i + 1U == bytes ? tap_bitstream_tail_mask(bits) : 0xffU) << shift);
+		const uint16_t value = (uint16_t)(src[i] << shift) & mask;
+		out[i] = (out[i] & ~(uint8_t)mask) | (uint8_t)value;
+		if (mask >> 8U)
+			out[i + 1U] = (out[i + 1U] & ~(uint8_t)(mask >> 8U)) | (uint8_t)(value >> 8U);
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef TAP_BITSTREAM_H_
+#define TAP_BITSTREAM_H_
+
+/*
+ * Conversion between BMP's packed TDI/TDO bit arrays and the buffers handed
+ * to a shift peripheral. BMP stores the first bit to clock in bit 0 of byte
+ * 0, which is what an LSB-first SPI peripheral expects, so packing is a
+ * copy with the unused tail bits cleared. The helpers also cover picking
+ * individual bits out for the edges the peripheral can't produce, such as
+ * the final TMS transition of a JTAG scan.
+ *
+ * This module has no ESP-IDF dependencies so that it can be built for the
+ * host and exercised against a software TAP model.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of bytes needed to hold `bits` bits */
+#define TAP_BITSTREAM_BYTES(bits) (((bits) + 7U) >> 3U)
+
+static inline bool tap_bitstream_get_bit(const uint8_t *const data, const size_t bit)
+{
+	return (data[bit >> 3U] >> (bit & 7U)) & 1U;
+}
+
+static inline void tap_bitstream_set_bit(uint8_t *const data, const size_t bit, const bool value)
+{
+	const uint8_t mask = 1U << (bit & 7U);
+	data[bit >> 3U] = (data[bit >> 3U] & ~mask) | (value ? mask : 0U);
+}
+
+/*
+ * Pack `bits` bits starting at bit `offset` of `src` into `dest`, starting
+ * at bit 0. Trailing bits of the last byte are cleared. A byte-aligned
+ * `offset` is a plain copy. Returns the number of bytes written.
+ */
+size_t tap_bitstream_encode(uint8_t *dest, const uint8_t *src, size_t offset, size_t bits);
+
+/*
+ * Unpack `bits` bits from `src` into `dest` starting at bit `offset`. Bits
+ * of `dest` outside the sequence, on either side of it, are left untouched.
+ */
+void tap_bitstream_decode(uint8_t *dest, size_t offset, const uint8_t *src, size_t bits);
+
+#endif /* TAP_BITSTREAM_H_ */
@@ -0,0 +1,374 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements the task that owns the SWD/JTAG pins and the ring that feeds it. */
+
+#include "general.h"
+#include "wire-engine.h"
+
+#if defined(CONFIG_WIRE_ENGINE)
+
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+
+#include "exception.h"
+#include "jtagtap-spi.h"
+
+#define TAG "wire-engine"
+
+/* Must be a power of two. Callers keep at most two operations in flight. */
+#define WIRE_ENGINE_RING 8U
+/*
+ * How long either side busy-waits before going to sleep. Back-to-back
+ * accesses from the GDB task arrive within a few microseconds of each other,
+ * and a spin is far cheaper than a pair of context switches.
+ */
+#define WIRE_ENGINE_SPIN_US 50U
+
+typedef struct wire_engine_cmd {
+	wire_engine_fn_t fn;
+	void *arg;
+	/* Task sleeping until this command completes. The engine takes it when it does. */
+	TaskHandle_t waiter;
+} wire_engine_cmd_s;
+
+static wire_engine_cmd_s wire_engine_ring[WIRE_ENGINE_RING];
+/* Commands ever submitted. Only the producer stores to this. */
+static uint32_t wire_engine_head;
+/* Commands ever completed. Only the engine stores to this. */
+static uint32_t wire_engine_done;
+/* Set by the engine before it blocks waiting for the doorbell */
+static bool wire_engine_idle;
+
+static TaskHandle_t wire_engine_task_handle;
+/* Held by the producer from its first submit until everything it submitted has completed */
+static SemaphoreHandle_t wire_engine_lock;
+/* Task holding wire_engine_lock, only ever written by that task */
+static TaskHandle_t wire_engine_producer;
+
+static uint32_t wire_engine_spin_cycles;
+
+static void IRAM_ATTR wire_engine_task(void *arg)
+{
+	(void)arg;
+	uint32_t tail = 0U;
+
+	for (;;) {
+		uint32_t head = __atomic_load_n(&wire_engine_head, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			const uint32_t start = esp_cpu_get_cycle_count();
+			while (head == tail && esp_cpu_get_cycle_count() - start < wire_engine_spin_cycles)
+				head = __atomic_load_n(&wire_engine_head, __ATOMIC_ACQUIRE);
+		}
+		if (head == tail) {
+			/* Check once more after announcing the sleep so a doorbell cannot be missed */
+			__atomic_store_n(&wire_engine_idle, true, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&wire_engine_head, __ATOMIC_SEQ_CST) == tail)
+				ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+			__atomic_store_n(&wire_engine_idle, false, __ATOMIC_SEQ_CST);
+			continue;
+		}
+
+		wire_engine_cmd_s *const cmd = &wire_engine_ring[tail % WIRE_ENGINE_RING];
+		cmd->fn(cmd->arg);
+		++tail;
+
+		__atomic_store_n(&wire_engine_done, tail, __ATOMIC_SEQ_CST);
+		TaskHandle_t waiter = __atomic_exchange_n(&cmd->waiter, NULL, __ATOMIC_SEQ_CST);
+		if (waiter)
+			xTaskNotifyGive(waiter);
+	}
+}
+
+void wire_engine_start(void)
+{
+	if (wire_engine_task_handle)
+		return;
+	wire_engine_spin_cycles = WIRE_ENGINE_SPIN_US * esp_rom_get_cpu_ticks_per_us();
+	wire_engine_lock = xSemaphoreCreateMutex();
+	/* Above everything else on its core, and it sleeps whenever the ring runs dry */
+	xTaskCreatePinnedToCore(wire_engine_task, "wire", 3072, NULL, configMAX_PRIORITIES - 2, &wire_engine_task_handle,
+		WIRE_ENGINE_CORE);
+	ESP_LOGI(TAG, "SWD/JTAG running on core %d", WIRE_ENGINE_CORE);
+}
+
+static inline bool wire_engine_is_complete(const uint32_t ticket)
+{
+	return (int32_t)(__atomic_load_n(&wire_engine_done, __ATOMIC_ACQUIRE) - ticket) >= 0;
+}
+
+static void wire_engine_wait_for(const uint32_t ticket)
+{
+	if (!wire_engine_is_complete(ticket)) {
+		const uint32_t start = esp_cpu_get_cycle_count();
+		while (!wire_engine_is_complete(ticket) && esp_cpu_get_cycle_count() - start < wire_engine_spin_cycles)
+			continue;
+	}
+	if (!wire_engine_is_complete(ticket)) {
+		/*
+		 * Ticket t is the command in slot t - 1. Check again once the handle is
+		 * in place, the engine may have finished before it could see it.
+		 */
+		wire_engine_cmd_s *const cmd = &wire_engine_ring[(ticket - 1U) % WIRE_ENGINE_RING];
+		__atomic_store_n(&cmd->waiter, xTaskGetCurrentTaskHandle(), __ATOMIC_SEQ_CST);
+		while (!wire_engine_is_complete(ticket))
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		__atomic_store_n(&cmd->waiter, NULL, __ATOMIC_SEQ_CST);
+	}
+}
+
+void wire_engine_wait(const uint32_t ticket)
+{
+	wire_engine_wait_for(ticket);
+	/* Hand the ring over once nothing we submitted is outstanding */
+	if (__atomic_load_n(&wire_engine_producer, __ATOMIC_RELAXED) == xTaskGetCurrentTaskHandle() &&
+		wire_engine_is_complete(__atomic_load_n(&wire_engine_head, __ATOMIC_RELAXED))) {
+		__atomic_store_n(&wire_engine_producer, NULL, __ATOMIC_RELAXED);
+		xSemaphoreGive(wire_engine_lock);
+	}
+}
+
+void wire_engine_drain(void)
+{
+	if (__atomic_load_n(&wire_engine_producer, __ATOMIC_RELAXED) == xTaskGetCurrentTaskHandle())
+		wire_engine_wait(__atomic_load_n(&wire_engine_head, __ATOMIC_RELAXED));
+}
+
+uint32_t wire_engine_submit(const wire_engine_fn_t fn, void *const arg)
+{
+	TaskHandle_t self = xTaskGetCurrentTaskHandle();
+	/* The engine itself, and anything that runs before it exists, calls straight through */
+	if (!wire_engine_task_handle || self == wire_engine_task_handle) {
+		fn(arg);
+		return __atomic_load_n(&wire_engine_done, __ATOMIC_RELAXED);
+	}
+
+	/* Blocks, with priority inheritance, until the previous producer has waited for all of its work */
+	if (__atomic_load_n(&wire_engine_producer, __ATOMIC_RELAXED) != self) {
+		xSemaphoreTake(wire_engine_lock, portMAX_DELAY);
+		__atomic_store_n(&wire_engine_producer, self, __ATOMIC_RELAXED);
+	}
+
+	const uint32_t head = __atomic_load_n(&wire_engine_head, __ATOMIC_RELAXED);
+	/* Make room if the ring is full */
+	wire_engine_wait_for(head - WIRE_ENGINE_RING + 1U);
+
+	wire_engine_cmd_s *const cmd = &wire_engine_ring[head % WIRE_ENGINE_RING];
+	cmd->fn = fn;
+	cmd->arg = arg;
+	cmd->waiter = NULL;
+	__atomic_store_n(&wire_engine_head, head + 1U, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&wire_engine_idle, __ATOMIC_SEQ_CST))
+		xTaskNotifyGive(wire_engine_task_handle);
+	return head + 1U;
+}
+
+void wire_engine_call(const wire_engine_fn_t fn, void *const arg)
+{
+	wire_engine_wait(wire_engine_submit(fn, arg));
+}
+
+/*
+ * Forwarders for the tap entry points that BMP calls directly. Each one
+ * packs its arguments into a struct on the caller's stack, which stays valid
+ * because the caller waits for the result.
+ */
+
+static swd_proc_s wire_engine_swd;
+static jtag_proc_s wire_engine_jtag;
+
+typedef struct wire_engine_seq {
+	uint32_t value;
+	size_t clock_cycles;
+	uint32_t *ret;
+	bool result;
+} wire_engine_seq_s;
+
+static void wire_engine_seq_in_remote(void *const arg)
+{
+	wire_engine_seq_s *const seq = (wire_engine_seq_s *)arg;
+	seq->value = wire_engine_swd.seq_in(seq->clock_cycles);
+}
+
+static void wire_engine_seq_in_parity_remote(void *const arg)
+{
+	wire_engine_seq_s *const seq = (wire_engine_seq_s *)arg;
+	seq->result = wire_engine_swd.seq_in_parity(seq->ret, seq->clock_cycles);
+}
+
+static void wire_engine_seq_out_remote(void *const arg)
+{
+	const wire_engine_seq_s *const seq = (const wire_engine_seq_s *)arg;
+	wire_engine_swd.seq_out(seq->value, seq->clock_cycles);
+}
+
+static void wire_engine_seq_out_parity_remote(void *const arg)
+{
+	const wire_engine_seq_s *const seq = (const wire_engine_seq_s *)arg;
+	wire_engine_swd.seq_out_parity(seq->value, seq->clock_cycles);
+}
+
+static uint32_t wire_engine_seq_in(const size_t clock_cycles)
+{
+	wire_engine_seq_s seq = {.clock_cycles = clock_cycles};
+	wire_engine_call(wire_engine_seq_in_remote, &seq);
+	return seq.value;
+}
+
+static bool wire_engine_seq_in_parity(uint32_t *const ret, const size_t clock_cycles)
+{
+	wire_engine_seq_s seq = {.ret = ret, .clock_cycles = clock_cycles};
+	wire_engine_call(wire_engine_seq_in_parity_remote, &seq);
+	return seq.result;
+}
+
+static void wire_engine_seq_out(const uint32_t tms_states, const size_t clock_cycles)
+{
+	wire_engine_seq_s seq = {.value = tms_states, .clock_cycles = clock_cycles};
+	wire_engine_call(wire_engine_seq_out_remote, &seq);
+}
+
+static void wire_engine_seq_out_parity(const uint32_t tms_states, const size_t clock_cycles)
+{
+	wire_engine_seq_s seq = {.value = tms_states, .clock_cycles = clock_cycles};
+	wire_engine_call(wire_engine_seq_out_parity_remote, &seq);
+}
+
+void wire_engine_wrap_swd(swd_proc_s *const proc)
+{
+	if (!wire_engine_task_handle || proc->seq_in == wire_engine_seq_in)
+		return;
+	wire_engine_swd = *proc;
+	proc->seq_in = wire_engine_seq_in;
+	proc->seq_in_parity = wire_engine_seq_in_parity;
+	proc->seq_out = wire_engine_seq_out;
+	proc->seq_out_parity = wire_engine_seq_out_parity;
+}
+
+typedef struct wire_engine_shift {
+	uint8_t *data_out;
+	const uint8_t *data_in;
+	size_t clock_cycles;
+	uint32_t tms_states;
+	bool tms;
+	bool tdi;
+	bool result;
+} wire_engine_shift_s;
+
+static void wire_engine_jtag_reset_remote(void *const arg)
+{
+	(void)arg;
+	wire_engine_jtag.jtagtap_reset();
+}
+
+static void wire_engine_jtag_next_remote(void *const arg)
+{
+	wire_engine_shift_s *const shift = (wire_engine_shift_s *)arg;
+	shift->result = wire_engine_jtag.jtagtap_next(shift->tms, shift->tdi);
+}
+
+static void wire_engine_jtag_tms_seq_remote(void *const arg)
+{
+	const wire_engine_shift_s *const shift = (const wire_engine_shift_s *)arg;
+	wire_engine_jtag.jtagtap_tms_seq(shift->tms_states, shift->clock_cycles);
+}
+
+/* The scan's result is whether it completed, which the caller raises on once it is back on its own task */
+static void wire_engine_jtag_tdi_tdo_seq_remote(void *const arg)
+{
+	wire_engine_shift_s *const shift = (wire_engine_shift_s *)arg;
+	wire_engine_jtag.jtagtap_tdi_tdo_seq(shift->data_out, shift->tms, shift->data_in, shift->clock_cycles);
+	shift->result = !jtagtap_spi_take_error();
+}
+
+static void wire_engine_jtag_tdi_seq_remote(void *const arg)
+{
+	wire_engine_shift_s *const shift = (wire_engine_shift_s *)arg;
+	wire_engine_jtag.jtagtap_tdi_seq(shift->tms, shift->data_in, shift->clock_cycles);
+	shift->result = !jtagtap_spi_take_error();
+}
+
+static void wire_engine_jtag_cycle_remote(void *const arg)
+{
+	const wire_engine_shift_s *const shift = (const wire_engine_shift_s *)arg;
+	wire_engine_jtag.jtagtap_cycle(shift->tms, shift->tdi, shift->clock_cycles);
+}
+
+static void wire_engine_jtag_reset(void)
+{
+	wire_engine_call(wire_engine_jtag_reset_remote, NULL);
+}
+
+static bool wire_engine_jtag_next(const bool tms, const bool tdi)
+{
+	wire_engine_shift_s shift = {.tms = tms, .tdi = tdi};
+	wire_engine_call(wire_engine_jtag_next_remote, &shift);
+	return shift.result;
+}
+
+static void wire_engine_jtag_tms_seq(const uint32_t tms_states, const size_t clock_cycles)
+{
+	wire_engine_shift_s shift = {.tms_states = tms_states, .clock_cycles = clock_cycles};
+	wire_engine_call(wire_engine_jtag_tms_seq_remote, &shift);
+}
+
+static void wire_engine_jtag_tdi_tdo_seq(
+	uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+{
+	wire_engine_shift_s shift = {
+		.data_out = data_out,
+		.data_in = data_in,
+		.clock_cycles = clock_cycles,
+		.tms = final_tms,
+	};
+	wire_engine_call(wire_engine_jtag_tdi_tdo_seq_remote, &shift);
+	if (!shift.result)
+		raise_exception(EXCEPTION_ERROR, "JTAG SPI scan failed");
+}
+
+static void wire_engine_jtag_tdi_seq(const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+{
+	wire_engine_shift_s shift = {.data_in = data_in, .clock_cycles = clock_cycles, .tms = final_tms};
+	wire_engine_call(wire_engine_jtag_tdi_seq_remote, &shift);
+	if (!shift.result)
+		raise_exception(EXCEPTION_ERROR, "JTAG SPI scan failed");
+}
+
+static void wire_engine_jtag_cycle(const bool tms, const bool tdi, const size_t clock_cycles)
+{
+	wire_engine_shift_s shift = {.tms = tms, .tdi = tdi, .clock_cycles = clock_cycles};
+	wire_engine_call(wire_engine_jtag_cycle_remote, &shift);
+}
+
+void wire_engine_wrap_jtag(jtag_proc_s *const proc)
+{
+	if (!wire_engine_task_handle || proc->jtagtap_reset == wire_engine_jtag_reset)
+		return;
+	wire_engine_jtag = *proc;
+	proc->jtagtap_reset = wire_engine_jtag_reset;
+	proc->jtagtap_next = wire_engine_jtag_next;
+	proc->jtagtap_tms_seq = wire_engine_jtag_tms_seq;
+	proc->jtagtap_tdi_tdo_seq = wire_engine_jtag_tdi_tdo_seq;
+	proc->jtagtap_tdi_seq = wire_engine_jtag_tdi_seq;
+	proc->jtagtap_cycle = wire_engine_jtag_cycle;
+}
+
+#endif /* CONFIG_WIRE_ENGINE */
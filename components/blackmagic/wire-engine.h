@@ -0,0 +1,97 @@
+#ifndef WIRE_ENGINE_H_
+#define WIRE_ENGINE_H_
+
+#include <freertos/FreeRTOS.h>
+
+#include "general.h"
+#include "adiv5.h"
+#include "jtagtap.h"
+
+/*
+ * Wire engine: runs every SWD/JTAG operation on a dedicated high-priority
+ * task on its own core, leaving RSP handling, hex encoding and the network
+ * stack on the other one.
+ *
+ * Callers hand the engine a function and an argument through a
+ * single-producer/single-consumer ring. The engine picks it up, runs it and
+ * publishes a completion count that the caller waits on, spinning first and
+ * blocking if the operation takes long. Functions run on the engine must not
+ * raise exceptions or talk to GDB; callers do their error handling once the
+ * result is back.
+ *
+ * The dedicated GPIO bundle belongs to the core that created it, so this is
+ * also what keeps every pin access on the same core no matter which task
+ * started it.
+ */
+
+typedef void (*wire_engine_fn_t)(void *arg);
+
+#if defined(CONFIG_WIRE_ENGINE)
+
+/* The engine sits on the last core, like the GDB task used to */
+#define WIRE_ENGINE_CORE (configNUMBER_OF_CORES - 1)
+/* Everything that talks to the network belongs on the other core */
+#define WIRE_ENGINE_NET_CORE 0
+
+void wire_engine_start(void);
+
+/*
+ * Queue `fn(arg)` on the engine and return a ticket for wire_engine_wait().
+ * `arg` must stay valid until then. Only one task submits at a time: the
+ * first submit takes a mutex that others block on, and it is given back
+ * once the task has waited for everything it submitted.
+ */
+uint32_t wire_engine_submit(wire_engine_fn_t fn, void *arg);
+void wire_engine_wait(uint32_t ticket);
+
+/* Wait for everything the calling task has in flight, for callers unwinding from an exception */
+void wire_engine_drain(void);
+
+/* Run `fn(arg)` on the engine and return once it has finished */
+void wire_engine_call(wire_engine_fn_t fn, void *arg);
+
+/* Replace the tap's entry points with ones that forward to the engine */
+void wire_engine_wrap_swd(swd_proc_s *proc);
+void wire_engine_wrap_jtag(jtag_proc_s *proc);
+
+#else
+
+#define WIRE_ENGINE_NET_CORE (configNUMBER_OF_CORES - 1)
+
+static inline void wire_engine_start(void)
+{
+}
+
+static inline uint32_t wire_engine_submit(const wire_engine_fn_t fn, void *const arg)
+{
+	fn(arg);
+	return 0U;
+}
+
+static inline void wire_engine_wait(const uint32_t ticket)
+{
+	(void)ticket;
+}
+
+static inline void wire_engine_drain(void)
+{
+}
+
+static inline void wire_engine_call(const wire_engine_fn_t fn, void *const arg)
+{
+	fn(arg);
+}
+
+static inline void wire_engine_wrap_swd(swd_proc_s *const proc)
+{
+	(void)proc;
+}
+
+static inline void wire_engine_wrap_jtag(jtag_proc_s *const proc)
+{
+	(void)proc;
+}
+
+#endif /* CONFIG_WIRE_ENGINE */
+
+#endif /* WIRE_ENGINE_H_ */
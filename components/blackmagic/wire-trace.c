@@ -0,0 +1,121 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements the ring behind the wire-level transaction recorder. */
+
+#include "general.h"
+#include "wire-trace.h"
+
+#if defined(CONFIG_WIRE_TRACE)
+
+#include "esp_rom_sys.h"
+
+bool wire_trace_enabled;
+
+static wire_trace_record_s wire_trace_ring[WIRE_TRACE_RECORDS];
+/* Total records ever published, and ever started. Only the writer stores to these. */
+static uint32_t wire_trace_head;
+static uint32_t wire_trace_reserved;
+/* Value of wire_trace_head at the last clear. Only readers store to this. */
+static uint32_t wire_trace_base;
+
+void IRAM_ATTR wire_trace_record(const wire_trace_record_s *const record)
+{
+	const uint32_t head = __atomic_load_n(&wire_trace_head, __ATOMIC_RELAXED);
+	/* Let readers know the slot is about to change before touching it */
+	__atomic_store_n(&wire_trace_reserved, head + 1U, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	wire_trace_ring[head % WIRE_TRACE_RECORDS] = *record;
+	/* Publish the record only once it is complete */
+	__atomic_store_n(&wire_trace_head, head + 1U, __ATOMIC_RELEASE);
+}
+
+/* Up to the first 32 bits of an LSB-first bit stream */
+static uint32_t wire_trace_first_word(const uint8_t *const data, const size_t clock_cycles)
+{
+	if (!data || !clock_cycles)
+		return 0U;
+	const size_t bits = MIN(clock_cycles, 32U);
+	uint32_t word = 0U;
+	for (size_t byte = 0; byte < (bits + 7U) / 8U; ++byte)
+		word |= (uint32_t)data[byte] << (byte * 8U);
+	return bits == 32U ? word : word & ((1U << bits) - 1U);
+}
+
+void IRAM_ATTR wire_trace_jtag_record(const wire_trace_type_e type, const size_t clock_cycles, const bool final_tms,
+	const uint8_t *const data_in, const uint8_t *const data_out, const uint32_t start)
+{
+	const wire_trace_record_s record = {
+		.timestamp = start,
+		.duration = esp_cpu_get_cycle_count() - start,
+		.data = wire_trace_first_word(data_in, clock_cycles),
+		.data_out = wire_trace_first_word(data_out, clock_cycles),
+		.request = MIN(clock_cycles, UINT16_MAX),
+		.type = type,
+		.ack = final_tms,
+	};
+	wire_trace_record(&record);
+}
+
+void wire_trace_clear(void)
+{
+	__atomic_store_n(&wire_trace_base, __atomic_load_n(&wire_trace_head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+void wire_trace_begin(wire_trace_cursor_s *const cursor, wire_trace_header_s *const header)
+{
+	const uint32_t head = __atomic_load_n(&wire_trace_head, __ATOMIC_ACQUIRE);
+	const uint32_t base = __atomic_load_n(&wire_trace_base, __ATOMIC_ACQUIRE);
+	/* Everything since the last clear, less whatever the ring could not hold */
+	const uint32_t available = MIN(head - base, WIRE_TRACE_RECORDS);
+	cursor->next = head - available;
+	cursor->dropped = head - base - available;
+	if (header) {
+		header->magic = WIRE_TRACE_MAGIC;
+		header->version = WIRE_TRACE_VERSION;
+		header->record_size = sizeof(wire_trace_record_s);
+		header->cycles_per_us = esp_rom_get_cpu_ticks_per_us();
+		header->dropped = cursor->dropped;
+		header->count = available;
+	}
+}
+
+size_t wire_trace_read(wire_trace_cursor_s *const cursor, wire_trace_record_s *const records, const size_t max)
+{
+	size_t count = 0;
+	while (count < max) {
+		const uint32_t head = __atomic_load_n(&wire_trace_head, __ATOMIC_ACQUIRE);
+		if (cursor->next == head)
+			break;
+		records[count] = wire_trace_ring[cursor->next % WIRE_TRACE_RECORDS];
+
+		/* If the writer started on this slot again during the copy, the record may be torn */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		const uint32_t reserved = __atomic_load_n(&wire_trace_reserved, __ATOMIC_RELAXED);
+		if (reserved - cursor->next > WIRE_TRACE_RECORDS) {
+			const uint32_t oldest = reserved - WIRE_TRACE_RECORDS;
+			cursor->dropped += oldest - cursor->next;
+			cursor->next = oldest;
+			continue;
+		}
+		++cursor->next;
+		++count;
+	}
+	return count;
+}
+
+#endif /* CONFIG_WIRE_TRACE */
@@ -0,0 +1,137 @@
+#ifndef WIRE_TRACE_H_
+#define WIRE_TRACE_H_
+
+#include "general.h"
+
+/*
+ * Wire-level transaction recorder.
+ *
+ * The tap backends log every SWD transaction and JTAG shift into a ring in
+ * RAM. There is a single writer, the task that owns the debug port, and it
+ * never blocks or takes a lock. Readers copy records out and detect
+ * records that were overwritten during the copy. When the ring is full the
+ * oldest records are dropped.
+ */
+
+#define WIRE_TRACE_MAGIC   0x54575046U /* "FPWT" */
+#define WIRE_TRACE_VERSION 1U
+
+typedef enum wire_trace_type {
+	WIRE_TRACE_SWD = 1,
+	WIRE_TRACE_JTAG_TDI_TDO = 2,
+	WIRE_TRACE_JTAG_TDI = 3,
+} wire_trace_type_e;
+
+/* Little-endian on the wire, exactly as laid out here */
+typedef struct __attribute__((packed)) wire_trace_record {
+	/* CPU cycle counter when the transaction started, wraps at 32 bits */
+	uint32_t timestamp;
+	/* CPU cycles the transaction took, retries are separate records */
+	uint32_t duration;
+	/* SWD: data written or read. JTAG: the first 32 bits shifted out on TDI. */
+	uint32_t data;
+	/* JTAG: the first 32 bits captured on TDO, 0 for SWD */
+	uint32_t data_out;
+	/* SWD: the 8-bit request header. JTAG: the number of clock cycles, saturated. */
+	uint16_t request;
+	uint8_t type;
+	/* SWD: the ACK, with SWD_TRANSFER_PARITY_ERROR set on a bad read. JTAG: the final TMS state. */
+	uint8_t ack;
+} wire_trace_record_s;
+
+/* Precedes the records in a download */
+typedef struct __attribute__((packed)) wire_trace_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	/* CPU cycles per microsecond, to turn timestamps into time */
+	uint32_t cycles_per_us;
+	/* Records overwritten before they could be read since the last clear */
+	uint32_t dropped;
+	/* Records held when the download started, later records are not included */
+	uint32_t count;
+} wire_trace_header_s;
+
+#if defined(CONFIG_WIRE_TRACE)
+#define WIRE_TRACE_RECORDS CONFIG_WIRE_TRACE_RECORDS
+
+extern bool wire_trace_enabled;
+
+void wire_trace_record(const wire_trace_record_s *record);
+
+/* Cycle count to pass back to wire_trace_swd()/wire_trace_jtag(), cheap when tracing is off */
+static inline uint32_t wire_trace_start(void)
+{
+	return wire_trace_enabled ? esp_cpu_get_cycle_count() : 0U;
+}
+
+static inline void wire_trace_swd(const uint8_t request, const uint8_t ack, const uint32_t data, const uint32_t start)
+{
+	if (!wire_trace_enabled)
+		return;
+	const wire_trace_record_s record = {
+		.timestamp = start,
+		.duration = esp_cpu_get_cycle_count() - start,
+		.data = data,
+		.request = request,
+		.type = WIRE_TRACE_SWD,
+		.ack = ack,
+	};
+	wire_trace_record(&record);
+}
+
+void wire_trace_jtag_record(wire_trace_type_e type, size_t clock_cycles, bool final_tms, const uint8_t *data_in,
+	const uint8_t *data_out, uint32_t start);
+
+static inline void wire_trace_jtag(const wire_trace_type_e type, const size_t clock_cycles, const bool final_tms,
+	const uint8_t *const data_in, const uint8_t *const data_out, const uint32_t start)
+{
+	if (wire_trace_enabled)
+		wire_trace_jtag_record(type, clock_cycles, final_tms, data_in, data_out, start);
+}
+
+/* Forget everything recorded so far. Safe to call while the writer is running. */
+void wire_trace_clear(void);
+
+/*
+ * Reading starts at the oldest record still in the ring. Each call to
+ * wire_trace_read() copies up to `max` records and advances the cursor,
+ * returning 0 once it has caught up with the writer.
+ */
+typedef struct wire_trace_cursor {
+	uint32_t next;
+	uint32_t dropped;
+} wire_trace_cursor_s;
+
+void wire_trace_begin(wire_trace_cursor_s *cursor, wire_trace_header_s *header);
+size_t wire_trace_read(wire_trace_cursor_s *cursor, wire_trace_record_s *records, size_t max);
+
+#else
+#define WIRE_TRACE_RECORDS 0U
+
+static inline uint32_t wire_trace_start(void)
+{
+	return 0U;
+}
+
+static inline void wire_trace_swd(const uint8_t request, const uint8_t ack, const uint32_t data, const uint32_t start)
+{
+	(void)request;
+	(void)ack;
+	(void)data;
+	(void)start;
+}
+
+static inline void wire_trace_jtag(const wire_trace_type_e type, const size_t clock_cycles, const bool final_tms,
+	const uint8_t *const data_in, const uint8_t *const data_out, const uint32_t start)
+{
+	(void)type;
+	(void)clock_cycles;
+	(void)final_tms;
+	(void)data_in;
+	(void)data_out;
+	(void)start;
+}
+#endif /* CONFIG_WIRE_TRACE */
+
+#endif /* WIRE_TRACE_H_ */
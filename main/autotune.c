@@ -0,0 +1,253 @@
+/*
+ * Probe clock calibration.
+ *
+ * Steps the SWD/JTAG clock up from a known-safe rate, hammering the debug
+ * port at each step and counting anything that goes wrong on the wire:
+ * parity errors, WAIT/FAULT/no-response ACKs and identification registers
+ * that read back differently than they did at the safe rate. The fastest
+ * step that stays clean, less one step of margin, is stored in NVS against
+ * the DPIDR of the target and re-applied whenever that target is attached.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "nvs_flash.h"
+
+#include "general.h"
+#include "adiv5.h"
+#include "cortexm.h"
+#include "exception.h"
+#include "gdb_packet.h"
+#include "target.h"
+#include "target_internal.h"
+
+#include "autotune.h"
+
+#define TAG "autotune"
+
+/* Number of DPIDR/CPUID read pairs at each clock step */
+#define AUTOTUNE_ITERATIONS 128U
+/* Give up on a step after this many errors, a WAIT storm can take seconds to run through */
+#define AUTOTUNE_MAX_ERRORS 8U
+
+extern nvs_handle h_nvs_conf;
+
+/* Candidate clocks, slowest first. 0 runs the tap without any delay. */
+static const uint32_t autotune_steps[] = {
+	100000U,
+	500000U,
+	1000000U,
+	2000000U,
+	3000000U,
+	4000000U,
+	6000000U,
+	8000000U,
+	10000000U,
+	0U,
+};
+
+typedef struct autotune_result {
+	uint32_t parity;
+	uint32_t wait;
+	uint32_t fault;
+	uint32_t mismatch;
+} autotune_result_s;
+
+static adiv5_debug_port_s *autotune_dp(target_s *const target)
+{
+	if (!target || !target_is_cortexm(target))
+		return NULL;
+	adiv5_access_port_s *const ap = cortexm_ap(target);
+	return ap ? ap->dp : NULL;
+}
+
+static void autotune_nvs_key(char *const key, const size_t len, const uint32_t dpidr)
+{
+	snprintf(key, len, "clk%08" PRIx32, dpidr);
+}
+
+/* Read DPIDR and, if there is a memory AP, the CPUID register. Returns false on any error. */
+static bool autotune_sample(target_s *const target, uint32_t *const dpidr, uint32_t *const cpuid,
+	autotune_result_s *const result)
+{
+	adiv5_access_port_s *const ap = cortexm_ap(target);
+	adiv5_debug_port_s *const dp = ap->dp;
+	bool ok = true;
+
+	TRY(EXCEPTION_ALL)
+	{
+		dp->fault = 0;
+		*dpidr = dp->low_access(dp, ADIV5_LOW_READ, ADIV5_DP_DPIDR, 0);
+		if (!dp->fault)
+			adiv5_mem_read(ap, cpuid, CORTEXM_CPUID, sizeof(*cpuid));
+	}
+	CATCH()
+	{
+	default:
+		/* Exceptions out of the low-level accessors are parity errors or garbled ACKs */
+		if (result)
+			++result->parity;
+		ok = false;
+	}
+
+	if (dp->fault) {
+		if (result) {
+			if (dp->fault == SWD_ACK_WAIT)
+				++result->wait;
+			else
+				++result->fault;
+		}
+		ok = false;
+	}
+	return ok;
+}
+
+/* Get the debug port talking again after a failed step */
+static void autotune_recover(adiv5_debug_port_s *const dp)
+{
+	TRY(EXCEPTION_ALL)
+	{
+		dp->error(dp, true);
+	}
+	CATCH()
+	{
+	default:
+		break;
+	}
+	dp->fault = 0;
+}
+
+static bool autotune_step(target_s *const target, const uint32_t ref_dpidr, const uint32_t ref_cpuid,
+	autotune_result_s *const result)
+{
+	adiv5_debug_port_s *const dp = autotune_dp(target);
+	uint32_t errors = 0;
+	memset(result, 0, sizeof(*result));
+	for (size_t i = AUTOTUNE_ITERATIONS; i-- && errors < AUTOTUNE_MAX_ERRORS;) {
+		uint32_t dpidr = 0;
+		uint32_t cpuid = 0;
+		if (!autotune_sample(target, &dpidr, &cpuid, result)) {
+			autotune_recover(dp);
+			++errors;
+			continue;
+		}
+		if (dpidr != ref_dpidr || cpuid != ref_cpuid) {
+			++result->mismatch;
+			++errors;
+		}
+	}
+	return errors == 0;
+}
+
+static const char *autotune_freq_str(const uint32_t freq, char *const buffer, const size_t len)
+{
+	if (freq == 0)
+		snprintf(buffer, len, "max");
+	else if (freq >= 1000000U)
+		snprintf(buffer, len, "%" PRIu32 ".%" PRIu32 " MHz", freq / 1000000U, (freq / 100000U) % 10U);
+	else
+		snprintf(buffer, len, "%" PRIu32 " kHz", freq / 1000U);
+	return buffer;
+}
+
+void autotune_apply(target_s *const target)
+{
+	adiv5_debug_port_s *const dp = autotune_dp(target);
+	if (!dp)
+		return;
+
+	uint32_t dpidr = 0;
+	if (!autotune_sample(target, &dpidr, &(uint32_t){0}, NULL))
+		return;
+
+	char key[16];
+	uint32_t freq;
+	autotune_nvs_key(key, sizeof(key), dpidr);
+	if (nvs_get_u32(h_nvs_conf, key, &freq) != ESP_OK)
+		return;
+
+	platform_max_frequency_set(freq);
+	ESP_LOGI(TAG, "applying calibrated clock of %" PRIu32 " Hz for DPIDR 0x%08" PRIx32, platform_max_frequency_get(),
+		dpidr);
+}
+
+static bool autotune_run(target_s *const target)
+{
+	adiv5_debug_port_s *const dp = autotune_dp(target);
+	const uint32_t original_freq = platform_max_frequency_get();
+	char freq_str[16];
+
+	/* Take the reference readings at the slowest step */
+	platform_max_frequency_set(autotune_steps[0]);
+	uint32_t ref_dpidr = 0;
+	uint32_t ref_cpuid = 0;
+	if (!autotune_sample(target, &ref_dpidr, &ref_cpuid, NULL)) {
+		autotune_recover(dp);
+		platform_max_frequency_set(original_freq);
+		gdb_out("Target does not respond reliably at the slowest clock\n");
+		return false;
+	}
+	gdb_outf("DPIDR 0x%08" PRIx32 ", CPUID 0x%08" PRIx32 "\n", ref_dpidr, ref_cpuid);
+
+	bool found = false;
+	size_t fastest_clean = 0;
+	for (size_t step = 0; step < ARRAY_LENGTH(autotune_steps); ++step) {
+		autotune_result_s result;
+		platform_max_frequency_set(autotune_steps[step]);
+		const bool clean = autotune_step(target, ref_dpidr, ref_cpuid, &result);
+		gdb_outf("%10s: parity %" PRIu32 ", wait %" PRIu32 ", fault %" PRIu32 ", mismatch %" PRIu32 "\n",
+			autotune_freq_str(platform_max_frequency_get(), freq_str, sizeof(freq_str)), result.parity, result.wait,
+			result.fault, result.mismatch);
+		if (!clean) {
+			platform_max_frequency_set(autotune_steps[0]);
+			autotune_recover(dp);
+			break;
+		}
+		found = true;
+		fastest_clean = step;
+	}
+
+	if (!found) {
+		platform_max_frequency_set(original_freq);
+		gdb_out("No clock step was clean, keeping the previous setting\n");
+		return false;
+	}
+
+	/* Back off one step from the fastest clean clock for margin */
+	const uint32_t chosen = autotune_steps[fastest_clean ? fastest_clean - 1U : 0U];
+	platform_max_frequency_set(chosen);
+
+	char key[16];
+	autotune_nvs_key(key, sizeof(key), ref_dpidr);
+	nvs_set_u32(h_nvs_conf, key, chosen);
+	nvs_commit(h_nvs_conf);
+
+	gdb_outf(
+		"Selected %s for this target\n", autotune_freq_str(platform_max_frequency_get(), freq_str, sizeof(freq_str)));
+	return true;
+}
+
+bool cmd_autotune(target_s *t, int argc, const char **argv)
+{
+	if (!autotune_dp(t)) {
+		gdb_out("Clock calibration needs an attached ARM target\n");
+		return false;
+	}
+
+	if (argc == 2 && !strcmp(argv[1], "clear")) {
+		uint32_t dpidr = 0;
+		if (!autotune_sample(t, &dpidr, &(uint32_t){0}, NULL))
+			return false;
+		char key[16];
+		autotune_nvs_key(key, sizeof(key), dpidr);
+		nvs_erase_key(h_nvs_conf, key);
+		nvs_commit(h_nvs_conf);
+		gdb_outf("Cleared calibrated clock for DPIDR 0x%08" PRIx32 "\n", dpidr);
+		return true;
+	}
+
+	return autotune_run(t);
+}
@@ -0,0 +1,12 @@
+#ifndef FARPATCH_AUTOTUNE_H__
+#define FARPATCH_AUTOTUNE_H__
+
+#include "target.h"
+
+/* Re-apply the clock previously calibrated for the target's debug port, if any */
+void autotune_apply(target_s *target);
+
+/* `monitor autotune [clear]` */
+bool cmd_autotune(target_s *t, int argc, const char **argv);
+
+#endif /* FARPATCH_AUTOTUNE_H__ */
@@ -0,0 +1,159 @@
+/*
+ * Cycle-count benchmarks for the probe's fast paths, run from the GDB
+ * monitor so they measure the firmware actually flashed on the probe.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp_cpu.h"
+#include "esp_random.h"
+#include "esp_rom_sys.h"
+
+#include "general.h"
+#include "gdb_packet.h"
+#include "gdb_rsp.h"
+#include "jtagtap.h"
+
+#include "bench.h"
+
+/* Each measurement is the best of this many runs, to filter out interrupts */
+#define BENCH_RUNS 8U
+
+#define BENCH_JTAG_MAX_BITS 4096U
+
+static uint8_t bench_jtag_in[BENCH_JTAG_MAX_BITS / 8U];
+static uint8_t bench_jtag_out[BENCH_JTAG_MAX_BITS / 8U];
+
+/* As big as the packets GDB sends, worst case every byte escaped when framed */
+#define BENCH_RSP_PAYLOAD 1024U
+
+static char bench_rsp_payload[BENCH_RSP_PAYLOAD];
+static char bench_rsp_framed[2U * BENCH_RSP_PAYLOAD + 4U];
+static char bench_rsp_packet[BENCH_RSP_PAYLOAD + 1U];
+
+static void bench_report(const char *const name, const uint32_t bits, const uint32_t cycles)
+{
+	const uint32_t cpu_mhz = esp_rom_get_cpu_ticks_per_us();
+	/* kbit/s = bits / (cycles / MHz) * 1000 */
+	const uint64_t kbps = cycles ? ((uint64_t)bits * cpu_mhz * 1000U) / cycles : 0;
+	gdb_outf("%-12s %5" PRIu32 " bits: %8" PRIu32 " cycles, %3" PRIu32 ".%02" PRIu32 " cycles/bit, %6" PRIu32
+			 " kbit/s\n",
+		name, bits, cycles, cycles / bits, ((cycles % bits) * 100U) / bits, (uint32_t)kbps);
+}
+
+static void bench_report_bytes(const char *const name, const uint32_t bytes, const uint32_t cycles)
+{
+	const uint32_t cpu_mhz = esp_rom_get_cpu_ticks_per_us();
+	/* kB/s = bytes / (cycles / MHz) * 1000 */
+	const uint64_t kbps = cycles ? ((uint64_t)bytes * cpu_mhz * 1000U) / cycles : 0;
+	gdb_outf("%-12s %5" PRIu32 " bytes: %8" PRIu32 " cycles, %3" PRIu32 ".%02" PRIu32 " cycles/byte, %6" PRIu32
+			 " kB/s\n",
+		name, bytes, cycles, cycles / bytes, ((cycles % bytes) * 100U) / bytes, (uint32_t)kbps);
+}
+
+static bool bench_jtag(target_s *const target)
+{
+	/* Random data on the wire would knock an attached session, SWD or JTAG, out of step */
+	if (target) {
+		gdb_out("Detach from the target before benchmarking JTAG\n");
+		return false;
+	}
+	/* Bringing the tap up here would clock the SWD to JTAG switch into whatever is connected */
+	if (!jtag_proc.jtagtap_tdi_tdo_seq) {
+		gdb_out("The probe is not in JTAG mode, run `monitor jtag_scan` first\n");
+		return false;
+	}
+
+	/* Shifting with TMS held low leaves the TAP in whichever stable state it is in */
+
+	esp_fill_random(bench_jtag_in, sizeof(bench_jtag_in));
+
+	static const size_t sizes[] = {32U, 256U, 4096U};
+	for (size_t idx = 0; idx < ARRAY_LENGTH(sizes); ++idx) {
+		const size_t bits = sizes[idx];
+		uint32_t best_tdi_tdo = UINT32_MAX;
+		uint32_t best_tdi = UINT32_MAX;
+		for (size_t run = BENCH_RUNS; run--;) {
+			uint32_t start = esp_cpu_get_cycle_count();
+			jtag_proc.jtagtap_tdi_tdo_seq(bench_jtag_out, false, bench_jtag_in, bits);
+			uint32_t elapsed = esp_cpu_get_cycle_count() - start;
+			if (elapsed < best_tdi_tdo)
+				best_tdi_tdo = elapsed;
+
+			start = esp_cpu_get_cycle_count();
+			jtag_proc.jtagtap_tdi_seq(false, bench_jtag_in, bits);
+			elapsed = esp_cpu_get_cycle_count() - start;
+			if (elapsed < best_tdi)
+				best_tdi = elapsed;
+		}
+		bench_report("tdi_tdo_seq", bits, best_tdi_tdo);
+		bench_report("tdi_seq", bits, best_tdi);
+	}
+	return true;
+}
+
+/* Frame a payload the way a reply is sent, then parse it back the way a request is received */
+static bool bench_rsp_payload_run(const char *const name)
+{
+	uint32_t best_frame = UINT32_MAX;
+	uint32_t best_parse = UINT32_MAX;
+	size_t framed = 0;
+	gdb_rsp_parser_s parser;
+	gdb_rsp_result_e result = GDB_RSP_MORE;
+	for (size_t run = BENCH_RUNS; run--;) {
+		uint32_t start = esp_cpu_get_cycle_count();
+		framed = gdb_rsp_frame(bench_rsp_framed, sizeof(bench_rsp_framed), bench_rsp_payload, BENCH_RSP_PAYLOAD);
+		uint32_t elapsed = esp_cpu_get_cycle_count() - start;
+		if (elapsed < best_frame)
+			best_frame = elapsed;
+
+		size_t used;
+		start = esp_cpu_get_cycle_count();
+		gdb_rsp_parser_init(&parser, bench_rsp_packet, BENCH_RSP_PAYLOAD);
+		result = gdb_rsp_parse(&parser, bench_rsp_framed, framed, &used);
+		elapsed = esp_cpu_get_cycle_count() - start;
+		if (elapsed < best_parse)
+			best_parse = elapsed;
+	}
+
+	if (result != GDB_RSP_PACKET || parser.size != BENCH_RSP_PAYLOAD ||
+		memcmp(bench_rsp_packet, bench_rsp_payload, BENCH_RSP_PAYLOAD) != 0) {
+		gdb_outf("%s payload did not survive framing\n", name);
+		return false;
+	}
+
+	gdb_outf("%s payload, %u bytes framed:\n", name, (unsigned)framed);
+	bench_report_bytes("frame", BENCH_RSP_PAYLOAD, best_frame);
+	bench_report_bytes("parse", BENCH_RSP_PAYLOAD, best_parse);
+	return true;
+}
+
+static bool bench_rsp(void)
+{
+	/* Random binary, like `X` and `vFlashWrite`, where some bytes need escaping */
+	esp_fill_random(bench_rsp_payload, sizeof(bench_rsp_payload));
+	if (!bench_rsp_payload_run("Binary"))
+		return false;
+
+	/* Hex digits, like `m` replies, which go out as they are */
+	static const char hex_digits[] = "0123456789abcdef";
+	for (size_t idx = 0; idx < BENCH_RSP_PAYLOAD; ++idx)
+		bench_rsp_payload[idx] = hex_digits[(uint8_t)bench_rsp_payload[idx] & 0xfU];
+	return bench_rsp_payload_run("Hex");
+}
+
+bool cmd_bench(target_s *t, int argc, const char **argv)
+{
+	if (argc == 2 && !strcmp(argv[1], "jtag")) {
+		gdb_outf("JTAG shift at %" PRIu32 " Hz, best of %u runs\n", platform_max_frequency_get(), BENCH_RUNS);
+		return bench_jtag(t);
+	}
+	if (argc == 2 && !strcmp(argv[1], "rsp")) {
+		gdb_outf("RSP packet framing, best of %u runs\n", BENCH_RUNS);
+		return bench_rsp();
+	}
+
+	gdb_out("usage: monitor bench jtag|rsp\n");
+	return false;
+}
@@ -0,0 +1,9 @@
+#ifndef FARPATCH_BENCH_H__
+#define FARPATCH_BENCH_H__
+
+#include "target.h"
+
+/* `monitor bench <subsystem>` */
+bool cmd_bench(target_s *t, int argc, const char **argv);
+
+#endif /* FARPATCH_BENCH_H__ */
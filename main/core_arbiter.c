@@ -0,0 +1,202 @@
+/*
+ * Arbitration for resources that only one task may drive at a time.
+ *
+ * GDB clients and the RTT monitor take turns at the BMP core, and the web
+ * server and BMP itself take the core lock around target accesses. Waiters
+ * used to poll a flag every 10 ms, or every 700 ms for the RTT monitor, and
+ * nothing decided who went next. Here a waiter queues up by its FreeRTOS
+ * priority and sleeps on its task notification. The owner hands over
+ * directly when it releases. An owner that only holds on while nobody else
+ * wants the resource, like the RTT monitor, sleeps in
+ * core_arbiter_wait_contended() and wakes as soon as someone important
+ * enough starts waiting.
+ *
+ * Notifications are only ever a hint to look at `granted` again, the same
+ * as in the wire engine, so a stray one from elsewhere does no harm.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "general.h"
+#include "gdb_packet.h"
+
+#include "core_arbiter.h"
+
+#define CORE_ARBITER_MAX 4U
+
+static const char TAG[] = "arbiter";
+
+struct core_arbiter_waiter {
+	TaskHandle_t task;
+	UBaseType_t priority;
+	bool granted;
+	core_arbiter_waiter_s *next;
+};
+
+/* Every arbiter, for `monitor arbiter` */
+static core_arbiter_s *core_arbiters[CORE_ARBITER_MAX];
+
+void core_arbiter_init(core_arbiter_s *const arbiter, const char *const name)
+{
+	memset(arbiter, 0, sizeof(*arbiter));
+	arbiter->name = name;
+	arbiter->lock = xSemaphoreCreateMutex();
+	arbiter->contended = xSemaphoreCreateBinary();
+
+	for (size_t idx = 0; idx < CORE_ARBITER_MAX; ++idx) {
+		if (!core_arbiters[idx]) {
+			core_arbiters[idx] = arbiter;
+			break;
+		}
+	}
+}
+
+/* Called by the new owner, which is the only one to touch the statistics */
+static void core_arbiter_account(core_arbiter_s *const arbiter, const int64_t start_us)
+{
+	++arbiter->stats.acquired;
+	if (start_us < 0)
+		return;
+	const uint32_t wait_us = (uint32_t)(esp_timer_get_time() - start_us);
+	++arbiter->stats.waited;
+	arbiter->stats.wait_us += wait_us;
+	arbiter->stats.max_wait_us = MAX(arbiter->stats.max_wait_us, wait_us);
+}
+
+bool core_arbiter_try_acquire(core_arbiter_s *const arbiter)
+{
+	xSemaphoreTake(arbiter->lock, portMAX_DELAY);
+	const bool acquired = !arbiter->owner;
+	if (acquired) {
+		arbiter->owner = xTaskGetCurrentTaskHandle();
+		arbiter->owner_priority = uxTaskPriorityGet(NULL);
+	}
+	xSemaphoreGive(arbiter->lock);
+
+	if (acquired)
+		core_arbiter_account(arbiter, -1);
+	return acquired;
+}
+
+void core_arbiter_acquire(core_arbiter_s *const arbiter)
+{
+	if (core_arbiter_try_acquire(arbiter))
+		return;
+
+	const int64_t start_us = esp_timer_get_time();
+	core_arbiter_waiter_s waiter = {
+		.task = xTaskGetCurrentTaskHandle(),
+		.priority = uxTaskPriorityGet(NULL),
+	};
+
+	xSemaphoreTake(arbiter->lock, portMAX_DELAY);
+	bool contends = false;
+	if (!arbiter->owner) {
+		/* Released since the first try */
+		arbiter->owner = waiter.task;
+		arbiter->owner_priority = waiter.priority;
+		waiter.granted = true;
+	} else {
+		core_arbiter_waiter_s **link = &arbiter->waiters;
+		while (*link && (*link)->priority >= waiter.priority)
+			link = &(*link)->next;
+		waiter.next = *link;
+		*link = &waiter;
+		contends = waiter.priority >= arbiter->owner_priority;
+		/* Lend the owner our priority until it releases */
+		if (waiter.priority > MAX(arbiter->owner_priority, arbiter->inherited_priority)) {
+			arbiter->inherited_priority = waiter.priority;
+			vTaskPrioritySet(arbiter->owner, waiter.priority);
+		}
+	}
+	xSemaphoreGive(arbiter->lock);
+
+	if (contends)
+		xSemaphoreGive(arbiter->contended);
+	while (!__atomic_load_n(&waiter.granted, __ATOMIC_ACQUIRE))
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	core_arbiter_account(arbiter, start_us);
+}
+
+void core_arbiter_release(core_arbiter_s *const arbiter)
+{
+	xSemaphoreTake(arbiter->lock, portMAX_DELAY);
+	if (arbiter->owner != xTaskGetCurrentTaskHandle()) {
+		xSemaphoreGive(arbiter->lock);
+		ESP_LOGE(TAG, "%s released by a task that does not own it", arbiter->name);
+		return;
+	}
+	/* The new owner is the most important waiter, so nobody is left to lend it a priority */
+	const bool restore = arbiter->inherited_priority != 0U;
+	const UBaseType_t own_priority = arbiter->owner_priority;
+	arbiter->inherited_priority = 0U;
+	core_arbiter_waiter_s *const next = arbiter->waiters;
+	TaskHandle_t next_task = NULL;
+	if (next) {
+		arbiter->waiters = next->next;
+		arbiter->owner = next->task;
+		arbiter->owner_priority = next->priority;
+		next_task = next->task;
+		/* The waiter's stack frame goes away as soon as it sees this, so it is the last thing to touch it */
+		__atomic_store_n(&next->granted, true, __ATOMIC_RELEASE);
+	} else {
+		arbiter->owner = NULL;
+	}
+	xSemaphoreGive(arbiter->lock);
+
+	if (next_task)
+		xTaskNotifyGive(next_task);
+	if (restore)
+		vTaskPrioritySet(NULL, own_priority);
+}
+
+bool core_arbiter_contended(core_arbiter_s *const arbiter)
+{
+	xSemaphoreTake(arbiter->lock, portMAX_DELAY);
+	const bool contended = arbiter->waiters && arbiter->waiters->priority >= arbiter->owner_priority;
+	xSemaphoreGive(arbiter->lock);
+	return contended;
+}
+
+bool core_arbiter_wait_contended(core_arbiter_s *const arbiter, const TickType_t ticks)
+{
+	const TickType_t start = xTaskGetTickCount();
+	while (!core_arbiter_contended(arbiter)) {
+		const TickType_t elapsed = xTaskGetTickCount() - start;
+		if (elapsed >= ticks)
+			return false;
+		/* Left over from a waiter that has since been served, or the real thing: look again either way */
+		xSemaphoreTake(arbiter->contended, ticks - elapsed);
+	}
+	return true;
+}
+
+bool cmd_arbiter(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	const bool clear = argc == 2 && !strcmp(argv[1], "clear");
+	if (argc != 1 && !clear) {
+		gdb_out("usage: monitor arbiter [clear]\n");
+		return false;
+	}
+
+	for (size_t idx = 0; idx < CORE_ARBITER_MAX && core_arbiters[idx]; ++idx) {
+		core_arbiter_s *const arbiter = core_arbiters[idx];
+		if (clear) {
+			memset(&arbiter->stats, 0, sizeof(arbiter->stats));
+			continue;
+		}
+		const core_arbiter_stats_s stats = arbiter->stats;
+		gdb_outf("%s: owned by %s, %" PRIu32 " acquired, %" PRIu32 " waited, %" PRIu32 " us average wait, %" PRIu32
+				 " us longest\n",
+			arbiter->name, arbiter->owner ? pcTaskGetName(arbiter->owner) : "nobody", stats.acquired, stats.waited,
+			stats.waited ? (uint32_t)(stats.wait_us / stats.waited) : 0U, stats.max_wait_us);
+	}
+	if (clear)
+		gdb_out("Arbiter statistics cleared\n");
+	return true;
+}
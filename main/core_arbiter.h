@@ -0,0 +1,64 @@
+#ifndef FARPATCH_CORE_ARBITER_H__
+#define FARPATCH_CORE_ARBITER_H__
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "target.h"
+
+/*
+ * Ownership of a shared resource, such as the BMP core, by one task at a
+ * time. Tasks that have to wait queue up by FreeRTOS priority, first come
+ * first served among equals, and releasing hands ownership straight to the
+ * head of the queue and wakes it. Nobody polls. While a more important task
+ * waits, the owner runs at that task's priority, so a busy task of middling
+ * priority cannot keep both of them waiting.
+ */
+
+typedef struct core_arbiter_waiter core_arbiter_waiter_s;
+
+typedef struct core_arbiter_stats {
+	uint32_t acquired;
+	/* Acquisitions that had to wait for another owner */
+	uint32_t waited;
+	uint64_t wait_us;
+	uint32_t max_wait_us;
+} core_arbiter_stats_s;
+
+typedef struct core_arbiter {
+	const char *name;
+	SemaphoreHandle_t lock;
+	TaskHandle_t owner;
+	/* The owner's own priority, which it gets back on release */
+	UBaseType_t owner_priority;
+	/* Priority the owner was raised to for a more important waiter, 0 if it was not */
+	UBaseType_t inherited_priority;
+	/* Highest priority first */
+	core_arbiter_waiter_s *waiters;
+	/* Given when a task at least as important as the owner starts waiting */
+	SemaphoreHandle_t contended;
+	/* Only ever written by the owner */
+	core_arbiter_stats_s stats;
+} core_arbiter_s;
+
+void core_arbiter_init(core_arbiter_s *arbiter, const char *name);
+
+/* Wait until the calling task owns `arbiter` */
+void core_arbiter_acquire(core_arbiter_s *arbiter);
+bool core_arbiter_try_acquire(core_arbiter_s *arbiter);
+/* Hand ownership to the next waiter, if there is one */
+void core_arbiter_release(core_arbiter_s *arbiter);
+
+/* Whether a task at least as important as the owner is waiting, and so the owner should let go soon */
+bool core_arbiter_contended(core_arbiter_s *arbiter);
+/* Sleep for up to `ticks`, waking early if the owner should let go. Returns core_arbiter_contended(). */
+bool core_arbiter_wait_contended(core_arbiter_s *arbiter, TickType_t ticks);
+
+/* `monitor arbiter [clear]` */
+bool cmd_arbiter(target_s *t, int argc, const char **argv);
+
+#endif /* FARPATCH_CORE_ARBITER_H__ */
@@ -0,0 +1,73 @@
+/*
+ * Gang programming from the GDB monitor. With gang mode on, everything GDB
+ * does to the target on the primary SWD port is repeated on every extra
+ * SWDIO lane, so flashing one board flashes them all. `monitor gang` shows
+ * which lanes are still following along.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "general.h"
+#include "gdb_packet.h"
+#include "swd-gang.h"
+
+#include "gang.h"
+#include "scan_cache.h"
+
+#if GANG_SWDIO_LANES > 0
+
+static bool gang_status(void)
+{
+	swd_gang_status_s status;
+	swd_gang_status(&status);
+
+	gdb_outf("Gang mode is %s, %u extra SWDIO lanes wired, %" PRIu32 " transfers\n", status.enabled ? "on" : "off",
+		GANG_SWDIO_LANES, status.transfers);
+	for (uint32_t lane = 1; lane < SWD_GANG_LANES; ++lane) {
+		if (status.active & (1U << lane))
+			gdb_outf("Lane %" PRIu32 ": in lockstep, %" PRIu32 " reads returned other data\n", lane,
+				status.read_mismatches[lane]);
+		else if (status.dropped & (1U << lane))
+			gdb_outf("Lane %" PRIu32 ": dropped after %" PRIu32 " transfers\n", lane, status.dropped_at[lane]);
+		else
+			gdb_outf("Lane %" PRIu32 ": idle\n", lane);
+	}
+	return true;
+}
+
+bool cmd_gang(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 1)
+		return gang_status();
+
+	if (argc == 2 && !strcmp(argv[1], "on")) {
+		swd_gang_enable(true);
+		scan_cache_invalidate();
+		gdb_out("Gang mode on, reconnect with `monitor swd_scan` to bring every lane along\n");
+		return true;
+	}
+	if (argc == 2 && !strcmp(argv[1], "off")) {
+		swd_gang_enable(false);
+		scan_cache_invalidate();
+		gdb_out("Gang mode off\n");
+		return true;
+	}
+
+	gdb_out("usage: monitor gang [on|off]\n");
+	return false;
+}
+
+#else
+
+bool cmd_gang(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	(void)argc;
+	(void)argv;
+	gdb_out("No gang SWDIO lanes are configured in this build (CONFIG_GANG_SWDIO1_GPIO)\n");
+	return false;
+}
+
+#endif /* GANG_SWDIO_LANES > 0 */
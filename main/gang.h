@@ -0,0 +1,9 @@
+#ifndef FARPATCH_GANG_H__
+#define FARPATCH_GANG_H__
+
+#include "target.h"
+
+/* `monitor gang [on|off]` */
+bool cmd_gang(target_s *t, int argc, const char **argv);
+
+#endif /* FARPATCH_GANG_H__ */
@@ -0,0 +1,479 @@
+/*
+ * Read-through cache of target memory and registers for the GDB server.
+ *
+ * Every time the target stops, GDB reads the same stack frames, locals and
+ * vector tables over and over, and every read is a round trip over Wi-Fi
+ * plus a trip down the wire. While the target is halted, memory inside its
+ * RAM and flash regions is fetched in aligned blocks with a single block
+ * read and kept here, so the repeats are answered from the probe's RAM.
+ *
+ * Registers are cached the same way for as long as the target stays halted.
+ * The full set GDB asks for with `g` is fetched straight after the halt is
+ * seen, while the probe is still talking to the target anyway, and single
+ * registers asked for with `p` are kept one by one, so the FPU registers are
+ * only ever read when GDB wants them.
+ *
+ * The cache wraps the target's own memory and run-control functions, so it
+ * sees BMP's accesses no matter which packet caused them. Resuming, stepping,
+ * resetting or detaching drops everything, writes drop the blocks they
+ * touch, register writes drop the registers, and nothing is cached while
+ * the target runs. Packets that can reach
+ * the target some other way, such as flash programming and monitor commands,
+ * flush the cache before they are handled.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "general.h"
+#include "gdb_packet.h"
+#include "target.h"
+#include "target_internal.h"
+
+#include "gdb_cache.h"
+
+#if defined(CONFIG_GDB_CACHE)
+
+#define GDB_CACHE_BLOCK_SIZE 128U
+#define GDB_CACHE_BLOCKS     CONFIG_GDB_CACHE_BLOCKS
+
+/* Reads bigger than this are bulk transfers that would only evict what GDB keeps coming back to */
+#define GDB_CACHE_MAX_READ ((GDB_CACHE_BLOCKS * GDB_CACHE_BLOCK_SIZE) / 2U)
+
+/* Largest register set kept for `g`, a Cortex-M with FPU needs under 200 bytes */
+#define GDB_CACHE_REGS_SIZE 512U
+/* Single registers are kept by number, up to the size of a double-precision FPU register */
+#define GDB_CACHE_REG_COUNT 96U
+#define GDB_CACHE_REG_SIZE  8U
+
+typedef struct gdb_cache_block {
+	target_addr_t addr;
+	uint32_t last_used;
+	bool valid;
+	uint8_t data[GDB_CACHE_BLOCK_SIZE];
+} gdb_cache_block_s;
+
+typedef struct gdb_cache_stats {
+	uint32_t hits;
+	uint32_t misses;
+	/* Reads passed straight through: target running, outside RAM and flash, or too big */
+	uint32_t uncached;
+	uint32_t flushes;
+	uint32_t reg_hits;
+	uint32_t reg_misses;
+} gdb_cache_stats_s;
+
+typedef struct gdb_cache_reg {
+	/* Zero while not cached */
+	uint8_t size;
+	uint8_t value[GDB_CACHE_REG_SIZE];
+} gdb_cache_reg_s;
+
+/* The target's own functions, called through on a miss */
+typedef struct gdb_cache_stock {
+	void (*mem_read)(target_s *target, void *dest, target_addr_t src, size_t len);
+	void (*mem_write)(target_s *target, target_addr_t dest, const void *src, size_t len);
+	void (*reset)(target_s *target);
+	target_halt_reason_e (*halt_poll)(target_s *target, target_addr_t *watch);
+	void (*halt_resume)(target_s *target, bool step);
+	void (*detach)(target_s *target);
+	void (*regs_read)(target_s *target, void *data);
+	void (*regs_write)(target_s *target, const void *data);
+	size_t (*reg_read)(target_s *target, uint32_t reg, void *data, size_t max);
+	size_t (*reg_write)(target_s *target, uint32_t reg, const void *data, size_t size);
+} gdb_cache_stock_s;
+
+static gdb_cache_block_s gdb_cache_blocks[GDB_CACHE_BLOCKS];
+static uint32_t gdb_cache_clock;
+static gdb_cache_stats_s gdb_cache_stats;
+static gdb_cache_stock_s gdb_cache_stock;
+static target_s *gdb_cache_target;
+static bool gdb_cache_halted;
+static bool gdb_cache_enabled = true;
+
+static uint8_t gdb_cache_regs[GDB_CACHE_REGS_SIZE];
+static bool gdb_cache_regs_valid;
+static gdb_cache_reg_s gdb_cache_reg[GDB_CACHE_REG_COUNT];
+
+static void gdb_cache_flush_regs(void)
+{
+	gdb_cache_regs_valid = false;
+	for (size_t idx = 0; idx < GDB_CACHE_REG_COUNT; ++idx)
+		gdb_cache_reg[idx].size = 0;
+}
+
+static void gdb_cache_flush(void)
+{
+	for (size_t idx = 0; idx < GDB_CACHE_BLOCKS; ++idx)
+		gdb_cache_blocks[idx].valid = false;
+	gdb_cache_flush_regs();
+	++gdb_cache_stats.flushes;
+}
+
+static void gdb_cache_drop_range(const target_addr_t addr, const size_t len)
+{
+	for (size_t idx = 0; idx < GDB_CACHE_BLOCKS; ++idx) {
+		gdb_cache_block_s *const block = &gdb_cache_blocks[idx];
+		if (block->valid && block->addr < addr + len && addr < block->addr + GDB_CACHE_BLOCK_SIZE)
+			block->valid = false;
+	}
+}
+
+/* Only plain memory is cached, peripheral registers may change while the core is halted */
+static bool gdb_cache_cacheable(const target_s *const target, const target_addr_t addr)
+{
+	for (const target_ram_s *ram = target->ram; ram; ram = ram->next) {
+		if (addr >= ram->start && ram->length >= GDB_CACHE_BLOCK_SIZE &&
+			addr - ram->start <= ram->length - GDB_CACHE_BLOCK_SIZE)
+			return true;
+	}
+	for (const target_flash_s *flash = target->flash; flash; flash = flash->next) {
+		if (addr >= flash->start && flash->length >= GDB_CACHE_BLOCK_SIZE &&
+			addr - flash->start <= flash->length - GDB_CACHE_BLOCK_SIZE)
+			return true;
+	}
+	return false;
+}
+
+static const gdb_cache_block_s *gdb_cache_lookup(target_s *const target, const target_addr_t addr)
+{
+	gdb_cache_block_s *victim = &gdb_cache_blocks[0];
+	for (size_t idx = 0; idx < GDB_CACHE_BLOCKS; ++idx) {
+		gdb_cache_block_s *const block = &gdb_cache_blocks[idx];
+		if (block->valid && block->addr == addr) {
+			++gdb_cache_stats.hits;
+			block->last_used = ++gdb_cache_clock;
+			return block;
+		}
+		/* Prefer an empty block, then the least recently used one */
+		if (victim->valid && (!block->valid || block->last_used < victim->last_used))
+			victim = block;
+	}
+
+	if (!gdb_cache_cacheable(target, addr)) {
+		++gdb_cache_stats.uncached;
+		return NULL;
+	}
+
+	++gdb_cache_stats.misses;
+	victim->valid = false;
+	gdb_cache_stock.mem_read(target, victim->data, addr, GDB_CACHE_BLOCK_SIZE);
+	/*
+	 * If the block could not be read, checking cleared the error. Let the
+	 * caller read just what GDB asked for, so the error it sees is its own.
+	 */
+	if (target->check_error && target->check_error(target))
+		return NULL;
+	victim->addr = addr;
+	victim->last_used = ++gdb_cache_clock;
+	victim->valid = true;
+	return victim;
+}
+
+static void gdb_cache_mem_read(target_s *const target, void *const dest, target_addr_t src, size_t len)
+{
+	if (!gdb_cache_enabled || !gdb_cache_halted || len > GDB_CACHE_MAX_READ) {
+		++gdb_cache_stats.uncached;
+		gdb_cache_stock.mem_read(target, dest, src, len);
+		return;
+	}
+
+	uint8_t *out = (uint8_t *)dest;
+	while (len) {
+		const target_addr_t base = src & ~(target_addr_t)(GDB_CACHE_BLOCK_SIZE - 1U);
+		const size_t offset = src - base;
+		const size_t chunk = MIN(len, GDB_CACHE_BLOCK_SIZE - offset);
+		const gdb_cache_block_s *const block = gdb_cache_lookup(target, base);
+		if (block)
+			memcpy(out, block->data + offset, chunk);
+		else
+			gdb_cache_stock.mem_read(target, out, src, chunk);
+		out += chunk;
+		src += chunk;
+		len -= chunk;
+	}
+}
+
+static void gdb_cache_mem_write(
+	target_s *const target, const target_addr_t dest, const void *const src, const size_t len)
+{
+	gdb_cache_drop_range(dest, len);
+	gdb_cache_stock.mem_write(target, dest, src, len);
+}
+
+static bool gdb_cache_regs_cacheable(const target_s *const target)
+{
+	return gdb_cache_enabled && gdb_cache_halted && target->regs_size <= GDB_CACHE_REGS_SIZE;
+}
+
+/* Fetch the register set for `g`, returns false if it could not be read */
+static bool gdb_cache_regs_fill(target_s *const target)
+{
+	gdb_cache_stock.regs_read(target, gdb_cache_regs);
+	gdb_cache_regs_valid = !target->check_error || !target->check_error(target);
+	return gdb_cache_regs_valid;
+}
+
+static void gdb_cache_regs_read(target_s *const target, void *const data)
+{
+	if (!gdb_cache_regs_cacheable(target)) {
+		gdb_cache_stock.regs_read(target, data);
+		return;
+	}
+	if (gdb_cache_regs_valid)
+		++gdb_cache_stats.reg_hits;
+	else {
+		++gdb_cache_stats.reg_misses;
+		/* Read again so the error is left for the caller to find */
+		if (!gdb_cache_regs_fill(target)) {
+			gdb_cache_stock.regs_read(target, data);
+			return;
+		}
+	}
+	memcpy(data, gdb_cache_regs, target->regs_size);
+}
+
+static void gdb_cache_regs_write(target_s *const target, const void *const data)
+{
+	gdb_cache_flush_regs();
+	gdb_cache_stock.regs_write(target, data);
+}
+
+static size_t gdb_cache_reg_read(target_s *const target, const uint32_t reg, void *const data, const size_t max)
+{
+	if (!gdb_cache_regs_cacheable(target) || reg >= GDB_CACHE_REG_COUNT)
+		return gdb_cache_stock.reg_read(target, reg, data, max);
+
+	gdb_cache_reg_s *const entry = &gdb_cache_reg[reg];
+	if (entry->size && entry->size <= max) {
+		++gdb_cache_stats.reg_hits;
+		memcpy(data, entry->value, entry->size);
+		return entry->size;
+	}
+
+	++gdb_cache_stats.reg_misses;
+	const size_t size = gdb_cache_stock.reg_read(target, reg, data, max);
+	if (size && size <= GDB_CACHE_REG_SIZE) {
+		memcpy(entry->value, data, size);
+		entry->size = size;
+	}
+	return size;
+}
+
+static size_t gdb_cache_reg_write(target_s *const target, const uint32_t reg, const void *const data, const size_t size)
+{
+	/* Special registers may be packed together, so one write can change what others read back */
+	gdb_cache_flush_regs();
+	return gdb_cache_stock.reg_write(target, reg, data, size);
+}
+
+static void gdb_cache_reset(target_s *const target)
+{
+	gdb_cache_halted = false;
+	gdb_cache_flush();
+	gdb_cache_stock.reset(target);
+}
+
+static target_halt_reason_e gdb_cache_halt_poll(target_s *const target, target_addr_t *const watch)
+{
+	const target_halt_reason_e reason = gdb_cache_stock.halt_poll(target, watch);
+	if (reason == TARGET_HALT_RUNNING || reason == TARGET_HALT_ERROR || gdb_cache_halted)
+		return reason;
+
+	gdb_cache_halted = true;
+	/* GDB asks for the registers as soon as it hears about the stop, have them ready */
+	if (gdb_cache_stock.regs_read && gdb_cache_regs_cacheable(target))
+		gdb_cache_regs_fill(target);
+	return reason;
+}
+
+static void gdb_cache_halt_resume(target_s *const target, const bool step)
+{
+	gdb_cache_halted = false;
+	gdb_cache_flush();
+	gdb_cache_stock.halt_resume(target, step);
+}
+
+static void gdb_cache_detach(target_s *const target)
+{
+	gdb_cache_halted = false;
+	gdb_cache_flush();
+	gdb_cache_stock.detach(target);
+}
+
+static bool gdb_cache_target_exists(const target_s *const target)
+{
+	for (const target_s *iter = target_list; iter; iter = iter->next) {
+		if (iter == target)
+			return true;
+	}
+	return false;
+}
+
+/* Put back the target's own functions, if it has not been freed in the meantime */
+static void gdb_cache_uninstall(void)
+{
+	target_s *const target = gdb_cache_target;
+	gdb_cache_target = NULL;
+	if (!target || !gdb_cache_target_exists(target) || target->mem_read != gdb_cache_mem_read)
+		return;
+	target->mem_read = gdb_cache_stock.mem_read;
+	target->mem_write = gdb_cache_stock.mem_write;
+	if (gdb_cache_stock.reset)
+		target->reset = gdb_cache_stock.reset;
+	if (gdb_cache_stock.halt_poll)
+		target->halt_poll = gdb_cache_stock.halt_poll;
+	if (gdb_cache_stock.halt_resume)
+		target->halt_resume = gdb_cache_stock.halt_resume;
+	if (gdb_cache_stock.detach)
+		target->detach = gdb_cache_stock.detach;
+	if (gdb_cache_stock.regs_read)
+		target->regs_read = gdb_cache_stock.regs_read;
+	if (gdb_cache_stock.regs_write)
+		target->regs_write = gdb_cache_stock.regs_write;
+	if (gdb_cache_stock.reg_read)
+		target->reg_read = gdb_cache_stock.reg_read;
+	if (gdb_cache_stock.reg_write)
+		target->reg_write = gdb_cache_stock.reg_write;
+}
+
+void gdb_cache_install(target_s *const target)
+{
+	if (target && target == gdb_cache_target && target->mem_read == gdb_cache_mem_read)
+		return;
+
+	gdb_cache_uninstall();
+	gdb_cache_flush();
+	/* Targets are halted once attached; if they are set running, the resume goes through us */
+	gdb_cache_halted = true;
+	if (!target || !target->mem_read || !target->mem_write)
+		return;
+
+	gdb_cache_stock = (gdb_cache_stock_s){
+		.mem_read = target->mem_read,
+		.mem_write = target->mem_write,
+		.reset = target->reset,
+		.halt_poll = target->halt_poll,
+		.halt_resume = target->halt_resume,
+		.detach = target->detach,
+		.regs_read = target->regs_read,
+		.regs_write = target->regs_write,
+		.reg_read = target->reg_read,
+		.reg_write = target->reg_write,
+	};
+	target->mem_read = gdb_cache_mem_read;
+	target->mem_write = gdb_cache_mem_write;
+	if (target->reset)
+		target->reset = gdb_cache_reset;
+	if (target->halt_poll)
+		target->halt_poll = gdb_cache_halt_poll;
+	if (target->halt_resume)
+		target->halt_resume = gdb_cache_halt_resume;
+	if (target->detach)
+		target->detach = gdb_cache_detach;
+	/* Writes are only hooked alongside reads, so nothing cached can go stale */
+	if (target->regs_read && target->regs_write) {
+		target->regs_read = gdb_cache_regs_read;
+		target->regs_write = gdb_cache_regs_write;
+	}
+	if (target->reg_read && target->reg_write) {
+		target->reg_read = gdb_cache_reg_read;
+		target->reg_write = gdb_cache_reg_write;
+	}
+	gdb_cache_target = target;
+}
+
+void gdb_cache_packet(const gdb_packet_s *const packet)
+{
+	switch (packet->data[0]) {
+	/* Reads, and breakpoints, which write memory through the target and so are seen anyway */
+	case 'm':
+	case 'x':
+	case 'g':
+	case 'p':
+	case '?':
+	case 'H':
+	case 'T':
+	case 'z':
+	case 'Z':
+		return;
+	/* Queries only read, except for monitor commands which can do anything */
+	case 'q':
+		if (strncmp(packet->data, "qRcmd,", 6U) != 0)
+			return;
+		break;
+	default:
+		break;
+	}
+	gdb_cache_flush();
+}
+
+static bool gdb_cache_status(void)
+{
+	size_t used = 0;
+	for (size_t idx = 0; idx < GDB_CACHE_BLOCKS; ++idx)
+		used += gdb_cache_blocks[idx].valid;
+
+	const uint32_t lookups = gdb_cache_stats.hits + gdb_cache_stats.misses;
+	gdb_outf("Target cache is %s, target is %s\n", gdb_cache_enabled ? "on" : "off",
+		gdb_cache_halted ? "halted" : "running");
+	gdb_outf("Memory: %u of %u blocks of %u bytes in use, %" PRIu32 " hits, %" PRIu32 " misses (%" PRIu32
+			 "%% hit rate)\n",
+		(unsigned)used, GDB_CACHE_BLOCKS, GDB_CACHE_BLOCK_SIZE, gdb_cache_stats.hits, gdb_cache_stats.misses,
+		lookups ? (gdb_cache_stats.hits * 100U) / lookups : 0U);
+	gdb_outf("%" PRIu32 " uncached reads, %" PRIu32 " flushes\n", gdb_cache_stats.uncached, gdb_cache_stats.flushes);
+	gdb_outf("Registers: %" PRIu32 " hits, %" PRIu32 " misses\n", gdb_cache_stats.reg_hits, gdb_cache_stats.reg_misses);
+	return true;
+}
+
+bool cmd_cache(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 1)
+		return gdb_cache_status();
+
+	if (argc == 2 && !strcmp(argv[1], "on")) {
+		gdb_cache_flush();
+		gdb_cache_enabled = true;
+		gdb_out("Target cache on\n");
+		return true;
+	}
+	if (argc == 2 && !strcmp(argv[1], "off")) {
+		gdb_cache_enabled = false;
+		gdb_cache_flush();
+		gdb_out("Target cache off\n");
+		return true;
+	}
+	if (argc == 2 && !strcmp(argv[1], "clear")) {
+		gdb_cache_flush();
+		memset(&gdb_cache_stats, 0, sizeof(gdb_cache_stats));
+		gdb_out("Target cache cleared\n");
+		return true;
+	}
+
+	gdb_out("usage: monitor cache [on|off|clear]\n");
+	return false;
+}
+
+#else
+
+void gdb_cache_install(target_s *target)
+{
+	(void)target;
+}
+
+void gdb_cache_packet(const gdb_packet_s *packet)
+{
+	(void)packet;
+}
+
+bool cmd_cache(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	(void)argc;
+	(void)argv;
+	gdb_out("Target cache support is not enabled in this build (CONFIG_GDB_CACHE)\n");
+	return false;
+}
+
+#endif /* CONFIG_GDB_CACHE */
@@ -0,0 +1,16 @@
+#ifndef FARPATCH_GDB_CACHE_H__
+#define FARPATCH_GDB_CACHE_H__
+
+#include "gdb_packet.h"
+#include "target.h"
+
+/* Serve repeated reads of `target` from the cache while it is halted. Call whenever cur_target changes. */
+void gdb_cache_install(target_s *target);
+
+/* Drop everything that `packet` could change behind the cache's back. Call before handing it to gdb_main(). */
+void gdb_cache_packet(const gdb_packet_s *packet);
+
+/* `monitor cache [on|off|clear]` */
+bool cmd_cache(target_s *t, int argc, const char **argv);
+
+#endif /* FARPATCH_GDB_CACHE_H__ */
@@ -35,8 +35,11 @@
 #include <freertos/timers.h>
 
 #include "gdb_if.h"
+#include "gdb_main.h"
 #include "gdb_main_farpatch.h"
 #include "gdb_packet.h"
+#include "gdb_rsp.h"
+#include "rsp_capture.h"
 
 #include "exception.h"
 #include "general.h"
@@ -49,23 +52,51 @@
 #define GDB_TLS_INDEX     1
 #define EXCEPTION_NETWORK 0x40
 
-static IRAM_ATTR unsigned char gdb_wifi_if_getchar(struct gdb_wifi_instance *instance)
+/* Target memory read per step when answering `m`, small enough to live on the stack */
+#define GDB_IF_READ_CHUNK 256U
+
+IRAM_ATTR bool verify_magic(struct gdb_wifi_instance *bmp)
+{
+	assert(bmp->magic == 0x55239912);
+	return bmp->magic == 0x55239912;
+}
+
+static inline struct gdb_wifi_instance *gdb_if_instance(void)
+{
+	struct gdb_wifi_instance *const instance = pvTaskGetThreadLocalStoragePointer(NULL, GDB_TLS_INDEX);
+	assert(instance);
+	return instance;
+}
+
+/* Make sure there is something in the receive buffer, returns false if the connection is going away */
+static IRAM_ATTR bool gdb_wifi_if_fill(struct gdb_wifi_instance *instance)
 {
 	if (instance->is_shutting_down) {
-		return 0;
+		return false;
 	}
 
 	if (instance->rx_bufpos < instance->rx_bufsize) {
-		return instance->rx_buf[instance->rx_bufpos++];
+		return true;
 	}
 
 	instance->rx_bufpos = 0;
-	instance->rx_bufsize = recv(instance->sock, instance->rx_buf, sizeof(instance->rx_buf), 0);
-	if (instance->rx_bufsize <= 0) {
+	instance->rx_bufsize = 0;
+	const int ret = recv(instance->sock, instance->rx_buf, sizeof(instance->rx_buf), 0);
+	if (ret <= 0) {
 		instance->is_shutting_down = true;
 		close(instance->sock);
-		raise_exception(EXCEPTION_NETWORK, "error on getchar");
+		raise_exception(EXCEPTION_NETWORK, "error on recv");
 		// should not be reached
+		return false;
+	}
+	rsp_capture(RSP_CAPTURE_FROM_GDB, instance->sock, instance->rx_buf, ret);
+	instance->rx_bufsize = ret;
+	return true;
+}
+
+static IRAM_ATTR unsigned char gdb_wifi_if_getchar(struct gdb_wifi_instance *instance)
+{
+	if (!gdb_wifi_if_fill(instance)) {
 		return 0;
 	}
 	return instance->rx_buf[instance->rx_bufpos++];
@@ -76,6 +107,9 @@ static IRAM_ATTR unsigned char gdb_wifi_if_getchar_to(struct gdb_wifi_instance *
 	if (instance->is_shutting_down) {
 		return 0xff;
 	}
+	if (instance->rx_bufpos < instance->rx_bufsize) {
+		return instance->rx_buf[instance->rx_bufpos++];
+	}
 	fd_set fds;
 	struct timeval tv;
 
@@ -99,57 +133,193 @@ static IRAM_ATTR unsigned char gdb_wifi_if_getchar_to(struct gdb_wifi_instance *
 	return 0xFF;
 }
 
-static IRAM_ATTR void gdb_wifi_if_putchar(struct gdb_wifi_instance *instance, unsigned char c, int flush)
+static IRAM_ATTR void gdb_wifi_if_send(struct gdb_wifi_instance *instance, const void *buf, size_t len)
 {
-	// ESP_LOGI("putchar", "instance: %p putting: %c (%d?) %d/%d", instance, c, flush, instance->tx_bufsize, sizeof(instance->tx_buf));
-	if (instance->is_shutting_down) {
+	if (instance->sock <= 0) {
 		return;
 	}
-
-	instance->tx_buf[instance->tx_bufsize++] = c;
-	if (flush || (instance->tx_bufsize >= sizeof(instance->tx_buf))) {
-		if (instance->sock > 0) {
-			int ret = send(instance->sock, instance->tx_buf, instance->tx_bufsize, 0);
-			if (ret <= 0) {
-				instance->is_shutting_down = true;
-				close(instance->sock);
-				raise_exception(EXCEPTION_NETWORK, "error on putchar");
-				// should not be reached
-				return;
-			}
+	const uint8_t *data = buf;
+	while (len) {
+		const int ret = send(instance->sock, data, len, 0);
+		if (ret <= 0) {
+			instance->is_shutting_down = true;
+			close(instance->sock);
+			raise_exception(EXCEPTION_NETWORK, "error on send");
+			// should not be reached
+			return;
 		}
-		instance->tx_bufsize = 0;
+		rsp_capture(RSP_CAPTURE_TO_GDB, instance->sock, data, ret);
+		data += ret;
+		len -= ret;
 	}
 }
 
-IRAM_ATTR bool verify_magic(struct gdb_wifi_instance *bmp)
+static IRAM_ATTR void gdb_wifi_if_write(struct gdb_wifi_instance *instance, const void *buf, size_t len, bool flush)
 {
-	assert(bmp->magic == 0x55239912);
-	return bmp->magic == 0x55239912;
+	if (instance->is_shutting_down) {
+		return;
+	}
+
+	const uint8_t *data = buf;
+	// Big writes go straight from the caller's buffer once what is queued is out
+	if (instance->tx_bufsize + len > sizeof(instance->tx_buf)) {
+		gdb_wifi_if_send(instance, instance->tx_buf, instance->tx_bufsize);
+		instance->tx_bufsize = 0;
+		if (len >= sizeof(instance->tx_buf)) {
+			gdb_wifi_if_send(instance, data, len);
+			return;
+		}
+	}
+
+	memcpy(instance->tx_buf + instance->tx_bufsize, data, len);
+	instance->tx_bufsize += len;
+	if (flush || (instance->tx_bufsize >= sizeof(instance->tx_buf))) {
+		gdb_wifi_if_send(instance, instance->tx_buf, instance->tx_bufsize);
+		instance->tx_bufsize = 0;
+	}
 }
 
+// The per-byte calls are BMP's and happen for every byte of every packet, so they
+// skip the magic check that the block calls do once per call.
 IRAM_ATTR unsigned char gdb_if_getchar_to(int timeout)
 {
-	void *ptr = pvTaskGetThreadLocalStoragePointer(NULL, GDB_TLS_INDEX);
-	assert(ptr);
-	verify_magic(ptr);
-	return gdb_wifi_if_getchar_to(ptr, timeout);
+	return gdb_wifi_if_getchar_to(gdb_if_instance(), timeout);
 }
 
 IRAM_ATTR unsigned char gdb_if_getchar(void)
 {
-	void *ptr = pvTaskGetThreadLocalStoragePointer(NULL, GDB_TLS_INDEX);
-	assert(ptr);
-	verify_magic(ptr);
-	return gdb_wifi_if_getchar(ptr);
+	return gdb_wifi_if_getchar(gdb_if_instance());
 }
 
 IRAM_ATTR void gdb_if_putchar(unsigned char c, int flush)
 {
-	void *ptr = pvTaskGetThreadLocalStoragePointer(NULL, GDB_TLS_INDEX);
-	assert(ptr);
-	verify_magic(ptr);
-	gdb_wifi_if_putchar(ptr, c, flush);
+	gdb_wifi_if_write(gdb_if_instance(), &c, 1, flush);
+}
+
+IRAM_ATTR size_t gdb_if_read(void *buf, size_t len)
+{
+	struct gdb_wifi_instance *const instance = gdb_if_instance();
+	verify_magic(instance);
+	if (!len || !gdb_wifi_if_fill(instance)) {
+		return 0;
+	}
+	const size_t count = MIN(len, (size_t)(instance->rx_bufsize - instance->rx_bufpos));
+	memcpy(buf, instance->rx_buf + instance->rx_bufpos, count);
+	instance->rx_bufpos += count;
+	return count;
+}
+
+IRAM_ATTR void gdb_if_write(const void *buf, size_t len, bool flush)
+{
+	struct gdb_wifi_instance *const instance = gdb_if_instance();
+	verify_magic(instance);
+	gdb_wifi_if_write(instance, buf, len, flush);
+}
+
+/*
+ * Receive the next packet straight out of the socket buffer. Runs of bytes
+ * are scanned, unescaped and checksummed a buffer at a time, and only the
+ * bytes of this packet are consumed, so a ^C right behind it is left for
+ * the next read.
+ */
+IRAM_ATTR const gdb_packet_s *gdb_if_packet_receive(void)
+{
+	struct gdb_wifi_instance *const instance = gdb_if_instance();
+	verify_magic(instance);
+	gdb_packet_s *const packet = &instance->gdb_packet;
+	gdb_rsp_parser_s parser;
+	gdb_rsp_parser_init(&parser, packet->data, sizeof(packet->data) - 1U);
+
+	while (true) {
+		if (!gdb_wifi_if_fill(instance)) {
+			raise_exception(EXCEPTION_NETWORK, "connection closed");
+		}
+		size_t used = 0;
+		const gdb_rsp_result_e result = gdb_rsp_parse(&parser, (const char *)instance->rx_buf + instance->rx_bufpos,
+			instance->rx_bufsize - instance->rx_bufpos, &used);
+		instance->rx_bufpos += used;
+
+		switch (result) {
+		case GDB_RSP_MORE:
+			break;
+		case GDB_RSP_BAD_PACKET:
+			if (!instance->no_ack_mode) {
+				gdb_wifi_if_write(instance, "-", 1, true);
+			}
+			break;
+		case GDB_RSP_TOO_LONG: {
+			// A NACK would only get the same packet again, and again. Take it and refuse it instead.
+			char reply[8];
+			if (!instance->no_ack_mode) {
+				gdb_wifi_if_write(instance, "+", 1, false);
+			}
+			gdb_wifi_if_write(instance, reply, gdb_rsp_frame(reply, sizeof(reply), "E01", 3U), true);
+			break;
+		}
+		case GDB_RSP_PACKET:
+			if (!instance->no_ack_mode) {
+				gdb_wifi_if_write(instance, "+", 1, true);
+			}
+			// The request itself is still acknowledged, nothing after it is
+			if (!strcmp(packet->data, "QStartNoAckMode")) {
+				instance->no_ack_mode = true;
+			}
+			packet->size = parser.size;
+			return packet;
+		case GDB_RSP_OUT_OF_BAND:
+			packet->size = parser.size;
+			return packet;
+		}
+	}
+}
+
+/*
+ * Answer `m` straight out of the transmit buffer. BMP reads the whole
+ * request into a buffer on its stack, hex-encodes that into a second one and
+ * then hands the packet over a byte at a time, each byte copied again into
+ * tx_buf. Here target memory is read a chunk at a time and hex-encoded
+ * directly into the frame that goes to send(). Hex digits never need
+ * escaping, so the frame is built without looking for anything to escape.
+ */
+IRAM_ATTR bool gdb_if_packet_read_memory(const gdb_packet_s *const packet)
+{
+	uint32_t addr;
+	uint32_t len;
+	if (packet->data[0] != 'm' || !cur_target || sscanf(packet->data, "m%" SCNx32 ",%" SCNx32, &addr, &len) != 2) {
+		return false;
+	}
+
+	struct gdb_wifi_instance *const instance = gdb_if_instance();
+	verify_magic(instance);
+	/* `$`, the digits and `#cs` have to fit in one buffer, anything else is BMP's to refuse */
+	if (!len || len > (sizeof(instance->tx_buf) - 4U) / 2U) {
+		return false;
+	}
+	if (instance->tx_bufsize) {
+		gdb_wifi_if_send(instance, instance->tx_buf, instance->tx_bufsize);
+		instance->tx_bufsize = 0;
+	}
+
+	char *const frame = (char *)instance->tx_buf;
+	size_t pos = 0;
+	frame[pos++] = '$';
+	uint8_t chunk[GDB_IF_READ_CHUNK];
+	for (uint32_t done = 0; done < len;) {
+		const size_t count = MIN(len - done, sizeof(chunk));
+		/* Nothing has gone out yet, so BMP can read it again and report the error its own way */
+		if (target_mem32_read(cur_target, chunk, addr + done, count)) {
+			return false;
+		}
+		hexify(frame + pos, chunk, count);
+		pos += count * 2U;
+		done += count;
+	}
+	const uint8_t checksum = gdb_rsp_checksum(frame + 1U, pos - 1U);
+	frame[pos++] = '#';
+	frame[pos++] = hex_digit(checksum >> 4U);
+	frame[pos++] = hex_digit(checksum & 0xfU);
+	gdb_wifi_if_send(instance, frame, pos);
+	return true;
 }
 
 IRAM_ATTR void gdb_target_printf(struct target_controller *tc, const char *fmt, va_list ap)
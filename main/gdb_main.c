@@ -9,39 +9,158 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 
+#include "autotune.h"
+#include "core_arbiter.h"
 #include "cortexm.h"
 #include "exception.h"
+#include "gdb_cache.h"
 #include "gdb_if.h"
 #include "gdb_main_farpatch.h"
 #include "gdb_main.h"
 #include "gdb_packet.h"
 #include "general.h"
 #include "morse.h"
+#include "net_reactor.h"
 #include "platform.h"
+#include "rsp_capture.h"
 #include "rtt.h"
+#include "rtt_engine.h"
+#include "scan_cache.h"
+#include "swd-transfer.h"
 #include "target.h"
 #include "target_internal.h"
+#include "wire-engine.h"
+
+// BMP sizes the buffer for `m` data on the stack by the request, so the stack grows with the packet size
+#define GDB_TASK_STACK_SIZE (5000 + GDB_PACKET_BUFFER_SIZE / 2)
+
+/* Held by BMP and the web server around target accesses */
+static core_arbiter_s bmp_core_arbiter;
+/* Held for a whole GDB session, or by the RTT monitor while no client wants the target */
+static core_arbiter_s gdb_session_arbiter;
+
+/*
+ * While the target runs, its halt status is polled quickly at first, so that
+ * steps and short runs come back at once. The polls then get further and
+ * further apart. RTT is polled as often as it asks to be. In between, the
+ * task sleeps.
+ */
+#define GDB_HALT_POLL_MIN_MS 1U
+#define GDB_HALT_POLL_MAX_MS CONFIG_GDB_HALT_POLL_MAX_MS
+
+typedef struct gdb_run_schedule {
+	uint32_t halt_poll_ms;
+	uint32_t next_halt_poll;
+	uint32_t next_rtt_poll;
+} gdb_run_schedule_s;
+
+static inline bool gdb_time_reached(const uint32_t now, const uint32_t when)
+{
+	return (int32_t)(now - when) >= 0;
+}
 
-static SemaphoreHandle_t bmp_core_mutex = NULL;
-static volatile int num_clients;
-static volatile bool gdb_is_free = true;
+/* Poll straight away and speed back up, after a resume or a halt request */
+static void gdb_run_schedule_reset(gdb_run_schedule_s *const schedule)
+{
+	const uint32_t now = platform_time_ms();
+	schedule->halt_poll_ms = GDB_HALT_POLL_MIN_MS;
+	schedule->next_halt_poll = now;
+	schedule->next_rtt_poll = now;
+}
 
-uint32_t poll_rtt_ms(void);
+/* Whether the halt status is due for a poll. If it is, the next one is pushed further out. */
+static bool gdb_run_schedule_halt(gdb_run_schedule_s *const schedule, const uint32_t now)
+{
+	if (!gdb_time_reached(now, schedule->next_halt_poll)) {
+		return false;
+	}
+	schedule->next_halt_poll = now + schedule->halt_poll_ms;
+	schedule->halt_poll_ms = MIN(schedule->halt_poll_ms * 2U, GDB_HALT_POLL_MAX_MS);
+	return true;
+}
 
-void bmp_core_lock(void)
+static void gdb_run_schedule_rtt(gdb_run_schedule_s *const schedule, target_s *const target, const uint32_t now)
 {
-	while (!xSemaphoreTake(bmp_core_mutex, pdMS_TO_TICKS(300))) {
-		ESP_LOGE("gdb", "Failed to take BMP core mutex after 300 ms! Trying again...");
+	if (!rtt_enabled || !gdb_time_reached(now, schedule->next_rtt_poll)) {
+		return;
 	}
+	rtt_engine_poll(target);
+	schedule->next_rtt_poll = platform_time_ms() + MAX(rtt_engine_poll_ms(), 1U);
 }
 
-void bmp_core_unlock(void)
+/* How long the task may sleep before something is due */
+static uint32_t gdb_run_schedule_idle_ms(const gdb_run_schedule_s *const schedule)
+{
+	const uint32_t now = platform_time_ms();
+	uint32_t next = schedule->next_halt_poll;
+	if (rtt_enabled && !gdb_time_reached(schedule->next_rtt_poll, next)) {
+		next = schedule->next_rtt_poll;
+	}
+	return gdb_time_reached(now, next) ? 0U : next - now;
+}
+
+#if defined(CONFIG_GDB_PERSISTENT_SESSION)
+/*
+ * When a GDB client drops off the network, the target it had attached is
+ * kept for a grace period instead of being freed. The next client that
+ * connects in that time picks up the attached target, with its breakpoints
+ * and probe settings, and does not need to scan for it again.
+ */
+static volatile bool gdb_session_parked;
+
+/* Called by a new client once it owns the session */
+static void gdb_session_adopt(void)
+{
+	if (__atomic_exchange_n(&gdb_session_parked, false, __ATOMIC_ACQ_REL)) {
+		ESP_LOGI("gdb", "reusing the target left attached by the last client");
+	}
+}
+
+/*
+ * Hold on to the session and the attached target until the next client
+ * asks for them. Returns true if one did, in which case the session now
+ * belongs to that client. Returns false if the grace period ran out, with
+ * the session still owned by the caller.
+ */
+static bool gdb_session_park(void)
 {
-	if (xSemaphoreGive(bmp_core_mutex) != pdTRUE) {
-		ESP_LOGE("gdb", "Failed to give BMP core mutex!");
+	if (!cur_target) {
+		return false;
+	}
+
+	ESP_LOGI("gdb", "keeping the target attached for %d ms", CONFIG_GDB_SESSION_GRACE_MS);
+	__atomic_store_n(&gdb_session_parked, true, __ATOMIC_RELEASE);
+	// The RTT monitor waits at a lower priority and does not count, another GDB client does
+	if (!core_arbiter_wait_contended(&gdb_session_arbiter, pdMS_TO_TICKS(CONFIG_GDB_SESSION_GRACE_MS))) {
+		__atomic_store_n(&gdb_session_parked, false, __ATOMIC_RELEASE);
+		ESP_LOGI("gdb", "no client came back, releasing the target");
+		return false;
 	}
+	core_arbiter_release(&gdb_session_arbiter);
+	return true;
+}
+#else
+static inline void gdb_session_adopt(void)
+{
+}
+
+static inline bool gdb_session_park(void)
+{
+	return false;
+}
+#endif
+
+void bmp_core_lock(void)
+{
+	core_arbiter_acquire(&bmp_core_arbiter);
+}
+
+void bmp_core_unlock(void)
+{
+	core_arbiter_release(&bmp_core_arbiter);
 }
 
 bool verify_magic(struct gdb_wifi_instance *bmp);
@@ -67,15 +186,25 @@ struct exception **get_innermost_exception(void)
 	return (struct exception **)pvTaskGetThreadLocalStoragePointer(NULL, EXCEPTION_TLS_INDEX);
 }
 
+// With large packets an instance is several times the packet size, so keep it
+// out of internal RAM when there is PSRAM to put it in.
+static struct gdb_wifi_instance *gdb_wifi_instance_alloc(void)
+{
+	struct gdb_wifi_instance *instance =
+		heap_caps_malloc_prefer(sizeof(struct gdb_wifi_instance), 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_DEFAULT);
+	if (instance) {
+		memset(instance, 0, sizeof(*instance));
+	}
+	return instance;
+}
+
 static void gdb_wifi_destroy(struct gdb_wifi_instance *instance)
 {
 	ESP_LOGI("gdb", "destroy %d", instance->sock);
-	num_clients -= 1;
 
 	if (instance->sock != -1) {
 		close(instance->sock);
 	}
-	gdb_is_free = true;
 
 	free(instance);
 	vTaskDelete(NULL);
@@ -116,12 +245,9 @@ static void IRAM_ATTR gdb_wifi_task(void *arg)
 	setsockopt(instance->sock, IPPROTO_TCP, TCP_KEEPCNT, (void *)&opt, sizeof(opt));
 	opt = 1;
 
-	num_clients += 1;
-
-	while (!gdb_is_free) {
-		platform_delay(10);
-	}
-	gdb_is_free = false;
+	core_arbiter_acquire(&gdb_session_arbiter);
+	gdb_session_adopt();
+	rsp_capture(RSP_CAPTURE_CONNECT, instance->sock, NULL, 0);
 
 	if (gdb_target_running && cur_target) {
 		target_halt_request(cur_target);
@@ -134,28 +260,38 @@ static void IRAM_ATTR gdb_wifi_task(void *arg)
 		TRY(EXCEPTION_ALL)
 		{
 			SET_IDLE_STATE(false);
+			gdb_run_schedule_s schedule;
+			gdb_run_schedule_reset(&schedule);
 			while (gdb_target_running && cur_target) {
-				gdb_poll_target();
-
-				// Check again, as `gdb_poll_target()` may
-				// alter these variables.
-				if (!gdb_target_running || !cur_target) {
-					break;
+				const uint32_t now = platform_time_ms();
+				if (gdb_run_schedule_halt(&schedule, now)) {
+					gdb_poll_target();
+
+					// Check again, as `gdb_poll_target()` may
+					// alter these variables.
+					if (!gdb_target_running || !cur_target) {
+						break;
+					}
 				}
-				char c = (char)gdb_if_getchar_to(0);
+				gdb_run_schedule_rtt(&schedule, cur_target, now);
+
+				// Sleep in select() until GDB sends something or the next poll is due
+				char c = (char)gdb_if_getchar_to(gdb_run_schedule_idle_ms(&schedule));
 				if (c == '\x03' || c == '\x04') {
 					target_halt_request(cur_target);
+					gdb_run_schedule_reset(&schedule);
 				}
-				if (rtt_enabled)
-					poll_rtt(cur_target);
 			}
 
 			SET_IDLE_STATE(true);
-			const gdb_packet_s *const packet = gdb_packet_receive();
+			const gdb_packet_s *const packet = gdb_if_packet_receive();
 			// If port closed and target detached, stay idle
 			if (packet->data[0] != '\x04' || cur_target)
 				SET_IDLE_STATE(false);
-			gdb_main(packet);
+			if (!scan_cache_packet(packet) && !gdb_if_packet_read_memory(packet)) {
+				gdb_cache_packet(packet);
+				gdb_main(packet);
+			}
 			// If the target changes, re-update the vectors.
 			if (cur_target != prev_target) {
 				uint32_t vectors_to_disable = 0
@@ -169,6 +305,9 @@ static void IRAM_ATTR gdb_wifi_task(void *arg)
 				if (vectors_to_disable) {
 					cortexm_vector_disable(cur_target, vectors_to_disable);
 				}
+				swdptap_transfer_install(cur_target);
+				gdb_cache_install(cur_target);
+				autotune_apply(cur_target);
 				prev_target = cur_target;
 			}
 		}
@@ -176,15 +315,18 @@ static void IRAM_ATTR gdb_wifi_task(void *arg)
 		{
 		case EXCEPTION_NETWORK:
 			ESP_LOGE("gdb", "network exception -- exiting: %s", exception_frame.msg);
-			TRY(EXCEPTION_ALL)
-			{
-				target_list_free();
-			}
-			CATCH()
-			{
-			default:
-				ESP_LOGE("gdb", "exception freeing target list");
-				break;
+			if (!gdb_session_park()) {
+				TRY(EXCEPTION_ALL)
+				{
+					scan_cache_release();
+				}
+				CATCH()
+				{
+				default:
+					ESP_LOGE("gdb", "exception freeing target list");
+					break;
+				}
+				core_arbiter_release(&gdb_session_arbiter);
 			}
 			gdb_wifi_destroy(instance);
 			return;
@@ -201,49 +343,45 @@ static void new_gdb_wifi_instance(int sock)
 	char name[CONFIG_FREERTOS_MAX_TASK_NAME_LEN];
 	snprintf(name, sizeof(name) - 1, "gdbc fd:%" PRId16, sock);
 
-	struct gdb_wifi_instance *instance = malloc(sizeof(struct gdb_wifi_instance));
+	struct gdb_wifi_instance *instance = gdb_wifi_instance_alloc();
 	if (!instance) {
+		ESP_LOGE("gdb", "no memory for a new client");
+		close(sock);
 		return;
 	}
 
-	memset(instance, 0, sizeof(*instance));
 	instance->sock = sock;
 	instance->magic = 0x55239912;
 
-	// Ensure the wifi task goes on the last available core. This ensures that
-	// the GPIO routines end up on the same core every time.
-	xTaskCreatePinnedToCore(
-		gdb_wifi_task, name, 5000, (void *)instance, tskIDLE_PRIORITY + 2, &instance->pid, configNUMBER_OF_CORES - 1);
+	// Keep the wifi task next to the network stack. The wire engine owns the
+	// debug pins on the other core; without it, this puts the GPIO routines
+	// on the same core every time.
+	xTaskCreatePinnedToCore(gdb_wifi_task, name, GDB_TASK_STACK_SIZE, (void *)instance, tskIDLE_PRIORITY + 2,
+		&instance->pid, WIRE_ENGINE_NET_CORE);
 }
 
-void gdb_net_task(void *arg)
+static bool gdb_net_accept(int gdb_if_serv, void *arg)
 {
-	struct sockaddr_in addr;
-	int gdb_if_serv;
-	int opt;
-
-	bmp_core_mutex = xSemaphoreCreateMutex();
-
-	addr.sin_family = AF_INET;
-	addr.sin_port = htons(CONFIG_GDB_TCP_PORT);
-	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	(void)arg;
+	int s = accept(gdb_if_serv, NULL, NULL);
+	if (s > 0) {
+		new_gdb_wifi_instance(s);
+	}
+	return true;
+}
 
-	assert((gdb_if_serv = socket(PF_INET, SOCK_STREAM, 0)) != -1);
-	opt = 1;
-	assert(setsockopt(gdb_if_serv, SOL_SOCKET, SO_REUSEADDR, (void *)&opt, sizeof(opt)) != -1);
-	assert(setsockopt(gdb_if_serv, IPPROTO_TCP, TCP_NODELAY, (void *)&opt, sizeof(opt)) != -1);
+void gdb_net_init(void)
+{
+	core_arbiter_init(&bmp_core_arbiter, "BMP core");
+	core_arbiter_init(&gdb_session_arbiter, "GDB session");
 
-	assert(bind(gdb_if_serv, (struct sockaddr *)&addr, sizeof(addr)) != -1);
-	assert(listen(gdb_if_serv, 1) != -1);
+	const int gdb_if_serv = net_reactor_listen(CONFIG_GDB_TCP_PORT, 1);
+	if (gdb_if_serv < 0) {
+		return;
+	}
+	net_reactor_add(gdb_if_serv, gdb_net_accept, NULL);
 
 	ESP_LOGI("gdb", "Listening on TCP:%d", CONFIG_GDB_TCP_PORT);
-
-	while (1) {
-		int s = accept(gdb_if_serv, NULL, NULL);
-		if (s > 0) {
-			new_gdb_wifi_instance(s);
-		}
-	}
 }
 
 #ifdef CONFIG_RTT_ON_BOOT
@@ -262,62 +400,60 @@ void rtt_monitor_task(void *params)
 	(void)params;
 	extern target_controller_s gdb_controller;
 
-	struct gdb_wifi_instance *instance = malloc(sizeof(struct gdb_wifi_instance));
+	struct gdb_wifi_instance *instance = gdb_wifi_instance_alloc();
 	if (!instance) {
 		return;
 	}
-	memset(instance, 0, sizeof(*instance));
 	instance->sock = -1;
 	instance->is_shutting_down = true; // Set this to `true` to prevent IO from occurring
 
 	vTaskSetThreadLocalStoragePointer(NULL, GDB_TLS_INDEX, instance); // used for exception handling
 
 	while (true) {
-		gdb_is_free = true;
-		while (num_clients > 0) {
-			platform_delay(700);
-			continue;
-		}
-		gdb_is_free = false;
+		// GDB clients run at a higher priority, so the session is handed over as soon as one connects
+		core_arbiter_acquire(&gdb_session_arbiter);
 		TRY(EXCEPTION_ALL)
 		{
 			// Scan for the target
 			if (!cur_target) {
 				// TODO: Extend this to JTAG scan as well
-				if (!adiv5_swd_scan(0)) {
-					platform_delay(200);
-					continue;
+				if (scan_cache_reuse(SCAN_CACHE_SWD) || adiv5_swd_scan(0)) {
+					cur_target = target_attach_n(1, &gdb_controller);
 				}
-				cur_target = target_attach_n(1, &gdb_controller);
-				if (!cur_target) {
-					platform_delay(200);
-					continue;
+				if (cur_target) {
+					swdptap_transfer_install(cur_target);
+					gdb_cache_install(cur_target);
+					autotune_apply(cur_target);
+					// If we successfully attached, set the target running
+					target_halt_resume(cur_target, false);
+					gdb_target_running = true;
 				}
-				// If we successfully attached, set the target running
-				target_halt_resume(cur_target, false);
-				gdb_target_running = true;
 			}
 
-			ESP_LOGI("rtt", "monitor attached to target");
-			while (cur_target && (num_clients == 0)) {
-				/* poll target */
-				target_addr_t watch;
-				target_halt_reason_e reason = target_halt_poll(cur_target, &watch);
-				if (reason) {
-					ESP_LOGI("rtt", "target halted: %s", target_halt_reason_str[reason]);
-					gdb_target_running = false;
-					if (cur_target) {
-						target_halt_resume(cur_target, false);
-						gdb_target_running = true;
+			if (cur_target) {
+				ESP_LOGI("rtt", "monitor attached to target");
+			}
+			gdb_run_schedule_s schedule;
+			gdb_run_schedule_reset(&schedule);
+			while (cur_target && !core_arbiter_contended(&gdb_session_arbiter)) {
+				const uint32_t now = platform_time_ms();
+				if (gdb_run_schedule_halt(&schedule, now)) {
+					/* poll target */
+					target_addr_t watch;
+					target_halt_reason_e reason = target_halt_poll(cur_target, &watch);
+					if (reason) {
+						ESP_LOGI("rtt", "target halted: %s", target_halt_reason_str[reason]);
+						gdb_target_running = false;
+						if (cur_target) {
+							target_halt_resume(cur_target, false);
+							gdb_target_running = true;
+						}
+						break;
 					}
-					break;
 				}
-				poll_rtt(cur_target);
-				platform_delay(rtt_min_poll_ms);
-			}
-			// No target and no clients, delay for a bit
-			if (num_clients == 0) {
-				platform_delay(200);
+				gdb_run_schedule_rtt(&schedule, cur_target, now);
+				const uint32_t idle_ms = MAX(gdb_run_schedule_idle_ms(&schedule), 1U);
+				core_arbiter_wait_contended(&gdb_session_arbiter, MAX(pdMS_TO_TICKS(idle_ms), 1));
 			}
 		}
 		CATCH()
@@ -335,6 +471,9 @@ void rtt_monitor_task(void *params)
 			cur_target = NULL;
 			break;
 		}
+		// No target, or it just halted: look again in a bit, unless a client wants the session first
+		core_arbiter_wait_contended(&gdb_session_arbiter, pdMS_TO_TICKS(200));
+		core_arbiter_release(&gdb_session_arbiter);
 	}
 }
 #endif /* CONFIG_RTT_ON_BOOT */
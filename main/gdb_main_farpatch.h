@@ -14,15 +14,22 @@
 struct gdb_wifi_instance {
 	uint32_t magic;
 	int sock;
-	uint8_t tx_buf[1028];
-	uint8_t rx_buf[1028];
+	/* Room for a whole packet with its framing, so one send() or recv() moves it */
+	uint8_t tx_buf[GDB_PACKET_BUFFER_SIZE + 4];
+	uint8_t rx_buf[GDB_PACKET_BUFFER_SIZE + 4];
 	struct gdb_packet gdb_packet;
-	uint16_t tx_bufsize;
-	uint16_t rx_bufsize;
-	uint16_t rx_bufpos;
+	uint32_t tx_bufsize;
+	uint32_t rx_bufsize;
+	uint32_t rx_bufpos;
 	bool no_ack_mode;
 	bool is_shutting_down;
 	TaskHandle_t pid;
 };
 
+/* Stands in for gdb_packet_receive(), reading whole buffers at a time */
+const gdb_packet_s *gdb_if_packet_receive(void);
+
+/* Answer an `m` packet without BMP's intermediate copies. Returns false to leave the packet to BMP. */
+bool gdb_if_packet_read_memory(const gdb_packet_s *packet);
+
 #endif /* GDB_MAIN_FARPATCH_H_ */
@@ -0,0 +1,192 @@
+/*
+ * Buffer-at-a-time framing for the GDB Remote Serial Protocol, used on the
+ * receive path of the GDB server and by `monitor bench rsp`.
+ */
+
+#include <string.h>
+
+#include "esp_attr.h"
+
+#include "gdb_rsp.h"
+
+#define GDB_RSP_ESCAPE       '}'
+#define GDB_RSP_ESCAPE_XOR   0x20U
+/* `#` and two checksum digits */
+#define GDB_RSP_TRAILER_SIZE 3U
+
+static const char gdb_rsp_hex_digits[] = "0123456789abcdef";
+
+void gdb_rsp_parser_init(gdb_rsp_parser_s *const parser, char *const data, const size_t capacity)
+{
+	memset(parser, 0, sizeof(*parser));
+	parser->data = data;
+	parser->capacity = capacity;
+}
+
+IRAM_ATTR uint8_t gdb_rsp_checksum(const char *const data, const size_t len)
+{
+	const uint8_t *const bytes = (const uint8_t *)data;
+	uint32_t sum = 0;
+	for (size_t idx = 0; idx < len; ++idx)
+		sum += bytes[idx];
+	return (uint8_t)sum;
+}
+
+static int gdb_rsp_hex_value(const char digit)
+{
+	if (digit >= '0' && digit <= '9')
+		return digit - '0';
+	if (digit >= 'a' && digit <= 'f')
+		return digit - 'a' + 10;
+	if (digit >= 'A' && digit <= 'F')
+		return digit - 'A' + 10;
+	return -1;
+}
+
+static IRAM_ATTR void gdb_rsp_append(gdb_rsp_parser_s *const parser, const char *const src, const size_t len)
+{
+	const size_t room = parser->capacity - parser->size;
+	if (len > room) {
+		memcpy(parser->data + parser->size, src, room);
+		parser->size = parser->capacity;
+		parser->overflow = true;
+		return;
+	}
+	memcpy(parser->data + parser->size, src, len);
+	parser->size += len;
+}
+
+/* Copy a run of packet data, undoing the escapes. An escape may be split across two buffers. */
+static IRAM_ATTR void gdb_rsp_unescape(gdb_rsp_parser_s *const parser, const char *src, size_t len)
+{
+	while (len) {
+		if (parser->escape) {
+			const char unescaped = (char)(*src ^ GDB_RSP_ESCAPE_XOR);
+			gdb_rsp_append(parser, &unescaped, 1U);
+			parser->escape = false;
+			++src;
+			--len;
+			continue;
+		}
+		const char *const escape = memchr(src, GDB_RSP_ESCAPE, len);
+		const size_t run = escape ? (size_t)(escape - src) : len;
+		gdb_rsp_append(parser, src, run);
+		if (!escape)
+			return;
+		parser->escape = true;
+		src += run + 1U;
+		len -= run + 1U;
+	}
+}
+
+IRAM_ATTR gdb_rsp_result_e gdb_rsp_parse(
+	gdb_rsp_parser_s *const parser, const char *const buf, const size_t len, size_t *const used)
+{
+	size_t pos = 0;
+	while (pos < len) {
+		switch (parser->state) {
+		case GDB_RSP_IDLE: {
+			/* Skip acks and noise up to the start of the next packet */
+			const char c = buf[pos++];
+			if (c == '$') {
+				parser->state = GDB_RSP_DATA;
+				parser->size = 0;
+				parser->checksum = 0;
+				parser->escape = false;
+				parser->overflow = false;
+				parser->bad_checksum = false;
+			} else if (c == '\x03' || c == '\x04') {
+				parser->data[0] = c;
+				parser->data[1] = '\0';
+				parser->size = 1U;
+				*used = pos;
+				return GDB_RSP_OUT_OF_BAND;
+			}
+			break;
+		}
+
+		case GDB_RSP_DATA: {
+			/* `#` never appears escaped, so the first one ends the data */
+			const char *const start = buf + pos;
+			const char *const end = memchr(start, '#', len - pos);
+			const size_t run = end ? (size_t)(end - start) : len - pos;
+			parser->checksum += gdb_rsp_checksum(start, run);
+			gdb_rsp_unescape(parser, start, run);
+			pos += run;
+			if (end) {
+				parser->state = GDB_RSP_CHECKSUM_HIGH;
+				++pos;
+			}
+			break;
+		}
+
+		case GDB_RSP_CHECKSUM_HIGH: {
+			const int value = gdb_rsp_hex_value(buf[pos++]);
+			parser->bad_checksum = value < 0;
+			parser->received_checksum = (uint8_t)(value << 4U);
+			parser->state = GDB_RSP_CHECKSUM_LOW;
+			break;
+		}
+
+		case GDB_RSP_CHECKSUM_LOW: {
+			const int value = gdb_rsp_hex_value(buf[pos++]);
+			parser->state = GDB_RSP_IDLE;
+			parser->data[parser->size] = '\0';
+			*used = pos;
+			if (value < 0 || parser->bad_checksum || (uint8_t)(parser->received_checksum | value) != parser->checksum)
+				return GDB_RSP_BAD_PACKET;
+			return parser->overflow ? GDB_RSP_TOO_LONG : GDB_RSP_PACKET;
+		}
+		}
+	}
+	*used = pos;
+	return GDB_RSP_MORE;
+}
+
+/* Length of the leading run that can go out as it is */
+static IRAM_ATTR size_t gdb_rsp_plain_run(const char *const data, const size_t len)
+{
+	for (size_t idx = 0; idx < len; ++idx) {
+		switch (data[idx]) {
+		case '$':
+		case '#':
+		case '*':
+		case GDB_RSP_ESCAPE:
+			return idx;
+		default:
+			break;
+		}
+	}
+	return len;
+}
+
+IRAM_ATTR size_t gdb_rsp_frame(char *const out, const size_t out_size, const char *data, size_t len)
+{
+	if (out_size < 1U + GDB_RSP_TRAILER_SIZE)
+		return 0;
+
+	size_t pos = 0;
+	out[pos++] = '$';
+	while (len) {
+		const size_t run = gdb_rsp_plain_run(data, len);
+		if (pos + run + GDB_RSP_TRAILER_SIZE > out_size)
+			return 0;
+		memcpy(out + pos, data, run);
+		pos += run;
+		data += run;
+		len -= run;
+		if (!len)
+			break;
+		if (pos + 2U + GDB_RSP_TRAILER_SIZE > out_size)
+			return 0;
+		out[pos++] = GDB_RSP_ESCAPE;
+		out[pos++] = (char)(*data++ ^ GDB_RSP_ESCAPE_XOR);
+		--len;
+	}
+
+	const uint8_t checksum = gdb_rsp_checksum(out + 1U, pos - 1U);
+	out[pos++] = '#';
+	out[pos++] = gdb_rsp_hex_digits[checksum >> 4U];
+	out[pos++] = gdb_rsp_hex_digits[checksum & 0xfU];
+	return pos;
+}
@@ -0,0 +1,60 @@
+#ifndef FARPATCH_GDB_RSP_H__
+#define FARPATCH_GDB_RSP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * GDB Remote Serial Protocol framing over whole buffers. Packets are found
+ * with memchr() and copied, unescaped and checksummed a run at a time
+ * instead of a byte per call.
+ */
+
+typedef enum gdb_rsp_result {
+	/* Everything given was consumed and the packet is not complete yet */
+	GDB_RSP_MORE,
+	GDB_RSP_PACKET,
+	/* Bad checksum, GDB should be asked to send it again */
+	GDB_RSP_BAD_PACKET,
+	/* Arrived intact but too big for the buffer. Sending it again would not help, it needs an error reply. */
+	GDB_RSP_TOO_LONG,
+	/* ^C or ^D outside of a packet, returned as a packet of its own */
+	GDB_RSP_OUT_OF_BAND,
+} gdb_rsp_result_e;
+
+typedef enum gdb_rsp_state {
+	GDB_RSP_IDLE,
+	GDB_RSP_DATA,
+	GDB_RSP_CHECKSUM_HIGH,
+	GDB_RSP_CHECKSUM_LOW,
+} gdb_rsp_state_e;
+
+typedef struct gdb_rsp_parser {
+	char *data;
+	size_t capacity;
+	size_t size;
+	gdb_rsp_state_e state;
+	uint8_t checksum;
+	uint8_t received_checksum;
+	bool escape;
+	bool overflow;
+	bool bad_checksum;
+} gdb_rsp_parser_s;
+
+/* Packets are unescaped into `data`, which needs room for `capacity` bytes and a terminating NUL */
+void gdb_rsp_parser_init(gdb_rsp_parser_s *parser, char *data, size_t capacity);
+
+/*
+ * Consume bytes from `buf` until a packet is complete or `len` runs out, and
+ * set `used` to the number of bytes consumed. Bytes after the end of the
+ * packet are left alone for whoever reads next.
+ */
+gdb_rsp_result_e gdb_rsp_parse(gdb_rsp_parser_s *parser, const char *buf, size_t len, size_t *used);
+
+uint8_t gdb_rsp_checksum(const char *data, size_t len);
+
+/* Build `$data#cs` in `out`, escaping as needed. Returns its length, or 0 if it does not fit. */
+size_t gdb_rsp_frame(char *out, size_t out_size, const char *data, size_t len);
+
+#endif /* FARPATCH_GDB_RSP_H__ */
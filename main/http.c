@@ -13,8 +13,10 @@
 #include "hashmap.h"
 #include "http_api.h"
 #include "ota-http.h"
+#include "rsp_capture.h"
 #include "farpatch_adc.h"
 #include "swo.h"
+#include "trace.h"
 #include "websocket.h"
 #include "wifi.h"
 #include "driver/uart.h"
@@ -576,6 +578,16 @@ static const httpd_uri_t basic_handlers[] = {
 		.handler = cgi_rtt_status,
 		.method = HTTP_GET,
 	},
+	{
+		.uri = "/fp/trace",
+		.handler = cgi_trace,
+		.method = HTTP_GET,
+	},
+	{
+		.uri = "/fp/rsp_capture",
+		.handler = cgi_rsp_capture,
+		.method = HTTP_GET,
+	},
 
 	// Wilma Manager
 	{
@@ -13,7 +13,6 @@
 /* send data to connected terminal websockets */
 void http_term_broadcast_uart(uint8_t *data, size_t len);
 void http_debug_putc(uint8_t c, int flush);
-void http_term_broadcast_rtt(uint8_t *data, size_t len);
 
 /* start the http server */
 httpd_handle_t webserver_start(void);
@@ -23,6 +23,7 @@
 
 #include "esp_log.h"
 #include "esp_attr.h"
+#include "esp_cpu.h"
 #include "timing.h"
 #include "driver/gpio.h"
 #include "hal/gpio_hal.h"
@@ -177,6 +178,11 @@ void platform_set_baud(uint32_t baud);
 #define PLATFORM_HAS_DEBUG
 #define PLATFORM_IDENT CONFIG_IDF_TARGET
 
+#define PLATFORM_HAS_CUSTOM_COMMANDS
+
+/* BMP sizes its packet buffer with this and advertises it to GDB as PacketSize */
+#define GDB_PACKET_BUFFER_SIZE CONFIG_GDB_PACKET_SIZE
+
 #define PLATFORM_HAS_TRACESWO
 #define NUM_TRACE_PACKETS (128)               /* This is an 8K buffer */
 #define SWO_ENCODING      3                   /* 1 = Manchester, 2 = NRZ / async, 3 = Both */
@@ -187,6 +193,26 @@ void platform_set_baud(uint32_t baud);
 #define SWO_UART        UART1
 #define SWO_UART_IDX    1
 
-extern uint32_t target_delay_us;
+/* Half of a tap clock period in CPU cycles, or 0 to clock as fast as the tap code runs */
+extern uint32_t target_delay_cycles;
+extern uint32_t target_clk_deadline;
+
+/*
+ * Busy-wait until half a clock period has passed since the previous call.
+ * The wait is measured against a running deadline, so the time spent
+ * toggling pins between calls is absorbed and the clock comes out at
+ * exactly the requested rate.
+ */
+static inline __attribute__((always_inline)) void platform_clk_delay(void)
+{
+	uint32_t deadline = target_clk_deadline + target_delay_cycles;
+	/* After an idle gap, time a full half period from now rather than bursting to catch up */
+	const uint32_t now = esp_cpu_get_cycle_count();
+	if ((int32_t)(now - deadline) > 0)
+		deadline = now + target_delay_cycles;
+	while ((int32_t)(esp_cpu_get_cycle_count() - deadline) < 0)
+		continue;
+	target_clk_deadline = deadline;
+}
 
 #endif /* FARPATCH_PLATFORM_H */
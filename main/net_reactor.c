@@ -0,0 +1,249 @@
+/*
+ * Network reactor for the probe's streaming services.
+ *
+ * The UART, RTT and SWO bridges and the GDB listener used to run a task
+ * each, all of them asleep in select() or accept() nearly all of the time
+ * with a kilobyte buffer on the stack. Here a single task owns every
+ * listening socket and every client of those services, waits on all of them
+ * with one select(), and hands each readable socket to the handler of the
+ * service it belongs to.
+ *
+ * Other tasks send on these sockets directly, but only the reactor closes
+ * them, so a socket is never closed and reused while select() is waiting on
+ * it. Sockets added or closed from another task wake the reactor through a
+ * loopback UDP socket so the change takes effect straight away.
+ */
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <errno.h>
+#include <lwip/sockets.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "general.h"
+#include "net_reactor.h"
+#include "wire-engine.h"
+
+#define NET_REACTOR_SOCKETS    CONFIG_LWIP_MAX_SOCKETS
+#define NET_REACTOR_STACK_SIZE 3072
+#define NET_REACTOR_PRIORITY   4
+
+static const char TAG[] = "net";
+
+typedef struct net_reactor_entry {
+	int sock;
+	net_reactor_handler_t handler;
+	void *arg;
+	/* Closed from another task, the reactor closes it on its next pass */
+	bool closing;
+} net_reactor_entry_s;
+
+static net_reactor_entry_s net_reactor_entries[NET_REACTOR_SOCKETS];
+static SemaphoreHandle_t net_reactor_lock;
+static int net_reactor_wake_sock = -1;
+static struct sockaddr_in net_reactor_wake_addr;
+static TaskHandle_t net_reactor_task_handle;
+
+static void net_reactor_wake(void)
+{
+	if (net_reactor_wake_sock < 0 || xTaskGetCurrentTaskHandle() == net_reactor_task_handle)
+		return;
+	const uint8_t wake = 0;
+	sendto(net_reactor_wake_sock, &wake, sizeof(wake), MSG_DONTWAIT, (struct sockaddr *)&net_reactor_wake_addr,
+		sizeof(net_reactor_wake_addr));
+}
+
+static net_reactor_entry_s *net_reactor_find(const int sock)
+{
+	for (size_t idx = 0; idx < NET_REACTOR_SOCKETS; ++idx) {
+		if (net_reactor_entries[idx].sock == sock)
+			return &net_reactor_entries[idx];
+	}
+	return NULL;
+}
+
+static void net_reactor_drop(net_reactor_entry_s *const entry)
+{
+	close(entry->sock);
+	memset(entry, 0, sizeof(*entry));
+}
+
+bool net_reactor_add(const int sock, const net_reactor_handler_t handler, void *const arg)
+{
+	xSemaphoreTake(net_reactor_lock, portMAX_DELAY);
+	net_reactor_entry_s *const entry = net_reactor_find(0);
+	if (entry) {
+		entry->sock = sock;
+		entry->handler = handler;
+		entry->arg = arg;
+		entry->closing = false;
+	}
+	xSemaphoreGive(net_reactor_lock);
+
+	if (!entry) {
+		ESP_LOGE(TAG, "no room to watch socket %d", sock);
+		return false;
+	}
+	net_reactor_wake();
+	return true;
+}
+
+void net_reactor_close(const int sock)
+{
+	if (sock <= 0)
+		return;
+
+	xSemaphoreTake(net_reactor_lock, portMAX_DELAY);
+	net_reactor_entry_s *const entry = net_reactor_find(sock);
+	if (entry)
+		entry->closing = true;
+	xSemaphoreGive(net_reactor_lock);
+
+	if (entry)
+		net_reactor_wake();
+	else
+		close(sock);
+}
+
+int net_reactor_listen(const uint16_t port, const int backlog)
+{
+	const int sock = socket(AF_INET, backlog ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if (sock < 0) {
+		ESP_LOGE(TAG, "socket() failed (%s)", strerror(errno));
+		return -1;
+	}
+
+	int opt = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (void *)&opt, sizeof(opt));
+
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || (backlog && listen(sock, backlog) < 0)) {
+		ESP_LOGE(TAG, "unable to listen on port %u (%s)", port, strerror(errno));
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+void net_reactor_client_options(const int sock)
+{
+	int opt = 1; /* SO_KEEPALIVE */
+	setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, (void *)&opt, sizeof(opt));
+	opt = 3; /* s TCP_KEEPIDLE */
+	setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, (void *)&opt, sizeof(opt));
+	opt = 1; /* s TCP_KEEPINTVL */
+	setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, (void *)&opt, sizeof(opt));
+	opt = 3; /* TCP_KEEPCNT */
+	setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, (void *)&opt, sizeof(opt));
+	opt = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (void *)&opt, sizeof(opt));
+}
+
+/* Call the handler of `sock`, unless it was closed since select() returned */
+static void net_reactor_dispatch(const int sock)
+{
+	xSemaphoreTake(net_reactor_lock, portMAX_DELAY);
+	const net_reactor_entry_s *const entry = net_reactor_find(sock);
+	const net_reactor_entry_s ready = entry && !entry->closing ? *entry : (net_reactor_entry_s){};
+	xSemaphoreGive(net_reactor_lock);
+
+	if (!ready.handler || ready.handler(sock, ready.arg))
+		return;
+
+	xSemaphoreTake(net_reactor_lock, portMAX_DELAY);
+	net_reactor_entry_s *const done = net_reactor_find(sock);
+	if (done)
+		net_reactor_drop(done);
+	xSemaphoreGive(net_reactor_lock);
+}
+
+static void net_reactor_task(void *arg)
+{
+	(void)arg;
+	int watched[NET_REACTOR_SOCKETS];
+
+	while (true) {
+		fd_set fds;
+		FD_ZERO(&fds);
+		int maxfd = net_reactor_wake_sock;
+		if (net_reactor_wake_sock >= 0)
+			FD_SET(net_reactor_wake_sock, &fds);
+		size_t count = 0;
+
+		xSemaphoreTake(net_reactor_lock, portMAX_DELAY);
+		for (size_t idx = 0; idx < NET_REACTOR_SOCKETS; ++idx) {
+			net_reactor_entry_s *const entry = &net_reactor_entries[idx];
+			if (entry->sock <= 0)
+				continue;
+			if (entry->closing) {
+				net_reactor_drop(entry);
+				continue;
+			}
+			FD_SET(entry->sock, &fds);
+			maxfd = MAX(maxfd, entry->sock);
+			watched[count++] = entry->sock;
+		}
+		xSemaphoreGive(net_reactor_lock);
+
+		/* Without a wakeup socket, come back now and then to pick up changes */
+		struct timeval poll = {.tv_sec = 1};
+		if (select(maxfd + 1, &fds, NULL, NULL, net_reactor_wake_sock >= 0 ? NULL : &poll) < 0) {
+			ESP_LOGE(TAG, "select() failed (%s)", strerror(errno));
+			vTaskDelay(pdMS_TO_TICKS(100));
+			continue;
+		}
+
+		if (net_reactor_wake_sock >= 0 && FD_ISSET(net_reactor_wake_sock, &fds)) {
+			uint8_t drain[16];
+			while (recv(net_reactor_wake_sock, drain, sizeof(drain), MSG_DONTWAIT) > 0)
+				continue;
+		}
+
+		for (size_t idx = 0; idx < count; ++idx) {
+			if (FD_ISSET(watched[idx], &fds))
+				net_reactor_dispatch(watched[idx]);
+		}
+	}
+}
+
+/* Loopback socket that other tasks poke to get select() to return */
+static int net_reactor_wake_open(void)
+{
+	const int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0)
+		return -1;
+
+	net_reactor_wake_addr = (struct sockaddr_in){
+		.sin_family = AF_INET,
+		.sin_port = 0,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t addr_len = sizeof(net_reactor_wake_addr);
+	/* Bind to any free port and find out which one it was */
+	if (bind(sock, (struct sockaddr *)&net_reactor_wake_addr, addr_len) < 0 ||
+		getsockname(sock, (struct sockaddr *)&net_reactor_wake_addr, &addr_len) < 0) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+void net_reactor_start(void)
+{
+	net_reactor_lock = xSemaphoreCreateMutex();
+
+	net_reactor_wake_sock = net_reactor_wake_open();
+	if (net_reactor_wake_sock < 0)
+		ESP_LOGE(TAG, "no wakeup socket (%s), changes will wait for the next poll", strerror(errno));
+
+	xTaskCreatePinnedToCore(net_reactor_task, "net_reactor", NET_REACTOR_STACK_SIZE, NULL, NET_REACTOR_PRIORITY,
+		&net_reactor_task_handle, WIRE_ENGINE_NET_CORE);
+}
@@ -0,0 +1,34 @@
+#ifndef FARPATCH_NET_REACTOR_H__
+#define FARPATCH_NET_REACTOR_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * One task that waits on every listening socket and every streaming client
+ * at once and calls the handler of whichever is readable. Handlers run on
+ * the reactor task, one at a time, and must not block.
+ */
+
+/* Called when `sock` is readable. Return false to have the reactor close it. */
+typedef bool (*net_reactor_handler_t)(int sock, void *arg);
+
+/* Start the reactor task. Must be called before anything is added to it. */
+void net_reactor_start(void);
+
+/* Open a socket bound to `port`: a listening TCP socket, or a UDP socket if `backlog` is 0. Returns -1 on error. */
+int net_reactor_listen(uint16_t port, int backlog);
+
+/* Keepalive and TCP_NODELAY for a freshly accepted client */
+void net_reactor_client_options(int sock);
+
+/* Watch `sock` and call `handler` each time it is readable. Returns false if there is no room for it. */
+bool net_reactor_add(int sock, net_reactor_handler_t handler, void *arg);
+
+/*
+ * Stop watching `sock` and close it. Safe to call from any task: the socket
+ * is closed by the reactor, so it is never closed under a pending select().
+ */
+void net_reactor_close(int sock);
+
+#endif /* FARPATCH_NET_REACTOR_H__ */
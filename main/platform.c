@@ -30,6 +30,19 @@
 #include "morse.h"
 #include "platform.h"
 #include "CBUF.h"
+#include "command.h"
+#include "autotune.h"
+#include "bench.h"
+#include "core_arbiter.h"
+#include "gang.h"
+#include "gdb_cache.h"
+#include "net_reactor.h"
+#include "rsp_capture.h"
+#include "rtt_cache.h"
+#include "scan_cache.h"
+#include "swo.h"
+#include "trace.h"
+#include "wire-engine.h"
 
 #include <assert.h>
 #include <sys/time.h>
@@ -52,6 +65,7 @@
 #include "esp_ota_ops.h"
 #include "esp_log.h"
 #include "esp_event.h"
+#include "esp_rom_sys.h"
 #include "esp_wifi.h"
 #include "soc/gpio_sig_map.h"
 #include "nvs_flash.h"
@@ -73,7 +87,8 @@ nvs_handle_t h_nvs_conf;
 // This value is used to spread out service startup,
 // which is useful for keeping the power consumption low.
 const uint32_t STARTUP_SERVICE_DELAY_MS = 400;
-uint32_t target_delay_us = 0;
+uint32_t target_delay_cycles = 0;
+uint32_t target_clk_deadline = 0;
 
 #if defined(CONFIG_VSEL_PRESENT)
 static const char *power_source_name = "unknown";
@@ -82,28 +97,40 @@ static const char *power_source_name = "unknown";
 void initialise_mdns(const char *hostname);
 void rtt_init(void);
 
+// Without a delay the bit-banged clock runs at about 12 MHz.
+#define PLATFORM_NO_DELAY_FREQUENCY 12000000U
+
 void platform_max_frequency_set(uint32_t freq)
 {
-	// Delay is done with a `sleep_us()`, so 1 MHz is the most
-	// we can reliably delay.
-	if ((freq == 0) || (freq > 1000000)) {
-		target_delay_us = 0;
+	const uint32_t cpu_hz = esp_rom_get_cpu_ticks_per_us() * 1000000U;
+	if ((freq == 0) || (freq >= PLATFORM_NO_DELAY_FREQUENCY)) {
+		target_delay_cycles = 0;
+		return;
+	}
+	// Round the half period up so we never clock faster than requested.
+	const uint32_t half_period = (cpu_hz + (2 * freq) - 1) / (2 * freq);
+	// Anything shorter than the bit-banging itself can't be honoured.
+	if (half_period <= cpu_hz / (2 * PLATFORM_NO_DELAY_FREQUENCY)) {
+		target_delay_cycles = 0;
 		return;
 	}
-	target_delay_us = 1000000 / freq;
+	target_delay_cycles = half_period;
 }
 
 uint32_t platform_max_frequency_get(void)
 {
-	// With no delay we run about 12 MHz.
-	if (target_delay_us == 0) {
-		return 12000000;
+	if (target_delay_cycles == 0) {
+		return PLATFORM_NO_DELAY_FREQUENCY;
 	}
-	return 1000000 / target_delay_us;
+	const uint32_t cpu_hz = esp_rom_get_cpu_ticks_per_us() * 1000000U;
+	return cpu_hz / (2 * target_delay_cycles);
 }
 
 void platform_init(void)
 {
+	// Start the task that drives the debug pins before anything touches them
+	wire_engine_start();
+
 #if defined(CONFIG_TDI_GPIO) && CONFIG_TDI_GPIO >= 0
 	gpio_reset_pin(CONFIG_TDI_GPIO);
 #endif
@@ -408,6 +435,19 @@ bool cmd_setbaud(target_s *t, int argc, const char **argv)
 	return 1;
 }
 
+const command_s platform_cmd_list[] = {
+	{"arbiter", cmd_arbiter, "Show who waited for the BMP core and for how long: [clear]"},
+	{"autotune", cmd_autotune, "Calibrate the fastest reliable clock for this target: [clear]"},
+	{"bench", cmd_bench, "Measure probe fast paths: jtag|rsp"},
+	{"cache", cmd_cache, "Cache target memory and registers while halted: [on|off|clear]"},
+	{"gang", cmd_gang, "Drive extra SWDIO lanes in lockstep: [on|off]"},
+	{"rsp_capture", cmd_rsp_capture, "Record GDB protocol traffic for tools/rsp_replay.py: [on|off|clear]"},
+	{"rtt_cache", cmd_rtt_cache, "Show where the RTT control block was found for each build: [clear]"},
+	{"scan_cache", cmd_scan_cache, "Reuse the last scan while the targets are unchanged: [on|off|clear]"},
+	{"trace", cmd_trace, "Record SWD/JTAG transactions on the wire: [on|off|clear|dump]"},
+	{NULL, NULL, NULL},
+};
+
 /// Enable or disable the clock output pin. This is not configured on
 /// current Farpatch designs, but will be used in a future model.
 void platform_target_clk_output_enable(bool enabled)
@@ -424,7 +464,7 @@ int vprintf_noop(const char *s, va_list va)
 	return 1;
 }
 
-void gdb_net_task(void *arg);
+void gdb_net_init(void);
 #ifdef CONFIG_RTT_ON_BOOT
 void rtt_monitor_task(void *params);
 #endif /* CONFIG_RTT_ON_BOOT */
@@ -498,6 +538,9 @@ void app_main(void)
 	vTaskDelay(pdMS_TO_TICKS(STARTUP_SERVICE_DELAY_MS));
 	platform_init();
 
+	ESP_LOGI(TAG, "starting network reactor");
+	net_reactor_start();
+
 	ESP_LOGI(TAG, "starting uart monitor");
 	vTaskDelay(pdMS_TO_TICKS(STARTUP_SERVICE_DELAY_MS));
 	uart_init();
@@ -508,7 +551,7 @@ void app_main(void)
 
 	ESP_LOGI(TAG, "starting gdb server");
 	vTaskDelay(pdMS_TO_TICKS(STARTUP_SERVICE_DELAY_MS));
-	xTaskCreate(gdb_net_task, "gdb_net", 2000, NULL, 3, NULL);
+	gdb_net_init();
 
 	ESP_LOGI(TAG, "starting tftp server");
 	vTaskDelay(pdMS_TO_TICKS(STARTUP_SERVICE_DELAY_MS));
@@ -516,8 +559,7 @@ void app_main(void)
 
 	ESP_LOGI(TAG, "starting swo server");
 	vTaskDelay(pdMS_TO_TICKS(STARTUP_SERVICE_DELAY_MS));
-	void swo_listen_task(void *);
-	xTaskCreate(swo_listen_task, "swo listen", 2000, NULL, 4, NULL);
+	swo_listen_init();
 
 #ifdef CONFIG_RESET_TARGET_ON_BOOT
 	ESP_LOGI(TAG, "resetting target on boot");
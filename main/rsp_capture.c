@@ -0,0 +1,183 @@
+/*
+ * Recorder for the GDB remote protocol traffic of a debug session.
+ *
+ * gdb_if.c hands every chunk it receives from or sends to a client to
+ * rsp_capture(). While capturing, each chunk is appended to a buffer with the
+ * time it went through the socket. The buffer is not a ring: a replay has to
+ * start from the beginning of a session, so once it is full the rest of the
+ * traffic is only counted. The monitor command gives a summary and the web
+ * server hands out the raw binary for tools/rsp_replay.py.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+#include "general.h"
+#include "gdb_packet.h"
+
+#include "rsp_capture.h"
+
+#if defined(CONFIG_GDB_RSP_CAPTURE)
+
+#define RSP_CAPTURE_SIZE (CONFIG_GDB_RSP_CAPTURE_KB * 1024U)
+
+bool rsp_capture_enabled;
+
+/* Allocated the first time capturing is turned on, and kept */
+static uint8_t *rsp_capture_buf;
+static SemaphoreHandle_t rsp_capture_lock;
+static size_t rsp_capture_used;
+static uint32_t rsp_capture_dropped;
+
+void rsp_capture_record(const rsp_capture_dir_e dir, const int sock, const void *const data, size_t len)
+{
+	const rsp_capture_record_s record_base = {
+		.timestamp_us = (uint32_t)esp_timer_get_time(),
+		.dir = dir,
+		.session = (uint8_t)sock,
+	};
+	const uint8_t *bytes = (const uint8_t *)data;
+
+	xSemaphoreTake(rsp_capture_lock, portMAX_DELAY);
+	do {
+		rsp_capture_record_s record = record_base;
+		record.len = MIN(len, UINT16_MAX);
+		/* Once something is missing, anything after it could not be parsed anyway */
+		if (rsp_capture_dropped || rsp_capture_used + sizeof(record) + record.len > RSP_CAPTURE_SIZE) {
+			rsp_capture_dropped += record.len;
+		} else {
+			memcpy(rsp_capture_buf + rsp_capture_used, &record, sizeof(record));
+			memcpy(rsp_capture_buf + rsp_capture_used + sizeof(record), bytes, record.len);
+			rsp_capture_used += sizeof(record) + record.len;
+		}
+		bytes += record.len;
+		len -= record.len;
+	} while (len);
+	xSemaphoreGive(rsp_capture_lock);
+}
+
+static void rsp_capture_clear(void)
+{
+	if (!rsp_capture_lock)
+		return;
+	xSemaphoreTake(rsp_capture_lock, portMAX_DELAY);
+	rsp_capture_used = 0;
+	rsp_capture_dropped = 0;
+	xSemaphoreGive(rsp_capture_lock);
+}
+
+static bool rsp_capture_enable(const bool enable)
+{
+	if (enable && !rsp_capture_buf) {
+		rsp_capture_buf = heap_caps_malloc_prefer(RSP_CAPTURE_SIZE, 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_DEFAULT);
+		if (!rsp_capture_buf)
+			return false;
+		rsp_capture_lock = xSemaphoreCreateMutex();
+	}
+	rsp_capture_enabled = enable;
+	return true;
+}
+
+bool cmd_rsp_capture(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 1) {
+		gdb_outf("RSP capture is %s, %u of %u bytes used, %" PRIu32 " bytes dropped\n",
+			rsp_capture_enabled ? "on" : "off", (unsigned)rsp_capture_used, RSP_CAPTURE_SIZE, rsp_capture_dropped);
+		return true;
+	}
+
+	if (argc == 2 && !strcmp(argv[1], "on")) {
+		if (!rsp_capture_enable(true)) {
+			gdb_outf("Unable to allocate %u bytes for the capture\n", RSP_CAPTURE_SIZE);
+			return false;
+		}
+		gdb_out("RSP capture on, download it from /fp/rsp_capture\n");
+		return true;
+	}
+	if (argc == 2 && !strcmp(argv[1], "off")) {
+		rsp_capture_enable(false);
+		gdb_out("RSP capture off\n");
+		return true;
+	}
+	if (argc == 2 && !strcmp(argv[1], "clear")) {
+		rsp_capture_clear();
+		gdb_out("RSP capture cleared\n");
+		return true;
+	}
+
+	gdb_out("usage: monitor rsp_capture [on|off|clear]\n");
+	return false;
+}
+
+esp_err_t cgi_rsp_capture(httpd_req_t *req)
+{
+	char query[64];
+	char value[8];
+	bool control = false;
+
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+		if (httpd_query_key_value(query, "clear", value, sizeof(value)) == ESP_OK && atoi(value)) {
+			rsp_capture_clear();
+			control = true;
+		}
+		if (httpd_query_key_value(query, "enable", value, sizeof(value)) == ESP_OK) {
+			if (!rsp_capture_enable(!!atoi(value)))
+				return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Unable to allocate the capture");
+			control = true;
+		}
+	}
+	if (control)
+		return httpd_resp_sendstr(req, rsp_capture_enabled ? "on\n" : "off\n");
+	if (!rsp_capture_lock)
+		return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Nothing captured, enable it with ?enable=1");
+
+	/* Stop capturing while downloading, so the download matches its header */
+	const bool was_enabled = rsp_capture_enabled;
+	rsp_capture_enabled = false;
+	xSemaphoreTake(rsp_capture_lock, portMAX_DELAY);
+	const rsp_capture_header_s header = {
+		.magic = RSP_CAPTURE_MAGIC,
+		.version = RSP_CAPTURE_VERSION,
+		.record_size = sizeof(rsp_capture_record_s),
+		.dropped = rsp_capture_dropped,
+		.size = rsp_capture_used,
+	};
+
+	httpd_resp_set_type(req, "application/octet-stream");
+	httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"farpatch.fprsp\"");
+	esp_err_t ret = httpd_resp_send_chunk(req, (const char *)&header, sizeof(header));
+	for (size_t pos = 0; ret == ESP_OK && pos < header.size; pos += 4096U)
+		ret = httpd_resp_send_chunk(req, (const char *)rsp_capture_buf + pos, MIN(header.size - pos, 4096U));
+	if (ret == ESP_OK)
+		ret = httpd_resp_send_chunk(req, NULL, 0);
+
+	xSemaphoreGive(rsp_capture_lock);
+	rsp_capture_enabled = was_enabled;
+	return ret;
+}
+
+#else
+
+bool cmd_rsp_capture(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	(void)argc;
+	(void)argv;
+	gdb_out("RSP capture support is not enabled in this build (CONFIG_GDB_RSP_CAPTURE)\n");
+	return false;
+}
+
+esp_err_t cgi_rsp_capture(httpd_req_t *req)
+{
+	return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "RSP capture support is not enabled in this build");
+}
+
+#endif /* CONFIG_GDB_RSP_CAPTURE */
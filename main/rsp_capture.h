@@ -0,0 +1,79 @@
+#ifndef FARPATCH_RSP_CAPTURE_H__
+#define FARPATCH_RSP_CAPTURE_H__
+
+#include <esp_http_server.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "target.h"
+
+/*
+ * Recorder for the raw GDB remote protocol traffic of every client, as it
+ * goes through the socket, with the time each chunk was received or sent.
+ * tools/rsp_replay.py splits a capture into packets, reports how the probe
+ * did at the time, and plays the client's side back against a probe to
+ * measure it again.
+ */
+
+#define RSP_CAPTURE_MAGIC   0x43525046U /* "FPRC" */
+#define RSP_CAPTURE_VERSION 1U
+
+typedef enum rsp_capture_dir {
+	/* Bytes received from the client */
+	RSP_CAPTURE_FROM_GDB = 0,
+	/* Bytes sent to the client */
+	RSP_CAPTURE_TO_GDB = 1,
+	/* A new client connected, no data */
+	RSP_CAPTURE_CONNECT = 2,
+} rsp_capture_dir_e;
+
+/* Little-endian on the wire, exactly as laid out here, and followed by `len` bytes of data */
+typedef struct __attribute__((packed)) rsp_capture_record {
+	/* esp_timer_get_time() when the chunk went through the socket, wraps at 32 bits */
+	uint32_t timestamp_us;
+	uint16_t len;
+	uint8_t dir;
+	/* Socket of the client, so overlapping sessions can be told apart */
+	uint8_t session;
+} rsp_capture_record_s;
+
+/* Precedes the records in a download */
+typedef struct __attribute__((packed)) rsp_capture_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	/* Bytes of traffic that did not fit once the buffer was full */
+	uint32_t dropped;
+	/* Bytes of records that follow */
+	uint32_t size;
+} rsp_capture_header_s;
+
+#if defined(CONFIG_GDB_RSP_CAPTURE)
+extern bool rsp_capture_enabled;
+
+void rsp_capture_record(rsp_capture_dir_e dir, int sock, const void *data, size_t len);
+
+/* Cheap enough for every send() and recv() when capturing is off */
+static inline void rsp_capture(const rsp_capture_dir_e dir, const int sock, const void *const data, const size_t len)
+{
+	if (rsp_capture_enabled)
+		rsp_capture_record(dir, sock, data, len);
+}
+#else
+static inline void rsp_capture(const rsp_capture_dir_e dir, const int sock, const void *const data, const size_t len)
+{
+	(void)dir;
+	(void)sock;
+	(void)data;
+	(void)len;
+}
+#endif /* CONFIG_GDB_RSP_CAPTURE */
+
+/* `monitor rsp_capture [on|off|clear]` */
+bool cmd_rsp_capture(target_s *t, int argc, const char **argv);
+
+/* GET /fp/rsp_capture downloads the capture, `enable` and `clear` control the recorder */
+esp_err_t cgi_rsp_capture(httpd_req_t *req);
+
+#endif /* FARPATCH_RSP_CAPTURE_H__ */
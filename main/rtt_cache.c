@@ -0,0 +1,251 @@
+/*
+ * Memory of where the RTT control block was found.
+ *
+ * Until it knows where the control block is, BMP sweeps all of target RAM
+ * for its signature on every RTT poll, which on a part with a lot of RAM
+ * takes long enough that the first output after an attach or a reset shows
+ * up late. The block lives at the same address every time a given build
+ * runs, so once a sweep has found it, the address is kept in NVS against
+ * the identity of the firmware: the part, its CPUID, and a hash of the
+ * vector table, which moves with nearly every change to the code.
+ *
+ * While RTT is searching, the signature is read straight from the
+ * remembered address, and if it is there BMP's search is narrowed to that
+ * one spot for the poll. Anything else, including firmware that has not set
+ * up its control block yet, is left to the full sweep.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "nvs_flash.h"
+
+#include "general.h"
+#include "cortexm.h"
+#include "exception.h"
+#include "gdb_packet.h"
+#include "rtt.h"
+#include "target.h"
+#include "target_internal.h"
+
+#include "rtt_cache.h"
+
+#define TAG "rtt_cache"
+
+#if defined(CONFIG_RTT_CB_CACHE)
+
+#define RTT_CACHE_NVS_KEY "rtt_cb"
+/* Builds remembered, the least recently used is forgotten first */
+#define RTT_CACHE_ENTRIES 8U
+/* The System Control Block's vector table offset register, reads as 0 where there is none */
+#define RTT_CACHE_VTOR 0xe000ed08U
+/* Initial stack pointer, reset and the system exception handlers */
+#define RTT_CACHE_VECTORS 16U
+/* The signature, and the channel counts that follow it in the control block */
+#define RTT_CACHE_CB_HEADER 24U
+
+extern nvs_handle h_nvs_conf;
+
+typedef struct rtt_cache_entry {
+	uint32_t identity;
+	uint32_t cbaddr;
+} rtt_cache_entry_s;
+
+static struct {
+	/* Searches narrowed to the remembered address */
+	uint32_t hits;
+	/* Searches that had to sweep RAM */
+	uint32_t misses;
+} rtt_cache_stats;
+
+static uint32_t rtt_cache_fnv1a(uint32_t hash, const void *const data, const size_t len)
+{
+	const uint8_t *const bytes = (const uint8_t *)data;
+	for (size_t idx = 0; idx < len; ++idx)
+		hash = (hash ^ bytes[idx]) * 16777619U;
+	return hash;
+}
+
+/* Read the memory or fail, without letting an exception out */
+static bool rtt_cache_read(target_s *const target, void *const dest, const target_addr_t src, const size_t len)
+{
+	volatile bool ok = false;
+	TRY(EXCEPTION_ALL)
+	{
+		ok = !target_mem32_read(target, dest, src, len);
+	}
+	CATCH()
+	{
+	default:
+		break;
+	}
+	return ok;
+}
+
+static bool rtt_cache_identity(target_s *const target, uint32_t *const identity)
+{
+	if (!target_is_cortexm(target))
+		return false;
+
+	uint32_t vtor = 0;
+	uint32_t vectors[RTT_CACHE_VECTORS];
+	if (!rtt_cache_read(target, &vtor, RTT_CACHE_VTOR, sizeof(vtor)) ||
+		!rtt_cache_read(target, vectors, vtor & ~0x7fU, sizeof(vectors)))
+		return false;
+
+	uint32_t hash = rtt_cache_fnv1a(2166136261U, &target->cpuid, sizeof(target->cpuid));
+	hash = rtt_cache_fnv1a(hash, &target->designer_code, sizeof(target->designer_code));
+	hash = rtt_cache_fnv1a(hash, &target->part_id, sizeof(target->part_id));
+	*identity = rtt_cache_fnv1a(hash, vectors, sizeof(vectors));
+	return true;
+}
+
+static size_t rtt_cache_load(rtt_cache_entry_s *const entries)
+{
+	size_t size = RTT_CACHE_ENTRIES * sizeof(*entries);
+	if (nvs_get_blob(h_nvs_conf, RTT_CACHE_NVS_KEY, entries, &size) != ESP_OK)
+		return 0;
+	return size / sizeof(*entries);
+}
+
+static uint32_t rtt_cache_lookup(const uint32_t identity)
+{
+	rtt_cache_entry_s entries[RTT_CACHE_ENTRIES];
+	const size_t count = rtt_cache_load(entries);
+	for (size_t idx = 0; idx < count; ++idx) {
+		if (entries[idx].identity == identity)
+			return entries[idx].cbaddr;
+	}
+	return 0;
+}
+
+/* Put the build at the front, dropping the oldest if it was not there already */
+static void rtt_cache_store(const uint32_t identity, const uint32_t cbaddr)
+{
+	rtt_cache_entry_s entries[RTT_CACHE_ENTRIES];
+	size_t count = rtt_cache_load(entries);
+	if (count && entries[0].identity == identity && entries[0].cbaddr == cbaddr)
+		return;
+
+	size_t found = count;
+	for (size_t idx = 0; idx < count; ++idx) {
+		if (entries[idx].identity == identity) {
+			found = idx;
+			break;
+		}
+	}
+	if (found == count)
+		count = MIN(count + 1U, RTT_CACHE_ENTRIES);
+	memmove(&entries[1], &entries[0], MIN(found, RTT_CACHE_ENTRIES - 1U) * sizeof(entries[0]));
+	entries[0] = (rtt_cache_entry_s){.identity = identity, .cbaddr = cbaddr};
+
+	nvs_set_blob(h_nvs_conf, RTT_CACHE_NVS_KEY, entries, count * sizeof(entries[0]));
+	nvs_commit(h_nvs_conf);
+	ESP_LOGI(TAG, "control block for firmware %08" PRIx32 " is at 0x%08" PRIx32, identity, cbaddr);
+}
+
+/* Whether the control block signature is at `cbaddr` right now */
+static bool rtt_cache_verify(target_s *const target, const uint32_t cbaddr)
+{
+	if (rtt_flag_ram && (cbaddr < rtt_ram_start || cbaddr + RTT_CACHE_CB_HEADER > rtt_ram_end))
+		return false;
+
+	char header[RTT_CACHE_CB_HEADER];
+	if (!rtt_cache_read(target, header, cbaddr, sizeof(header)))
+		return false;
+	const char *const ident = rtt_ident[0] ? rtt_ident : "SEGGER RTT";
+	return !strncmp(header, ident, strnlen(ident, sizeof(rtt_ident)));
+}
+
+void rtt_cache_poll(target_s *const target)
+{
+	if (!rtt_enabled || rtt_found) {
+		poll_rtt(target);
+		return;
+	}
+
+	uint32_t identity = 0;
+	const bool identified = rtt_cache_identity(target, &identity);
+	const uint32_t cbaddr = identified ? rtt_cache_lookup(identity) : 0;
+	const bool narrow = cbaddr && rtt_cache_verify(target, cbaddr);
+
+	/* BMP only searches where the user told it to, so tell it to look at the one place */
+	const bool flag_ram = rtt_flag_ram;
+	const uint32_t ram_start = rtt_ram_start;
+	const uint32_t ram_end = rtt_ram_end;
+	if (narrow) {
+		rtt_flag_ram = true;
+		rtt_ram_start = cbaddr;
+		rtt_ram_end = cbaddr + RTT_CACHE_CB_HEADER;
+	}
+	TRY(EXCEPTION_ALL)
+	{
+		poll_rtt(target);
+	}
+	CATCH()
+	{
+	default:
+		/* The user's search range has to survive a failed poll too */
+		rtt_flag_ram = flag_ram;
+		rtt_ram_start = ram_start;
+		rtt_ram_end = ram_end;
+		raise_exception(exception_frame.type, exception_frame.msg);
+	}
+	rtt_flag_ram = flag_ram;
+	rtt_ram_start = ram_start;
+	rtt_ram_end = ram_end;
+
+	if (!rtt_found)
+		return;
+	if (narrow && rtt_cbaddr == cbaddr) {
+		++rtt_cache_stats.hits;
+		return;
+	}
+	++rtt_cache_stats.misses;
+	if (identified)
+		rtt_cache_store(identity, rtt_cbaddr);
+}
+
+bool cmd_rtt_cache(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 2 && !strcmp(argv[1], "clear")) {
+		nvs_erase_key(h_nvs_conf, RTT_CACHE_NVS_KEY);
+		nvs_commit(h_nvs_conf);
+		memset(&rtt_cache_stats, 0, sizeof(rtt_cache_stats));
+		gdb_out("Forgot every remembered RTT control block\n");
+		return true;
+	}
+	if (argc != 1) {
+		gdb_out("usage: monitor rtt_cache [clear]\n");
+		return false;
+	}
+
+	rtt_cache_entry_s entries[RTT_CACHE_ENTRIES];
+	const size_t count = rtt_cache_load(entries);
+	gdb_outf("%" PRIu32 " searches went straight to the remembered address, %" PRIu32 " swept RAM\n",
+		rtt_cache_stats.hits, rtt_cache_stats.misses);
+	for (size_t idx = 0; idx < count; ++idx)
+		gdb_outf("firmware %08" PRIx32 ": control block at 0x%08" PRIx32 "\n", entries[idx].identity,
+			entries[idx].cbaddr);
+	return true;
+}
+
+#else
+
+void rtt_cache_poll(target_s *const target)
+{
+	poll_rtt(target);
+}
+
+bool cmd_rtt_cache(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	(void)argc;
+	(void)argv;
+	gdb_out("RTT control block caching is not enabled in this build (CONFIG_RTT_CB_CACHE)\n");
+	return false;
+}
+
+#endif /* CONFIG_RTT_CB_CACHE */
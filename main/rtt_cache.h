@@ -0,0 +1,15 @@
+#ifndef FARPATCH_RTT_CACHE_H__
+#define FARPATCH_RTT_CACHE_H__
+
+#include "target.h"
+
+/*
+ * Poll RTT like poll_rtt(), but while the control block has not been found,
+ * look first where it was the last time this firmware ran on this target
+ */
+void rtt_cache_poll(target_s *target);
+
+/* `monitor rtt_cache [clear]` */
+bool cmd_rtt_cache(target_s *t, int argc, const char **argv);
+
+#endif /* FARPATCH_RTT_CACHE_H__ */
@@ -0,0 +1,391 @@
+/*
+ * RTT data pump.
+ *
+ * Once the control block has been found, BMP's poll_rtt() reads the
+ * descriptor of each channel and then its read and write offsets field by
+ * field, and every field is a round trip on the wire. Here every poll is one
+ * block read of the control block header and the descriptors of all the
+ * channels that are enabled. The rings that hold data are then drained
+ * with one block read each. When a ring has wrapped and little of it is
+ * stale, that one read covers the whole ring, both segments at once. The
+ * new offsets go back to the target together, in one batch on the SWD
+ * queue when the target is on SW-DP.
+ *
+ * How often to poll follows the target. How far each up ring's write offset
+ * moved since the last poll gives how fast the target fills it, and the
+ * next poll comes before the fastest ring is half full. Rings that stop
+ * filling let the interval drift back out to rtt_max_poll_ms. A ring that
+ * has filled up since the last poll counts as an overflow, or as a stall if
+ * it is in blocking mode and the target is waiting for room. A ring that
+ * stays full over several polls is only counted once.
+ *
+ * Finding the control block is still left to BMP, by way of rtt_cache_poll().
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "general.h"
+#include "cortexm.h"
+#include "exception.h"
+#include "rtt.h"
+#include "rtt_if.h"
+#include "swd-queue.h"
+#include "target.h"
+#include "target_internal.h"
+
+#include "rtt_cache.h"
+#include "rtt_engine.h"
+
+uint32_t poll_rtt_ms(void);
+
+#if defined(CONFIG_RTT_ENGINE)
+
+#define RTT_ENGINE_ID_SIZE     16U
+#define RTT_ENGINE_HEADER_SIZE 24U
+/* Where the offsets are in a ring descriptor */
+#define RTT_ENGINE_WR_OFF 12U
+#define RTT_ENGINE_RD_OFF 16U
+/* Most data moved through one ring in one poll */
+#define RTT_ENGINE_BUF_SIZE 2048U
+/* What the target does with a full up ring: drop, trim, or wait for room */
+#define RTT_ENGINE_MODE_MASK  3U
+#define RTT_ENGINE_MODE_BLOCK 2U
+
+/* As laid out in target memory, which is little-endian like the probe */
+typedef struct rtt_engine_ring {
+	uint32_t name;
+	uint32_t buffer;
+	uint32_t size;
+	uint32_t wr_off;
+	uint32_t rd_off;
+	uint32_t flags;
+} rtt_engine_ring_s;
+
+typedef struct rtt_engine_cb {
+	char id[RTT_ENGINE_ID_SIZE];
+	uint32_t max_up;
+	uint32_t max_down;
+	rtt_engine_ring_s rings[MAX_RTT_CHAN];
+} rtt_engine_cb_s;
+
+typedef struct rtt_engine_channel {
+	bool seen;
+	uint32_t wr_off;
+	uint32_t size;
+	/* How fast the target fills the ring, in bytes per second, smoothed over a few polls */
+	uint32_t rate;
+	/* The ring was full at the last poll, so it has been counted already */
+	bool full;
+} rtt_engine_channel_s;
+
+static struct {
+	/* Control block that the ring counts below were read from */
+	uint32_t cbaddr;
+	uint32_t num_up;
+	uint32_t num_down;
+	uint32_t poll_ms;
+	uint32_t last_poll;
+	uint32_t errors;
+	/* Data was left in a ring because it would not fit in one poll */
+	bool backlog;
+	uint32_t overflows;
+	uint32_t stalls;
+} rtt_engine;
+
+static rtt_engine_channel_s rtt_engine_channels[MAX_RTT_CHAN];
+
+/* Only used by whoever holds the GDB session, a GDB client or the RTT monitor */
+static rtt_engine_cb_s rtt_engine_cb;
+/* Room for the words either side of an unaligned run */
+static uint8_t rtt_engine_buf[RTT_ENGINE_BUF_SIZE + 8U];
+
+static bool rtt_engine_signed(const rtt_engine_cb_s *const cb)
+{
+	const char *const ident = rtt_ident[0] ? rtt_ident : "SEGGER RTT";
+	return !strncmp(cb->id, ident, strnlen(ident, sizeof(rtt_ident)));
+}
+
+/* BMP numbers the up rings first and the down rings after them */
+static bool rtt_engine_enabled(const uint32_t idx)
+{
+	if (rtt_auto_channel)
+		return idx == 0 || idx == rtt_engine.num_up;
+	return rtt_channel_enabled[idx];
+}
+
+/* Read `len` bytes as whole aligned words, which take the batched path. Returns NULL on error. */
+static const uint8_t *rtt_engine_read(target_s *const target, const target_addr_t addr, const size_t len)
+{
+	const target_addr_t start = addr & ~3U;
+	const size_t span = (addr - start + len + 3U) & ~3U;
+	if (target_mem32_read(target, rtt_engine_buf, start, span))
+		return NULL;
+	return rtt_engine_buf + (addr - start);
+}
+
+/* Send what the target wrote to the host, returning the new read offset */
+static uint32_t rtt_engine_drain(
+	target_s *const target, const uint32_t channel, const rtt_engine_ring_s *const ring, size_t *const moved)
+{
+	const uint32_t rd = ring->rd_off;
+	const uint32_t wr = ring->wr_off;
+	if (wr > rd) {
+		const size_t len = MIN(wr - rd, RTT_ENGINE_BUF_SIZE);
+		const uint8_t *const data = rtt_engine_read(target, ring->buffer + rd, len);
+		if (!data)
+			return rd;
+		rtt_write(channel, (const char *)data, len);
+		*moved += len;
+		return rd + len;
+	}
+
+	/* Wrapped: the data runs from `rd` to the end of the ring, then from its start up to `wr` */
+	const uint32_t tail = ring->size - rd;
+	if (ring->size <= RTT_ENGINE_BUF_SIZE && rd - wr <= tail + wr) {
+		/* No more stale bytes in between than there is data, so one read of the whole ring is cheaper */
+		const uint8_t *const data = rtt_engine_read(target, ring->buffer, ring->size);
+		if (!data)
+			return rd;
+		rtt_write(channel, (const char *)data + rd, tail);
+		if (wr)
+			rtt_write(channel, (const char *)data, wr);
+		*moved += tail + wr;
+		return wr;
+	}
+	const size_t len = MIN(tail, RTT_ENGINE_BUF_SIZE);
+	const uint8_t *const data = rtt_engine_read(target, ring->buffer + rd, len);
+	if (!data)
+		return rd;
+	rtt_write(channel, (const char *)data, len);
+	*moved += len;
+	return (rd + len) % ring->size;
+}
+
+/* Copy what the host sent into the target's ring, returning the new write offset */
+static uint32_t rtt_engine_fill(
+	target_s *const target, const uint32_t channel, const rtt_engine_ring_s *const ring, size_t *const moved)
+{
+	const uint32_t rd = ring->rd_off;
+	const uint32_t wr = ring->wr_off;
+	const size_t space = MIN((rd > wr ? rd - wr : ring->size - wr + rd) - 1U, RTT_ENGINE_BUF_SIZE);
+	size_t len = 0;
+	while (len < space && !rtt_nodata(channel)) {
+		const int32_t c = rtt_getchar(channel);
+		if (c < 0)
+			break;
+		rtt_engine_buf[len++] = (uint8_t)c;
+	}
+	if (!len)
+		return wr;
+
+	const size_t first = MIN(len, ring->size - wr);
+	if (target_mem32_write(target, ring->buffer + wr, rtt_engine_buf, first) ||
+		(len > first && target_mem32_write(target, ring->buffer, rtt_engine_buf + first, len - first)))
+		return wr;
+	*moved += len;
+	return (wr + len) % ring->size;
+}
+
+static void rtt_engine_write_offsets(
+	target_s *const target, const target_addr_t *const addrs, const uint32_t *const values, const size_t count)
+{
+	adiv5_access_port_s *const ap = target_is_cortexm(target) ? cortexm_ap(target) : NULL;
+	if (ap && swd_queue_mem_write_words(ap, addrs, values, count))
+		return;
+	for (size_t idx = 0; idx < count; ++idx)
+		target_mem32_write(target, addrs[idx], &values[idx], sizeof(values[idx]));
+}
+
+/* Read the ring counts of a control block BMP has just found */
+static bool rtt_engine_learn(target_s *const target)
+{
+	if (target_mem32_read(target, &rtt_engine_cb, rtt_cbaddr, RTT_ENGINE_HEADER_SIZE))
+		return false;
+	rtt_engine.num_up = MIN(rtt_engine_cb.max_up, MAX_RTT_CHAN);
+	rtt_engine.num_down = MIN(rtt_engine_cb.max_down, MAX_RTT_CHAN - rtt_engine.num_up);
+	rtt_engine.cbaddr = rtt_cbaddr;
+	memset(rtt_engine_channels, 0, sizeof(rtt_engine_channels));
+	return true;
+}
+
+/* Estimate how fast the target fills an up ring from how far its write offset moved since the last poll */
+static void rtt_engine_observe(const uint32_t idx, const rtt_engine_ring_s *const ring, const uint32_t elapsed_ms)
+{
+	rtt_engine_channel_s *const channel = &rtt_engine_channels[idx];
+	const uint32_t used = (ring->wr_off + ring->size - ring->rd_off) % ring->size;
+	const bool full = used == ring->size - 1U;
+	if (full && !channel->full) {
+		if ((ring->flags & RTT_ENGINE_MODE_MASK) == RTT_ENGINE_MODE_BLOCK)
+			++rtt_engine.stalls;
+		else
+			++rtt_engine.overflows;
+	}
+	channel->full = full;
+
+	if (channel->seen && channel->size == ring->size && elapsed_ms) {
+		const uint32_t produced = (ring->wr_off + ring->size - channel->wr_off) % ring->size;
+		const uint32_t rate = (uint32_t)(((uint64_t)produced * 1000U) / elapsed_ms);
+		channel->rate = (channel->rate * 3U + rate) / 4U;
+	}
+	channel->seen = true;
+	channel->wr_off = ring->wr_off;
+	channel->size = ring->size;
+}
+
+static uint32_t rtt_engine_interval(const size_t moved)
+{
+	if (rtt_engine.backlog)
+		return rtt_min_poll_ms;
+
+	uint32_t interval = rtt_max_poll_ms;
+	bool filling = false;
+	for (uint32_t idx = 0; idx < rtt_engine.num_up; ++idx) {
+		const rtt_engine_channel_s *const channel = &rtt_engine_channels[idx];
+		if (!rtt_engine_enabled(idx) || !channel->rate)
+			continue;
+		/* Back before it is half full, leaving the other half for jitter and for the drain itself */
+		const uint64_t half_full_ms = ((uint64_t)(channel->size / 2U) * 1000U) / channel->rate;
+		interval = MIN(interval, (uint32_t)MIN(half_full_ms, UINT32_MAX));
+		filling = true;
+	}
+	if (filling)
+		return MAX(interval, rtt_min_poll_ms);
+	/* Data with no rate yet is the first of it, anything else is idle */
+	if (moved)
+		return rtt_min_poll_ms;
+	return MIN(MAX(rtt_engine.poll_ms, 1U) * 2U, rtt_max_poll_ms);
+}
+
+static bool rtt_engine_pump(target_s *const target, const uint32_t elapsed_ms, size_t *const moved)
+{
+	if (rtt_engine.cbaddr != rtt_cbaddr && !rtt_engine_learn(target))
+		return false;
+
+	/* Descriptors up to the last enabled one */
+	uint32_t rings = 0;
+	for (uint32_t idx = 0; idx < rtt_engine.num_up + rtt_engine.num_down; ++idx) {
+		if (rtt_engine_enabled(idx))
+			rings = idx + 1U;
+	}
+
+	/* The header comes along every time, to notice the block going away, as it does on a reset */
+	if (target_mem32_read(
+			target, &rtt_engine_cb, rtt_engine.cbaddr, RTT_ENGINE_HEADER_SIZE + rings * sizeof(rtt_engine_ring_s)))
+		return false;
+	if (!rtt_engine_signed(&rtt_engine_cb)) {
+		rtt_found = false;
+		rtt_engine.cbaddr = 0;
+		return true;
+	}
+
+	target_addr_t offset_addrs[MAX_RTT_CHAN];
+	uint32_t offset_values[MAX_RTT_CHAN];
+	size_t offsets = 0;
+	bool drained = true;
+	for (uint32_t idx = 0; idx < rings; ++idx) {
+		const rtt_engine_ring_s *const ring = &rtt_engine_cb.rings[idx];
+		if (!rtt_engine_enabled(idx) || !ring->size || ring->wr_off >= ring->size || ring->rd_off >= ring->size)
+			continue;
+
+		const target_addr_t ring_addr = rtt_engine.cbaddr + RTT_ENGINE_HEADER_SIZE + idx * sizeof(*ring);
+		if (idx < rtt_engine.num_up) {
+			rtt_engine_observe(idx, ring, elapsed_ms);
+			if (ring->wr_off == ring->rd_off)
+				continue;
+			const uint32_t rd = rtt_engine_drain(target, idx, ring, moved);
+			if (rd == ring->rd_off) {
+				/* The rings before this one were sent already, their offsets still have to go back */
+				drained = false;
+				break;
+			}
+			rtt_engine.backlog |= rd != ring->wr_off;
+			offset_addrs[offsets] = ring_addr + RTT_ENGINE_RD_OFF;
+			offset_values[offsets++] = rd;
+		} else {
+			const uint32_t wr = rtt_engine_fill(target, idx - rtt_engine.num_up, ring, moved);
+			if (wr == ring->wr_off)
+				continue;
+			offset_addrs[offsets] = ring_addr + RTT_ENGINE_WR_OFF;
+			offset_values[offsets++] = wr;
+		}
+	}
+
+	rtt_engine_write_offsets(target, offset_addrs, offset_values, offsets);
+	return drained && !target_check_error(target);
+}
+
+void rtt_engine_poll(target_s *const target)
+{
+	if (!rtt_enabled || !target)
+		return;
+	if (!rtt_found) {
+		rtt_engine.cbaddr = 0;
+		rtt_cache_poll(target);
+		return;
+	}
+
+	const uint32_t now = platform_time_ms();
+	const uint32_t elapsed_ms = now - rtt_engine.last_poll;
+	rtt_engine.last_poll = now;
+	rtt_engine.backlog = false;
+
+	size_t moved = 0;
+	volatile bool ok = false;
+	TRY(EXCEPTION_ALL)
+	{
+		ok = rtt_engine_pump(target, elapsed_ms, &moved);
+	}
+	CATCH()
+	{
+	default:
+		break;
+	}
+
+	if (!ok) {
+		/* Give the block up after too many errors in a row, BMP will look for it again */
+		if (++rtt_engine.errors >= rtt_max_poll_errs) {
+			rtt_found = false;
+			rtt_engine.errors = 0;
+		}
+		rtt_engine.poll_ms = rtt_max_poll_ms;
+		return;
+	}
+	rtt_engine.errors = 0;
+	rtt_engine.poll_ms = rtt_engine_interval(moved);
+}
+
+uint32_t rtt_engine_poll_ms(void)
+{
+	return rtt_found ? rtt_engine.poll_ms : poll_rtt_ms();
+}
+
+void rtt_engine_status(rtt_engine_status_s *const status)
+{
+	status->poll_ms = rtt_engine_poll_ms();
+	status->overflows = rtt_engine.overflows;
+	status->stalls = rtt_engine.stalls;
+	status->rate = 0;
+	for (uint32_t idx = 0; idx < rtt_engine.num_up; ++idx)
+		status->rate += rtt_engine_channels[idx].rate;
+}
+
+#else
+
+void rtt_engine_poll(target_s *const target)
+{
+	rtt_cache_poll(target);
+}
+
+uint32_t rtt_engine_poll_ms(void)
+{
+	return poll_rtt_ms();
+}
+
+void rtt_engine_status(rtt_engine_status_s *const status)
+{
+	memset(status, 0, sizeof(*status));
+	status->poll_ms = poll_rtt_ms();
+}
+
+#endif /* CONFIG_RTT_ENGINE */
@@ -0,0 +1,27 @@
+#ifndef FARPATCH_RTT_ENGINE_H__
+#define FARPATCH_RTT_ENGINE_H__
+
+#include <stdint.h>
+
+#include "target.h"
+
+/* Move RTT data between the target and the host, or look for the control block if it has not been found */
+void rtt_engine_poll(target_s *target);
+
+/* How long until rtt_engine_poll() wants to be called again */
+uint32_t rtt_engine_poll_ms(void);
+
+typedef struct rtt_engine_status {
+	/* Interval the scheduler has chosen */
+	uint32_t poll_ms;
+	/* Times an up ring filled up, so the target dropped data */
+	uint32_t overflows;
+	/* Times an up ring in blocking mode filled up, so the target had to wait */
+	uint32_t stalls;
+	/* Bytes per second the target is writing, over all up rings */
+	uint32_t rate;
+} rtt_engine_status_s;
+
+void rtt_engine_status(rtt_engine_status_s *status);
+
+#endif /* FARPATCH_RTT_ENGINE_H__ */
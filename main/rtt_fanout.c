@@ -0,0 +1,207 @@
+/*
+ * Shared queue between RTT and its clients.
+ *
+ * RTT data used to go out to the websocket, TCP and UDP clients straight
+ * from the poll, which runs while the BMP core is held, so a single client
+ * on a poor Wi-Fi link held up RTT for everyone else and held up GDB too.
+ * Now the poll copies the data into one ring and returns. Each client reads
+ * the ring from its own cursor on the fan-out task, at whatever pace its
+ * link allows.
+ *
+ * Data goes in as records tagged with their channel. When the ring is full
+ * the oldest record makes way for the new one. A client that had not been
+ * sent all of that record yet skips to the next, and what it missed is
+ * counted against it, so the poll never waits for anybody.
+ */
+
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "general.h"
+#include "rtt_fanout.h"
+
+#define RTT_FANOUT_SIZE (CONFIG_RTT_FANOUT_KB * 1024U)
+/* Longer writes are split, so there is always room for a record */
+#define RTT_FANOUT_RECORD_MAX 1024U
+
+_Static_assert((RTT_FANOUT_SIZE & (RTT_FANOUT_SIZE - 1U)) == 0, "CONFIG_RTT_FANOUT_KB must be a power of two");
+
+typedef struct rtt_fanout_record {
+	uint16_t len;
+	uint8_t channel;
+	uint8_t reserved;
+} rtt_fanout_record_s;
+
+typedef struct rtt_fanout_subscriber {
+	bool active;
+	uint32_t channel;
+	/* Position of the next record to send */
+	uint32_t cursor;
+	/* How much of that record has been sent already */
+	uint32_t offset;
+	/* Record that the last peek came from */
+	uint32_t peeked;
+	/* Bytes this subscriber missed that have not been reported yet */
+	uint32_t dropped;
+} rtt_fanout_subscriber_s;
+
+static struct {
+	SemaphoreHandle_t lock;
+	TaskHandle_t waiter;
+	/* Positions count every byte ever queued, the ring index is the low bits */
+	uint32_t head;
+	uint32_t tail;
+	uint32_t dropped;
+} rtt_fanout;
+
+static uint8_t rtt_fanout_ring[RTT_FANOUT_SIZE];
+static rtt_fanout_subscriber_s rtt_fanout_subscribers[RTT_FANOUT_SUBSCRIBERS];
+
+static void rtt_fanout_copy_in(const uint32_t pos, const void *const src, const size_t len)
+{
+	const size_t at = pos & (RTT_FANOUT_SIZE - 1U);
+	const size_t first = MIN(len, RTT_FANOUT_SIZE - at);
+	memcpy(&rtt_fanout_ring[at], src, first);
+	memcpy(rtt_fanout_ring, (const uint8_t *)src + first, len - first);
+}
+
+static void rtt_fanout_copy_out(void *const dest, const uint32_t pos, const size_t len)
+{
+	const size_t at = pos & (RTT_FANOUT_SIZE - 1U);
+	const size_t first = MIN(len, RTT_FANOUT_SIZE - at);
+	memcpy(dest, &rtt_fanout_ring[at], first);
+	memcpy((uint8_t *)dest + first, rtt_fanout_ring, len - first);
+}
+
+/* Drop the oldest record, moving on anybody who was still on it */
+static void rtt_fanout_evict(void)
+{
+	rtt_fanout_record_s record;
+	rtt_fanout_copy_out(&record, rtt_fanout.tail, sizeof(record));
+	const uint32_t next = rtt_fanout.tail + sizeof(record) + record.len;
+	for (size_t slot = 0; slot < RTT_FANOUT_SUBSCRIBERS; ++slot) {
+		rtt_fanout_subscriber_s *const subscriber = &rtt_fanout_subscribers[slot];
+		if (!subscriber->active || subscriber->cursor != rtt_fanout.tail)
+			continue;
+		if (subscriber->channel == record.channel) {
+			subscriber->dropped += record.len - subscriber->offset;
+			rtt_fanout.dropped += record.len - subscriber->offset;
+		}
+		subscriber->cursor = next;
+		subscriber->offset = 0;
+	}
+	rtt_fanout.tail = next;
+}
+
+void rtt_fanout_init(void)
+{
+	if (!rtt_fanout.lock)
+		rtt_fanout.lock = xSemaphoreCreateMutex();
+}
+
+void rtt_fanout_put(const uint32_t channel, const uint8_t *data, size_t len)
+{
+	if (!rtt_fanout.lock)
+		return;
+
+	xSemaphoreTake(rtt_fanout.lock, portMAX_DELAY);
+	while (len) {
+		const rtt_fanout_record_s record = {
+			.len = MIN(len, RTT_FANOUT_RECORD_MAX),
+			.channel = channel,
+		};
+		const uint32_t need = sizeof(record) + record.len;
+		while (rtt_fanout.head - rtt_fanout.tail + need > RTT_FANOUT_SIZE)
+			rtt_fanout_evict();
+		rtt_fanout_copy_in(rtt_fanout.head, &record, sizeof(record));
+		rtt_fanout_copy_in(rtt_fanout.head + sizeof(record), data, record.len);
+		rtt_fanout.head += need;
+		data += record.len;
+		len -= record.len;
+	}
+	xSemaphoreGive(rtt_fanout.lock);
+
+	if (rtt_fanout.waiter)
+		xTaskNotifyGive(rtt_fanout.waiter);
+}
+
+void rtt_fanout_subscribe(const size_t slot, const uint32_t channel)
+{
+	xSemaphoreTake(rtt_fanout.lock, portMAX_DELAY);
+	rtt_fanout_subscribers[slot] = (rtt_fanout_subscriber_s){
+		.active = true,
+		.channel = channel,
+		.cursor = rtt_fanout.head,
+	};
+	xSemaphoreGive(rtt_fanout.lock);
+}
+
+void rtt_fanout_unsubscribe(const size_t slot)
+{
+	xSemaphoreTake(rtt_fanout.lock, portMAX_DELAY);
+	rtt_fanout_subscribers[slot].active = false;
+	xSemaphoreGive(rtt_fanout.lock);
+}
+
+size_t rtt_fanout_peek(const size_t slot, uint8_t *const buf, const size_t max)
+{
+	rtt_fanout_subscriber_s *const subscriber = &rtt_fanout_subscribers[slot];
+	size_t len = 0;
+	xSemaphoreTake(rtt_fanout.lock, portMAX_DELAY);
+	while (subscriber->active && subscriber->cursor != rtt_fanout.head) {
+		rtt_fanout_record_s record;
+		rtt_fanout_copy_out(&record, subscriber->cursor, sizeof(record));
+		if (record.channel == subscriber->channel) {
+			len = MIN(record.len - subscriber->offset, max);
+			rtt_fanout_copy_out(buf, subscriber->cursor + sizeof(record) + subscriber->offset, len);
+			subscriber->peeked = subscriber->cursor;
+			break;
+		}
+		subscriber->cursor += sizeof(record) + record.len;
+	}
+	xSemaphoreGive(rtt_fanout.lock);
+	return len;
+}
+
+void rtt_fanout_consume(const size_t slot, const size_t len)
+{
+	rtt_fanout_subscriber_s *const subscriber = &rtt_fanout_subscribers[slot];
+	xSemaphoreTake(rtt_fanout.lock, portMAX_DELAY);
+	/*
+	 * If the record was evicted while it was being sent, the cursor has
+	 * already moved on and the rest of it was counted as dropped
+	 */
+	if (subscriber->active && subscriber->cursor == subscriber->peeked && subscriber->cursor != rtt_fanout.head) {
+		rtt_fanout_record_s record;
+		rtt_fanout_copy_out(&record, subscriber->cursor, sizeof(record));
+		subscriber->offset += len;
+		if (subscriber->offset >= record.len) {
+			subscriber->cursor += sizeof(record) + record.len;
+			subscriber->offset = 0;
+		}
+	}
+	xSemaphoreGive(rtt_fanout.lock);
+}
+
+void rtt_fanout_wait(const TickType_t ticks)
+{
+	rtt_fanout.waiter = xTaskGetCurrentTaskHandle();
+	ulTaskNotifyTake(pdTRUE, ticks);
+}
+
+uint32_t rtt_fanout_take_dropped(const size_t slot)
+{
+	xSemaphoreTake(rtt_fanout.lock, portMAX_DELAY);
+	const uint32_t dropped = rtt_fanout_subscribers[slot].dropped;
+	rtt_fanout_subscribers[slot].dropped = 0;
+	xSemaphoreGive(rtt_fanout.lock);
+	return dropped;
+}
+
+uint32_t rtt_fanout_dropped(void)
+{
+	return rtt_fanout.dropped;
+}
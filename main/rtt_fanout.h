@@ -0,0 +1,43 @@
+#ifndef FARPATCH_RTT_FANOUT_H__
+#define FARPATCH_RTT_FANOUT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+
+#include "sdkconfig.h"
+#include "websocket.h"
+
+/* Subscriber slots: the TCP clients, the UDP peer, then the websocket clients */
+#define RTT_FANOUT_TCP         0U
+#define RTT_FANOUT_UDP         CONFIG_RTT_MAX_CONNECTIONS
+#define RTT_FANOUT_WEBSOCKET   (RTT_FANOUT_UDP + 1U)
+#define RTT_FANOUT_SUBSCRIBERS (RTT_FANOUT_WEBSOCKET + HTTP_TERM_RTT_CLIENTS)
+
+void rtt_fanout_init(void);
+
+/* Queue data from the target for every subscriber to `channel`. Never waits on a client. */
+void rtt_fanout_put(uint32_t channel, const uint8_t *data, size_t len);
+
+/* Start `slot` at the newest data, delivering `channel` from now on */
+void rtt_fanout_subscribe(size_t slot, uint32_t channel);
+void rtt_fanout_unsubscribe(size_t slot);
+
+/* Copy out up to `max` bytes of what `slot` has not been sent yet, returning how many. Nothing is consumed. */
+size_t rtt_fanout_peek(size_t slot, uint8_t *buf, size_t max);
+
+/* Mark `len` bytes of what rtt_fanout_peek() returned as sent */
+void rtt_fanout_consume(size_t slot, size_t len);
+
+/* Sleep until there is new data or `ticks` pass */
+void rtt_fanout_wait(TickType_t ticks);
+
+/* Bytes `slot` fell too far behind to be sent since the last call */
+uint32_t rtt_fanout_take_dropped(size_t slot);
+
+/* Bytes that subscribers fell too far behind to be sent, since boot */
+uint32_t rtt_fanout_dropped(void);
+
+#endif /* FARPATCH_RTT_FANOUT_H__ */
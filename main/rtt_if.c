@@ -1,6 +1,8 @@
 #include <esp_attr.h>
 #include <esp_log.h>
 #include <esp_http_server.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include <lwip/sockets.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -8,9 +10,14 @@
 #include "CBUF.h"
 #include "general.h"
 #include "http.h"
+#include "net_reactor.h"
 #include "rtt.h"
+#include "rtt_engine.h"
+#include "rtt_fanout.h"
 #include "rtt_if.h"
 #include "sdkconfig.h"
+#include "websocket.h"
+#include "wire-engine.h"
 
 static struct sockaddr_in udp_peer_addr;
 static int tcp_serv_sock[CONFIG_RTT_MAX_CHANNELS] = {};
@@ -24,6 +31,12 @@ const static char http_content_type_json[] = "application/json";
 
 #define TAG "rtt"
 
+#define RTT_CLIENT_STACK_SIZE 3072
+/* Until a client that could not take any more is tried again */
+#define RTT_CLIENT_RETRY_MS 10
+/* Websocket clients are noticed on this pass even when there is no data */
+#define RTT_CLIENT_IDLE_MS 100
+
 static struct {
 	volatile uint8_t m_get_idx;
 	volatile uint8_t m_put_idx;
@@ -54,33 +67,8 @@ int rtt_if_exit(void)
 /* target to host: write len bytes from the buffer starting at buf. return number bytes written */
 uint32_t rtt_write(const uint32_t channel, const char *buf, uint32_t len)
 {
-	int ret;
-	int index;
-
-	// Only support channel 0 for http for now
-	if (channel == 0) {
-		http_term_broadcast_rtt((uint8_t *)buf, len);
-	}
-
-	for (index = 0; index < CONFIG_RTT_MAX_CONNECTIONS; index += 1) {
-		if ((tcp_client_sock[index] != 0) && (tcp_client_channel[index] == channel)) {
-			ret = send(tcp_client_sock[index], buf, len, 0);
-			if (ret < 0) {
-				ESP_LOGE(__func__, "tcp send() failed (%s)", strerror(errno));
-				close(tcp_client_sock[index]);
-				tcp_client_sock[index] = 0;
-			}
-		}
-	}
-
-	if ((channel == 0) && (udp_peer_addr.sin_addr.s_addr != 0)) {
-		ret = sendto(udp_serv_sock, buf, len, MSG_DONTWAIT, (struct sockaddr *)&udp_peer_addr, sizeof(udp_peer_addr));
-		if (ret < 0) {
-			ESP_LOGE(__func__, "udp send() failed (%s)", strerror(errno));
-			udp_peer_addr.sin_addr.s_addr = 0;
-		}
-	}
-
+	// Clients are sent the data from the client task, so a slow one never holds up the poll
+	rtt_fanout_put(channel, (const uint8_t *)buf, len);
 	return len;
 }
 
@@ -114,7 +102,7 @@ void IRAM_ATTR rtt_append_data(const uint32_t channel, const uint8_t *data, int
 
 esp_err_t cgi_rtt_status(httpd_req_t *req)
 {
-	char buff[256];
+	char buff[448];
 	char value_string[64];
 
 	// `enable` may be 0 or nonzero
@@ -182,8 +170,15 @@ esp_err_t cgi_rtt_status(httpd_req_t *req)
 						 "\"auto_channel\":%s,"   // 8
 						 "\"max_flag_skip\":%s,"  // 9
 						 "\"max_flag_block\":%s," // 10
-						 "\"channels\":[%s]"      // 11
+						 "\"channels\":[%s],"     // 11
+						 "\"poll_ms\":%" PRIu32 ","   // 12
+						 "\"overflows\":%" PRIu32 "," // 13
+						 "\"stalls\":%" PRIu32 ","    // 14
+						 "\"rate\":%" PRIu32 ","      // 15
+						 "\"dropped\":%" PRIu32       // 16
 						 "}";
+	rtt_engine_status_s status;
+	rtt_engine_status(&status);
 	len = snprintf(buff, sizeof(buff), format,
 		rtt_ident,                           // 1
 		rtt_enabled ? "true" : "false",      // 2
@@ -195,7 +190,12 @@ esp_err_t cgi_rtt_status(httpd_req_t *req)
 		rtt_auto_channel ? "true" : "false", // 8
 		rtt_flag_skip ? "true" : "false",    // 9
 		rtt_flag_block ? "true" : "false",   // 10
-		value_string                         // 11
+		value_string,                        // 11
+		status.poll_ms,                      // 12
+		status.overflows,                    // 13
+		status.stalls,                       // 14
+		status.rate,                         // 15
+		rtt_fanout_dropped()                 // 16
 	);
 	httpd_resp_set_type(req, http_content_type_json);
 	httpd_resp_send(req, buff, len);
@@ -203,8 +203,126 @@ esp_err_t cgi_rtt_status(httpd_req_t *req)
 	return ESP_OK;
 }
 
-static bool accept_tcp(int sock, int channel)
+/* Only ever used on the client task */
+static uint8_t rtt_client_buf[1024];
+static uint32_t rtt_client_websocket[HTTP_TERM_RTT_CLIENTS];
+
+/* Returns how much was sent, 0 if the client cannot take any more yet, or -1 if it has gone away */
+static int rtt_client_send(const size_t slot, const uint8_t *data, const size_t len)
+{
+	if (slot < RTT_FANOUT_UDP) {
+		const int sock = tcp_client_sock[slot];
+		if (sock == 0)
+			return -1;
+		const int ret = send(sock, data, len, MSG_DONTWAIT);
+		if (ret >= 0)
+			return ret;
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		ESP_LOGE(__func__, "tcp send() failed (%s)", strerror(errno));
+		net_reactor_close(sock);
+		tcp_client_sock[slot] = 0;
+		return -1;
+	}
+
+	if (slot == RTT_FANOUT_UDP) {
+		if (udp_peer_addr.sin_addr.s_addr == 0)
+			return -1;
+		const int ret =
+			sendto(udp_serv_sock, data, len, MSG_DONTWAIT, (struct sockaddr *)&udp_peer_addr, sizeof(udp_peer_addr));
+		if (ret >= 0)
+			return len;
+		// lwIP reports a full send queue as ENOMEM for UDP
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOMEM)
+			return 0;
+		ESP_LOGE(__func__, "udp send() failed (%s)", strerror(errno));
+		udp_peer_addr.sin_addr.s_addr = 0;
+		return -1;
+	}
+
+	return http_term_send_rtt(slot - RTT_FANOUT_WEBSOCKET, data, len);
+}
+
+/* Websocket clients come and go on the HTTP server's task, pick up the changes here */
+static void rtt_client_track_websockets(void)
+{
+	for (size_t idx = 0; idx < HTTP_TERM_RTT_CLIENTS; ++idx) {
+		const uint32_t client = http_term_rtt_client(idx);
+		if (client == rtt_client_websocket[idx])
+			continue;
+		rtt_client_websocket[idx] = client;
+		// Only support channel 0 for http for now
+		if (client)
+			rtt_fanout_subscribe(RTT_FANOUT_WEBSOCKET + idx, 0);
+		else
+			rtt_fanout_unsubscribe(RTT_FANOUT_WEBSOCKET + idx);
+	}
+}
+
+/* Send `slot` the next piece of what it has not had yet. Returns whether there was any. */
+static bool rtt_client_deliver(const size_t slot, bool *const blocked)
+{
+	const size_t len = rtt_fanout_peek(slot, rtt_client_buf, sizeof(rtt_client_buf));
+	if (len) {
+		const int sent = rtt_client_send(slot, rtt_client_buf, len);
+		if (sent < 0) {
+			rtt_fanout_unsubscribe(slot);
+			return false;
+		}
+		if (sent == 0) {
+			*blocked = true;
+			return false;
+		}
+		rtt_fanout_consume(slot, sent);
+		return true;
+	}
+
+	const uint32_t dropped = rtt_fanout_take_dropped(slot);
+	if (dropped)
+		ESP_LOGW(TAG, "client %u fell behind and missed %" PRIu32 " bytes", (unsigned)slot, dropped);
+	return false;
+}
+
+static void rtt_client_task(void *arg)
+{
+	(void)arg;
+	bool blocked = false;
+	while (true) {
+		rtt_fanout_wait(pdMS_TO_TICKS(blocked ? RTT_CLIENT_RETRY_MS : RTT_CLIENT_IDLE_MS));
+		rtt_client_track_websockets();
+
+		// A piece to each client in turn, so the fast ones are not held behind a slow one
+		blocked = false;
+		bool more = true;
+		while (more) {
+			more = false;
+			for (size_t slot = 0; slot < RTT_FANOUT_SUBSCRIBERS; ++slot)
+				more |= rtt_client_deliver(slot, &blocked);
+		}
+	}
+}
+
+/* Only ever used on the reactor task */
+static uint8_t rtt_net_buf[1024];
+
+static bool rtt_tcp_recv(int sock, void *arg)
+{
+	const int index = (int)(intptr_t)arg;
+	const int ret = recv(sock, rtt_net_buf, sizeof(rtt_net_buf), MSG_DONTWAIT);
+	if (ret > 0) {
+		rtt_append_data(tcp_client_channel[index], rtt_net_buf, ret);
+		return true;
+	}
+	ESP_LOGE(__func__, "tcp client recv() failed (%s)", strerror(errno));
+	rtt_fanout_unsubscribe(RTT_FANOUT_TCP + index);
+	tcp_client_sock[index] = 0;
+	tcp_client_channel[index] = 0;
+	return false;
+}
+
+static bool rtt_tcp_accept(int sock, void *arg)
 {
+	const int channel = (int)(intptr_t)arg;
 	int new_sock_index = -1;
 	int index;
 
@@ -217,41 +335,46 @@ static bool accept_tcp(int sock, int channel)
 	if (new_sock_index == -1) {
 		ESP_LOGE(__func__, "no free tcp client sockets");
 		close(accept(sock, 0, 0));
-		return false;
+		return true;
 	}
-	tcp_client_sock[new_sock_index] = accept(sock, 0, 0);
-	if (tcp_client_sock[new_sock_index] < 0) {
+	const int client = accept(sock, 0, 0);
+	if (client < 0) {
 		ESP_LOGE(__func__, "accept() failed (%s)", strerror(errno));
-		tcp_client_sock[new_sock_index] = 0;
-		return false;
+		return true;
 	}
 	ESP_LOGI(__func__, "accepted tcp connection for channel %d", channel);
+	net_reactor_client_options(client);
 	tcp_client_channel[new_sock_index] = channel;
+	tcp_client_sock[new_sock_index] = client;
+	rtt_fanout_subscribe(RTT_FANOUT_TCP + new_sock_index, channel);
+	if (!net_reactor_add(client, rtt_tcp_recv, (void *)(intptr_t)new_sock_index)) {
+		rtt_fanout_unsubscribe(RTT_FANOUT_TCP + new_sock_index);
+		close(client);
+		tcp_client_sock[new_sock_index] = 0;
+	}
+	return true;
+}
 
-	int opt = 1; /* SO_KEEPALIVE */
-	setsockopt(tcp_client_sock[new_sock_index], SOL_SOCKET, SO_KEEPALIVE, (void *)&opt, sizeof(opt));
-	opt = 3; /* s TCP_KEEPIDLE */
-	setsockopt(tcp_client_sock[new_sock_index], IPPROTO_TCP, TCP_KEEPIDLE, (void *)&opt, sizeof(opt));
-	opt = 1; /* s TCP_KEEPINTVL */
-	setsockopt(tcp_client_sock[new_sock_index], IPPROTO_TCP, TCP_KEEPINTVL, (void *)&opt, sizeof(opt));
-	opt = 3; /* TCP_KEEPCNT */
-	setsockopt(tcp_client_sock[new_sock_index], IPPROTO_TCP, TCP_KEEPCNT, (void *)&opt, sizeof(opt));
-	opt = 1;
-	setsockopt(tcp_client_sock[new_sock_index], IPPROTO_TCP, TCP_NODELAY, (void *)&opt, sizeof(opt));
+static bool rtt_udp_recv(int sock, void *arg)
+{
+	(void)arg;
+	const struct sockaddr_in peer = udp_peer_addr;
+	socklen_t slen = sizeof(udp_peer_addr);
+	const int ret = recvfrom(sock, rtt_net_buf, sizeof(rtt_net_buf), 0, (struct sockaddr *)&udp_peer_addr, &slen);
+	if (ret > 0) {
+		// Whoever sent the last datagram gets channel 0, from the newest data on
+		if (peer.sin_addr.s_addr != udp_peer_addr.sin_addr.s_addr || peer.sin_port != udp_peer_addr.sin_port)
+			rtt_fanout_subscribe(RTT_FANOUT_UDP, 0);
+		rtt_append_data(0, rtt_net_buf, ret);
+	} else {
+		ESP_LOGE(__func__, "udp recvfrom() failed (%s)", strerror(errno));
+	}
 	return true;
 }
 
-static void net_rtt_task(void *params)
+static void rtt_net_init(void)
 {
-	int ret;
 	int index;
-	uint8_t buf[1024];
-	struct sockaddr_in saddr;
-
-	for (index = 0; index < CONFIG_RTT_MAX_CHANNELS; index += 1) {
-		tcp_serv_sock[index] = socket(AF_INET, SOCK_STREAM, 0);
-	}
-	udp_serv_sock = socket(AF_INET, SOCK_DGRAM, 0);
 
 	if ((CONFIG_RTT_TCP_PORT < 0) && (CONFIG_RTT_UDP_PORT < 0)) {
 		ESP_LOGI(__func__, "RTT network support is disabled in the configuration");
@@ -259,87 +382,21 @@ static void net_rtt_task(void *params)
 	}
 
 	if (CONFIG_RTT_TCP_PORT >= 0) {
-		saddr.sin_addr.s_addr = 0;
-		saddr.sin_family = AF_INET;
-
-		for (index = 0; index < CONFIG_RTT_MAX_CHANNELS; index += 1) {
-			saddr.sin_port = ntohs(CONFIG_RTT_TCP_PORT + index);
-			bind(tcp_serv_sock[index], (struct sockaddr *)&saddr, sizeof(saddr));
-			listen(tcp_serv_sock[index], 1);
-		}
-
 		memset(tcp_client_sock, 0, sizeof(tcp_client_sock));
 		memset(tcp_client_channel, 0, sizeof(tcp_client_channel));
-	}
-
-	if (CONFIG_RTT_UDP_PORT >= 0) {
-		saddr.sin_addr.s_addr = 0;
-		saddr.sin_port = ntohs(CONFIG_RTT_UDP_PORT);
-		saddr.sin_family = AF_INET;
-		bind(udp_serv_sock, (struct sockaddr *)&saddr, sizeof(saddr));
-	}
-
-	while (1) {
-		fd_set fds;
-		struct timeval tv;
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
-
-		FD_ZERO(&fds);
-
-		int maxfd = 0;
-
-		if (CONFIG_RTT_TCP_PORT >= 0) {
-			for (index = 0; index < CONFIG_RTT_MAX_CHANNELS; index += 1) {
-				FD_SET(tcp_serv_sock[index], &fds);
-				maxfd = MAX(maxfd, tcp_serv_sock[index]);
-			}
-		}
 
-		if (CONFIG_RTT_UDP_PORT >= 0) {
-			FD_SET(udp_serv_sock, &fds);
-			maxfd = MAX(maxfd, udp_serv_sock);
-		}
-
-		for (index = 0; index < CONFIG_RTT_MAX_CONNECTIONS; index += 1) {
-			if (tcp_client_sock[index]) {
-				FD_SET(tcp_client_sock[index], &fds);
-				maxfd = MAX(maxfd, tcp_client_sock[index]);
+		for (index = 0; index < CONFIG_RTT_MAX_CHANNELS; index += 1) {
+			tcp_serv_sock[index] = net_reactor_listen(CONFIG_RTT_TCP_PORT + index, 1);
+			if (tcp_serv_sock[index] >= 0) {
+				net_reactor_add(tcp_serv_sock[index], rtt_tcp_accept, (void *)(intptr_t)index);
 			}
 		}
+	}
 
-		if ((ret = select(maxfd + 1, &fds, NULL, NULL, &tv) > 0)) {
-			for (index = 0; index < CONFIG_RTT_MAX_CHANNELS; index += 1) {
-				if (FD_ISSET(tcp_serv_sock[index], &fds)) {
-					if (!accept_tcp(tcp_serv_sock[index], index)) {
-						continue;
-					}
-				}
-			}
-
-			if (FD_ISSET(udp_serv_sock, &fds)) {
-				socklen_t slen = sizeof(udp_peer_addr);
-				ret = recvfrom(udp_serv_sock, buf, sizeof(buf), 0, (struct sockaddr *)&udp_peer_addr, &slen);
-				if (ret > 0) {
-					rtt_append_data(0, buf, ret);
-				} else {
-					ESP_LOGE(__func__, "udp recvfrom() failed (%s)", strerror(errno));
-				}
-			}
-
-			for (index = 0; index < CONFIG_RTT_MAX_CONNECTIONS; index += 1) {
-				if (tcp_client_sock[index] && FD_ISSET(tcp_client_sock[index], &fds)) {
-					ret = recv(tcp_client_sock[index], buf, sizeof(buf), MSG_DONTWAIT);
-					if (ret > 0) {
-						rtt_append_data(tcp_client_channel[index], buf, ret);
-					} else {
-						ESP_LOGE(__func__, "tcp client recv() failed (%s)", strerror(errno));
-						close(tcp_client_sock[index]);
-						tcp_client_sock[index] = 0;
-						tcp_client_channel[index] = 0;
-					}
-				}
-			}
+	if (CONFIG_RTT_UDP_PORT >= 0) {
+		udp_serv_sock = net_reactor_listen(CONFIG_RTT_UDP_PORT, 0);
+		if (udp_serv_sock >= 0) {
+			net_reactor_add(udp_serv_sock, rtt_udp_recv, NULL);
 		}
 	}
 }
@@ -348,7 +405,9 @@ void rtt_init(void)
 {
 	ESP_LOGI(__func__, "configuring RTT for target");
 
-	// Start RTT task
 	rtt_enabled = true;
-	xTaskCreate(net_rtt_task, "rtt_rx", 5 * 1024, NULL, 4, NULL);
+	rtt_fanout_init();
+	xTaskCreatePinnedToCore(rtt_client_task, "rtt_client", RTT_CLIENT_STACK_SIZE, NULL, tskIDLE_PRIORITY + 1, NULL,
+		WIRE_ENGINE_NET_CORE);
+	rtt_net_init();
 }
@@ -0,0 +1,359 @@
+/*
+ * Reuse of the last SWD scan.
+ *
+ * A scan walks every DP, AP and CoreSight ROM table on the bus and probes
+ * each core for a driver, which on a big SoC takes seconds. The hardware on
+ * a bench hardly ever changes between GDB sessions, so when a session ends
+ * the targets it found are detached but kept, and the DPIDR of each one's
+ * debug port is noted. The next `monitor swd_scan`, or the RTT monitor
+ * looking for a target, first reads back the DPIDR, the IDR of the core's
+ * AP and the CPUID of each kept core. If every one of them still matches
+ * what was seen before, the old targets are handed out again and the bus
+ * is not walked. A target that was power cycled needs its DP brought up
+ * again, so the first read fails and a full scan follows. That is also
+ * the only way a swapped board is noticed: two boards of the same part
+ * have the same DPIDR, AP IDR and CPUID, and pass every check.
+ *
+ * The kept targets are only handed out to the same kind of scan that found
+ * them. A `monitor swd_scan` after a `monitor jtag_scan` must switch the
+ * probe over to SWD, so it always walks the bus.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "general.h"
+#include "adiv5.h"
+#include "cortexm.h"
+#include "exception.h"
+#include "gdb_main.h"
+#include "gdb_packet.h"
+#include "target.h"
+#include "target_internal.h"
+
+#include "scan_cache.h"
+
+#if defined(CONFIG_SCAN_CACHE)
+
+/* Longest part of a monitor command this looks at, enough for any scan command's name */
+#define SCAN_CACHE_CMD_MAX 16U
+/* Kept targets whose debug port is remembered, any beyond this are rescanned */
+#define SCAN_CACHE_TARGETS 8U
+
+static bool scan_cache_enabled = true;
+/* Set when something changed that a scan has to see, such as the gang lanes */
+static bool scan_cache_stale;
+/* Which scan built target_list */
+static scan_cache_kind_e scan_cache_kind;
+
+static struct {
+	/* Scans answered from the cache */
+	uint32_t hits;
+	/* Scans that found the targets gone or changed */
+	uint32_t misses;
+} scan_cache_stats;
+
+/* What each kept target's debug port answered when it was released */
+typedef struct scan_cache_port {
+	const target_s *target;
+	uint32_t dpidr;
+} scan_cache_port_s;
+
+static scan_cache_port_s scan_cache_ports[SCAN_CACHE_TARGETS];
+static size_t scan_cache_port_count;
+
+static bool scan_cache_read_dpidr(target_s *const target, uint32_t *const dpidr)
+{
+	if (!target_is_cortexm(target))
+		return false;
+	adiv5_access_port_s *const ap = cortexm_ap(target);
+	if (!ap || !ap->dp)
+		return false;
+	ap->dp->fault = 0;
+	*dpidr = adiv5_dp_read(ap->dp, ADIV5_DP_DPIDR);
+	return !ap->dp->fault;
+}
+
+/* Note the DPIDR of every kept target, for scan_cache_target_alive() to compare against */
+static void scan_cache_remember(void)
+{
+	scan_cache_port_count = 0;
+	TRY(EXCEPTION_ALL)
+	{
+		for (target_s *target = target_list; target && scan_cache_port_count < SCAN_CACHE_TARGETS;
+			 target = target->next) {
+			scan_cache_port_s *const port = &scan_cache_ports[scan_cache_port_count];
+			if (!scan_cache_read_dpidr(target, &port->dpidr))
+				continue;
+			port->target = target;
+			++scan_cache_port_count;
+		}
+	}
+	CATCH()
+	{
+	default:
+		/* Targets left out will not match, and the next scan walks the bus */
+		break;
+	}
+}
+
+static const scan_cache_port_s *scan_cache_port(const target_s *const target)
+{
+	for (size_t idx = 0; idx < scan_cache_port_count; ++idx) {
+		if (scan_cache_ports[idx].target == target)
+			return &scan_cache_ports[idx];
+	}
+	return NULL;
+}
+
+static bool scan_cache_target_alive(target_s *const target)
+{
+	if (!target_is_cortexm(target) || !target->cpuid || !target->mem_read || !target->check_error)
+		return false;
+
+	/* The same kind of core on a different part, or behind a different debug port, is a different target */
+	const scan_cache_port_s *const port = scan_cache_port(target);
+	uint32_t dpidr = 0;
+	if (!port || !scan_cache_read_dpidr(target, &dpidr) || dpidr != port->dpidr)
+		return false;
+	adiv5_access_port_s *const ap = cortexm_ap(target);
+	if (adiv5_ap_read(ap, ADIV5_AP_IDR) != ap->idr || ap->dp->fault)
+		return false;
+
+	uint32_t cpuid = 0;
+	target->mem_read(target, &cpuid, CORTEXM_CPUID, sizeof(cpuid));
+	return !target->check_error(target) && cpuid == target->cpuid;
+}
+
+static bool scan_cache_validate(void)
+{
+	volatile bool alive = target_list != NULL;
+	TRY(EXCEPTION_ALL)
+	{
+		for (target_s *target = target_list; target && alive; target = target->next)
+			alive = scan_cache_target_alive(target);
+	}
+	CATCH()
+	{
+	default:
+		alive = false;
+		break;
+	}
+	return alive;
+}
+
+bool scan_cache_reuse(const scan_cache_kind_e kind)
+{
+	const bool same_kind = kind == scan_cache_kind;
+	/* If this returns false, the caller's scan replaces the list */
+	scan_cache_kind = kind;
+	if (!scan_cache_enabled || !target_list || !same_kind || kind == SCAN_CACHE_OTHER)
+		return false;
+	if (scan_cache_stale) {
+		scan_cache_stale = false;
+		return false;
+	}
+
+	/* Same as a real scan: whatever was attached is let go first */
+	if (cur_target) {
+		target_detach(cur_target);
+		cur_target = NULL;
+	}
+
+	if (!scan_cache_validate()) {
+		++scan_cache_stats.misses;
+		scan_cache_port_count = 0;
+		target_list_free();
+		return false;
+	}
+	++scan_cache_stats.hits;
+	return true;
+}
+
+void scan_cache_release(void)
+{
+	if (!scan_cache_enabled) {
+		scan_cache_port_count = 0;
+		target_list_free();
+		return;
+	}
+	if (cur_target) {
+		target_detach(cur_target);
+		cur_target = NULL;
+	}
+	scan_cache_remember();
+}
+
+void scan_cache_invalidate(void)
+{
+	scan_cache_stale = true;
+}
+
+static int scan_cache_hex_value(const char digit)
+{
+	if (digit >= '0' && digit <= '9')
+		return digit - '0';
+	if (digit >= 'a' && digit <= 'f')
+		return digit - 'a' + 10;
+	if (digit >= 'A' && digit <= 'F')
+		return digit - 'A' + 10;
+	return -1;
+}
+
+/*
+ * Decode the start of the hex-encoded command of a `qRcmd` packet, as much
+ * as fits in `command`. Returns false if it is not one. `whole` is set if
+ * the command was not cut short.
+ */
+static bool scan_cache_command(
+	const gdb_packet_s *const packet, char *const command, const size_t size, bool *const whole)
+{
+	if (strncmp(packet->data, "qRcmd,", 6U) != 0)
+		return false;
+
+	const char *hex = packet->data + 6U;
+	const size_t hex_len = packet->size - 6U;
+	if (hex_len % 2U)
+		return false;
+
+	const size_t len = MIN(hex_len / 2U, size - 1U);
+	for (size_t idx = 0; idx < len; ++idx) {
+		const int high = scan_cache_hex_value(hex[idx * 2U]);
+		const int low = scan_cache_hex_value(hex[idx * 2U + 1U]);
+		if (high < 0 || low < 0)
+			return false;
+		command[idx] = (char)((high << 4U) | low);
+	}
+	command[len] = '\0';
+	*whole = len == hex_len / 2U;
+	return true;
+}
+
+/*
+ * The kind of scan `command` runs, or SCAN_CACHE_OTHER for a scan with
+ * arguments. Returns false if it is not a scan at all. BMP runs the first
+ * command that the first word is a prefix of, so every prefix of a scan's
+ * name counts as that scan.
+ */
+static bool scan_cache_scan_kind(const char *const command, const bool whole, scan_cache_kind_e *const kind)
+{
+	static const struct {
+		const char *name;
+		scan_cache_kind_e kind;
+	} scans[] = {
+		{"swd_scan", SCAN_CACHE_SWD},
+		{"swdp_scan", SCAN_CACHE_SWD},
+		{"jtag_scan", SCAN_CACHE_JTAG},
+		{"auto_scan", SCAN_CACHE_AUTO},
+	};
+
+	const size_t word = strcspn(command, " \t");
+	if (!word || (!whole && !command[word]))
+		return false;
+	for (size_t idx = 0; idx < ARRAY_LENGTH(scans); ++idx) {
+		if (strncmp(command, scans[idx].name, word) != 0)
+			continue;
+		const bool bare = whole && !command[word] && !scans[idx].name[word];
+		*kind = bare ? scans[idx].kind : SCAN_CACHE_OTHER;
+		return true;
+	}
+	return false;
+}
+
+static void scan_cache_display_target(size_t idx, target_s *target, void *context)
+{
+	(void)context;
+	gdb_outf(" %2u   %c  %s %s\n", (unsigned)idx, target->attached ? '*' : ' ', target->driver,
+		target->core ? target->core : "");
+}
+
+bool scan_cache_packet(const gdb_packet_s *const packet)
+{
+	char command[SCAN_CACHE_CMD_MAX];
+	bool whole = false;
+	scan_cache_kind_e kind = SCAN_CACHE_OTHER;
+	if (!scan_cache_command(packet, command, sizeof(command), &whole) || !scan_cache_scan_kind(command, whole, &kind))
+		return false;
+	/* A JTAG scan, or a scan with arguments that asks for something specific, is left to BMP */
+	if (kind != SCAN_CACHE_SWD && kind != SCAN_CACHE_AUTO) {
+		scan_cache_kind = kind;
+		return false;
+	}
+	if (!scan_cache_reuse(kind))
+		return false;
+
+	gdb_out("Targets unchanged since the last scan, `monitor scan_cache clear` forces a new one\n");
+	gdb_out("Available Targets:\n");
+	gdb_out("No. Att Driver\n");
+	target_foreach(scan_cache_display_target, NULL);
+	gdb_put_packet_ok();
+	return true;
+}
+
+bool cmd_scan_cache(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 1) {
+		size_t targets = 0;
+		for (const target_s *target = target_list; target; target = target->next)
+			++targets;
+		gdb_outf("Scan cache is %s, %u targets kept\n", scan_cache_enabled ? "on" : "off", (unsigned)targets);
+		gdb_outf("%" PRIu32 " scans skipped, %" PRIu32 " targets changed\n", scan_cache_stats.hits,
+			scan_cache_stats.misses);
+		return true;
+	}
+
+	if (argc == 2 && !strcmp(argv[1], "on")) {
+		scan_cache_enabled = true;
+		gdb_out("Scan cache on\n");
+		return true;
+	}
+	if (argc == 2 && !strcmp(argv[1], "off")) {
+		scan_cache_enabled = false;
+		gdb_out("Scan cache off\n");
+		return true;
+	}
+	if (argc == 2 && !strcmp(argv[1], "clear")) {
+		scan_cache_invalidate();
+		memset(&scan_cache_stats, 0, sizeof(scan_cache_stats));
+		gdb_out("Scan cache cleared\n");
+		return true;
+	}
+
+	gdb_out("usage: monitor scan_cache [on|off|clear]\n");
+	return false;
+}
+
+#else
+
+bool scan_cache_reuse(const scan_cache_kind_e kind)
+{
+	(void)kind;
+	return false;
+}
+
+void scan_cache_release(void)
+{
+	target_list_free();
+}
+
+void scan_cache_invalidate(void)
+{
+}
+
+bool scan_cache_packet(const gdb_packet_s *packet)
+{
+	(void)packet;
+	return false;
+}
+
+bool cmd_scan_cache(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	(void)argc;
+	(void)argv;
+	gdb_out("Scan cache support is not enabled in this build (CONFIG_SCAN_CACHE)\n");
+	return false;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef FARPATCH_SCAN_CACHE_H__
+#define FARPATCH_SCAN_CACHE_H__
+
+#include "gdb_packet.h"
+#include "target.h"
+
+/* The scan that built the target list, which only the same kind of scan may reuse */
+typedef enum scan_cache_kind {
+	/* A scan with arguments, or one this has not seen */
+	SCAN_CACHE_OTHER,
+	SCAN_CACHE_SWD,
+	SCAN_CACHE_JTAG,
+	SCAN_CACHE_AUTO,
+} scan_cache_kind_e;
+
+/*
+ * Bring back the targets of the last scan if a `kind` scan built them and they
+ * still answer as they did. Returns false if a scan is needed, and the list
+ * the caller's scan builds is then taken to be of `kind`.
+ */
+bool scan_cache_reuse(scan_cache_kind_e kind);
+
+/* Done with the current target: detach it, keeping the targets around for scan_cache_reuse() if caching is on */
+void scan_cache_release(void);
+
+/* Make the next scan walk the bus again */
+void scan_cache_invalidate(void);
+
+/*
+ * Answer `monitor swd_scan` and `monitor auto_scan` from the cache, and note
+ * any other scan that goes by. Returns true if `packet` was handled.
+ */
+bool scan_cache_packet(const gdb_packet_s *packet);
+
+/* `monitor scan_cache [on|off|clear]` */
+bool cmd_scan_cache(target_s *t, int argc, const char **argv);
+
+#endif /* FARPATCH_SCAN_CACHE_H__ */
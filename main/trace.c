@@ -0,0 +1,196 @@
+/*
+ * Access to the wire-level transaction recorder. The GDB monitor gives a
+ * summary or a hex dump, the web server hands out the raw binary. Both are
+ * understood by tools/fptrace.py.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_rom_sys.h"
+
+#include "general.h"
+#include "gdb_packet.h"
+#include "swd-transfer.h"
+#include "wire-trace.h"
+
+#include "trace.h"
+
+#if defined(CONFIG_WIRE_TRACE)
+
+/* Records copied out of the ring per step, small enough to live on the stack */
+#define TRACE_CHUNK 16U
+
+typedef struct trace_summary {
+	uint32_t swd;
+	uint32_t swd_ack[8];
+	uint32_t swd_parity;
+	uint32_t jtag;
+	uint64_t jtag_bits;
+	uint64_t cycles;
+	uint64_t wait_cycles;
+} trace_summary_s;
+
+static void trace_summarise(trace_summary_s *const summary, const wire_trace_record_s *const record)
+{
+	summary->cycles += record->duration;
+	if (record->type != WIRE_TRACE_SWD) {
+		++summary->jtag;
+		summary->jtag_bits += record->request;
+		return;
+	}
+	++summary->swd;
+	++summary->swd_ack[record->ack & 7U];
+	if (record->ack & SWD_TRANSFER_PARITY_ERROR)
+		++summary->swd_parity;
+	if ((record->ack & 7U) == SWD_ACK_WAIT)
+		summary->wait_cycles += record->duration;
+}
+
+static uint32_t trace_cycles_to_us(const uint64_t cycles)
+{
+	return cycles / esp_rom_get_cpu_ticks_per_us();
+}
+
+static bool trace_status(void)
+{
+	wire_trace_cursor_s cursor;
+	wire_trace_header_s header;
+	wire_trace_record_s records[TRACE_CHUNK];
+	trace_summary_s summary;
+	memset(&summary, 0, sizeof(summary));
+
+	wire_trace_begin(&cursor, &header);
+	for (size_t count; (count = wire_trace_read(&cursor, records, TRACE_CHUNK));) {
+		for (size_t idx = 0; idx < count; ++idx)
+			trace_summarise(&summary, &records[idx]);
+	}
+
+	gdb_outf("Wire trace is %s, %" PRIu32 " of %u records used, %" PRIu32 " dropped\n",
+		wire_trace_enabled ? "on" : "off", header.count, WIRE_TRACE_RECORDS, cursor.dropped);
+	gdb_outf("SWD: %" PRIu32 " transfers, %" PRIu32 " OK, %" PRIu32 " WAIT, %" PRIu32 " FAULT, %" PRIu32
+			 " no response, %" PRIu32 " parity errors\n",
+		summary.swd, summary.swd_ack[SWD_ACK_OK], summary.swd_ack[SWD_ACK_WAIT], summary.swd_ack[SWD_ACK_FAULT],
+		summary.swd_ack[SWD_ACK_NO_RESPONSE], summary.swd_parity);
+	gdb_outf("JTAG: %" PRIu32 " shifts, %" PRIu64 " bits\n", summary.jtag, summary.jtag_bits);
+	gdb_outf("Time on the wire: %" PRIu32 " us, %" PRIu32 " us of it answered with WAIT\n",
+		trace_cycles_to_us(summary.cycles), trace_cycles_to_us(summary.wait_cycles));
+	return true;
+}
+
+static void trace_dump_bytes(const void *const data, const size_t len)
+{
+	const uint8_t *const bytes = (const uint8_t *)data;
+	char line[2U * sizeof(wire_trace_record_s) + 2U];
+	size_t pos = 0;
+	for (size_t idx = 0; idx < len; ++idx)
+		pos += snprintf(line + pos, sizeof(line) - pos, "%02x", bytes[idx]);
+	snprintf(line + pos, sizeof(line) - pos, "\n");
+	gdb_out(line);
+}
+
+/* One record per line, in the same byte order as the HTTP download */
+static bool trace_dump(void)
+{
+	wire_trace_cursor_s cursor;
+	wire_trace_header_s header;
+	wire_trace_record_s records[TRACE_CHUNK];
+
+	const bool was_enabled = wire_trace_enabled;
+	wire_trace_enabled = false;
+	wire_trace_begin(&cursor, &header);
+	trace_dump_bytes(&header, sizeof(header));
+	for (size_t count; (count = wire_trace_read(&cursor, records, TRACE_CHUNK));) {
+		for (size_t idx = 0; idx < count; ++idx)
+			trace_dump_bytes(&records[idx], sizeof(records[idx]));
+	}
+	wire_trace_enabled = was_enabled;
+	return true;
+}
+
+bool cmd_trace(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc == 1)
+		return trace_status();
+
+	if (argc == 2 && !strcmp(argv[1], "on")) {
+		wire_trace_enabled = true;
+		gdb_out("Wire trace on\n");
+		return true;
+	}
+	if (argc == 2 && !strcmp(argv[1], "off")) {
+		wire_trace_enabled = false;
+		gdb_out("Wire trace off\n");
+		return true;
+	}
+	if (argc == 2 && !strcmp(argv[1], "clear")) {
+		wire_trace_clear();
+		gdb_out("Wire trace cleared\n");
+		return true;
+	}
+	if (argc == 2 && !strcmp(argv[1], "dump"))
+		return trace_dump();
+
+	gdb_out("usage: monitor trace [on|off|clear|dump]\n");
+	return false;
+}
+
+esp_err_t cgi_trace(httpd_req_t *req)
+{
+	char query[64];
+	char value[8];
+	bool control = false;
+
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+		if (httpd_query_key_value(query, "enable", value, sizeof(value)) == ESP_OK) {
+			wire_trace_enabled = !!atoi(value);
+			control = true;
+		}
+		if (httpd_query_key_value(query, "clear", value, sizeof(value)) == ESP_OK && atoi(value)) {
+			wire_trace_clear();
+			control = true;
+		}
+	}
+	if (control)
+		return httpd_resp_sendstr(req, wire_trace_enabled ? "on\n" : "off\n");
+
+	wire_trace_cursor_s cursor;
+	wire_trace_header_s header;
+	wire_trace_record_s records[TRACE_CHUNK];
+
+	/* Stop recording while downloading, so the download matches its header */
+	const bool was_enabled = wire_trace_enabled;
+	wire_trace_enabled = false;
+	wire_trace_begin(&cursor, &header);
+
+	httpd_resp_set_type(req, "application/octet-stream");
+	httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"farpatch.fptrace\"");
+	esp_err_t ret = httpd_resp_send_chunk(req, (const char *)&header, sizeof(header));
+	for (size_t count; ret == ESP_OK && (count = wire_trace_read(&cursor, records, TRACE_CHUNK));)
+		ret = httpd_resp_send_chunk(req, (const char *)records, count * sizeof(records[0]));
+	if (ret == ESP_OK)
+		ret = httpd_resp_send_chunk(req, NULL, 0);
+
+	wire_trace_enabled = was_enabled;
+	return ret;
+}
+
+#else
+
+bool cmd_trace(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	(void)argc;
+	(void)argv;
+	gdb_out("Wire trace support is not enabled in this build (CONFIG_WIRE_TRACE)\n");
+	return false;
+}
+
+esp_err_t cgi_trace(httpd_req_t *req)
+{
+	return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Wire trace support is not enabled in this build");
+}
+
+#endif /* CONFIG_WIRE_TRACE */
@@ -0,0 +1,14 @@
+#ifndef FARPATCH_TRACE_H__
+#define FARPATCH_TRACE_H__
+
+#include <esp_http_server.h>
+
+#include "target.h"
+
+/* `monitor trace [on|off|clear|dump]` */
+bool cmd_trace(target_s *t, int argc, const char **argv);
+
+/* GET /fp/trace downloads the recorded transactions, `enable` and `clear` control the recorder */
+esp_err_t cgi_trace(httpd_req_t *req);
+
+#endif /* FARPATCH_TRACE_H__ */
@@ -18,13 +18,14 @@
 
 #include "CBUF.h"
 #include "http.h"
+#include "net_reactor.h"
 #include "tinyprintf.h"
 #include "uart.h"
 
 static struct sockaddr_in udp_peer_addr;
 static int tcp_serv_sock;
 static int udp_serv_sock;
-static int tcp_client_sock = 0;
+static volatile int tcp_client_sock = 0;
 
 // UART statistics counters
 uint32_t uart_overrun_cnt;
@@ -102,87 +103,74 @@ void uart_dbg_install(void)
 	xTaskCreate(&dbg_log_task, "dbg_log_main", 2048, NULL, 4, NULL);
 }
 
-static void uart_net_task(void *params)
-{
-	tcp_serv_sock = socket(AF_INET, SOCK_STREAM, 0);
-	udp_serv_sock = socket(AF_INET, SOCK_DGRAM, 0);
-	tcp_client_sock = 0;
+/* Only ever used on the reactor task */
+static uint8_t uart_net_buf[1024];
 
-	int ret;
-	uint8_t buf[1024];
+static bool uart_tcp_recv(int sock, void *arg)
+{
+	(void)arg;
+	const int ret = recv(sock, uart_net_buf, sizeof(uart_net_buf), MSG_DONTWAIT);
+	if (ret > 0) {
+		uart_write_bytes(TARGET_UART_IDX, (const char *)uart_net_buf, ret);
+		uart_tx_count += ret;
+		return true;
+	}
+	ESP_LOGE(__func__, "tcp client recv() failed (%s)", strerror(errno));
+	if (tcp_client_sock == sock) {
+		tcp_client_sock = 0;
+	}
+	return false;
+}
 
-	struct sockaddr_in saddr;
-	saddr.sin_addr.s_addr = 0;
-	saddr.sin_port = ntohs(CONFIG_UART_TCP_PORT);
-	saddr.sin_family = AF_INET;
+static bool uart_tcp_accept(int sock, void *arg)
+{
+	(void)arg;
+	const int client = accept(sock, 0, 0);
+	if (client < 0) {
+		ESP_LOGE(__func__, "accept() failed");
+		return true;
+	}
+	ESP_LOGI(__func__, "accepted tcp connection");
+	net_reactor_client_options(client);
 
-	bind(tcp_serv_sock, (struct sockaddr *)&saddr, sizeof(saddr));
+	// The newest connection takes over the port
+	const int prev_client = tcp_client_sock;
+	tcp_client_sock = 0;
+	net_reactor_close(prev_client);
+	if (net_reactor_add(client, uart_tcp_recv, NULL)) {
+		tcp_client_sock = client;
+	} else {
+		close(client);
+	}
+	return true;
+}
 
-	saddr.sin_addr.s_addr = 0;
-	saddr.sin_port = ntohs(CONFIG_UART_UDP_PORT);
-	saddr.sin_family = AF_INET;
-	bind(udp_serv_sock, (struct sockaddr *)&saddr, sizeof(saddr));
-	listen(tcp_serv_sock, 1);
+static bool uart_udp_recv(int sock, void *arg)
+{
+	(void)arg;
+	socklen_t slen = sizeof(udp_peer_addr);
+	const int ret = recvfrom(sock, uart_net_buf, sizeof(uart_net_buf), 0, (struct sockaddr *)&udp_peer_addr, &slen);
+	if (ret > 0) {
+		uart_write_bytes(TARGET_UART_IDX, (const char *)uart_net_buf, ret);
+		uart_tx_count += ret;
+	} else {
+		ESP_LOGE(__func__, "udp recvfrom() failed");
+	}
+	return true;
+}
 
-	while (1) {
-		fd_set fds;
-		struct timeval tv;
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
-
-		FD_ZERO(&fds);
-		FD_SET(tcp_serv_sock, &fds);
-		FD_SET(udp_serv_sock, &fds);
-		if (tcp_client_sock)
-			FD_SET(tcp_client_sock, &fds);
-
-		int maxfd = MAX(tcp_serv_sock, MAX(udp_serv_sock, tcp_client_sock));
-
-		if ((ret = select(maxfd + 1, &fds, NULL, NULL, &tv) > 0)) {
-			if (FD_ISSET(tcp_serv_sock, &fds)) {
-				tcp_client_sock = accept(tcp_serv_sock, 0, 0);
-				if (tcp_client_sock < 0) {
-					ESP_LOGE(__func__, "accept() failed");
-					tcp_client_sock = 0;
-				} else {
-					ESP_LOGI(__func__, "accepted tcp connection");
-
-					int opt = 1; /* SO_KEEPALIVE */
-					setsockopt(tcp_client_sock, SOL_SOCKET, SO_KEEPALIVE, (void *)&opt, sizeof(opt));
-					opt = 3; /* s TCP_KEEPIDLE */
-					setsockopt(tcp_client_sock, IPPROTO_TCP, TCP_KEEPIDLE, (void *)&opt, sizeof(opt));
-					opt = 1; /* s TCP_KEEPINTVL */
-					setsockopt(tcp_client_sock, IPPROTO_TCP, TCP_KEEPINTVL, (void *)&opt, sizeof(opt));
-					opt = 3; /* TCP_KEEPCNT */
-					setsockopt(tcp_client_sock, IPPROTO_TCP, TCP_KEEPCNT, (void *)&opt, sizeof(opt));
-					opt = 1;
-					setsockopt(tcp_client_sock, IPPROTO_TCP, TCP_NODELAY, (void *)&opt, sizeof(opt));
-				}
-			}
+static void uart_net_init(void)
+{
+	tcp_client_sock = 0;
 
-			if (FD_ISSET(udp_serv_sock, &fds)) {
-				socklen_t slen = sizeof(udp_peer_addr);
-				ret = recvfrom(udp_serv_sock, buf, sizeof(buf), 0, (struct sockaddr *)&udp_peer_addr, &slen);
-				if (ret > 0) {
-					uart_write_bytes(TARGET_UART_IDX, (const char *)buf, ret);
-					uart_tx_count += ret;
-				} else {
-					ESP_LOGE(__func__, "udp recvfrom() failed");
-				}
-			}
+	tcp_serv_sock = net_reactor_listen(CONFIG_UART_TCP_PORT, 1);
+	if (tcp_serv_sock >= 0) {
+		net_reactor_add(tcp_serv_sock, uart_tcp_accept, NULL);
+	}
 
-			if (tcp_client_sock && FD_ISSET(tcp_client_sock, &fds)) {
-				ret = recv(tcp_client_sock, buf, sizeof(buf), MSG_DONTWAIT);
-				if (ret > 0) {
-					uart_write_bytes(TARGET_UART_IDX, (const char *)buf, ret);
-					uart_tx_count += ret;
-				} else {
-					ESP_LOGE(__func__, "tcp client recv() failed (%s)", strerror(errno));
-					close(tcp_client_sock);
-					tcp_client_sock = 0;
-				}
-			}
-		}
+	udp_serv_sock = net_reactor_listen(CONFIG_UART_UDP_PORT, 0);
+	if (udp_serv_sock >= 0) {
+		net_reactor_add(udp_serv_sock, uart_udp_recv, NULL);
 	}
 }
 
@@ -251,12 +239,15 @@ static void IRAM_ATTR uart_hw_task(void *parameters)
 			uart_rx_count += count;
 			http_term_broadcast_uart(buf, count);
 
-			if (tcp_client_sock) {
-				ret = send(tcp_client_sock, buf, count, 0);
+			const int client = tcp_client_sock;
+			if (client) {
+				ret = send(client, buf, count, 0);
 				if (ret < 0) {
 					ESP_LOGE(__func__, "tcp send() failed (%s)", strerror(errno));
-					close(tcp_client_sock);
-					tcp_client_sock = 0;
+					if (tcp_client_sock == client) {
+						tcp_client_sock = 0;
+					}
+					net_reactor_close(client);
 				}
 			}
 
@@ -292,6 +283,6 @@ void uart_init(void)
 
 	// Start UART tasks
 	xTaskCreate(uart_hw_task, "uart_hw_task", 3072, NULL, 3, NULL);
-	xTaskCreate(uart_net_task, "uart_net_task", 3072, NULL, 3, NULL);
+	uart_net_init();
 #endif
 }
@@ -2,6 +2,8 @@
 #include <esp_http_server.h>
 #include <esp_log.h>
 #include <lwip/sockets.h>
+#include <stdlib.h>
+#include <string.h>
 #include "platform.h"
 #include "websocket.h"
 
@@ -12,13 +14,16 @@
 #define PKT_DATA 0
 #define PKT_PING 1
 
+// Sends to an RTT client that can be queued on the server's task before the client counts as busy
+#define RTT_SEND_IN_FLIGHT 2
+
 struct websocket_session {
 	int fd;
 	uint32_t cookie;
 };
 
 static struct websocket_session debug_handles[8];
-static struct websocket_session rtt_handles[8];
+static struct websocket_session rtt_handles[HTTP_TERM_RTT_CLIENTS];
 static struct websocket_session uart_handles[8];
 extern httpd_handle_t http_daemon;
 
@@ -109,9 +114,60 @@ void http_term_broadcast_uart(uint8_t *data, size_t len)
 	websocket_broadcast(http_daemon, uart_handles, sizeof(uart_handles) / sizeof(uart_handles[0]), data, len);
 }
 
-void http_term_broadcast_rtt(uint8_t *data, size_t len)
+uint32_t http_term_rtt_client(size_t slot)
+{
+	return rtt_handles[slot].fd ? rtt_handles[slot].cookie : 0;
+}
+
+struct rtt_send {
+	size_t slot;
+	uint32_t cookie;
+	size_t len;
+	uint8_t data[];
+};
+
+static uint8_t rtt_send_in_flight[HTTP_TERM_RTT_CLIENTS];
+
+// Runs on the server's task, which is the only one that sends to or clears a websocket handle
+static void rtt_send_work(void *arg)
+{
+	struct rtt_send *item = arg;
+	struct websocket_session *session = &rtt_handles[item->slot];
+
+	// The client may have gone, and another one taken the slot, since this was queued
+	if ((session->fd != 0) && (session->cookie == item->cookie)) {
+		websocket_broadcast(http_daemon, session, 1, item->data, item->len);
+	}
+	__atomic_fetch_sub(&rtt_send_in_flight[item->slot], 1, __ATOMIC_RELEASE);
+	free(item);
+}
+
+int http_term_send_rtt(size_t slot, const uint8_t *data, size_t len)
 {
-	websocket_broadcast(http_daemon, rtt_handles, sizeof(rtt_handles) / sizeof(rtt_handles[0]), data, len);
+	const struct websocket_session session = rtt_handles[slot];
+	if (session.fd == 0) {
+		return -1;
+	}
+	if (__atomic_load_n(&rtt_send_in_flight[slot], __ATOMIC_ACQUIRE) >= RTT_SEND_IN_FLIGHT) {
+		return 0;
+	}
+
+	struct rtt_send *item = malloc(sizeof(*item) + len);
+	if (item == NULL) {
+		return 0;
+	}
+	item->slot = slot;
+	item->cookie = session.cookie;
+	item->len = len;
+	memcpy(item->data, data, len);
+
+	__atomic_fetch_add(&rtt_send_in_flight[slot], 1, __ATOMIC_RELAXED);
+	if (httpd_queue_work(http_daemon, rtt_send_work, item) != ESP_OK) {
+		__atomic_fetch_sub(&rtt_send_in_flight[slot], 1, __ATOMIC_RELAXED);
+		free(item);
+		return 0;
+	}
+	return len;
 }
 
 void http_debug_putc(uint8_t c, int flush)
@@ -1,13 +1,23 @@
 #ifndef _FP_WEBSOCKET_H_
 #define _FP_WEBSOCKET_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#define HTTP_TERM_RTT_CLIENTS 8
+
 esp_err_t cgi_websocket(httpd_req_t *req);
 void http_debug_putc(uint8_t c, int flush);
-void http_term_broadcast_rtt(uint8_t *data, size_t len);
 void http_term_broadcast_uart(uint8_t *data, size_t len);
 
+/* Identifies the RTT client in `slot`, or 0 if there is none. A new client in the slot gets a new value. */
+uint32_t http_term_rtt_client(size_t slot);
+/*
+ * Queue `data` for the RTT client in `slot` without waiting on its socket. Returns `len`,
+ * 0 if the client still has sends outstanding, or -1 if there is no client in the slot.
+ */
+int http_term_send_rtt(size_t slot, const uint8_t *data, size_t len);
+
 struct websocket_config;
 extern const struct websocket_config debug_websocket;
 extern const struct websocket_config uart_websocket;
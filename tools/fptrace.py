@@ -0,0 +1,218 @@
+#!/usr/bin/env python3
+"""Summarise a Farpatch wire trace.
+
+The trace comes from `GET /fp/trace` on the probe, or from the hex lines
+printed by `monitor trace dump` in GDB. Pass a file name, a URL, or `-` for
+standard input:
+
+    fptrace.py http://farpatch.local/fp/trace
+    fptrace.py --list capture.fptrace
+"""
+
+import argparse
+import collections
+import struct
+import sys
+import urllib.request
+
+MAGIC = 0x54575046
+HEADER = struct.Struct("<IHHIII")
+RECORD = struct.Struct("<IIIIHBB")
+
+TYPE_SWD = 1
+TYPE_JTAG_TDI_TDO = 2
+TYPE_JTAG_TDI = 3
+
+ACK_OK = 1
+ACK_WAIT = 2
+ACK_FAULT = 4
+ACK_NO_RESPONSE = 7
+PARITY_ERROR = 0x08
+
+ACK_NAMES = {ACK_OK: "OK", ACK_WAIT: "WAIT", ACK_FAULT: "FAULT", ACK_NO_RESPONSE: "NO RESPONSE"}
+DP_REGS = {(0x0, True): "DPIDR", (0x0, False): "ABORT", 0x4: "CTRL/STAT", (0x8, True): "RESEND",
+           (0x8, False): "SELECT", 0xC: "RDBUFF"}
+AP_REGS = {0x00: "CSW", 0x04: "TAR", 0x0C: "DRW", 0x10: "BD0", 0x14: "BD1", 0x18: "BD2", 0x1C: "BD3",
+           0xF4: "CFG", 0xF8: "BASE", 0xFC: "IDR"}
+
+
+class Record:
+    def __init__(self, raw):
+        (self.timestamp, self.duration, self.data, self.data_out, self.request, self.type,
+         self.ack) = RECORD.unpack(raw)
+
+    @property
+    def is_swd(self):
+        return self.type == TYPE_SWD
+
+    @property
+    def apndp(self):
+        return bool(self.request & 0x02)
+
+    @property
+    def rnw(self):
+        return bool(self.request & 0x04)
+
+    @property
+    def addr(self):
+        return (self.request >> 1) & 0x0C
+
+    @property
+    def ack_code(self):
+        return self.ack & 0x07
+
+
+def load(source):
+    if source == "-":
+        data = sys.stdin.buffer.read()
+    elif "://" in source:
+        with urllib.request.urlopen(source) as response:
+            data = response.read()
+    else:
+        with open(source, "rb") as f:
+            data = f.read()
+
+    if len(data) < 4 or struct.unpack_from("<I", data)[0] != MAGIC:
+        # Hex dump from the GDB console, one header or record per line
+        hexdigits = set("0123456789abcdefABCDEF")
+        lines = [line.strip() for line in data.decode("utf-8", "replace").splitlines()]
+        data = bytes.fromhex("".join(line for line in lines if line and set(line) <= hexdigits))
+
+    if len(data) < HEADER.size:
+        raise SystemExit("trace is too short")
+    magic, version, record_size, cycles_per_us, dropped, count = HEADER.unpack_from(data)
+    if magic != MAGIC:
+        raise SystemExit("not a Farpatch wire trace")
+    if version != 1 or record_size != RECORD.size:
+        raise SystemExit(f"unsupported trace version {version} with {record_size}-byte records")
+
+    body = data[HEADER.size:]
+    records = [Record(body[off:off + RECORD.size]) for off in range(0, len(body) - RECORD.size + 1, RECORD.size)]
+    return cycles_per_us, dropped, count, records
+
+
+def swd_reg_name(record, ap_bank):
+    if record.apndp:
+        return "AP " + AP_REGS.get(ap_bank | record.addr, f"0x{ap_bank | record.addr:02x}")
+    name = DP_REGS.get((record.addr, record.rnw), DP_REGS.get(record.addr, f"0x{record.addr:x}"))
+    return "DP " + name
+
+
+def describe(record, ap_bank):
+    if record.is_swd:
+        ack = ACK_NAMES.get(record.ack_code, f"ACK {record.ack_code}")
+        if record.ack & PARITY_ERROR:
+            ack += " PARITY"
+        direction = "R" if record.rnw else "W"
+        return f"SWD  {direction} {swd_reg_name(record, ap_bank):14} {record.data:08x} {ack}"
+    kind = "TDI/TDO" if record.type == TYPE_JTAG_TDI_TDO else "TDI"
+    out = f" -> {record.data_out:08x}" if record.type == TYPE_JTAG_TDI_TDO else ""
+    return f"JTAG {kind:7} {record.request:5} bits {record.data:08x}{out}{' TMS' if record.ack else ''}"
+
+
+def analyse(records, cycles_per_us, list_records):
+    us = lambda cycles: cycles / cycles_per_us
+    acks = collections.Counter()
+    regs = collections.Counter()
+    reg_time = collections.Counter()
+    jtag_lengths = collections.Counter()
+    parity = 0
+    wire = 0
+    wait_time = 0
+    storms = []
+    storm = 0
+    gaps = 0
+    tar_writes = 0
+    redundant_tar = 0
+
+    # Track the MEM-AP state so TAR writes that change nothing stand out
+    select = 0
+    csw_size = 4
+    csw_inc = True
+    tar = None
+
+    previous_end = None
+    for record in records:
+        ap_bank = select & 0xF0
+        wire += record.duration
+        if previous_end is not None:
+            gap = (record.timestamp - previous_end) & 0xFFFFFFFF
+            # A long gap means the probe was idle rather than busy between transfers
+            if gap < cycles_per_us * 1000:
+                gaps += gap
+        previous_end = (record.timestamp + record.duration) & 0xFFFFFFFF
+
+        if list_records:
+            print(f"{record.timestamp:10} {us(record.duration):9.2f}us  {describe(record, ap_bank)}")
+
+        if not record.is_swd:
+            jtag_lengths[record.request] += 1
+            continue
+
+        acks[record.ack_code] += 1
+        if record.ack & PARITY_ERROR:
+            parity += 1
+        name = ("R " if record.rnw else "W ") + swd_reg_name(record, ap_bank)
+        regs[name] += 1
+        reg_time[name] += record.duration
+
+        if record.ack_code == ACK_WAIT:
+            wait_time += record.duration
+            storm += 1
+            continue
+        if storm:
+            storms.append(storm)
+            storm = 0
+        if record.ack_code != ACK_OK:
+            continue
+
+        if not record.apndp and not record.rnw and record.addr == 0x8:
+            select = record.data
+        elif record.apndp and ap_bank == 0 and not record.rnw and record.addr == 0x0:
+            csw_size = {0: 1, 1: 2}.get(record.data & 7, 4)
+            csw_inc = (record.data >> 4) & 3 != 0
+        elif record.apndp and ap_bank == 0 and not record.rnw and record.addr == 0x4:
+            tar_writes += 1
+            if tar == record.data:
+                redundant_tar += 1
+            tar = record.data
+        elif record.apndp and ap_bank == 0 and record.addr == 0xC and tar is not None and csw_inc:
+            tar = (tar & ~0x3FF) | ((tar + csw_size) & 0x3FF)
+    if storm:
+        storms.append(storm)
+
+    swd = sum(acks.values())
+    print(f"{len(records)} records, {swd} SWD transfers, {sum(jtag_lengths.values())} JTAG shifts")
+    print(f"time on the wire {us(wire):.1f} us, between transfers {us(gaps):.1f} us")
+    if swd:
+        print("ACKs: " + ", ".join(f"{ACK_NAMES.get(ack, ack)} {count}" for ack, count in sorted(acks.items())))
+        print(f"parity errors: {parity}")
+        print(f"time answered with WAIT: {us(wait_time):.1f} us ({100 * wait_time / max(wire, 1):.1f}% of wire time)")
+        if storms:
+            print(f"WAIT runs: {len(storms)}, longest {max(storms)} retries, {sum(storms)} retries in total")
+        print(f"TAR writes: {tar_writes}, of which {redundant_tar} rewrote the address TAR already held")
+        print("registers:")
+        for name, count in regs.most_common():
+            print(f"  {name:18} {count:7} {us(reg_time[name]):10.1f} us")
+    if jtag_lengths:
+        print("JTAG shift lengths:")
+        for length, count in sorted(jtag_lengths.items()):
+            print(f"  {length:5} bits {count:7}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("trace", help="trace file, http URL of /fp/trace, or - for stdin")
+    parser.add_argument("--list", action="store_true", help="print every record")
+    args = parser.parse_args()
+
+    cycles_per_us, dropped, count, records = load(args.trace)
+    if len(records) != count:
+        print(f"warning: header says {count} records, found {len(records)}", file=sys.stderr)
+    if dropped:
+        print(f"{dropped} older records were overwritten before the trace was read")
+    analyse(records, cycles_per_us or 1, args.list)
+
+
+if __name__ == "__main__":
+    main()
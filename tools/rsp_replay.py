@@ -0,0 +1,293 @@
+#!/usr/bin/env python3
+"""Measure and replay Farpatch GDB protocol captures.
+
+A capture comes from `GET /fp/rsp_capture` on the probe after
+`monitor rsp_capture on`. Record one session per workload you care about,
+such as loading a 512 KiB image, stepping 200 times, or a backtrace from a
+deep stack, and keep the files. Pass a file name, a URL, or `-` for standard
+input. Without a probe, the timings as recorded are reported:
+
+    rsp_replay.py load-512k.fprsp
+    rsp_replay.py --list http://farpatch.local/fp/rsp_capture
+
+With --target, the client's side of each session is played back against a
+probe and the timings are reported next to the recorded ones. The target
+must be in the same state as when the capture was taken, attached to the
+same hardware, for the replies to line up:
+
+    rsp_replay.py --target farpatch.local --repeat 3 step-200.fprsp
+"""
+
+import argparse
+import collections
+import socket
+import struct
+import sys
+import time
+import urllib.request
+
+MAGIC = 0x43525046
+HEADER = struct.Struct("<IHHII")
+RECORD = struct.Struct("<IHBB")
+
+DIR_FROM_GDB = 0
+DIR_TO_GDB = 1
+DIR_CONNECT = 2
+
+INTERRUPT = b"\x03"
+
+
+class Session:
+    def __init__(self, number):
+        self.number = number
+        self.records = []
+
+
+class Exchange:
+    """A request from GDB and the packets the probe sent back before the next one"""
+
+    def __init__(self, request, timestamp):
+        self.request = request
+        self.timestamp = timestamp
+        self.responses = []
+        self.response_time = None
+
+    @property
+    def kind(self):
+        if self.request == INTERRUPT:
+            return "^C"
+        if self.request[:1] in (b"q", b"Q", b"v"):
+            end = 1
+            while end < len(self.request) and chr(self.request[end]).isalpha():
+                end += 1
+            return self.request[:end].decode("ascii", "replace")
+        return self.request[:1].decode("ascii", "replace")
+
+    @property
+    def latency(self):
+        if self.response_time is None:
+            return None
+        return (self.response_time - self.timestamp) & 0xFFFFFFFF
+
+
+class Parser:
+    """Split a byte stream into RSP packets and ^C, dropping acknowledgements"""
+
+    def __init__(self):
+        self.packet = None
+        self.payload = b""
+
+    def feed(self, data):
+        for byte in data:
+            if self.packet is None:
+                if byte == 0x24:  # $
+                    self.packet = bytearray()
+                elif byte == 0x03:
+                    yield INTERRUPT
+                continue
+            if isinstance(self.packet, int):
+                # Two checksum digits after the #
+                self.packet -= 1
+                if not self.packet:
+                    yield self.payload
+                    self.packet = None
+            elif byte == 0x23:  # #
+                self.payload = bytes(self.packet)
+                self.packet = 2
+            else:
+                self.packet.append(byte)
+
+
+def load(source):
+    if source == "-":
+        data = sys.stdin.buffer.read()
+    elif "://" in source:
+        with urllib.request.urlopen(source) as response:
+            data = response.read()
+    else:
+        with open(source, "rb") as f:
+            data = f.read()
+
+    if len(data) < HEADER.size:
+        raise SystemExit("capture is too short")
+    magic, version, record_size, dropped, size = HEADER.unpack_from(data)
+    if magic != MAGIC:
+        raise SystemExit("not a Farpatch RSP capture")
+    if version != 1 or record_size != RECORD.size:
+        raise SystemExit(f"unsupported capture version {version} with {record_size}-byte records")
+    body = data[HEADER.size:HEADER.size + size]
+    if len(body) != size:
+        print(f"warning: header says {size} bytes, found {len(body)}", file=sys.stderr)
+
+    sessions = []
+    current = {}
+    off = 0
+    while off + RECORD.size <= len(body):
+        timestamp, length, direction, sock = RECORD.unpack_from(body, off)
+        payload = body[off + RECORD.size:off + RECORD.size + length]
+        off += RECORD.size + length
+        if direction == DIR_CONNECT or sock not in current:
+            current[sock] = Session(len(sessions) + 1)
+            sessions.append(current[sock])
+        if direction != DIR_CONNECT:
+            current[sock].records.append((timestamp, direction, payload))
+    return dropped, sessions
+
+
+def exchanges(session):
+    """Pair each request with the replies that follow it, in the order they went through the probe"""
+    result = []
+    requests = Parser()
+    replies = Parser()
+    for timestamp, direction, payload in session.records:
+        if direction == DIR_FROM_GDB:
+            result.extend(Exchange(request, timestamp) for request in requests.feed(payload))
+        elif result:
+            for reply in replies.feed(payload):
+                result[-1].responses.append(reply)
+                result[-1].response_time = timestamp
+        else:
+            # Nothing was asked yet, keep the parser in step
+            collections.deque(replies.feed(payload), maxlen=0)
+    return result
+
+
+def percentile(values, fraction):
+    if not values:
+        return 0
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+class Stats:
+    def __init__(self):
+        self.latencies = []
+        self.by_kind = collections.defaultdict(list)
+        self.packets = 0
+        self.bytes = 0
+        self.duration_us = 0
+        self.mismatched = 0
+
+    def add(self, exchange, latency_us, nbytes):
+        self.packets += 1
+        self.bytes += nbytes
+        if latency_us is not None:
+            self.latencies.append(latency_us)
+            self.by_kind[exchange.kind].append(latency_us)
+
+    def report(self, label):
+        seconds = max(self.duration_us, 1) / 1e6
+        lat = self.latencies
+        print(f"{label}: {self.packets} packets in {seconds:.3f} s, {self.packets / seconds:.0f} packets/s, "
+              f"{self.bytes / seconds / 1024:.1f} KiB/s")
+        print(f"  latency us: p50 {percentile(lat, 0.5)}, p90 {percentile(lat, 0.9)}, "
+              f"p99 {percentile(lat, 0.99)}, max {max(lat, default=0)}")
+        if self.mismatched:
+            print(f"  {self.mismatched} requests did not get the replies they got when recorded")
+
+
+def recorded_stats(session, items):
+    stats = Stats()
+    for exchange in items:
+        nbytes = len(exchange.request) + sum(len(reply) for reply in exchange.responses)
+        stats.add(exchange, exchange.latency, nbytes)
+    if session.records:
+        stats.duration_us = (session.records[-1][0] - session.records[0][0]) & 0xFFFFFFFF
+    return stats
+
+
+def frame(payload):
+    return b"$" + payload + b"#" + f"{sum(payload) & 0xFF:02x}".encode()
+
+
+def replay(target, port, items, timeout):
+    stats = Stats()
+    sock = socket.create_connection((target, port), timeout=timeout)
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    parser = Parser()
+    pending = collections.deque()
+    acks = True
+    start = time.perf_counter()
+    try:
+        for exchange in items:
+            sent = time.perf_counter()
+            sock.sendall(INTERRUPT if exchange.request == INTERRUPT else frame(exchange.request))
+            nbytes = len(exchange.request)
+            received = []
+            deadline = sent + timeout
+            while len(received) < len(exchange.responses):
+                while pending and len(received) < len(exchange.responses):
+                    received.append(pending.popleft())
+                if len(received) == len(exchange.responses):
+                    break
+                sock.settimeout(max(deadline - time.perf_counter(), 0.001))
+                try:
+                    data = sock.recv(65536)
+                except socket.timeout:
+                    break
+                if not data:
+                    raise SystemExit("the probe closed the connection")
+                replies = list(parser.feed(data))
+                if acks and replies:
+                    sock.sendall(b"+" * len(replies))
+                pending.extend(replies)
+            done = time.perf_counter()
+
+            if len(received) != len(exchange.responses):
+                stats.mismatched += 1
+            nbytes += sum(len(reply) for reply in received)
+            latency = int((done - sent) * 1e6) if exchange.responses else None
+            stats.add(exchange, latency, nbytes)
+            if exchange.request == b"QStartNoAckMode" and received[-1:] == [b"OK"]:
+                acks = False
+    finally:
+        stats.duration_us = int((time.perf_counter() - start) * 1e6)
+        sock.close()
+    return stats
+
+
+def list_exchanges(items):
+    for exchange in items:
+        request = exchange.request[:60].decode("ascii", "replace")
+        latency = exchange.latency
+        latency = f"{latency:9}us" if latency is not None else " " * 11
+        print(f"{exchange.timestamp:10} {latency}  {request} -> {len(exchange.responses)} replies")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("captures", nargs="+", help="capture file, http URL of /fp/rsp_capture, or - for stdin")
+    parser.add_argument("--list", action="store_true", help="print every request with its recorded latency")
+    parser.add_argument("--session", type=int, help="only use this session of each capture, numbered from 1")
+    parser.add_argument("--target", help="probe to replay against, host or host:port")
+    parser.add_argument("--repeat", type=int, default=1, help="replay each session this many times")
+    parser.add_argument("--timeout", type=float, default=10.0, help="seconds to wait for the replies to a request")
+    args = parser.parse_args()
+
+    for source in args.captures:
+        dropped, sessions = load(source)
+        if dropped:
+            print(f"{source}: the buffer filled up and {dropped} bytes are missing from the end")
+        for session in sessions:
+            if args.session and session.number != args.session:
+                continue
+            items = exchanges(session)
+            label = f"{source} session {session.number}"
+            if args.list:
+                list_exchanges(items)
+            recorded = recorded_stats(session, items)
+            recorded.report(f"{label} as recorded")
+            print("  slowest request kinds, total us:")
+            totals = sorted(recorded.by_kind.items(), key=lambda kind: -sum(kind[1]))
+            for kind, latencies in totals[:8]:
+                print(f"    {kind:16} {len(latencies):7} {sum(latencies):12} p50 {percentile(latencies, 0.5)}")
+
+            if not args.target:
+                continue
+            host, _, port = args.target.partition(":")
+            for run in range(args.repeat):
+                replay(host, int(port or 2022), items, args.timeout).report(f"{label} replay {run + 1}")
+
+
+if __name__ == "__main__":
+    main()